@@ -18,12 +18,14 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <xdc/std.h>
 #include <ti/sdo/ce/Engine.h>
 #include <ext/cmem/gstcmemallocator.h>
 
 #include "gstce.h"
+#include "gstcecodeccache.h"
 #include "gstceh264enc.h"
 #include "gstcejpegenc.h"
 #include "gstceaacenc.h"
@@ -63,6 +65,10 @@ plugin_init (GstPlugin * plugin)
    * Inside this function the Codec Engine is initialized*/
   gst_cmem_init ();
 
+  /* The plugin stays loaded until the process exits, the idle codec
+   * instances kept without a timeout are destroyed then */
+  atexit (gst_ce_codec_cache_clear);
+
   /* Register elements */
   num_elements = ARRAY_SIZE (gst_ce_element_list);
   for (i = 0; i < num_elements; i++) {
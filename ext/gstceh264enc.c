@@ -23,6 +23,8 @@
 #include <ti/sdo/codecs/h264enc/ih264venc.h>
 
 #include "gstceh264enc.h"
+#include "gstcestartcode.h"
+#include "gstcmemallocator.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_ce_h264enc_debug);
 #define GST_CAT_DEFAULT gst_ce_h264enc_debug
@@ -33,7 +35,7 @@ GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS ("video/x-raw, "
-        "   format = (string) NV12,"
+        "   format = (string) { NV12, I420, YV12, YUY2 },"
         "   framerate=(fraction)[ 0, 120], "
         "   width=(int)[ 128, 4080 ], " "   height=(int)[ 96, 4096 ]")
     );
@@ -47,11 +49,22 @@ GST_STATIC_PAD_TEMPLATE ("src",
         "   framerate=(fraction)[ 0, 120], "
         "   width=(int)[ 128, 4080 ], "
         "   height=(int)[ 96, 4096 ],"
-        "   stream-format = (string) { avc, byte-stream }")
+        "   stream-format = (string) { avc, byte-stream }; "
+        "application/x-rtp, "
+        "   media = (string) video, "
+        "   payload = (int) [ 96, 127 ], "
+        "   clock-rate = (int) 90000, "
+        "   encoding-name = (string) H264")
     );
 
 #define NAL_LENGTH 4
 
+/* RTP packetization */
+#define RTP_HEADER_SIZE 12
+#define RTP_CLOCK_RATE 90000
+#define FU_A_HEADER_SIZE 2
+#define FU_A_TYPE 28
+
 enum
 {
   PROP_0,
@@ -76,6 +89,13 @@ enum
   PROP_IDRINTERVAL,
   PROP_INTERLACE,
   PROP_INTERLACE_MODE,
+  PROP_LAZY_CODEC_DATA,
+  PROP_NAL_INDEX,
+  PROP_MTU,
+  PROP_PT,
+  PROP_INSERT_CONFIG,
+  PROP_CONFIG_INTERVAL,
+  PROP_MAX_TEMPORAL_LAYER,
 };
 
 enum
@@ -93,6 +113,7 @@ enum
   GST_H264_NAL_SEI = 6,
   GST_H264_NAL_SPS = 7,
   GST_H264_NAL_PPS = 8,
+  GST_H264_NAL_PREFIX = 14,
 };
 
 
@@ -134,6 +155,13 @@ typedef struct
 #define PROP_IDRINTERVAL_DEFAULT          0
 #define PROP_INTERLACE_DEFAULT            FALSE
 #define PROP_INTERLACE_MODE_DEFAULT       0
+#define PROP_LAZY_CODEC_DATA_DEFAULT      FALSE
+#define PROP_NAL_INDEX_DEFAULT            FALSE
+#define PROP_MTU_DEFAULT                  1400
+#define PROP_PT_DEFAULT                   96
+#define PROP_INSERT_CONFIG_DEFAULT        GST_CE_H264ENC_INSERT_CONFIG_NONE
+#define PROP_CONFIG_INTERVAL_DEFAULT      1
+#define PROP_MAX_TEMPORAL_LAYER_DEFAULT   3
 
 enum
 {
@@ -394,12 +422,45 @@ gst_ce_h264enc_interlace_mode_get_type (void)
   return interlace_mode_type;
 }
 
+enum {
+  GST_CE_H264ENC_INSERT_CONFIG_NONE = 0,
+  GST_CE_H264ENC_INSERT_CONFIG_IDR_COUNT,
+  GST_CE_H264ENC_INSERT_CONFIG_SECONDS,
+};
+
+#define GST_CE_H264ENC_INSERT_CONFIG_TYPE (gst_ce_h264enc_insert_config_get_type())
+static GType
+gst_ce_h264enc_insert_config_get_type (void)
+{
+  static GType insert_config_type = 0;
+
+  static const GEnumValue insert_config_types[] = {
+    {GST_CE_H264ENC_INSERT_CONFIG_NONE, "Don't insert SPS/PPS", "none"},
+    {GST_CE_H264ENC_INSERT_CONFIG_IDR_COUNT,
+        "Insert SPS/PPS every config-interval IDR frames", "idr-count"},
+    {GST_CE_H264ENC_INSERT_CONFIG_SECONDS,
+        "Insert SPS/PPS on the first IDR frame after config-interval seconds",
+        "seconds"},
+    {0, NULL, NULL}
+  };
+
+  if (!insert_config_type) {
+    insert_config_type =
+        g_enum_register_static ("GstCeH264EncInsertConfig",
+        insert_config_types);
+  }
+  return insert_config_type;
+}
 
 static void gst_ce_h264enc_reset (GstCeVidEnc * ce_videnc);
 static gboolean gst_ce_h264enc_set_src_caps (GstCeVidEnc * ce_videnc,
     GstCaps ** caps, GstBuffer ** codec_data);
+static GstFlowReturn gst_ce_h264enc_pre_push (GstVideoEncoder * encoder,
+    GstVideoCodecFrame * frame);
 static gboolean gst_ce_h264enc_post_process (GstCeVidEnc * ce_videnc,
     GstBuffer * buffer);
+static gboolean gst_ce_h264enc_set_complexity (GstCeVidEnc * ce_videnc,
+    guint level);
 
 static void gst_ce_h264enc_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
@@ -557,6 +618,58 @@ gst_ce_h264enc_class_init (GstCeH264EncClass * klass)
 	  GST_CE_H264ENC_INTERLACE_MODE_TYPE,
           PROP_INTERLACE_MODE_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_LAZY_CODEC_DATA,
+      g_param_spec_boolean ("lazy-codec-data",
+          "Lazy codec data",
+          "Take the avc codec_data from the SPS/PPS of the first IDR frame "
+          "instead of running a separate header generation pass. The "
+          "codec_data is added to the caps before the first buffer",
+          PROP_LAZY_CODEC_DATA_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_NAL_INDEX,
+      g_param_spec_boolean ("nal-index",
+          "NAL index",
+          "Attach a GstCeNalMeta with the offset and type of each NAL unit "
+          "to the output buffers, so downstream can split them without "
+          "parsing",
+          PROP_NAL_INDEX_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MTU,
+      g_param_spec_uint ("mtu", "MTU",
+          "Maximum size of the RTP packets when the output is "
+          "application/x-rtp", RTP_HEADER_SIZE + FU_A_HEADER_SIZE + 1,
+          G_MAXUINT, PROP_MTU_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PT,
+      g_param_spec_uint ("pt", "Payload type",
+          "Payload type of the RTP packets when the output is "
+          "application/x-rtp", 96, 127, PROP_PT_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_INSERT_CONFIG,
+      g_param_spec_enum ("insert-config", "Insert config",
+          "Put the SPS/PPS in front of the IDR frames of a byte-stream "
+          "output, so decoders can join mid-stream. The headers are shared "
+          "by all the frames, the frame data is not copied",
+          GST_CE_H264ENC_INSERT_CONFIG_TYPE, PROP_INSERT_CONFIG_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CONFIG_INTERVAL,
+      g_param_spec_uint ("config-interval", "Config interval",
+          "IDR frames or seconds between SPS/PPS insertions, "
+          "depending on insert-config", 1, G_MAXUINT,
+          PROP_CONFIG_INTERVAL_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_TEMPORAL_LAYER,
+      g_param_spec_uint ("max-temporal-layer", "Max temporal layer",
+          "Drop the frames of the temporal layers above this one before "
+          "pushing them, each layer dropped halves the frame rate",
+          0, 3, PROP_MAX_TEMPORAL_LAYER_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   /* pad templates */
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_ce_h264enc_sink_pad_template));
@@ -568,10 +681,13 @@ gst_ce_h264enc_class_init (GstCeH264EncClass * klass)
       "Encode video in H.264 format",
       "Melissa Montero <melissa.montero@ridgerun.com>");
 
+  GST_VIDEO_ENCODER_CLASS (klass)->pre_push = gst_ce_h264enc_pre_push;
+
   ce_videnc_class->codec_name = "h264enc";
   ce_videnc_class->reset = gst_ce_h264enc_reset;
   ce_videnc_class->set_src_caps = gst_ce_h264enc_set_src_caps;
   ce_videnc_class->post_process = gst_ce_h264enc_post_process;
+  ce_videnc_class->set_complexity = gst_ce_h264enc_set_complexity;
 }
 
 static void
@@ -582,20 +698,24 @@ gst_ce_h264enc_init (GstCeH264Enc * h264enc)
   IH264VENC_DynamicParams *h264_dyn_params = NULL;
 
   GST_DEBUG_OBJECT (h264enc, "setup H.264 parameters");
-  /* Alloc the params and set a default value */
+  /* Alloc the params and set a default value. The codec cache compares
+   * them byte by byte, so they are copied as a whole, padding included,
+   * over zeroed memory instead of being assigned */
   h264_params = g_malloc0 (sizeof (IH264VENC_Params));
   if (!h264_params)
     goto fail_alloc;
-  *h264_params = IH264VENC_PARAMS;
+  memcpy (h264_params, &IH264VENC_PARAMS, sizeof (IH264VENC_Params));
 
   h264_dyn_params = g_malloc0 (sizeof (IH264VENC_DynamicParams));
   if (!h264_dyn_params)
     goto fail_alloc;
-  *h264_dyn_params = H264VENC_TI_IH264VENC_DYNAMICPARAMS;
+  memcpy (h264_dyn_params, &H264VENC_TI_IH264VENC_DYNAMICPARAMS,
+      sizeof (IH264VENC_DynamicParams));
 
   if (ce_videnc->codec_params) {
     GST_DEBUG_OBJECT (h264enc, "codec params not NULL, copy and free them");
-    h264_params->videncParams = *ce_videnc->codec_params;
+    memcpy (&h264_params->videncParams, ce_videnc->codec_params,
+        sizeof (VIDENC1_Params));
     g_free (ce_videnc->codec_params);
   }
   ce_videnc->codec_params = (VIDENC1_Params *) h264_params;
@@ -603,7 +723,8 @@ gst_ce_h264enc_init (GstCeH264Enc * h264enc)
   if (ce_videnc->codec_dyn_params) {
     GST_DEBUG_OBJECT (h264enc,
         "codec dynamic params not NULL, copy and free them");
-    h264_dyn_params->videncDynamicParams = *ce_videnc->codec_dyn_params;
+    memcpy (&h264_dyn_params->videncDynamicParams,
+        ce_videnc->codec_dyn_params, sizeof (VIDENC1_DynamicParams));
     g_free (ce_videnc->codec_dyn_params);
   }
   ce_videnc->codec_dyn_params = (VIDENC1_DynamicParams *) h264_dyn_params;
@@ -631,83 +752,70 @@ static gboolean
 gst_ce_h264enc_fetch_header (guint8 * data, gint buffer_size,
     nalUnit * sps, nalUnit * pps)
 {
-  gint i;
+  gint pos = 0;
+  gint next;
   gint nal_type;
   gint found = 0;
   nalUnit *nalu = NULL;
-  gint32 state;
-
-  const gint32 start_code = 0x00000001;
 
   GST_LOG ("fetching header PPS and SPS");
   GST_MEMDUMP ("Header", data, buffer_size);
-  /*Initialize to a pattern that does not match the start code */
-  state = ~(start_code);
-  for (i = 0; i < (buffer_size - NAL_LENGTH); i++) {
-    state = ((state << 8) | data[i]);
-
-    /* In bytestream format each NAL si preceded by 
-     * a four byte start code: 0x00 0x00 0x00 0x01.
-     * The byte after this code indicates the NAL type,
-     * we're looking for the SPS(0x07) and PPS(0x08) NAL*/
-    if (state == start_code) {
-      if (nalu) {
-        nalu->size = i - nalu->index - NAL_LENGTH + 1;
-        nalu = NULL;
-      }
-
-      if (found == 2)
-        break;
 
-      nal_type = (data[i + 1]) & 0x1f;
-      if (nal_type == GST_H264_NAL_SPS)
-        nalu = sps;
-      else if (nal_type == GST_H264_NAL_PPS)
-        nalu = pps;
-      else
-        continue;
+  /* In bytestream format each NAL si preceded by 
+   * a four byte start code: 0x00 0x00 0x00 0x01.
+   * The byte after this code indicates the NAL type,
+   * we're looking for the SPS(0x07) and PPS(0x08) NAL*/
+  while ((next = gst_ce_find_start_code (data + pos,
+              buffer_size - NAL_LENGTH - pos)) >= 0) {
+    next += pos;
+
+    if (nalu) {
+      nalu->size = next - nalu->index;
+      nalu = NULL;
+    }
 
-      nalu->type = nal_type;
-      nalu->index = i + 1;
+    if (found == 2)
+      break;
 
-      i++;
-      found++;
-    }
+    pos = next + NAL_LENGTH;
+    nal_type = data[pos] & 0x1f;
+    if (nal_type == GST_H264_NAL_SPS)
+      nalu = sps;
+    else if (nal_type == GST_H264_NAL_PPS)
+      nalu = pps;
+    else
+      continue;
+
+    nalu->type = nal_type;
+    nalu->index = pos;
+    found++;
   }
 
-  if (i >= (buffer_size - 5))
+  if (nalu)
     nalu->size = buffer_size - nalu->index;
 
   return TRUE;
 }
 
+/*
+ * gst_ce_h264enc_build_codec_data
+ *
+ * Builds the avc codec data out of the SPS and PPS found in @header. On
+ * success @header_end is set to the offset right after the PPS.
+ */
 static gboolean
-gst_ce_h264enc_get_codec_data (GstCeH264Enc * h264enc, GstBuffer ** codec_data)
+gst_ce_h264enc_build_codec_data (GstCeH264Enc * h264enc, guint8 * header,
+    gint size, GstBuffer ** codec_data, gint * header_end)
 {
-  GstBuffer *buf;
-  GstMapInfo info;
-  nalUnit sps, pps;
-  guint8 *header, *buffer, *sps_ptr;
+  nalUnit sps = { 0, }, pps = { 0, };
+  guint8 *buffer, *sps_ptr;
   gint codec_data_size;
   gint num_sps = 1;
   gint num_pps = 1;
   gint nal_idx;
 
-  GST_DEBUG_OBJECT (h264enc, "generating codec data..");
-
-  if (!gst_ce_videnc_get_header (GST_CEVIDENC (h264enc), &buf,
-          &h264enc->header_size))
-    return FALSE;
-
-  /*Get pointer to the header data */
-  if (!gst_buffer_map (buf, &info, GST_MAP_READ))
-    return FALSE;
-
-  header = info.data;
-  gst_buffer_unmap (buf, &info);
-
   /*Parse the PPS and SPS */
-  gst_ce_h264enc_fetch_header (header, h264enc->header_size, &sps, &pps);
+  gst_ce_h264enc_fetch_header (header, size, &sps, &pps);
 
   if (sps.type != 7 || pps.type != 8 || sps.size < 4 || pps.size < 1) {
     GST_WARNING_OBJECT (h264enc, "unexpected H.264 header");
@@ -764,9 +872,127 @@ gst_ce_h264enc_get_codec_data (GstCeH264Enc * h264enc, GstBuffer ** codec_data)
   nal_idx += pps.size;
 
   GST_MEMDUMP ("Codec data", buffer, codec_data_size);
-  gst_buffer_unref (buf);
 
   *codec_data = gst_buffer_new_wrapped (buffer, codec_data_size);
+  *header_end = MAX (sps.index + sps.size, pps.index + pps.size);
+
+  return TRUE;
+}
+
+static gboolean
+gst_ce_h264enc_get_codec_data (GstCeH264Enc * h264enc, GstBuffer ** codec_data)
+{
+  GstBuffer *buf;
+  GstMapInfo info;
+  gint header_end;
+  gboolean ret;
+
+  GST_DEBUG_OBJECT (h264enc, "generating codec data..");
+
+  if (!gst_ce_videnc_get_header (GST_CEVIDENC (h264enc), &buf,
+          &h264enc->header_size))
+    return FALSE;
+
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ)) {
+    gst_buffer_unref (buf);
+    return FALSE;
+  }
+
+  ret = gst_ce_h264enc_build_codec_data (h264enc, info.data,
+      h264enc->header_size, codec_data, &header_end);
+
+  gst_buffer_unmap (buf, &info);
+  gst_buffer_unref (buf);
+
+  return ret;
+}
+
+/*
+ * gst_ce_h264enc_take_codec_data
+ *
+ * Builds the codec data out of the SPS/PPS on front of an IDR frame
+ * and hands it to the base class to update the caps.
+ */
+static gboolean
+gst_ce_h264enc_take_codec_data (GstCeH264Enc * h264enc, GstBuffer * buffer)
+{
+  GstBuffer *codec_data;
+  GstMapInfo info;
+  gint header_end;
+  gboolean ret;
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ))
+    return FALSE;
+
+  ret = gst_ce_h264enc_build_codec_data (h264enc, info.data, info.size,
+      &codec_data, &header_end);
+
+  gst_buffer_unmap (buffer, &info);
+
+  if (!ret)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (h264enc, "took codec data from the first IDR frame");
+  /* The start codes of the SPS and PPS are part of the header */
+  h264enc->header_size = header_end;
+
+  return gst_ce_videnc_set_codec_data (GST_CEVIDENC (h264enc), codec_data);
+}
+
+/*
+ * gst_ce_h264enc_set_rtp_caps
+ *
+ * Completes the RTP caps with the session parameters and the SPS/PPS
+ * of the stream.
+ */
+static gboolean
+gst_ce_h264enc_set_rtp_caps (GstCeH264Enc * h264enc, GstStructure * s)
+{
+  GstBuffer *buf;
+  GstMapInfo info;
+  nalUnit sps = { 0, }, pps = { 0, };
+  gchar *sps64, *pps64, *sprop, *profile;
+  gint header_size;
+
+  if (!gst_ce_videnc_get_header (GST_CEVIDENC (h264enc), &buf, &header_size))
+    return FALSE;
+
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ)) {
+    gst_buffer_unref (buf);
+    return FALSE;
+  }
+
+  gst_ce_h264enc_fetch_header (info.data, header_size, &sps, &pps);
+  if (sps.type != GST_H264_NAL_SPS || pps.type != GST_H264_NAL_PPS ||
+      sps.size < 4 || pps.size < 1) {
+    GST_WARNING_OBJECT (h264enc, "unexpected H.264 header");
+    gst_buffer_unmap (buf, &info);
+    gst_buffer_unref (buf);
+    return FALSE;
+  }
+
+  sps64 = g_base64_encode (&info.data[sps.index], sps.size);
+  pps64 = g_base64_encode (&info.data[pps.index], pps.size);
+  sprop = g_strdup_printf ("%s,%s", sps64, pps64);
+  profile = g_strdup_printf ("%02x%02x%02x", info.data[sps.index + 1],
+      info.data[sps.index + 2], info.data[sps.index + 3]);
+
+  gst_buffer_unmap (buf, &info);
+  gst_buffer_unref (buf);
+  h264enc->header_size = header_size;
+
+  gst_structure_set (s, "payload", G_TYPE_INT, h264enc->pt,
+      "ssrc", G_TYPE_UINT, h264enc->ssrc,
+      "timestamp-offset", G_TYPE_UINT, h264enc->timestamp_offset,
+      "seqnum-offset", G_TYPE_UINT, (guint) h264enc->seqnum,
+      "packetization-mode", G_TYPE_STRING, "1",
+      "profile-level-id", G_TYPE_STRING, profile,
+      "sprop-parameter-sets", G_TYPE_STRING, sprop, NULL);
+
+  g_free (sps64);
+  g_free (pps64);
+  g_free (sprop);
+  g_free (profile);
 
   return TRUE;
 }
@@ -785,6 +1011,27 @@ gst_ce_h264enc_set_src_caps (GstCeVidEnc * ce_videnc, GstCaps ** caps,
   *caps = gst_caps_make_writable (*caps);
   s = gst_caps_get_structure (*caps, 0);
 
+  h264enc->codec_data_pending = FALSE;
+
+  /* The parameters may have changed, the headers are taken again */
+  if (h264enc->config) {
+    gst_memory_unref (h264enc->config);
+    h264enc->config = NULL;
+  }
+  h264enc->idrs_since_config = 0;
+  h264enc->last_config_time = GST_CLOCK_TIME_NONE;
+
+  h264enc->rtp = gst_structure_has_name (s, "application/x-rtp");
+  if (h264enc->rtp) {
+    /* Packetized out of the avc output, keeping the headers in-band */
+    GST_DEBUG_OBJECT (h264enc, "stream format: rtp");
+    /* Every NAL unit is packetized on its own, the SPS and PPS included */
+    if (h264enc->single_nalu)
+      GST_WARNING_OBJECT (h264enc, "single-nalu is ignored for RTP output");
+    h264enc->current_stream_format = GST_CE_H264ENC_STREAM_FORMAT_AVC;
+    return gst_ce_h264enc_set_rtp_caps (h264enc, s);
+  }
+
   stream_format = gst_structure_get_string (s, "stream-format");
   h264enc->current_stream_format = GST_CE_H264ENC_STREAM_FORMAT_FROM_PROPERTY;
   if (stream_format) {
@@ -811,7 +1058,15 @@ gst_ce_h264enc_set_src_caps (GstCeVidEnc * ce_videnc, GstCaps ** caps,
   }
 
   if (h264enc->current_stream_format == GST_CE_H264ENC_STREAM_FORMAT_AVC) {
-    ret = gst_ce_h264enc_get_codec_data (h264enc, codec_data);
+    if (h264enc->lazy_codec_data) {
+      GST_DEBUG_OBJECT (h264enc, "codec data will be taken from the first "
+          "IDR frame");
+      h264enc->codec_data_pending = TRUE;
+      /* avc caps are useless downstream without it */
+      gst_ce_videnc_wait_codec_data (ce_videnc);
+    } else {
+      ret = gst_ce_h264enc_get_codec_data (h264enc, codec_data);
+    }
     gst_structure_set (s, "stream-format", G_TYPE_STRING, "avc", NULL);
   } else {
     gst_structure_set (s, "stream-format", G_TYPE_STRING, "byte-stream", NULL);
@@ -830,6 +1085,11 @@ gst_ce_h264enc_reset (GstCeVidEnc * ce_videnc)
 
   GST_DEBUG_OBJECT (h264enc, "H.264 reset");
 
+  if (h264enc->config) {
+    gst_memory_unref (h264enc->config);
+    h264enc->config = NULL;
+  }
+
   if ((ce_videnc->codec_params->size != sizeof (IH264VENC_Params)) ||
       (ce_videnc->codec_dyn_params->size != sizeof (IH264VENC_DynamicParams)))
     return;
@@ -843,6 +1103,21 @@ gst_ce_h264enc_reset (GstCeVidEnc * ce_videnc)
   h264enc->single_nalu = PROP_SINGLE_NALU_DEFAULT;
   h264enc->headers = PROP_HEADERS_DEFAULT;
   h264enc->interlace = PROP_INTERLACE_DEFAULT;
+  h264enc->lazy_codec_data = PROP_LAZY_CODEC_DATA_DEFAULT;
+  h264enc->codec_data_pending = FALSE;
+  h264enc->nal_index = PROP_NAL_INDEX_DEFAULT;
+  h264enc->rtp = FALSE;
+  h264enc->mtu = PROP_MTU_DEFAULT;
+  h264enc->pt = PROP_PT_DEFAULT;
+  h264enc->ssrc = g_random_int ();
+  h264enc->timestamp_offset = g_random_int ();
+  h264enc->seqnum = g_random_int_range (0, G_MAXUINT16);
+  h264enc->insert_config = PROP_INSERT_CONFIG_DEFAULT;
+  h264enc->config_interval = PROP_CONFIG_INTERVAL_DEFAULT;
+  h264enc->idrs_since_config = 0;
+  h264enc->last_config_time = GST_CLOCK_TIME_NONE;
+  h264enc->max_temporal_layer = PROP_MAX_TEMPORAL_LAYER_DEFAULT;
+  h264enc->layer_index = 0;
 
   h264_params->profileIdc = PROP_PROFILE_DEFAULT;
   h264_params->levelIdc = PROP_LEVEL_DEFAULT;
@@ -865,26 +1140,497 @@ gst_ce_h264enc_reset (GstCeVidEnc * ce_videnc)
 
   gst_ce_videnc_set_interlace (ce_videnc, h264enc->interlace);
 
+  h264enc->complexity = 0;
+  h264enc->user_enc_quality = PROP_ENCQUALITY_DEFAULT;
+  h264enc->user_t8x8intra = PROP_T8X8INTRA_DEFAULT;
+  h264enc->user_t8x8inter = PROP_T8X8INTER_DEFAULT;
+
   return;
 }
 
+/*
+ * gst_ce_h264enc_set_complexity
+ *
+ * Each complexity level disables one more of the most expensive coding
+ * tools the user enabled: first the 8x8 transform for P frames, then
+ * for I frames, and finally the high quality mode. The codec params are
+ * always derived from the user values, which are left untouched.
+ */
+static gboolean
+gst_ce_h264enc_set_complexity (GstCeVidEnc * ce_videnc, guint level)
+{
+  GstCeH264Enc *h264enc = GST_CE_H264ENC (ce_videnc);
+  IH264VENC_Params *params = (IH264VENC_Params *) ce_videnc->codec_params;
+  gint enc_quality, t8x8intra, t8x8inter;
+  guint steps = 0;
+
+  if (ce_videnc->codec_params->size != sizeof (IH264VENC_Params))
+    return FALSE;
+
+  enc_quality = h264enc->user_enc_quality;
+  t8x8intra = h264enc->user_t8x8intra;
+  t8x8inter = h264enc->user_t8x8inter;
+
+  if (steps < level && t8x8inter) {
+    t8x8inter = 0;
+    steps++;
+  }
+  if (steps < level && t8x8intra) {
+    t8x8intra = 0;
+    steps++;
+  }
+  if (steps < level && enc_quality != XDM_HIGH_SPEED) {
+    enc_quality = XDM_HIGH_SPEED;
+    steps++;
+  }
+
+  if (steps < level)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (h264enc, "complexity level %u: encquality %d, "
+      "t8x8intra %d, t8x8inter %d", level, enc_quality, t8x8intra, t8x8inter);
+
+  params->encQuality = enc_quality;
+  params->transform8x8FlagIntraFrame = t8x8intra;
+  params->transform8x8FlagInterFrame = t8x8inter;
+  h264enc->complexity = level;
+
+  return TRUE;
+}
+
+/*
+ * gst_ce_h264enc_get_config
+ *
+ * Takes the SPS/PPS of the current parameters into a read-only memory
+ * that is shared by every IDR frame they are inserted on.
+ */
+static gboolean
+gst_ce_h264enc_get_config (GstCeH264Enc * h264enc)
+{
+  GstBuffer *buf;
+  GstMapInfo info;
+  nalUnit sps = { 0, }, pps = { 0, };
+  gint header_size;
+
+  if (!gst_ce_videnc_get_header (GST_CEVIDENC (h264enc), &buf, &header_size))
+    return FALSE;
+
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ)) {
+    gst_buffer_unref (buf);
+    return FALSE;
+  }
+  gst_ce_h264enc_fetch_header (info.data, header_size, &sps, &pps);
+  gst_buffer_unmap (buf, &info);
+
+  if (sps.type != GST_H264_NAL_SPS || pps.type != GST_H264_NAL_PPS) {
+    GST_WARNING_OBJECT (h264enc, "unexpected H.264 header");
+    gst_buffer_unref (buf);
+    return FALSE;
+  }
+
+  h264enc->config = gst_memory_share (gst_buffer_peek_memory (buf, 0), 0,
+      header_size);
+  GST_MINI_OBJECT_FLAG_SET (h264enc->config, GST_MEMORY_FLAG_READONLY);
+  gst_buffer_unref (buf);
+
+  h264enc->config_nals[0].offset = sps.index;
+  h264enc->config_nals[0].size = sps.size;
+  h264enc->config_nals[0].type = GST_H264_NAL_SPS;
+  h264enc->config_nals[1].offset = pps.index;
+  h264enc->config_nals[1].size = pps.size;
+  h264enc->config_nals[1].type = GST_H264_NAL_PPS;
+
+  return TRUE;
+}
+
+/*
+ * gst_ce_h264enc_insert_config
+ *
+ * Prepends the SPS/PPS memory to the IDR frames the interval asks for,
+ * unless the codec already put the headers there.
+ */
+static void
+gst_ce_h264enc_insert_config (GstCeH264Enc * h264enc,
+    GstVideoCodecFrame * frame)
+{
+  GstBuffer *buffer = frame->output_buffer;
+  GstCeEncodeMeta *meta;
+  GstCeNalMeta *nal_meta;
+  GstMapInfo info;
+  gboolean due, present;
+  guint n, k;
+  gsize config_size;
+
+  meta = GST_CE_ENCODE_META_GET (buffer);
+  if (!meta || meta->frame_type != GST_CE_ENCODE_FRAME_IDR)
+    return;
+
+  if (h264enc->insert_config == GST_CE_H264ENC_INSERT_CONFIG_SECONDS)
+    due = !GST_CLOCK_TIME_IS_VALID (h264enc->last_config_time) ||
+        !GST_CLOCK_TIME_IS_VALID (frame->pts) ||
+        frame->pts >= h264enc->last_config_time +
+        h264enc->config_interval * GST_SECOND;
+  else
+    due = h264enc->idrs_since_config == 0 ||
+        h264enc->idrs_since_config >= h264enc->config_interval;
+
+  h264enc->idrs_since_config++;
+  if (!due)
+    return;
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ))
+    return;
+  present = info.size > NAL_LENGTH &&
+      (info.data[NAL_LENGTH] & 0x1f) == GST_H264_NAL_SPS;
+  gst_buffer_unmap (buffer, &info);
+
+  if (!present) {
+    if (!h264enc->config && !gst_ce_h264enc_get_config (h264enc)) {
+      GST_WARNING_OBJECT (h264enc, "can't insert the SPS/PPS");
+      return;
+    }
+
+    GST_DEBUG_OBJECT (h264enc, "inserting SPS/PPS");
+    gst_buffer_prepend_memory (buffer, gst_memory_ref (h264enc->config));
+
+    /* Keep the NAL index in line with the new layout */
+    nal_meta = GST_CE_NAL_META_GET (buffer);
+    if (nal_meta) {
+      config_size = gst_memory_get_sizes (h264enc->config, NULL, NULL);
+      n = nal_meta->n_nals;
+      gst_ce_nal_meta_add_nal (nal_meta, 0, 0, 0);
+      gst_ce_nal_meta_add_nal (nal_meta, 0, 0, 0);
+      memmove (nal_meta->nals + 2, nal_meta->nals, n * sizeof (GstCeNal));
+      for (k = 2; k < n + 2; k++)
+        nal_meta->nals[k].offset += config_size;
+      nal_meta->nals[0] = h264enc->config_nals[0];
+      nal_meta->nals[1] = h264enc->config_nals[1];
+    }
+  }
+
+  h264enc->idrs_since_config = 1;
+  h264enc->last_config_time = frame->pts;
+}
+
+/*
+ * gst_ce_h264enc_rtp_header
+ *
+ * Writes the fixed RTP header of the next packet
+ */
+static void
+gst_ce_h264enc_rtp_header (GstCeH264Enc * h264enc, guint8 * header,
+    gboolean marker, guint32 timestamp)
+{
+  header[0] = 0x80;             /* version 2, no padding nor extensions */
+  header[1] = (marker ? 0x80 : 0x00) | h264enc->pt;
+  GST_WRITE_UINT16_BE (header + 2, h264enc->seqnum);
+  GST_WRITE_UINT32_BE (header + 4, timestamp);
+  GST_WRITE_UINT32_BE (header + 8, h264enc->ssrc);
+
+  h264enc->seqnum++;
+}
+
+/*
+ * gst_ce_h264enc_pre_push
+ *
+ * In RTP mode pushes the frame as a list of single NAL unit and FU-A
+ * packets instead. The payloads are sub-memories of the output slice,
+ * only the RTP headers are written, all of them in a single block.
+ */
+static GstFlowReturn
+gst_ce_h264enc_pre_push (GstVideoEncoder * encoder, GstVideoCodecFrame * frame)
+{
+  GstCeH264Enc *h264enc = GST_CE_H264ENC (encoder);
+  GstBuffer *buffer = frame->output_buffer;
+  GstCeEncodeMeta *meta;
+  GstCeNalMeta *nal_meta;
+  GstBufferList *list;
+  GstBuffer *packet;
+  GstMemory *slice, *headers;
+  GstMapInfo info;
+  GstClockTime running_time;
+  guint8 *header_data, *header_sizes, *h;
+  guint max_payload, frag_size, n_packets, n, i;
+  guint offset, size, len;
+  guint32 timestamp;
+  gboolean last;
+  GstFlowReturn ret;
+
+  /* Thin the stream down to the layers requested */
+  meta = GST_CE_ENCODE_META_GET (buffer);
+  if (meta && meta->temporal_layer > h264enc->max_temporal_layer) {
+    GST_LOG_OBJECT (h264enc, "dropping frame of temporal layer %u",
+        meta->temporal_layer);
+    return GST_FLOW_CUSTOM_SUCCESS;
+  }
+
+  if (!h264enc->rtp) {
+    if (h264enc->insert_config != GST_CE_H264ENC_INSERT_CONFIG_NONE &&
+        h264enc->current_stream_format ==
+        GST_CE_H264ENC_STREAM_FORMAT_BYTE_STREAM)
+      gst_ce_h264enc_insert_config (h264enc, frame);
+    return GST_FLOW_OK;
+  }
+
+  nal_meta = GST_CE_NAL_META_GET (buffer);
+  if (!nal_meta || gst_buffer_n_memory (buffer) != 1)
+    goto fail_packetize;
+
+  max_payload = h264enc->mtu - RTP_HEADER_SIZE;
+  frag_size = max_payload - FU_A_HEADER_SIZE;
+
+  /* Count the packets to write all the headers in one block */
+  n_packets = 0;
+  for (i = 0; i < nal_meta->n_nals; i++) {
+    size = nal_meta->nals[i].size;
+    if (size <= max_payload)
+      n_packets++;
+    else
+      n_packets += (size - 1 + frag_size - 1) / frag_size;
+  }
+
+  if (!n_packets) {
+    GST_WARNING_OBJECT (h264enc, "no NAL units to packetize, dropping frame");
+    return GST_FLOW_CUSTOM_SUCCESS;
+  }
+
+  running_time = gst_segment_to_running_time (&encoder->output_segment,
+      GST_FORMAT_TIME, frame->pts);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    running_time = 0;
+  timestamp = h264enc->timestamp_offset +
+      gst_util_uint64_scale (running_time, RTP_CLOCK_RATE, GST_SECOND);
+
+  /* The NAL unit headers are needed for the FU-A ones */
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ))
+    goto fail_packetize;
+
+  header_data = g_malloc (n_packets * (RTP_HEADER_SIZE + FU_A_HEADER_SIZE));
+  header_sizes = g_malloc (n_packets);
+  slice = gst_buffer_peek_memory (buffer, 0);
+  list = gst_buffer_list_new_sized (n_packets);
+
+  h = header_data;
+  for (i = 0, n = 0; i < nal_meta->n_nals; i++) {
+    guint8 nal_header;
+
+    offset = nal_meta->nals[i].offset;
+    size = nal_meta->nals[i].size;
+    last = (i == nal_meta->n_nals - 1);
+
+    if (size <= max_payload) {
+      /* Single NAL unit packet */
+      gst_ce_h264enc_rtp_header (h264enc, h, last, timestamp);
+      header_sizes[n++] = RTP_HEADER_SIZE;
+      h += RTP_HEADER_SIZE;
+
+      packet = gst_buffer_new ();
+      gst_buffer_append_memory (packet, gst_cmem_share (slice, offset, size));
+      gst_buffer_list_add (list, packet);
+      continue;
+    }
+
+    /* FU-A fragments, the NAL unit header goes into the FU headers */
+    nal_header = info.data[offset];
+    offset++;
+    size--;
+    while (size) {
+      len = MIN (size, frag_size);
+
+      gst_ce_h264enc_rtp_header (h264enc, h, last && len == size, timestamp);
+      h[RTP_HEADER_SIZE] = (nal_header & 0xe0) | FU_A_TYPE;
+      h[RTP_HEADER_SIZE + 1] = (offset == nal_meta->nals[i].offset + 1 ?
+          0x80 : 0x00) | (len == size ? 0x40 : 0x00) | (nal_header & 0x1f);
+      header_sizes[n++] = RTP_HEADER_SIZE + FU_A_HEADER_SIZE;
+      h += RTP_HEADER_SIZE + FU_A_HEADER_SIZE;
+
+      packet = gst_buffer_new ();
+      gst_buffer_append_memory (packet, gst_cmem_share (slice, offset, len));
+      gst_buffer_list_add (list, packet);
+
+      offset += len;
+      size -= len;
+    }
+  }
+
+  gst_buffer_unmap (buffer, &info);
+
+  /* Put the headers in front of the payloads */
+  headers = gst_memory_new_wrapped (0, header_data, h - header_data, 0,
+      h - header_data, header_data, g_free);
+  for (i = 0, offset = 0; i < n_packets; i++) {
+    packet = gst_buffer_list_get (list, i);
+    gst_buffer_prepend_memory (packet, gst_memory_share (headers, offset,
+            header_sizes[i]));
+    offset += header_sizes[i];
+
+    GST_BUFFER_PTS (packet) = frame->pts;
+    GST_BUFFER_DTS (packet) = frame->dts;
+  }
+  gst_memory_unref (headers);
+  g_free (header_sizes);
+
+  GST_LOG_OBJECT (h264enc, "pushing %u RTP packets", n_packets);
+
+  /* The frame itself must not be pushed anymore */
+  ret = gst_pad_push_list (GST_VIDEO_ENCODER_SRC_PAD (encoder), list);
+  return ret == GST_FLOW_OK ? GST_FLOW_CUSTOM_SUCCESS : ret;
+
+fail_packetize:
+  {
+    GST_ERROR_OBJECT (h264enc, "can't packetize the frame");
+    return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * gst_ce_h264enc_tag_layer
+ *
+ * Finds the temporal layer of the frame, from the prefix NAL unit when
+ * the SVC syntax is enabled or else from its position in the dyadic
+ * structure of the codec. The frames of the top layer aren't used as
+ * reference and are flagged as droppable.
+ */
+static void
+gst_ce_h264enc_tag_layer (GstCeH264Enc * h264enc, GstBuffer * buffer,
+    GstCeEncodeMeta * meta)
+{
+  IH264VENC_Params *params;
+  GstMapInfo info;
+  guint layers, index;
+  gint layer = -1;
+  gint pos = 0;
+  gint i, nal_type;
+
+  params = (IH264VENC_Params *) GST_CEVIDENC (h264enc)->codec_params;
+  if (params->numTemporalLayers == GST_CE_H264ENC_LAYERS_ALL)
+    layers = 1;
+  else
+    layers = params->numTemporalLayers + 1;
+
+  /* The layer structure starts over on each intra frame */
+  if (meta->frame_type == GST_CE_ENCODE_FRAME_I ||
+      meta->frame_type == GST_CE_ENCODE_FRAME_IDR)
+    h264enc->layer_index = 0;
+  index = h264enc->layer_index++;
+
+  meta->temporal_layer = 0;
+  if (layers < 2)
+    return;
+
+  if ((params->svcSyntaxEnable == GST_CE_H264ENC_SVCSYNTAX_SVC_SW ||
+          params->svcSyntaxEnable == GST_CE_H264ENC_SVCSYNTAX_SVC_MMCO) &&
+      gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+    /* The prefix comes right before the first slice */
+    while ((i = gst_ce_find_start_code (info.data + pos,
+                info.size - NAL_LENGTH - pos)) >= 0) {
+      pos += i + NAL_LENGTH;
+      nal_type = info.data[pos] & 0x1f;
+      if (nal_type == GST_H264_NAL_PREFIX) {
+        if (pos + 3 < info.size)
+          layer = info.data[pos + 3] >> 5;
+        break;
+      }
+      if (nal_type == GST_H264_NAL_SLICE || nal_type == GST_H264_NAL_SLICE_IDR)
+        break;
+    }
+    gst_buffer_unmap (buffer, &info);
+  }
+
+  if (layer < 0) {
+    if (index % (1 << (layers - 1)) == 0)
+      layer = 0;
+    else
+      layer = layers - 1 - g_bit_nth_lsf (index, -1);
+  }
+
+  GST_LOG_OBJECT (h264enc, "frame %u of temporal layer %d", index, layer);
+  meta->temporal_layer = layer;
+  if (layer == layers - 1)
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DROPPABLE);
+}
+
+/*
+ * gst_ce_h264enc_index_nals
+ *
+ * Indexes the NAL units of a byte-stream buffer
+ */
+static gboolean
+gst_ce_h264enc_index_nals (GstCeH264Enc * h264enc, GstBuffer * buffer)
+{
+  GstCeNalMeta *nal_meta;
+  GstMapInfo info;
+  gint pos, next;
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (h264enc, "failed to map buffer");
+    return FALSE;
+  }
+
+  nal_meta = gst_ce_nal_meta_set (buffer);
+
+  pos = gst_ce_find_start_code (info.data, info.size);
+  while (pos >= 0 && pos + NAL_LENGTH < info.size) {
+    pos += NAL_LENGTH;
+    next = gst_ce_find_start_code (info.data + pos, info.size - pos);
+    gst_ce_nal_meta_add_nal (nal_meta, pos,
+        next < 0 ? info.size - pos : next, info.data[pos] & 0x1f);
+    pos = next < 0 ? -1 : pos + next;
+  }
+
+  gst_buffer_unmap (buffer, &info);
+
+  return TRUE;
+}
+
 static gboolean
 gst_ce_h264enc_post_process (GstCeVidEnc * ce_videnc, GstBuffer * buffer)
 {
   GstCeH264Enc *h264enc = GST_CE_H264ENC (ce_videnc);
+  IH264VENC_DynamicParams *dyn_params;
+  GstCeEncodeMeta *meta;
+  GstCeNalMeta *nal_meta = NULL;
   GstMapInfo info;
   guint8 *data;
   gint i, mark = 0;
+  gint pos = 0;
+  gint skip = 0;
   gint curr_nal_type = -1;
   gint prev_nal_type = -1;
   gint size;
-  gint32 state;
 
-  const gint32 start_code = 0x00000001;
+  /* Report the QP configured for the type of the encoded frame */
+  meta = GST_CE_ENCODE_META_GET (buffer);
+  if (meta && ce_videnc->codec_dyn_params->size ==
+      sizeof (IH264VENC_DynamicParams)) {
+    dyn_params = (IH264VENC_DynamicParams *) ce_videnc->codec_dyn_params;
+    if (meta->frame_type == GST_CE_ENCODE_FRAME_I ||
+        meta->frame_type == GST_CE_ENCODE_FRAME_IDR)
+      meta->qp = dyn_params->intraFrameQP;
+    else
+      meta->qp = dyn_params->interPFrameQP;
+  }
+
+  /* Still in byte-stream format here */
+  if (meta && ce_videnc->codec_params->size == sizeof (IH264VENC_Params))
+    gst_ce_h264enc_tag_layer (h264enc, buffer, meta);
 
   if (h264enc->current_stream_format ==
-      GST_CE_H264ENC_STREAM_FORMAT_BYTE_STREAM)
+      GST_CE_H264ENC_STREAM_FORMAT_BYTE_STREAM) {
+    if (h264enc->nal_index)
+      return gst_ce_h264enc_index_nals (h264enc, buffer);
     return TRUE;
+  }
+
+  /* The first IDR still carries its SPS/PPS start codes at this point */
+  if (h264enc->codec_data_pending && meta &&
+      meta->frame_type == GST_CE_ENCODE_FRAME_IDR) {
+    if (!gst_ce_h264enc_take_codec_data (h264enc, buffer)) {
+      GST_ERROR_OBJECT (h264enc, "failed to get codec data from IDR frame");
+      return FALSE;
+    }
+    h264enc->codec_data_pending = FALSE;
+  }
 
   GST_DEBUG_OBJECT (h264enc, "parsing byte-stream to avc");
 
@@ -893,68 +1639,79 @@ gst_ce_h264enc_post_process (GstCeVidEnc * ce_videnc, GstBuffer * buffer)
     return FALSE;
   }
 
+  /* The RTP packetization works out of the NAL index */
+  if (h264enc->nal_index || h264enc->rtp)
+    nal_meta = gst_ce_nal_meta_set (buffer);
+
   data = info.data;
   size = info.size;
-  /*Initialize to a pattern that does not match the start code */
-  state = ~(start_code);
-  for (i = 0; i < size - NAL_LENGTH; i++) {
-    state = ((state << 8) | data[i]);
-    if (state == start_code) {
-      prev_nal_type = curr_nal_type;
-      curr_nal_type = (data[i + 1]) & 0x1f;
-      GST_DEBUG_OBJECT (h264enc, "NAL unit %d", curr_nal_type);
-      if (h264enc->single_nalu) {
-        if ((curr_nal_type == GST_H264_NAL_SPS)
-            || (curr_nal_type == GST_H264_NAL_PPS)) {
-          GST_DEBUG_OBJECT (ce_videnc, "single NALU, found a I-frame");
-          /* Caution: here we are asumming the output buffer only 
-           * has one memory block*/
-          info.memory->offset = h264enc->header_size;
-          gst_buffer_set_size (buffer, size - h264enc->header_size);
-          mark = i + h264enc->header_size + 1;
-        } else {
-          GST_DEBUG_OBJECT (h264enc, "single NALU, found a P-frame");
-          mark = i + 1;
-        }
-        i = size - NAL_LENGTH;
-        break;
+  /* i points to the last byte of each start code found */
+  while ((i = gst_ce_find_start_code (data + pos,
+              size - NAL_LENGTH - pos)) >= 0) {
+    i += pos + NAL_LENGTH - 1;
+    pos = i + 1;
+
+    prev_nal_type = curr_nal_type;
+    curr_nal_type = (data[i + 1]) & 0x1f;
+    GST_DEBUG_OBJECT (h264enc, "NAL unit %d", curr_nal_type);
+    if (h264enc->single_nalu && !h264enc->rtp) {
+      if ((curr_nal_type == GST_H264_NAL_SPS)
+          || (curr_nal_type == GST_H264_NAL_PPS)) {
+        GST_DEBUG_OBJECT (ce_videnc, "single NALU, found a I-frame");
+        /* Caution: here we are asumming the output buffer only 
+         * has one memory block*/
+        info.memory->offset = h264enc->header_size;
+        gst_buffer_set_size (buffer, size - h264enc->header_size);
+        mark = i + h264enc->header_size + 1;
+        skip = h264enc->header_size;
       } else {
-        if ((prev_nal_type == GST_H264_NAL_SPS
-                || prev_nal_type == GST_H264_NAL_PPS)
-            && !h264enc->headers) {
-          /* Discard anything previous to the SPS and PPS */
-          /* Caution: here we are asumming the output buffer  
-           * has only one memory block*/
-          info.memory->offset = i - NAL_LENGTH + 1;
-          gst_buffer_set_size (buffer, size - (i - NAL_LENGTH + 1));
-          GST_DEBUG_OBJECT (h264enc, "SPS and PPS discard");
-        } else if (prev_nal_type != -1) {
-          /* Replace the NAL start code with the length */
-          gint length = i - mark - NAL_LENGTH + 1;
-          gint k;
-          for (k = 1; k <= 4; k++) {
-            data[mark - k] = length & 0xff;
-            length >>= 8;
-          }
+        GST_DEBUG_OBJECT (h264enc, "single NALU, found a P-frame");
+        mark = i + 1;
+      }
+      break;
+    } else {
+      if ((prev_nal_type == GST_H264_NAL_SPS
+              || prev_nal_type == GST_H264_NAL_PPS)
+          && !h264enc->headers && !h264enc->rtp) {
+        /* Discard anything previous to the SPS and PPS */
+        /* Caution: here we are asumming the output buffer  
+         * has only one memory block*/
+        info.memory->offset = i - NAL_LENGTH + 1;
+        gst_buffer_set_size (buffer, size - (i - NAL_LENGTH + 1));
+        GST_DEBUG_OBJECT (h264enc, "SPS and PPS discard");
+        skip = i - NAL_LENGTH + 1;
+        if (nal_meta)
+          nal_meta->n_nals = 0;
+      } else if (prev_nal_type != -1) {
+        /* Replace the NAL start code with the length */
+        gint length = i - mark - NAL_LENGTH + 1;
+        gint k;
+        for (k = 1; k <= 4; k++) {
+          data[mark - k] = length & 0xff;
+          length >>= 8;
         }
+        if (nal_meta)
+          gst_ce_nal_meta_add_nal (nal_meta, mark - skip,
+              i - mark - NAL_LENGTH + 1, prev_nal_type);
       }
-      /* Mark where next NALU starts */
-      mark = i + 1;
     }
+    /* Mark where next NALU starts */
+    mark = i + 1;
   }
 
-  if (i == (size - 4)) {
-    /* We reach the end of the buffer */
-    if (curr_nal_type != -1) {
-      gint k;
-      gint length = size - mark;
-      GST_DEBUG_OBJECT (h264enc, "Replace the NAL start code "
-          "with the length %d buffer %d", length, size);
-      for (k = 1; k <= 4; k++) {
-        data[mark - k] = length & 0xff;
-        length >>= 8;
-      }
+  /* The last NAL unit runs to the end of the buffer */
+  if (curr_nal_type != -1) {
+    gint k;
+    gint length = size - mark;
+    GST_DEBUG_OBJECT (h264enc, "Replace the NAL start code "
+        "with the length %d buffer %d", length, size);
+    for (k = 1; k <= 4; k++) {
+      data[mark - k] = length & 0xff;
+      length >>= 8;
     }
+    if (nal_meta)
+      gst_ce_nal_meta_add_nal (nal_meta, mark - skip, size - mark,
+          data[mark] & 0x1f);
   }
 
   gst_buffer_unmap (buffer, &info);
@@ -970,9 +1727,8 @@ gst_ce_h264enc_set_property (GObject * object, guint prop_id,
   GstCeH264Enc *h264enc = GST_CE_H264ENC (object);
   IH264VENC_Params *params;
   IH264VENC_DynamicParams *dyn_params;
-  VIDENC1_Status enc_status;
   gboolean set_params = FALSE;
-  guint ret;
+  gboolean set_complexity = FALSE;
 
   params = (IH264VENC_Params *) ce_videnc->codec_params;
   dyn_params = (IH264VENC_DynamicParams *) ce_videnc->codec_dyn_params;
@@ -982,6 +1738,7 @@ gst_ce_h264enc_set_property (GObject * object, guint prop_id,
     return;
   }
 
+  GST_OBJECT_LOCK (ce_videnc);
   switch (prop_id) {
     case PROP_BYTESTREAM:
       h264enc->byte_stream = g_value_get_boolean (value);
@@ -1012,23 +1769,24 @@ gst_ce_h264enc_set_property (GObject * object, guint prop_id,
       break;
     case PROP_T8X8INTRA:
       if (!ce_videnc->codec_handle)
-        params->transform8x8FlagIntraFrame =
-            g_value_get_boolean (value) ? 1 : 0;
+        h264enc->user_t8x8intra = g_value_get_boolean (value) ? 1 : 0;
       else
         goto fail_static_prop;
+      set_complexity = TRUE;
       break;
     case PROP_T8X8INTER:
       if (!ce_videnc->codec_handle)
-        params->transform8x8FlagInterFrame =
-            g_value_get_boolean (value) ? 1 : 0;
+        h264enc->user_t8x8inter = g_value_get_boolean (value) ? 1 : 0;
       else
         goto fail_static_prop;
+      set_complexity = TRUE;
       break;
     case PROP_ENCQUALITY:
       if (!ce_videnc->codec_handle)
-        params->encQuality = g_value_get_enum (value);
+        h264enc->user_enc_quality = g_value_get_enum (value);
       else
         goto fail_static_prop;
+      set_complexity = TRUE;
       break;
     case PROP_ENABLETCM:
       if (!ce_videnc->codec_handle)
@@ -1083,7 +1841,9 @@ gst_ce_h264enc_set_property (GObject * object, guint prop_id,
     case PROP_INTERLACE:
       if (!ce_videnc->codec_handle) {
 	h264enc->interlace = g_value_get_boolean(value);
+	GST_OBJECT_UNLOCK (ce_videnc);
 	gst_ce_videnc_set_interlace (ce_videnc, h264enc->interlace);
+	GST_OBJECT_LOCK (ce_videnc);
       } else {
 	goto fail_static_prop;
       }
@@ -1092,27 +1852,49 @@ gst_ce_h264enc_set_property (GObject * object, guint prop_id,
       dyn_params->interlaceRefMode = g_value_get_enum (value);
       set_params = TRUE;
       break;
+    case PROP_LAZY_CODEC_DATA:
+      h264enc->lazy_codec_data = g_value_get_boolean (value);
+      break;
+    case PROP_NAL_INDEX:
+      h264enc->nal_index = g_value_get_boolean (value);
+      break;
+    case PROP_MTU:
+      h264enc->mtu = g_value_get_uint (value);
+      break;
+    case PROP_PT:
+      h264enc->pt = g_value_get_uint (value);
+      break;
+    case PROP_INSERT_CONFIG:
+      h264enc->insert_config = g_value_get_enum (value);
+      break;
+    case PROP_CONFIG_INTERVAL:
+      h264enc->config_interval = g_value_get_uint (value);
+      break;
+    case PROP_MAX_TEMPORAL_LAYER:
+      h264enc->max_temporal_layer = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 
-  /* Set dynamic parameters if needed */
-  if (set_params && ce_videnc->codec_handle) {
-    enc_status.size = sizeof (VIDENC1_Status);
-    enc_status.data.buf = NULL;
-    ret = VIDENC1_control (ce_videnc->codec_handle, XDM_SETPARAMS,
-        (VIDENC1_DynamicParams *) dyn_params, &enc_status);
-    if (ret != VIDENC1_EOK)
-      GST_WARNING_OBJECT (ce_videnc, "failed to set dynamic parameters, "
-          "status error %x, %d", (guint) enc_status.extendedError, ret);
-  }
+  /* Derive the codec params from the new user value, falling back to
+   * the user values if the current level can't be reached anymore */
+  if (set_complexity && !gst_ce_h264enc_set_complexity (ce_videnc,
+          h264enc->complexity))
+    gst_ce_h264enc_set_complexity (ce_videnc, 0);
+
+  /* Set dynamic parameters along with the next frame */
+  if (set_params)
+    gst_ce_videnc_update_dynamic_params (ce_videnc);
 
+  GST_OBJECT_UNLOCK (ce_videnc);
   return;
 
 fail_static_prop:
   GST_WARNING_OBJECT (ce_videnc, "can't set static property when "
       "the codec is already configured");
+  GST_OBJECT_UNLOCK (ce_videnc);
 }
 
 static void
@@ -1152,15 +1934,13 @@ gst_ce_h264enc_get_property (GObject * object, guint prop_id,
       g_value_set_enum (value, params->entropyMode);
       break;
     case PROP_T8X8INTRA:
-      g_value_set_boolean (value,
-          params->transform8x8FlagIntraFrame ? TRUE : FALSE);
+      g_value_set_boolean (value, h264enc->user_t8x8intra ? TRUE : FALSE);
       break;
     case PROP_T8X8INTER:
-      g_value_set_boolean (value,
-          params->transform8x8FlagInterFrame ? TRUE : FALSE);
+      g_value_set_boolean (value, h264enc->user_t8x8inter ? TRUE : FALSE);
       break;
     case PROP_ENCQUALITY:
-      g_value_set_enum (value, params->encQuality);
+      g_value_set_enum (value, h264enc->user_enc_quality);
       break;
     case PROP_ENABLETCM:
       g_value_set_boolean (value, params->enableARM926Tcm ? TRUE : FALSE);
@@ -1198,6 +1978,27 @@ gst_ce_h264enc_get_property (GObject * object, guint prop_id,
     case PROP_INTERLACE_MODE:
       g_value_set_enum (value, dyn_params->interlaceRefMode);
       break;
+    case PROP_LAZY_CODEC_DATA:
+      g_value_set_boolean (value, h264enc->lazy_codec_data);
+      break;
+    case PROP_NAL_INDEX:
+      g_value_set_boolean (value, h264enc->nal_index);
+      break;
+    case PROP_MTU:
+      g_value_set_uint (value, h264enc->mtu);
+      break;
+    case PROP_PT:
+      g_value_set_uint (value, h264enc->pt);
+      break;
+    case PROP_INSERT_CONFIG:
+      g_value_set_enum (value, h264enc->insert_config);
+      break;
+    case PROP_CONFIG_INTERVAL:
+      g_value_set_uint (value, h264enc->config_interval);
+      break;
+    case PROP_MAX_TEMPORAL_LAYER:
+      g_value_set_uint (value, h264enc->max_temporal_layer);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
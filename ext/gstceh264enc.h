@@ -47,6 +47,36 @@ struct _GstCeH264Enc
   gboolean single_nalu;
   gint header_size;
   gboolean interlace;
+  gboolean lazy_codec_data;
+  gboolean codec_data_pending;
+  gboolean nal_index;
+
+  /* RTP output */
+  gboolean rtp;
+  guint mtu;
+  guint pt;
+  guint32 ssrc;
+  guint32 timestamp_offset;
+  guint16 seqnum;
+
+  /* SPS/PPS insertion */
+  gint insert_config;
+  guint config_interval;
+  guint idrs_since_config;
+  GstClockTime last_config_time;
+  GstMemory *config;
+  GstCeNal config_nals[2];
+
+  /* Temporal layers */
+  guint max_temporal_layer;
+  guint layer_index;
+
+  /* Static params configured by the user, the codec params are derived
+   * from them for the current complexity level */
+  guint complexity;
+  gint user_enc_quality;
+  gint user_t8x8intra;
+  gint user_t8x8inter;
 
 };
 
@@ -34,9 +34,9 @@ GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS ("video/x-raw, "
-        "   format = (string) {NV12,UYVY},"
+        "   format = (string) {NV12,UYVY,I420,YV12,YUY2},"
         "   framerate=(fraction)[ 0, 120], "
-        "   width=(int)[ 97, 4080 ], " "   height=(int)[ 16, 4096 ]")
+        "   width=(int)[ 97, 4080 ], " "   height=(int)[ 16, 65535 ]")
     );
 /* *INDENT-ON* */
 
@@ -46,7 +46,16 @@ GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS ("image/jpeg, "
         "   framerate=(fraction)[ 0, 120], "
-        "   width=(int)[ 97, 4080 ], " "   height=(int)[ 16, 4096 ]")
+        "   width=(int)[ 97, 4080 ], " "   height=(int)[ 16, 65535 ]")
+    );
+
+static GstStaticPadTemplate gst_ce_jpegenc_thumbnail_pad_template =
+GST_STATIC_PAD_TEMPLATE (GST_CE_IMGENC_THUMBNAIL,
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS ("image/jpeg, "
+        "   framerate=(fraction)[ 0, 120], "
+        "   width=(int)[ 97, 4080 ], " "   height=(int)[ 2, 4096 ]")
     );
 
 enum
@@ -59,6 +68,17 @@ enum
 #define JPEG_DEFAULT_ROTATION 0
 #define JPEG_DEFAULT_DISABLE_EOI 0
 #define JPEG_DEFAULT_RST_INTERVAL 84
+/* Tallest image the codec takes, taller ones are encoded in tiles */
+#define JPEG_MAX_HEIGHT 4096
+/* Size of the 4:2:0 MCUs */
+#define JPEG_MCU_SIZE 16
+
+#define JPEG_MARKER_SOF0 0xC0
+#define JPEG_MARKER_SOF2 0xC2
+#define JPEG_MARKER_RST0 0xD0
+#define JPEG_MARKER_RST7 0xD7
+#define JPEG_MARKER_EOI 0xD9
+#define JPEG_MARKER_SOS 0xDA
 
 enum
 {
@@ -90,6 +110,10 @@ gst_ce_jpegenc_rotation_get_type (void)
 }
 
 static void gst_ce_jpegenc_reset (GstCeImgEnc * ce_imgenc);
+static gboolean gst_ce_jpegenc_set_tiling (GstCeImgEnc * ce_imgenc,
+    gint width, gint tile_height);
+static gboolean gst_ce_jpegenc_join_tile (GstCeImgEnc * ce_imgenc,
+    guint8 * data, gsize offset, gsize * size, guint tile, guint n_tiles);
 
 static void gst_ce_jpegenc_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
@@ -136,6 +160,8 @@ gst_ce_jpegenc_class_init (GstCeJpegEncClass * klass)
       gst_static_pad_template_get (&gst_ce_jpegenc_sink_pad_template));
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_ce_jpegenc_src_pad_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_ce_jpegenc_thumbnail_pad_template));
 
   gst_element_class_set_static_metadata (element_class,
       "CE JPEG image/video encoder", "Codec/Encoder/Image",
@@ -144,6 +170,8 @@ gst_ce_jpegenc_class_init (GstCeJpegEncClass * klass)
 
   ce_imgenc_class->codec_name = "jpegenc";
   ce_imgenc_class->reset = gst_ce_jpegenc_reset;
+  ce_imgenc_class->set_tiling = gst_ce_jpegenc_set_tiling;
+  ce_imgenc_class->join_tile = gst_ce_jpegenc_join_tile;
 }
 
 /**
@@ -187,6 +215,9 @@ gst_ce_jpegenc_init (GstCeJpegEnc * jpegenc)
   ce_imgenc->codec_params->size = sizeof (IJPEGENC_Params);
   ce_imgenc->codec_dyn_params->size = sizeof (IJPEGENC_DynamicParams);
 
+  /* Taller images are encoded in tiles */
+  gst_ce_imgenc_set_max_height (ce_imgenc, JPEG_MAX_HEIGHT);
+
   gst_ce_jpegenc_reset (ce_imgenc);
 
   return;
@@ -212,9 +243,10 @@ gst_ce_jpegenc_reset (GstCeImgEnc * ce_imgenc)
   IJPEGENC_DynamicParams *jpeg_dyn_params;
 
   if ((sizeof (IJPEGENC_Params) != ce_imgenc->codec_params->size) ||
-      (sizeof (IJPEGENC_DynamicParams) != ce_imgenc->codec_dyn_params->size))
+      (sizeof (IJPEGENC_DynamicParams) != ce_imgenc->codec_dyn_params->size)) {
     GST_WARNING_OBJECT (ce_imgenc, "there isn't JPEG extended parameters");
-  return;
+    return;
+  }
 
   jpeg_params = (IJPEGENC_Params *) ce_imgenc->codec_params;
   jpeg_dyn_params = (IJPEGENC_DynamicParams *) ce_imgenc->codec_dyn_params;
@@ -235,6 +267,127 @@ gst_ce_jpegenc_reset (GstCeImgEnc * ce_imgenc)
   return;
 }
 
+/**
+ * Adapts the restart interval to the tiles, a restart marker between
+ * them lets each tile start its own entropy coded segment
+ */
+static gboolean
+gst_ce_jpegenc_set_tiling (GstCeImgEnc * ce_imgenc, gint width,
+    gint tile_height)
+{
+  IJPEGENC_DynamicParams *jpeg_dyn_params;
+  guint interval = JPEG_DEFAULT_RST_INTERVAL;
+  gboolean ret = TRUE;
+
+  jpeg_dyn_params = (IJPEGENC_DynamicParams *) ce_imgenc->codec_dyn_params;
+
+  if (tile_height)
+    interval = (GST_ROUND_UP_16 (width) / JPEG_MCU_SIZE) *
+        (tile_height / JPEG_MCU_SIZE);
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  if (tile_height && jpeg_dyn_params->rotation) {
+    GST_ERROR_OBJECT (ce_imgenc, "rotation isn't supported with tiles");
+    ret = FALSE;
+  } else if (interval > G_MAXUINT16) {
+    GST_ERROR_OBJECT (ce_imgenc, "%u MCUs per tile are too many", interval);
+    ret = FALSE;
+  } else {
+    GST_DEBUG_OBJECT (ce_imgenc, "restart interval of %u MCUs", interval);
+    jpeg_dyn_params->rstInterval = interval;
+    gst_ce_imgenc_update_dynamic_params (ce_imgenc);
+  }
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  return ret;
+}
+
+/**
+ * Finds the image height in the frame header and the start of the entropy
+ * coded data in a JPEG image
+ */
+static gboolean
+gst_ce_jpegenc_parse_header (const guint8 * data, gsize size,
+    gsize * height_offset, gsize * scan_offset)
+{
+  gsize pos = 2;
+  guint8 marker;
+
+  *height_offset = 0;
+  while (pos + 4 <= size) {
+    if (data[pos] != 0xFF)
+      return FALSE;
+
+    marker = data[pos + 1];
+    if (marker == 0xFF) {
+      pos++;
+      continue;
+    }
+
+    if (marker >= JPEG_MARKER_SOF0 && marker <= JPEG_MARKER_SOF2)
+      *height_offset = pos + 5;
+
+    pos += 2 + GST_READ_UINT16_BE (data + pos + 2);
+    if (marker == JPEG_MARKER_SOS) {
+      *scan_offset = pos;
+      return *height_offset && pos <= size;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+ * Joins a tile to the previous ones, keeping only its entropy coded data
+ * behind a restart marker and adding its height to the first frame header
+ */
+static gboolean
+gst_ce_jpegenc_join_tile (GstCeImgEnc * ce_imgenc, guint8 * data,
+    gsize offset, gsize * size, guint tile, guint n_tiles)
+{
+  GstCeJpegEnc *jpegenc = GST_CE_JPEGENC (ce_imgenc);
+  guint8 *tile_data = data + offset;
+  gsize len = *size;
+  gsize height_offset, scan_offset;
+  guint height;
+
+  if (len < 4 || !gst_ce_jpegenc_parse_header (tile_data, len,
+          &height_offset, &scan_offset)) {
+    GST_ERROR_OBJECT (ce_imgenc, "invalid JPEG tile %u", tile);
+    return FALSE;
+  }
+
+  /* Only the last tile ends the image */
+  if (tile < n_tiles - 1) {
+    if (tile_data[len - 2] == 0xFF && tile_data[len - 1] == JPEG_MARKER_EOI)
+      len -= 2;
+    if (tile_data[len - 2] == 0xFF && tile_data[len - 1] >= JPEG_MARKER_RST0
+        && tile_data[len - 1] <= JPEG_MARKER_RST7)
+      len -= 2;
+  }
+
+  if (tile == 0) {
+    jpegenc->height_offset = height_offset;
+    *size = len;
+    return TRUE;
+  }
+
+  height = GST_READ_UINT16_BE (data + jpegenc->height_offset) +
+      GST_READ_UINT16_BE (tile_data + height_offset);
+  if (height > G_MAXUINT16) {
+    GST_ERROR_OBJECT (ce_imgenc, "image height %u is too large", height);
+    return FALSE;
+  }
+  GST_WRITE_UINT16_BE (data + jpegenc->height_offset, height);
+
+  tile_data[0] = 0xFF;
+  tile_data[1] = JPEG_MARKER_RST0 + ((tile - 1) & 7);
+  memmove (tile_data + 2, tile_data + scan_offset, len - scan_offset);
+  *size = 2 + len - scan_offset;
+
+  return TRUE;
+}
+
 /**
  * Sets custom properties to JPEG encoder
  */
@@ -244,8 +397,6 @@ gst_ce_jpegenc_set_property (GObject * object, guint prop_id,
 {
   GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (object);
   IJPEGENC_DynamicParams *dyn_params;
-  IMGENC1_Status enc_status;
-  guint ret = IMGENC1_EFAIL;
 
   dyn_params = (IJPEGENC_DynamicParams *) ce_imgenc->codec_dyn_params;
 
@@ -254,6 +405,7 @@ gst_ce_jpegenc_set_property (GObject * object, guint prop_id,
     return;
   }
 
+  GST_OBJECT_LOCK (ce_imgenc);
   switch (prop_id) {
     case PROP_ROTATION:
       dyn_params->rotation = g_value_get_enum (value);
@@ -266,16 +418,9 @@ gst_ce_jpegenc_set_property (GObject * object, guint prop_id,
       break;
   }
 
-  /* Set dynamic parameters if needed */
-  if (ce_imgenc->codec_handle) {
-    enc_status.size = sizeof (IMGENC1_Status);
-    enc_status.data.buf = NULL;
-    ret = IMGENC1_control (ce_imgenc->codec_handle, XDM_SETPARAMS,
-        (IMGENC1_DynamicParams *) dyn_params, &enc_status);
-    if (IMGENC1_EOK != ret)
-      GST_WARNING_OBJECT (ce_imgenc, "failed to set dynamic parameters, "
-          "status error %x, %d", (guint) enc_status.extendedError, ret);
-  }
+  /* Set dynamic parameters along with the next image */
+  gst_ce_imgenc_update_dynamic_params (ce_imgenc);
+  GST_OBJECT_UNLOCK (ce_imgenc);
 
   return;
 }
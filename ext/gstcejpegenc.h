@@ -41,6 +41,9 @@ typedef struct _GstCeJpegEncClass GstCeJpegEncClass;
 struct _GstCeJpegEnc
 {
   GstCeImgEnc encoder;
+
+  /* Tiled encoding, where the first tile keeps the image height */
+  gsize height_offset;
 };
 
 struct _GstCeJpegEncClass
@@ -46,6 +46,7 @@
 #include <ext/cmem/gstceslicepool.h>
 
 #include "gstceaudenc.h"
+#include "gstcestats.h"
 
 #include <ti/sdo/ce/osal/Memory.h>
 #include <ittiam/codecs/aaclc_enc/ieaacplusenc.h>
@@ -58,12 +59,17 @@ enum
   PROP_0,
   PROP_BITRATE,
   PROP_MAX_BITRATE,
-  PROP_NUM_OUT_BUFFERS
+  PROP_NUM_OUT_BUFFERS,
+  PROP_ENABLE_STATS,
+  PROP_STATS,
+  PROP_LOW_LATENCY
 };
 
 #define PROP_BITRATE_DEFAULT          128000
 #define PROP_MAX_BITRATE_DEFAULT      128000
 #define PROP_NUM_OUT_BUFFERS_DEFAULT       3
+#define PROP_ENABLE_STATS_DEFAULT      FALSE
+#define PROP_LOW_LATENCY_DEFAULT       FALSE
 
 #define SAMPLE_RATE_DEFAULT            48000
 #define INPUT_BITS_PER_SAMPLE_DEFAULT     16
@@ -95,6 +101,15 @@ struct _GstCeAudEncPrivate
   Engine_Handle engine_handle;
   XDM1_BufDesc inbuf_desc;
   XDM1_BufDesc outbuf_desc;
+
+  /* Encoding time statistics */
+  GstCeStats *stats;
+  gboolean stats_enabled;
+
+  /* Reported latency */
+  GstCeLatency latency;
+  gboolean low_latency;
+  gboolean latency_reported_low;
 };
 
 /* A number of function prototypes are given so we can refer to them later. */
@@ -162,6 +177,28 @@ gst_ce_audenc_class_init (GstCeAudEncClass * klass)
           "each buffer contains the maximum amount of samples supported by the audio codec",
           3, G_MAXINT32, PROP_NUM_OUT_BUFFERS_DEFAULT, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_ENABLE_STATS,
+      g_param_spec_boolean ("enable-stats",
+          "Enable statistics",
+          "Time each phase of the encoding process, enabling them "
+          "resets the statistics",
+          PROP_ENABLE_STATS_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats",
+          "Statistics",
+          "Minimum, average, maximum and 99th percentile time in "
+          "nanoseconds spent on each phase of the encoding process",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency",
+          "Low latency",
+          "Encode the smallest frames the codec takes one at a time and "
+          "report a maximum latency equal to the encoding latency, so no "
+          "buffering is added behind the encoder",
+          PROP_LOW_LATENCY_DEFAULT, G_PARAM_READWRITE));
+
   aenc_class->open = GST_DEBUG_FUNCPTR (gst_ce_audenc_open);
   aenc_class->close = GST_DEBUG_FUNCPTR (gst_ce_audenc_close);
   aenc_class->stop = GST_DEBUG_FUNCPTR (gst_ce_audenc_stop);
@@ -207,6 +244,9 @@ gst_ce_audenc_init (GstCeAudEnc * ceaudenc)
 
   priv->engine_handle = NULL;
   priv->allocator = NULL;
+  priv->stats = gst_ce_stats_new ();
+  priv->stats_enabled = PROP_ENABLE_STATS_DEFAULT;
+  priv->low_latency = PROP_LOW_LATENCY_DEFAULT;
 
   gst_ce_audenc_reset ((GstAudioEncoder *) ceaudenc);
 }
@@ -227,6 +267,11 @@ gst_ce_audenc_finalize (GObject * object)
     ceaudenc->codec_dyn_params = NULL;
   }
 
+  if (ceaudenc->priv->stats) {
+    gst_ce_stats_free (ceaudenc->priv->stats);
+    ceaudenc->priv->stats = NULL;
+  }
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -461,6 +506,39 @@ gst_ce_audenc_allocate_frame (GstCeAudEnc * ceaudenc, GstBuffer ** buf,
   return TRUE;
 }
 
+/*
+ * gst_ce_audenc_update_latency
+ *
+ * Tracks the time the codec and the post-process took for the last
+ * frame and reports the latency again when it drifts. The samples
+ * gathered for a frame add its duration to the latency.
+ */
+static void
+gst_ce_audenc_update_latency (GstCeAudEnc * ceaudenc, GstClockTime sample)
+{
+  GstCeAudEncPrivate *priv = ceaudenc->priv;
+  GstClockTime latency;
+  gboolean low_latency;
+
+  GST_OBJECT_LOCK (ceaudenc);
+  low_latency = priv->low_latency;
+  GST_OBJECT_UNLOCK (ceaudenc);
+
+  if (!gst_ce_latency_add (&priv->latency, sample, &latency) &&
+      low_latency == priv->latency_reported_low)
+    return;
+
+  priv->latency_reported_low = low_latency;
+  if (priv->rate)
+    latency += gst_util_uint64_scale_int (priv->samples, GST_SECOND,
+        priv->rate);
+
+  GST_DEBUG_OBJECT (ceaudenc, "reporting a latency of %" GST_TIME_FORMAT
+      "%s", GST_TIME_ARGS (latency), low_latency ? " (low latency)" : "");
+  gst_audio_encoder_set_latency (GST_AUDIO_ENCODER (ceaudenc), latency,
+      low_latency ? latency : GST_CLOCK_TIME_NONE);
+}
+
 static GstFlowReturn
 gst_ce_audenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
 {
@@ -471,8 +549,18 @@ gst_ce_audenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
   GstMapInfo info_in, info_out;
   AUDENC1_InArgs in_args;
   AUDENC1_OutArgs out_args;
+  GstCeStats *stats = NULL;
+  GstClockTime last = 0;
+  GstClockTime start, duration, post_start;
+  GstCeEncodeMeta *meta;
+  GstFlowReturn ret;
   gint32 status;
 
+  if (priv->stats_enabled)
+    stats = priv->stats;
+
+  GST_CE_STATS_START (stats, last);
+
   gst_buffer_map (buffer, &info_in, GST_MAP_READ);
   /* Copy input buffer to a contiguous buffer */
   if ((!priv->inbuf) || (info_in.size != priv->inbuf_desc.descs[0].bufSize)) {
@@ -490,8 +578,13 @@ gst_ce_audenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
   gst_buffer_fill (priv->inbuf, 0, info_in.data, info_in.size);
   gst_buffer_unmap (buffer, &info_in);
 
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_CONTIGUITY, last);
+
   gst_buffer_map (priv->inbuf, &info_in, GST_MAP_READ);
   priv->inbuf_desc.descs[0].buf = (XDAS_Int8 *) info_in.data;
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_MAP, last);
+
   GST_DEBUG_OBJECT (ceaudenc, "input buffer %p of size %li %d",
       priv->inbuf_desc.descs[0].buf, priv->inbuf_desc.descs[0].bufSize,
       priv->samples);
@@ -500,10 +593,11 @@ gst_ce_audenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
   if (gst_pad_check_reconfigure (encoder->srcpad))
     gst_audio_encoder_negotiate (GST_AUDIO_ENCODER (encoder));
   /* Allocate an output buffer */
+  GST_CE_STATS_START (stats, last);
   if (gst_buffer_pool_acquire_buffer (GST_BUFFER_POOL_CAST (priv->outbuf_pool),
           &outbuf, NULL) != GST_FLOW_OK) {
     outbuf = NULL;
-    GstFlowReturn ret =
+    ret =
         gst_audio_encoder_finish_frame (GST_AUDIO_ENCODER (ceaudenc), outbuf,
         priv->samples);
     GST_WARNING ("Dropping samples %d", ret);
@@ -515,6 +609,8 @@ gst_ce_audenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
   GST_DEBUG_OBJECT (ceaudenc, "output buffer %p of size %li",
       priv->outbuf_desc.descs[0].buf, priv->outbuf_desc.descs[0].bufSize);
 
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_ALLOC, last);
+
   /* Encode process */
   in_args.size = sizeof (AUDENC1_InArgs);
   in_args.numInSamples = priv->samples;
@@ -525,23 +621,36 @@ gst_ce_audenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
   out_args.size = sizeof (AUDENC1_OutArgs);
   out_args.extendedError = 0;
 
+  GST_CE_STATS_START (stats, last);
   if (klass->pre_process) {
     GST_DEBUG_OBJECT (ceaudenc, "calling pre-processing");
     klass->pre_process (ceaudenc, priv->inbuf);
   }
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_PRE_PROCESS, last);
 
   /* Encode the audio buffer */
+  start = gst_util_get_timestamp ();
   status =
       AUDENC1_process (ceaudenc->codec_handle, &priv->inbuf_desc,
       &priv->outbuf_desc, &in_args, &out_args);
   if (status != AUDENC1_EOK)
     goto fail_encode;
 
+  duration = gst_util_get_timestamp () - start;
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_PROCESS, last);
+
+  post_start = gst_util_get_timestamp ();
   if (klass->post_process) {
     GST_DEBUG_OBJECT (ceaudenc, "calling post-processing");
     klass->post_process (ceaudenc, outbuf);
   }
 
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_POST_PROCESS, last);
+
+  gst_ce_audenc_update_latency (ceaudenc,
+      duration + gst_util_get_timestamp () - post_start);
+
   gst_buffer_unmap (priv->inbuf, &info_in);
   gst_buffer_unmap (outbuf, &info_out);
 
@@ -552,13 +661,24 @@ gst_ce_audenc_handle_frame (GstAudioEncoder * encoder, GstBuffer * buffer)
   gst_ce_slice_buffer_resize (GST_CE_SLICE_BUFFER_POOL_CAST (priv->outbuf_pool),
       outbuf, out_args.bytesGenerated);
 
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_RESIZE, last);
+
+  meta = gst_ce_encode_meta_set (outbuf);
+  meta->bytes = out_args.bytesGenerated;
+  meta->encode_duration = duration;
+  meta->bitrate = ceaudenc->codec_dyn_params->bitRate;
+
   if (gst_buffer_get_size (outbuf) == 0)
     goto fail_outbuf_size;
 
   GST_LOG_OBJECT (ceaudenc, "Sending buffer");
-  return gst_audio_encoder_finish_frame (GST_AUDIO_ENCODER (ceaudenc), outbuf,
+  ret = gst_audio_encoder_finish_frame (GST_AUDIO_ENCODER (ceaudenc), outbuf,
       priv->samples);
 
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_PUSH, last);
+
+  return ret;
+
 fail_inbuf_alloc:
   {
     GST_ERROR_OBJECT (ceaudenc, "failed to allocate input buffer");
@@ -625,6 +745,18 @@ gst_ce_audenc_set_property (GObject * object,
           "setting number of output buffers to %d",
           ceaudenc->priv->num_out_buffers);
       break;
+    case PROP_ENABLE_STATS:
+      ceaudenc->priv->stats_enabled = g_value_get_boolean (value);
+      if (ceaudenc->priv->stats_enabled)
+        gst_ce_stats_reset (ceaudenc->priv->stats);
+      GST_LOG_OBJECT (ceaudenc, "setting stats enabled to %d",
+          ceaudenc->priv->stats_enabled);
+      break;
+    case PROP_LOW_LATENCY:
+      ceaudenc->priv->low_latency = g_value_get_boolean (value);
+      GST_LOG_OBJECT (ceaudenc, "setting low latency to %d",
+          ceaudenc->priv->low_latency);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -674,6 +806,16 @@ gst_ce_audenc_get_property (GObject * object,
     case PROP_NUM_OUT_BUFFERS:
       g_value_set_int (value, ceaudenc->priv->num_out_buffers);
       break;
+    case PROP_ENABLE_STATS:
+      g_value_set_boolean (value, ceaudenc->priv->stats_enabled);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value,
+          gst_ce_stats_get_structure (ceaudenc->priv->stats));
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, ceaudenc->priv->low_latency);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -790,6 +932,9 @@ gst_ce_audenc_reset (GstAudioEncoder * encoder)
     ceaudenc->codec_handle = NULL;
   }
 
+  gst_ce_latency_reset (&priv->latency);
+  priv->latency_reported_low = FALSE;
+
   GST_OBJECT_LOCK (ceaudenc);
   priv->num_out_buffers = PROP_NUM_OUT_BUFFERS_DEFAULT;
   /* Set default values for codec static params */
@@ -898,6 +1043,7 @@ gst_ce_audenc_get_buffer_info (GstCeAudEnc * ceaudenc)
  * Lets #GstCeAudEnc sub-classes to set the audio codec samples per buffer 
  * capabilities. If @max_samples is equal to @min_samples, means the codec
  * cannot handle less samples, the leftover samples will simply be discarded.
+ * In low latency mode the codec is given @min_samples at a time.
  *
  */
 void
@@ -911,6 +1057,12 @@ gst_ce_audenc_set_frame_samples (GstCeAudEnc * ceaudenc, gint min_samples,
   priv->max_samples = max_samples;
   priv->samples = max_samples;
 
+  /* Don't wait for more samples than the codec needs */
+  if (priv->low_latency && min_samples > 0) {
+    priv->max_samples = priv->samples = min_samples;
+    gst_audio_encoder_set_frame_max (encoder, 1);
+  }
+
   /* report needs to base class */
   gst_audio_encoder_set_frame_samples_min (encoder, priv->min_samples);
   gst_audio_encoder_set_frame_samples_max (encoder, priv->max_samples);
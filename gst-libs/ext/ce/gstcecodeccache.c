@@ -0,0 +1,464 @@
+/*
+ * gstcecodeccache.c
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+/*
+ * Process wide cache of idle codec instances.
+ *
+ * Creating a codec instance means opening the Codec Engine and running
+ * the algorithm creation, which is expensive on the DM36x. Elements that
+ * are stopped and restarted often (segment rotation, camera restarts)
+ * can park their codec instance here when stopping and adopt it again
+ * when they are configured with the very same static parameters.
+ *
+ * Each entry owns both the codec instance and the engine handle it was
+ * created on. Entries are evicted in least recently released order when
+ * the number of idle instances exceeds the limit requested by the
+ * releasing element, or when their idle timeout expires. The ones kept
+ * without a timeout are destroyed by gst_ce_codec_cache_clear().
+ *
+ * The parameters are compared byte by byte, padding included, so they
+ * must be zero initialized before being filled.
+ *
+ * The stream headers generated by the codecs are cached as well, keyed
+ * by the parameters they were generated with, so renegotiations and
+ * restarts don't need an extra header generation pass.
+ */
+
+#include <string.h>
+
+#include "gstcecodeccache.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_ce_codec_cache_debug);
+#define GST_CAT_DEFAULT gst_ce_codec_cache_debug
+
+/* Maximum number of stream headers kept */
+#define HEADER_CACHE_SIZE 16
+
+typedef struct _GstCeCodecCacheEntry GstCeCodecCacheEntry;
+typedef struct _GstCeHeaderCacheEntry GstCeHeaderCacheEntry;
+
+struct _GstCeCodecCacheEntry
+{
+  gchar *codec_name;
+  gpointer params;
+  gsize params_size;
+
+  Engine_Handle engine;
+  gpointer handle;
+  GstCeCodecDeleteFunc delete_func;
+
+  GstClockTime expire;
+};
+
+struct _GstCeHeaderCacheEntry
+{
+  gchar *codec_name;
+  gpointer key;
+  gsize key_size;
+
+  GstBuffer *header;
+};
+
+static GMutex cache_lock;
+static GQueue cache_entries = G_QUEUE_INIT;
+static GstClock *cache_clock = NULL;
+static GstClockID cache_timer = NULL;
+static GQueue header_entries = G_QUEUE_INIT;
+
+static void
+gst_ce_codec_cache_init_debug (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_ce_codec_cache_debug, "ce_codeccache", 0,
+        "CE codec instance cache");
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+static void
+gst_ce_codec_cache_entry_free (GstCeCodecCacheEntry * entry)
+{
+  GST_DEBUG ("destroying idle %s instance %p", entry->codec_name,
+      entry->handle);
+
+  if (entry->handle && entry->delete_func)
+    entry->delete_func (entry->handle);
+
+  if (entry->engine)
+    Engine_close (entry->engine);
+
+  g_free (entry->codec_name);
+  g_free (entry->params);
+  g_slice_free (GstCeCodecCacheEntry, entry);
+}
+
+static gboolean gst_ce_codec_cache_timeout (GstClock * clock,
+    GstClockTime time, GstClockID id, gpointer user_data);
+
+/*
+ * Replace the timer by one for the next entry to expire. Call with the
+ * lock held and give the timers to gst_ce_codec_cache_arm() once it is
+ * released.
+ */
+static void
+gst_ce_codec_cache_schedule (GstClockID * old_timer, GstClockID * new_timer)
+{
+  GstClockTime next = GST_CLOCK_TIME_NONE;
+  GList *l;
+
+  *old_timer = cache_timer;
+  *new_timer = NULL;
+  cache_timer = NULL;
+
+  for (l = cache_entries.head; l; l = l->next) {
+    GstCeCodecCacheEntry *entry = l->data;
+
+    if (GST_CLOCK_TIME_IS_VALID (entry->expire) &&
+        (!GST_CLOCK_TIME_IS_VALID (next) || entry->expire < next))
+      next = entry->expire;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (next))
+    return;
+
+  cache_timer = gst_clock_new_single_shot_id (cache_clock, next);
+  *new_timer = gst_clock_id_ref (cache_timer);
+}
+
+/*
+ * Cancel the replaced timer and start the new one. Call without the lock,
+ * the clock may be firing the old one meanwhile. A timer replaced again
+ * before being started was already unscheduled, so it never fires.
+ */
+static void
+gst_ce_codec_cache_arm (GstClockID old_timer, GstClockID new_timer)
+{
+  if (old_timer) {
+    gst_clock_id_unschedule (old_timer);
+    gst_clock_id_unref (old_timer);
+  }
+
+  if (new_timer) {
+    gst_clock_id_wait_async (new_timer, gst_ce_codec_cache_timeout, NULL,
+        NULL);
+    gst_clock_id_unref (new_timer);
+  }
+}
+
+static gboolean
+gst_ce_codec_cache_timeout (GstClock * clock, GstClockTime time,
+    GstClockID id, gpointer user_data)
+{
+  GList *expired = NULL, *l, *next;
+  GstClockID old_timer = NULL, new_timer = NULL;
+  GstClockTime now;
+
+  g_mutex_lock (&cache_lock);
+
+  now = gst_clock_get_time (cache_clock);
+  for (l = cache_entries.head; l; l = next) {
+    GstCeCodecCacheEntry *entry = l->data;
+
+    next = l->next;
+    if (GST_CLOCK_TIME_IS_VALID (entry->expire) && entry->expire <= now) {
+      g_queue_delete_link (&cache_entries, l);
+      expired = g_list_prepend (expired, entry);
+    }
+  }
+
+  if (expired)
+    gst_ce_codec_cache_schedule (&old_timer, &new_timer);
+
+  g_mutex_unlock (&cache_lock);
+
+  gst_ce_codec_cache_arm (old_timer, new_timer);
+
+  /* Destroying a codec may take a while, don't block the cache meanwhile */
+  g_list_free_full (expired, (GDestroyNotify) gst_ce_codec_cache_entry_free);
+
+  return TRUE;
+}
+
+/**
+ * gst_ce_codec_cache_acquire:
+ * @codec_name: name of the codec on the Codec Engine
+ * @params: the static parameters the instance should be created with
+ * @params_size: size in bytes of @params
+ * @engine: (out): the engine handle the instance was created on
+ *
+ * Looks for an idle codec instance that was created with exactly the
+ * same static parameters. On success the caller takes ownership of both
+ * the codec instance and @engine.
+ *
+ * Returns: the cached codec handle or %NULL if there is none.
+ */
+gpointer
+gst_ce_codec_cache_acquire (const gchar * codec_name, gconstpointer params,
+    gsize params_size, Engine_Handle * engine)
+{
+  GstCeCodecCacheEntry *entry = NULL;
+  GstClockID old_timer = NULL, new_timer = NULL;
+  gpointer handle;
+  GList *l;
+
+  g_return_val_if_fail (codec_name, NULL);
+  g_return_val_if_fail (params, NULL);
+  g_return_val_if_fail (engine, NULL);
+
+  gst_ce_codec_cache_init_debug ();
+
+  g_mutex_lock (&cache_lock);
+
+  /* Most recently released instances are at the tail */
+  for (l = cache_entries.tail; l; l = l->prev) {
+    GstCeCodecCacheEntry *candidate = l->data;
+
+    if (candidate->params_size == params_size &&
+        !strcmp (candidate->codec_name, codec_name) &&
+        !memcmp (candidate->params, params, params_size)) {
+      entry = candidate;
+      g_queue_delete_link (&cache_entries, l);
+      gst_ce_codec_cache_schedule (&old_timer, &new_timer);
+      break;
+    }
+  }
+
+  g_mutex_unlock (&cache_lock);
+
+  gst_ce_codec_cache_arm (old_timer, new_timer);
+
+  if (!entry) {
+    GST_DEBUG ("no idle %s instance matches the parameters", codec_name);
+    return NULL;
+  }
+
+  GST_DEBUG ("reusing idle %s instance %p", codec_name, entry->handle);
+
+  *engine = entry->engine;
+  handle = entry->handle;
+
+  entry->engine = NULL;
+  entry->handle = NULL;
+  gst_ce_codec_cache_entry_free (entry);
+
+  return handle;
+}
+
+/**
+ * gst_ce_codec_cache_release:
+ * @codec_name: name of the codec on the Codec Engine
+ * @params: the static parameters the instance was created with
+ * @params_size: size in bytes of @params
+ * @engine: the engine handle the instance was created on
+ * @codec_handle: the codec instance
+ * @delete_func: function used to destroy the instance
+ * @max_idle: maximum number of idle instances to keep, 0 disables caching
+ * @idle_timeout: time to keep the instance idle, or #GST_CLOCK_TIME_NONE
+ *     to keep it until evicted or the cache is cleared
+ *
+ * Hands a codec instance and its engine handle over to the cache. If the
+ * cache is disabled both are destroyed right away.
+ */
+void
+gst_ce_codec_cache_release (const gchar * codec_name, gconstpointer params,
+    gsize params_size, Engine_Handle engine, gpointer codec_handle,
+    GstCeCodecDeleteFunc delete_func, guint max_idle,
+    GstClockTime idle_timeout)
+{
+  GstCeCodecCacheEntry *entry;
+  GstClockID old_timer = NULL, new_timer = NULL;
+  GList *evicted = NULL;
+
+  g_return_if_fail (codec_name);
+  g_return_if_fail (params);
+  g_return_if_fail (codec_handle);
+  g_return_if_fail (delete_func);
+
+  gst_ce_codec_cache_init_debug ();
+
+  entry = g_slice_new0 (GstCeCodecCacheEntry);
+  entry->codec_name = g_strdup (codec_name);
+  entry->params = g_memdup (params, params_size);
+  entry->params_size = params_size;
+  entry->engine = engine;
+  entry->handle = codec_handle;
+  entry->delete_func = delete_func;
+  entry->expire = GST_CLOCK_TIME_NONE;
+
+  if (!max_idle) {
+    gst_ce_codec_cache_entry_free (entry);
+    return;
+  }
+
+  g_mutex_lock (&cache_lock);
+
+  if (!cache_clock)
+    cache_clock = gst_system_clock_obtain ();
+
+  if (GST_CLOCK_TIME_IS_VALID (idle_timeout))
+    entry->expire = gst_clock_get_time (cache_clock) + idle_timeout;
+
+  GST_DEBUG ("parking idle %s instance %p", codec_name, codec_handle);
+  g_queue_push_tail (&cache_entries, entry);
+
+  while (g_queue_get_length (&cache_entries) > max_idle)
+    evicted = g_list_prepend (evicted, g_queue_pop_head (&cache_entries));
+
+  gst_ce_codec_cache_schedule (&old_timer, &new_timer);
+
+  g_mutex_unlock (&cache_lock);
+
+  gst_ce_codec_cache_arm (old_timer, new_timer);
+
+  g_list_free_full (evicted, (GDestroyNotify) gst_ce_codec_cache_entry_free);
+}
+
+static void
+gst_ce_header_cache_entry_free (GstCeHeaderCacheEntry * entry)
+{
+  gst_buffer_unref (entry->header);
+  g_free (entry->codec_name);
+  g_free (entry->key);
+  g_slice_free (GstCeHeaderCacheEntry, entry);
+}
+
+/**
+ * gst_ce_codec_cache_lookup_header:
+ * @codec_name: name of the codec on the Codec Engine
+ * @key: the parameters the header depends on
+ * @key_size: size in bytes of @key
+ *
+ * Looks for a stream header generated with exactly the same parameters.
+ *
+ * Returns: (transfer full): the header or %NULL if there is none.
+ */
+GstBuffer *
+gst_ce_codec_cache_lookup_header (const gchar * codec_name,
+    gconstpointer key, gsize key_size)
+{
+  GstBuffer *header = NULL;
+  GList *l;
+
+  g_return_val_if_fail (codec_name, NULL);
+  g_return_val_if_fail (key, NULL);
+
+  gst_ce_codec_cache_init_debug ();
+
+  g_mutex_lock (&cache_lock);
+
+  for (l = header_entries.tail; l; l = l->prev) {
+    GstCeHeaderCacheEntry *entry = l->data;
+
+    if (entry->key_size == key_size &&
+        !strcmp (entry->codec_name, codec_name) &&
+        !memcmp (entry->key, key, key_size)) {
+      header = gst_buffer_ref (entry->header);
+      /* Keep the most recently used headers at the tail */
+      g_queue_unlink (&header_entries, l);
+      g_queue_push_tail_link (&header_entries, l);
+      break;
+    }
+  }
+
+  g_mutex_unlock (&cache_lock);
+
+  GST_DEBUG ("%s header %sfound", codec_name, header ? "" : "not ");
+
+  return header;
+}
+
+/**
+ * gst_ce_codec_cache_store_header:
+ * @codec_name: name of the codec on the Codec Engine
+ * @key: the parameters the header depends on
+ * @key_size: size in bytes of @key
+ * @header: the generated header, it must not be modified afterwards
+ *
+ * Keeps a stream header for later lookups, evicting the least recently
+ * used one when the cache is full.
+ */
+void
+gst_ce_codec_cache_store_header (const gchar * codec_name,
+    gconstpointer key, gsize key_size, GstBuffer * header)
+{
+  GstCeHeaderCacheEntry *entry, *evicted = NULL;
+
+  g_return_if_fail (codec_name);
+  g_return_if_fail (key);
+  g_return_if_fail (GST_IS_BUFFER (header));
+
+  gst_ce_codec_cache_init_debug ();
+
+  entry = g_slice_new0 (GstCeHeaderCacheEntry);
+  entry->codec_name = g_strdup (codec_name);
+  entry->key = g_memdup (key, key_size);
+  entry->key_size = key_size;
+  entry->header = gst_buffer_ref (header);
+
+  g_mutex_lock (&cache_lock);
+
+  GST_DEBUG ("storing %s header of %" G_GSIZE_FORMAT " bytes", codec_name,
+      gst_buffer_get_size (header));
+  g_queue_push_tail (&header_entries, entry);
+
+  if (g_queue_get_length (&header_entries) > HEADER_CACHE_SIZE)
+    evicted = g_queue_pop_head (&header_entries);
+
+  g_mutex_unlock (&cache_lock);
+
+  if (evicted)
+    gst_ce_header_cache_entry_free (evicted);
+}
+
+/**
+ * gst_ce_codec_cache_clear:
+ *
+ * Destroys all the idle codec instances, the ones kept without a timeout
+ * included, and drops the cached stream headers. Meant to run when the
+ * process exits, after the last element is gone.
+ */
+void
+gst_ce_codec_cache_clear (void)
+{
+  GstClockID old_timer = NULL;
+  GList *entries, *headers;
+
+  gst_ce_codec_cache_init_debug ();
+
+  g_mutex_lock (&cache_lock);
+
+  entries = cache_entries.head;
+  g_queue_init (&cache_entries);
+  headers = header_entries.head;
+  g_queue_init (&header_entries);
+
+  old_timer = cache_timer;
+  cache_timer = NULL;
+
+  g_mutex_unlock (&cache_lock);
+
+  gst_ce_codec_cache_arm (old_timer, NULL);
+
+  GST_DEBUG ("clearing %u idle instances", g_list_length (entries));
+  g_list_free_full (entries, (GDestroyNotify) gst_ce_codec_cache_entry_free);
+  g_list_free_full (headers, (GDestroyNotify) gst_ce_header_cache_entry_free);
+}
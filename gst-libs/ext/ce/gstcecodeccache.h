@@ -0,0 +1,56 @@
+/*
+ * gstcecodeccache.h
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifndef __GST_CE_CODEC_CACHE_H__
+#define __GST_CE_CODEC_CACHE_H__
+
+#include <gst/gst.h>
+#include <xdc/std.h>
+#include <ti/sdo/ce/Engine.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstCeCodecDeleteFunc:
+ * @codec_handle: the codec instance to destroy
+ *
+ * Function used by the cache to destroy an idle codec instance,
+ * i.e. VIDENC1_delete() or IMGENC1_delete().
+ */
+typedef void (*GstCeCodecDeleteFunc) (gpointer codec_handle);
+
+gpointer gst_ce_codec_cache_acquire (const gchar * codec_name,
+    gconstpointer params, gsize params_size, Engine_Handle * engine);
+
+void gst_ce_codec_cache_release (const gchar * codec_name,
+    gconstpointer params, gsize params_size, Engine_Handle engine,
+    gpointer codec_handle, GstCeCodecDeleteFunc delete_func,
+    guint max_idle, GstClockTime idle_timeout);
+
+GstBuffer *gst_ce_codec_cache_lookup_header (const gchar * codec_name,
+    gconstpointer key, gsize key_size);
+
+void gst_ce_codec_cache_store_header (const gchar * codec_name,
+    gconstpointer key, gsize key_size, GstBuffer * header);
+
+void gst_ce_codec_cache_clear (void);
+
+G_END_DECLS
+#endif /*__GST_CE_CODEC_CACHE_H__*/
@@ -0,0 +1,391 @@
+/*
+ * gstceconvert.c
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+/*
+ * Conversion of the layouts the codecs can't read into the ones they can.
+ *
+ * The codecs only take NV12 and UYVY, but software sources and decoders
+ * mostly produce planar I420/YV12 or YUY2. The encoders convert them while
+ * copying the frame into their contiguous staging buffer, so the frame is
+ * read and written once. None of the conversions compute anything, they
+ * only move bytes around: the chroma planes are interleaved, the bytes of
+ * YUY2 are swapped, or its lumas and chromas are split. NEON does 16
+ * pixels at a time with its interleaving loads and stores when the
+ * compiler targets it, otherwise the bytes are moved a word at a time
+ * where the alignment allows it.
+ *
+ * The thumbnails are the exception, they are scaled down by averaging
+ * boxes of samples in plain C. They are small and encoded on the side.
+ */
+
+#include <string.h>
+#include "gstceconvert.h"
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#else
+#define IS_WORD_ALIGNED(p) (((gsize) (p) & 3) == 0)
+#endif
+
+/* The conversions the encoders know, by order of preference */
+static const struct
+{
+  GstVideoFormat in;
+  GstVideoFormat out;
+} conversions[] = {
+  {GST_VIDEO_FORMAT_I420, GST_VIDEO_FORMAT_NV12},
+  {GST_VIDEO_FORMAT_YV12, GST_VIDEO_FORMAT_NV12},
+  {GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_UYVY},
+  {GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_NV12},
+};
+
+/*
+ * gst_ce_convert_interleave
+ *
+ * Interleaves n samples of the u and v chroma rows into the uv row.
+ */
+static void
+gst_ce_convert_interleave (guint8 * uv, const guint8 * u, const guint8 * v,
+    gint n)
+{
+  gint i = 0;
+
+#if defined (CONVERT_NEON)
+  uint8x16x2_t pairs;
+
+  for (; i + 16 <= n; i += 16) {
+    pairs.val[0] = vld1q_u8 (u + i);
+    pairs.val[1] = vld1q_u8 (v + i);
+    vst2q_u8 (uv + 2 * i, pairs);
+  }
+#else
+  if (IS_WORD_ALIGNED (uv)) {
+    for (; i + 2 <= n; i += 2)
+      *(guint32 *) (uv + 2 * i) = GUINT32_TO_LE (u[i] | v[i] << 8 |
+          u[i + 1] << 16 | (guint32) v[i + 1] << 24);
+  }
+#endif
+
+  for (; i < n; i++) {
+    uv[2 * i] = u[i];
+    uv[2 * i + 1] = v[i];
+  }
+}
+
+/*
+ * gst_ce_convert_swap
+ *
+ * Swaps the bytes of each of the n / 2 pairs of bytes at src into dest,
+ * which turns YUY2 into UYVY.
+ */
+static void
+gst_ce_convert_swap (guint8 * dest, const guint8 * src, gint n)
+{
+  gint i = 0;
+
+#if defined (CONVERT_NEON)
+  for (; i + 16 <= n; i += 16)
+    vst1q_u8 (dest + i, vrev16q_u8 (vld1q_u8 (src + i)));
+#else
+  guint32 word;
+
+  /* The same for both byte orders, the pairs are swapped in place */
+  if (IS_WORD_ALIGNED (dest) && IS_WORD_ALIGNED (src)) {
+    for (; i + 4 <= n; i += 4) {
+      word = *(const guint32 *) (src + i);
+      *(guint32 *) (dest + i) = ((word & 0x00ff00ff) << 8) |
+          ((word >> 8) & 0x00ff00ff);
+    }
+  }
+#endif
+
+  for (; i + 2 <= n; i += 2) {
+    dest[i] = src[i + 1];
+    dest[i + 1] = src[i];
+  }
+}
+
+/*
+ * gst_ce_convert_split
+ *
+ * Splits the n pixels of a YUY2 row into its lumas and, unless uv is
+ * NULL, its interleaved chromas, which are already in the NV12 order.
+ * n is even.
+ */
+static void
+gst_ce_convert_split (guint8 * y, guint8 * uv, const guint8 * src, gint n)
+{
+  gint i = 0;
+
+#if defined (CONVERT_NEON)
+  uint8x16x2_t pixels;
+
+  for (; i + 16 <= n; i += 16) {
+    pixels = vld2q_u8 (src + 2 * i);
+    vst1q_u8 (y + i, pixels.val[0]);
+    if (uv)
+      vst1q_u8 (uv + i, pixels.val[1]);
+  }
+#endif
+
+  for (; i + 2 <= n; i += 2) {
+    y[i] = src[2 * i];
+    y[i + 1] = src[2 * i + 2];
+    if (uv) {
+      uv[i] = src[2 * i + 1];
+      uv[i + 1] = src[2 * i + 3];
+    }
+  }
+}
+
+static void
+gst_ce_convert_planar (GstVideoFrame * dest, GstVideoFrame * src,
+    gint width, gint height)
+{
+  guint8 *d, *s, *u, *v;
+  gint dstride, sstride, ustride, vstride;
+  gint i;
+
+  d = GST_VIDEO_FRAME_PLANE_DATA (dest, 0);
+  s = GST_VIDEO_FRAME_PLANE_DATA (src, 0);
+  dstride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, 0);
+  sstride = GST_VIDEO_FRAME_PLANE_STRIDE (src, 0);
+
+  for (i = 0; i < height; i++)
+    memcpy (d + i * dstride, s + i * sstride, width);
+
+  /* The components, unlike the planes, are U and V for YV12 as well */
+  d = GST_VIDEO_FRAME_PLANE_DATA (dest, 1);
+  dstride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, 1);
+  u = GST_VIDEO_FRAME_COMP_DATA (src, 1);
+  v = GST_VIDEO_FRAME_COMP_DATA (src, 2);
+  ustride = GST_VIDEO_FRAME_COMP_STRIDE (src, 1);
+  vstride = GST_VIDEO_FRAME_COMP_STRIDE (src, 2);
+
+  for (i = 0; i < (height + 1) / 2; i++)
+    gst_ce_convert_interleave (d + i * dstride, u + i * ustride,
+        v + i * vstride, (width + 1) / 2);
+}
+
+static void
+gst_ce_convert_packed (GstVideoFrame * dest, GstVideoFrame * src,
+    gint width, gint height)
+{
+  guint8 *d, *uv, *s;
+  gint dstride, uvstride, sstride;
+  gint i;
+
+  s = GST_VIDEO_FRAME_PLANE_DATA (src, 0);
+  sstride = GST_VIDEO_FRAME_PLANE_STRIDE (src, 0);
+  d = GST_VIDEO_FRAME_PLANE_DATA (dest, 0);
+  dstride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, 0);
+  width = GST_ROUND_UP_2 (width);
+
+  if (GST_VIDEO_FRAME_FORMAT (dest) == GST_VIDEO_FORMAT_UYVY) {
+    for (i = 0; i < height; i++)
+      gst_ce_convert_swap (d + i * dstride, s + i * sstride, width * 2);
+    return;
+  }
+
+  /* NV12 keeps the chromas of the even rows only */
+  uv = GST_VIDEO_FRAME_PLANE_DATA (dest, 1);
+  uvstride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, 1);
+
+  for (i = 0; i < height; i++)
+    gst_ce_convert_split (d + i * dstride,
+        i & 1 ? NULL : uv + i / 2 * uvstride, s + i * sstride, width);
+}
+
+/*
+ * gst_ce_convert_box
+ *
+ * Averages boxes of fx by fy samples of one component of s into the
+ * width by height samples of d. The strides between samples are given
+ * apart, so packed components are scaled in place.
+ */
+static void
+gst_ce_convert_box (guint8 * d, gint dstride, gint dpstride,
+    const guint8 * s, gint sstride, gint spstride, gint width, gint height,
+    gint fx, gint fy)
+{
+  const guint8 *row;
+  guint sum, n = fx * fy;
+  gint x, y, i, j;
+
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      sum = 0;
+      for (j = 0; j < fy; j++) {
+        row = s + (y * fy + j) * sstride + x * fx * spstride;
+        for (i = 0; i < fx; i++)
+          sum += row[i * spstride];
+      }
+      d[y * dstride + x * dpstride] = (sum + n / 2) / n;
+    }
+  }
+}
+
+/**
+ * gst_ce_convert_get_format:
+ * @format: the format of the input frames
+ * @caps: the caps with the formats the codec reads
+ *
+ * Picks the format among the ones in @caps that the frames in @format are
+ * converted into, the first of NV12 or UYVY that can be reached.
+ *
+ * Returns: @format if the codec reads it already, the format to convert
+ * into or %GST_VIDEO_FORMAT_UNKNOWN if there is no conversion
+ */
+GstVideoFormat
+gst_ce_convert_get_format (GstVideoFormat format, GstCaps * caps)
+{
+  GstVideoFormat out = GST_VIDEO_FORMAT_UNKNOWN;
+  GstCaps *format_caps;
+  guint i;
+
+  if (format == GST_VIDEO_FORMAT_NV12 || format == GST_VIDEO_FORMAT_UYVY)
+    return format;
+
+  for (i = 0; i < G_N_ELEMENTS (conversions); i++) {
+    if (conversions[i].in != format)
+      continue;
+
+    format_caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING,
+        gst_video_format_to_string (conversions[i].out), NULL);
+    if (gst_caps_can_intersect (caps, format_caps))
+      out = conversions[i].out;
+    gst_caps_unref (format_caps);
+
+    if (out != GST_VIDEO_FORMAT_UNKNOWN)
+      break;
+  }
+
+  return out;
+}
+
+/**
+ * gst_ce_convert_frame:
+ * @dest: the frame to write
+ * @src: the frame to read
+ *
+ * Copies @src into @dest, converting it on the way if their formats
+ * differ. The frames are expected to have the same size, otherwise the
+ * top left corner they share is converted.
+ *
+ * Returns: %TRUE unless the formats have no conversion
+ */
+gboolean
+gst_ce_convert_frame (GstVideoFrame * dest, GstVideoFrame * src)
+{
+  GstVideoFormat in, out;
+  gint width, height;
+
+  g_return_val_if_fail (dest, FALSE);
+  g_return_val_if_fail (src, FALSE);
+
+  in = GST_VIDEO_FRAME_FORMAT (src);
+  out = GST_VIDEO_FRAME_FORMAT (dest);
+
+  if (in == out)
+    return gst_video_frame_copy (dest, src);
+
+  width = MIN (GST_VIDEO_FRAME_WIDTH (dest), GST_VIDEO_FRAME_WIDTH (src));
+  height = MIN (GST_VIDEO_FRAME_HEIGHT (dest), GST_VIDEO_FRAME_HEIGHT (src));
+
+  switch (in) {
+    case GST_VIDEO_FORMAT_I420:
+    case GST_VIDEO_FORMAT_YV12:
+      if (out != GST_VIDEO_FORMAT_NV12)
+        return FALSE;
+      gst_ce_convert_planar (dest, src, width, height);
+      return TRUE;
+    case GST_VIDEO_FORMAT_YUY2:
+      if (out != GST_VIDEO_FORMAT_UYVY && out != GST_VIDEO_FORMAT_NV12)
+        return FALSE;
+      gst_ce_convert_packed (dest, src, width, height);
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/**
+ * gst_ce_convert_downscale:
+ * @dest: the frame to write
+ * @src: the frame to read
+ *
+ * Scales @src down into @dest, both in the same 8 bits format. Each
+ * sample of @dest is the average of a box of samples of @src, whose size
+ * is the integer ratio between the frame sizes. The right and bottom
+ * edges of @src that don't fill a box are left out.
+ *
+ * Returns: %TRUE unless the frames can't be scaled
+ */
+gboolean
+gst_ce_convert_downscale (GstVideoFrame * dest, GstVideoFrame * src)
+{
+  gint fx, fy, c;
+
+  g_return_val_if_fail (dest, FALSE);
+  g_return_val_if_fail (src, FALSE);
+
+  if (GST_VIDEO_FRAME_FORMAT (dest) != GST_VIDEO_FRAME_FORMAT (src))
+    return FALSE;
+
+  fx = GST_VIDEO_FRAME_WIDTH (src) / GST_VIDEO_FRAME_WIDTH (dest);
+  fy = GST_VIDEO_FRAME_HEIGHT (src) / GST_VIDEO_FRAME_HEIGHT (dest);
+  if (!fx || !fy)
+    return FALSE;
+
+  for (c = 0; c < GST_VIDEO_FRAME_N_COMPONENTS (dest); c++)
+    if (GST_VIDEO_FRAME_COMP_DEPTH (dest, c) != 8)
+      return FALSE;
+
+  /* The subsampled components are scaled by the same factors */
+  for (c = 0; c < GST_VIDEO_FRAME_N_COMPONENTS (dest); c++)
+    gst_ce_convert_box (GST_VIDEO_FRAME_COMP_DATA (dest, c),
+        GST_VIDEO_FRAME_COMP_STRIDE (dest, c),
+        GST_VIDEO_FRAME_COMP_PSTRIDE (dest, c),
+        GST_VIDEO_FRAME_COMP_DATA (src, c),
+        GST_VIDEO_FRAME_COMP_STRIDE (src, c),
+        GST_VIDEO_FRAME_COMP_PSTRIDE (src, c),
+        MIN (GST_VIDEO_FRAME_COMP_WIDTH (dest, c),
+            GST_VIDEO_FRAME_COMP_WIDTH (src, c) / fx),
+        MIN (GST_VIDEO_FRAME_COMP_HEIGHT (dest, c),
+            GST_VIDEO_FRAME_COMP_HEIGHT (src, c) / fy), fx, fy);
+
+  return TRUE;
+}
+
+/**
+ * gst_ce_convert_impl:
+ *
+ * Returns: the name of the kernels the conversions were built with
+ */
+const gchar *
+gst_ce_convert_impl (void)
+{
+#if defined (CONVERT_NEON)
+  return "neon";
+#else
+  return "word";
+#endif
+}
@@ -0,0 +1,39 @@
+/*
+ * gstceconvert.h
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifndef __GST_CE_CONVERT_H__
+#define __GST_CE_CONVERT_H__
+
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+GstVideoFormat gst_ce_convert_get_format (GstVideoFormat format,
+    GstCaps * caps);
+
+gboolean gst_ce_convert_frame (GstVideoFrame * dest, GstVideoFrame * src);
+
+gboolean gst_ce_convert_downscale (GstVideoFrame * dest,
+    GstVideoFrame * src);
+
+const gchar *gst_ce_convert_impl (void);
+
+G_END_DECLS
+#endif /*__GST_CE_CONVERT_H__*/
@@ -49,6 +49,9 @@
 #include <ext/cmem/gstceslicepool.h>
 
 #include "gstceimgenc.h"
+#include "gstceconvert.h"
+#include "gstcestats.h"
+#include "gstcestaticscene.h"
 
 #include <ti/sdo/ce/osal/Memory.h>
 
@@ -60,12 +63,90 @@ enum
   PROP_0,
   PROP_QUALITY_VALUE,
   PROP_NUM_OUT_BUFFERS,
-  PROP_MIN_SIZE_PERCENTAGE
+  PROP_MIN_SIZE_PERCENTAGE,
+  PROP_ENABLE_STATS,
+  PROP_STATS,
+  PROP_LOW_LATENCY,
+  PROP_SKIP_STATIC,
+  PROP_STATIC_THRESHOLD,
+  PROP_STATIC_MAX_SKIP,
+  PROP_MAX_FRAMERATE,
+  PROP_TARGET_BITRATE,
+  PROP_FRAME_BUDGET,
+  PROP_MIN_QUALITY,
+  PROP_MAX_QUALITY_STEP,
+  PROP_SNAPSHOT,
+  PROP_TILE_HEIGHT,
+  PROP_THUMBNAIL_FACTOR,
+  PROP_N_INSTANCES
 };
 
 #define PROP_QUALITY_VALUE_DEFAULT            75
 #define PROP_NUM_OUT_BUFFERS_DEFAULT          3
 #define PROP_MIN_SIZE_PERCENTAGE_DEFAULT      100
+#define PROP_ENABLE_STATS_DEFAULT             FALSE
+#define PROP_LOW_LATENCY_DEFAULT              FALSE
+#define PROP_SKIP_STATIC_DEFAULT              FALSE
+#define PROP_STATIC_THRESHOLD_DEFAULT         0
+#define PROP_STATIC_MAX_SKIP_DEFAULT          30
+#define PROP_MAX_FRAMERATE_N_DEFAULT          0
+#define PROP_MAX_FRAMERATE_D_DEFAULT          1
+#define PROP_TARGET_BITRATE_DEFAULT           0
+#define PROP_FRAME_BUDGET_DEFAULT             0
+#define PROP_MIN_QUALITY_DEFAULT              20
+#define PROP_MAX_QUALITY_STEP_DEFAULT         5
+#define PROP_SNAPSHOT_DEFAULT                 FALSE
+#define PROP_TILE_HEIGHT_DEFAULT              0
+#define PROP_THUMBNAIL_FACTOR_DEFAULT         4
+#define PROP_N_INSTANCES_DEFAULT              1
+
+/* Rows of a JPEG MCU, tiles must hold whole MCU rows */
+#define TILE_ROWS_ALIGN 16
+
+enum
+{
+  SIGNAL_SNAPSHOT,
+  LAST_SIGNAL
+};
+
+static guint gst_ce_imgenc_signals[LAST_SIGNAL] = { 0 };
+
+/* Images averaged before each quality update of the rate control */
+#define RATE_CONTROL_WINDOW 4
+/* Deviation from the budget the rate control lives with, in percent */
+#define RATE_CONTROL_DEAD_BAND 10
+
+/* An image on its way through the codec */
+typedef struct _GstCeImgEncJob
+{
+  GstVideoCodecFrame *frame;
+  GstBuffer *staging;
+  GstBuffer *outbuf;
+  GstMapInfo info_out;
+  XDAS_Int8 *planes[GST_VIDEO_MAX_PLANES];
+  gint strides[GST_VIDEO_MAX_PLANES];
+  gsize bytes;
+  GstClockTime duration;
+  XDAS_Int32 error;
+  gboolean done;
+  gboolean failed;
+  gboolean dropped;
+} GstCeImgEncJob;
+
+/* A codec instance encoding images in its own thread */
+typedef struct _GstCeImgEncWorker
+{
+  GstCeImgEnc *ce_imgenc;
+  guint index;
+  GThread *thread;
+  GAsyncQueue *queue;
+  Engine_Handle engine_handle;
+  IMGENC1_Handle codec_handle;
+  IMGENC1_DynamicParams *dyn_params;
+  guint dyn_params_serial;
+  XDM1_BufDesc inbuf_desc;
+  XDM1_BufDesc outbuf_desc;
+} GstCeImgEncWorker;
 
 #define GST_CE_IMGENC_GET_PRIVATE(obj)  \
     (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GST_TYPE_CE_IMGENC, GstCeImgEncPrivate))
@@ -79,6 +160,21 @@ struct _GstCeImgEncPrivate
   gint32 frame_height;
   gint32 frame_pitch;
 
+  /* Tiled encoding, in horizontal strips of tile_rows, for the images
+   * taller than max_height or tile_height */
+  guint max_height;
+  guint tile_height;
+  gint tile_rows;
+  guint n_tiles;
+
+  /* Frame rate decimation */
+  gint max_fps_num;
+  gint max_fps_den;
+  GstClockTime decimate_period;
+  GstClockTime decimate_next;
+  gint fps_num;
+  gint fps_den;
+
   gint32 outbuf_size;
   guint outbuf_size_percentage;
   gint num_out_buffers;
@@ -92,10 +188,81 @@ struct _GstCeImgEncPrivate
   GstAllocator *allocator;
   GstAllocationParams alloc_params;
 
+  /* Copies of the frames the codec can't read in place, converted to the
+   * codec format if the input has another one */
+  GstVideoInfo staging_info;
+  GstBufferPool *staging_pool;
+  const gchar *staging_reason;
+
   /* Codec Data */
   Engine_Handle engine_handle;
   XDM1_BufDesc inbuf_desc;
   XDM1_BufDesc outbuf_desc;
+
+  /* codec_dyn_params changed since they were last given to the codec */
+  gboolean dyn_params_pending;
+  /* Counts the times they were given, for the workers to catch up */
+  guint dyn_params_serial;
+  /* Snapshot of codec_dyn_params the current image is encoded with, the
+   * codec calls are made with it without the object lock and the tiles
+   * only change its height */
+  IMGENC1_DynamicParams *dyn_params_copy;
+
+  /* Encoding time statistics */
+  GstCeStats *stats;
+  gboolean stats_enabled;
+
+  /* Reported latency */
+  GstCeLatency latency;
+  gboolean low_latency;
+  gboolean latency_reported_low;
+
+  /* Static scene skipping */
+  gboolean skip_static;
+  guint static_threshold;
+  guint static_max_skip;
+  guint static_skipped;
+  GstCeStaticScene static_scene;
+
+  /* Rate control, quality is the value set by the user */
+  gint quality;
+  guint target_bitrate;
+  guint frame_budget;
+  gint min_quality;
+  guint max_quality_step;
+  guint64 rc_bytes;
+  guint rc_frames;
+
+  /* Snapshot mode, the held frame is encoded when a snapshot is taken */
+  gboolean snapshot;
+  GstVideoCodecFrame *snapshot_frame;
+  guint snapshot_burst;
+  gboolean snapshot_capture;
+  GstBuffer *snapshot_buffer;
+
+  /* Thumbnail pad, a second codec encodes the input scaled down
+   * thumb_factor times into thumb_inbuf */
+  GstPad *thumb_pad;
+  guint thumb_factor;
+  gboolean thumb_segment_pending;
+  GstVideoInfo thumb_info;
+  GstBuffer *thumb_inbuf;
+  IMGENC1_Handle thumb_handle;
+  IMGENC1_Params *thumb_params;
+  IMGENC1_DynamicParams *thumb_dyn_params;
+  XDM1_BufDesc thumb_inbuf_desc;
+  XDM1_BufDesc thumb_outbuf_desc;
+  gsize thumb_outbuf_size;
+
+  /* Parallel encoding, the jobs in flight are kept in input order */
+  guint n_instances;
+  GstCeImgEncWorker **workers;
+  guint n_workers;
+  guint next_worker;
+  guint max_jobs;
+  GQueue jobs;
+  GMutex jobs_lock;
+  GCond jobs_cond;
 };
 
 /* A number of function prototypes are given so we can refer to them later */
@@ -110,6 +277,22 @@ static gboolean gst_ce_imgenc_decide_allocation (GstVideoEncoder * encoder,
     GstQuery * query);
 static GstFlowReturn gst_ce_imgenc_handle_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame);
+static GstFlowReturn gst_ce_imgenc_finish (GstVideoEncoder * encoder);
+static gboolean gst_ce_imgenc_sink_event (GstVideoEncoder * encoder,
+    GstEvent * event);
+static gboolean gst_ce_imgenc_src_event (GstVideoEncoder * encoder,
+    GstEvent * event);
+static GstSample *gst_ce_imgenc_snapshot (GstCeImgEnc * ce_imgenc,
+    guint frames);
+static GstPad *gst_ce_imgenc_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_ce_imgenc_release_pad (GstElement * element, GstPad * pad);
+static void gst_ce_imgenc_close_thumbnail (GstCeImgEnc * ce_imgenc);
+static gboolean gst_ce_imgenc_start_workers (GstCeImgEnc * ce_imgenc);
+static void gst_ce_imgenc_stop_workers (GstCeImgEnc * ce_imgenc);
+static GstFlowReturn gst_ce_imgenc_finish_jobs (GstCeImgEnc * ce_imgenc,
+    guint max_jobs);
+static void gst_ce_imgenc_drop_jobs (GstCeImgEnc * ce_imgenc);
 
 static void gst_ce_imgenc_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
@@ -117,8 +300,14 @@ static void gst_ce_imgenc_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
 static gboolean gst_ce_imgenc_reset (GstVideoEncoder * encoder);
 static void gst_ce_imgenc_finalize (GObject * object);
-static gboolean gst_ce_imgenc_set_dynamic_params (GstCeImgEnc * ce_imgenc);
-static gboolean gst_ce_imgenc_get_buffer_info (GstCeImgEnc * ce_imgenc);
+static IMGENC1_DynamicParams *gst_ce_imgenc_copy_dynamic_params (GstCeImgEnc *
+    ce_imgenc);
+static gboolean gst_ce_imgenc_set_dynamic_params (GstCeImgEnc * ce_imgenc,
+    IMGENC1_DynamicParams * dyn_params);
+static gboolean gst_ce_imgenc_get_buffer_info (GstCeImgEnc * ce_imgenc,
+    IMGENC1_DynamicParams * dyn_params);
+static gboolean gst_ce_imgenc_set_tiling (GstCeImgEnc * ce_imgenc);
+static void gst_ce_imgenc_free_staging (GstCeImgEnc * ce_imgenc);
 
 #define gst_ce_imgenc_parent_class parent_class
 G_DEFINE_TYPE (GstCeImgEnc, gst_ce_imgenc, GST_TYPE_VIDEO_ENCODER);
@@ -130,9 +319,11 @@ static void
 gst_ce_imgenc_class_init (GstCeImgEncClass * klass)
 {
   GObjectClass *gobject_class;
+  GstElementClass *element_class;
   GstVideoEncoderClass *venc_class;
 
   gobject_class = G_OBJECT_CLASS (klass);
+  element_class = GST_ELEMENT_CLASS (klass);
   venc_class = GST_VIDEO_ENCODER_CLASS (klass);
 
   GST_DEBUG_CATEGORY_INIT (gst_ce_imgenc_debug, "ce_imgenc", 0,
@@ -164,11 +355,136 @@ gst_ce_imgenc_class_init (GstCeImgEncClass * klass)
           "ensure the encoder will compress the data enough to fit in the smaller buffer "
           "and you don't want to drop buffers",
           10, 100, PROP_MIN_SIZE_PERCENTAGE_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_ENABLE_STATS,
+      g_param_spec_boolean ("enable-stats",
+          "Enable statistics",
+          "Time each phase of the encoding process, enabling them "
+          "resets the statistics",
+          PROP_ENABLE_STATS_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats",
+          "Statistics",
+          "Minimum, average, maximum and 99th percentile time in "
+          "nanoseconds spent on each phase of the encoding process",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency",
+          "Low latency",
+          "Report a maximum latency equal to the encoding latency, so no "
+          "buffering is added behind the encoder",
+          PROP_LOW_LATENCY_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_SKIP_STATIC,
+      g_param_spec_boolean ("skip-static",
+          "Skip static scenes",
+          "Drop the images that did not change since the last encoded one "
+          "and send a gap event in their place",
+          PROP_SKIP_STATIC_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_STATIC_THRESHOLD,
+      g_param_spec_uint ("static-threshold",
+          "Static scene threshold",
+          "Number of the sampled luma points that may change in an image "
+          "still considered static",
+          0, GST_CE_STATIC_SCENE_GRID * GST_CE_STATIC_SCENE_GRID,
+          PROP_STATIC_THRESHOLD_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_STATIC_MAX_SKIP,
+      g_param_spec_uint ("static-max-skip",
+          "Static scene maximum consecutive drops",
+          "Encode an image after dropping this many consecutive static "
+          "images (0 = unlimited)",
+          0, G_MAXUINT, PROP_STATIC_MAX_SKIP_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAMERATE,
+      gst_param_spec_fraction ("max-framerate",
+          "Maximum frame rate",
+          "Drop the input images that exceed this frame rate, based on "
+          "their timestamps (0/1 = no limit). Takes effect on the next "
+          "negotiation",
+          0, 1, G_MAXINT, 1, PROP_MAX_FRAMERATE_N_DEFAULT,
+          PROP_MAX_FRAMERATE_D_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_TARGET_BITRATE,
+      g_param_spec_uint ("target-bitrate",
+          "Target bitrate",
+          "Lower the quality of the images below quality-value as needed "
+          "to meet this bit rate at the negotiated frame rate "
+          "(0 = fixed quality)",
+          0, G_MAXUINT, PROP_TARGET_BITRATE_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_FRAME_BUDGET,
+      g_param_spec_uint ("frame-budget",
+          "Frame budget",
+          "Lower the quality of the images below quality-value as needed "
+          "to meet this size in bytes, takes precedence over "
+          "target-bitrate (0 = disabled)",
+          0, G_MAXUINT, PROP_FRAME_BUDGET_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_MIN_QUALITY,
+      g_param_spec_int ("min-quality",
+          "Minimum quality",
+          "Lowest quality factor the rate control may use", 2, 97,
+          PROP_MIN_QUALITY_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_MAX_QUALITY_STEP,
+      g_param_spec_uint ("max-quality-step",
+          "Maximum quality step",
+          "Largest change of the quality factor the rate control makes "
+          "at once", 1, 95, PROP_MAX_QUALITY_STEP_DEFAULT,
+          G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_SNAPSHOT,
+      g_param_spec_boolean ("snapshot",
+          "Snapshot mode",
+          "Only hold on to the latest input image, and encode it when a "
+          "snapshot is taken with the snapshot signal or event",
+          PROP_SNAPSHOT_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_TILE_HEIGHT,
+      g_param_spec_uint ("tile-height",
+          "Tile height",
+          "Encode the images in horizontal strips of this many rows, "
+          "rounded down to a multiple of 16 (0 = only the images taller "
+          "than the codec takes). Takes effect on the next negotiation",
+          0, G_MAXUINT16, PROP_TILE_HEIGHT_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_THUMBNAIL_FACTOR,
+      g_param_spec_uint ("thumbnail-factor",
+          "Thumbnail factor",
+          "Scale the images of the thumbnail pad down by this factor in "
+          "both dimensions. Takes effect on the next negotiation",
+          2, 16, PROP_THUMBNAIL_FACTOR_DEFAULT, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_N_INSTANCES,
+      g_param_spec_uint ("n-instances",
+          "Number of codec instances",
+          "Encode consecutive images in parallel with this many codec "
+          "instances, trading latency for throughput (1 = serial). The "
+          "images in flight are limited to num-out-buffers - 1, and tiled "
+          "images are always encoded serially. Takes effect on the next "
+          "negotiation",
+          1, 8, PROP_N_INSTANCES_DEFAULT, G_PARAM_READWRITE));
+
+  /**
+   * GstCeImgEnc::snapshot:
+   * @ce_imgenc: the image encoder
+   * @frames: number of consecutive images to encode, 0 is taken as 1
+   *
+   * Encodes the latest input image held in snapshot mode and pushes it on
+   * the src pad, followed by the next @frames - 1 images. If no image was
+   * held yet, the burst starts with the next one.
+   *
+   * Returns: a #GstSample with the first encoded image, or %NULL if it
+   * was not encoded right away.
+   */
+  gst_ce_imgenc_signals[SIGNAL_SNAPSHOT] =
+      g_signal_new ("snapshot", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstCeImgEncClass, snapshot), NULL, NULL,
+      g_cclosure_marshal_generic, GST_TYPE_SAMPLE, 1, G_TYPE_UINT);
+
+  klass->snapshot = gst_ce_imgenc_snapshot;
+
+  element_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_ce_imgenc_request_new_pad);
+  element_class->release_pad = GST_DEBUG_FUNCPTR (gst_ce_imgenc_release_pad);
 
   venc_class->open = GST_DEBUG_FUNCPTR (gst_ce_imgenc_open);
   venc_class->close = GST_DEBUG_FUNCPTR (gst_ce_imgenc_close);
   venc_class->stop = GST_DEBUG_FUNCPTR (gst_ce_imgenc_stop);
   venc_class->handle_frame = GST_DEBUG_FUNCPTR (gst_ce_imgenc_handle_frame);
+  venc_class->finish = GST_DEBUG_FUNCPTR (gst_ce_imgenc_finish);
+  venc_class->sink_event = GST_DEBUG_FUNCPTR (gst_ce_imgenc_sink_event);
+  venc_class->src_event = GST_DEBUG_FUNCPTR (gst_ce_imgenc_src_event);
   venc_class->set_format = GST_DEBUG_FUNCPTR (gst_ce_imgenc_set_format);
   venc_class->propose_allocation =
       GST_DEBUG_FUNCPTR (gst_ce_imgenc_propose_allocation);
@@ -214,6 +530,27 @@ gst_ce_imgenc_init (GstCeImgEnc * ce_imgenc)
   priv->first_buffer = TRUE;
   priv->engine_handle = NULL;
   priv->allocator = NULL;
+  priv->dyn_params_pending = FALSE;
+  priv->stats = gst_ce_stats_new ();
+  priv->stats_enabled = PROP_ENABLE_STATS_DEFAULT;
+  priv->low_latency = PROP_LOW_LATENCY_DEFAULT;
+  priv->skip_static = PROP_SKIP_STATIC_DEFAULT;
+  priv->static_threshold = PROP_STATIC_THRESHOLD_DEFAULT;
+  priv->static_max_skip = PROP_STATIC_MAX_SKIP_DEFAULT;
+  priv->max_fps_num = PROP_MAX_FRAMERATE_N_DEFAULT;
+  priv->max_fps_den = PROP_MAX_FRAMERATE_D_DEFAULT;
+  priv->target_bitrate = PROP_TARGET_BITRATE_DEFAULT;
+  priv->frame_budget = PROP_FRAME_BUDGET_DEFAULT;
+  priv->min_quality = PROP_MIN_QUALITY_DEFAULT;
+  priv->max_quality_step = PROP_MAX_QUALITY_STEP_DEFAULT;
+  priv->snapshot = PROP_SNAPSHOT_DEFAULT;
+  priv->max_height = 0;
+  priv->tile_height = PROP_TILE_HEIGHT_DEFAULT;
+  priv->thumb_factor = PROP_THUMBNAIL_FACTOR_DEFAULT;
+  priv->n_instances = PROP_N_INSTANCES_DEFAULT;
+  g_queue_init (&priv->jobs);
+  g_mutex_init (&priv->jobs_lock);
+  g_cond_init (&priv->jobs_cond);
 
   gst_ce_imgenc_reset (GST_VIDEO_ENCODER (ce_imgenc));
 }
@@ -238,6 +575,18 @@ gst_ce_imgenc_finalize (GObject * object)
     ce_imgenc->codec_dyn_params = NULL;
   }
 
+  g_free (ce_imgenc->priv->dyn_params_copy);
+  ce_imgenc->priv->dyn_params_copy = NULL;
+
+  /* Free the encoding statistics */
+  if (ce_imgenc->priv->stats) {
+    gst_ce_stats_free (ce_imgenc->priv->stats);
+    ce_imgenc->priv->stats = NULL;
+  }
+
+  g_mutex_clear (&ce_imgenc->priv->jobs_lock);
+  g_cond_clear (&ce_imgenc->priv->jobs_cond);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -250,7 +599,6 @@ gst_ce_imgenc_configure_codec (GstCeImgEnc * ce_imgenc)
 {
   GstCeImgEncClass *klass;
   GstCeImgEncPrivate *priv;
-  IMGENC1_Status enc_status;
   IMGENC1_Params *params;
   IMGENC1_DynamicParams *dyn_params;
 
@@ -276,18 +624,19 @@ gst_ce_imgenc_configure_codec (GstCeImgEnc * ce_imgenc)
       dyn_params->captureWidth = priv->frame_pitch;
       break;
     default:
+      GST_OBJECT_UNLOCK (ce_imgenc);
       GST_ELEMENT_ERROR (ce_imgenc, STREAM, NOT_IMPLEMENTED,
           ("unsupported format in video stream: %d\n",
               priv->video_format), (NULL));
       return FALSE;
   }
 
-  /* Set input frame dimensions */
+  /* Set input frame dimensions, the codec only sees a tile at a time */
   params->maxWidth = priv->frame_width;
-  params->maxHeight = priv->frame_height;
+  params->maxHeight = priv->tile_rows;
 
   dyn_params->inputWidth = priv->frame_width;
-  dyn_params->inputHeight = priv->frame_height;
+  dyn_params->inputHeight = priv->tile_rows;
 
   /* Create the codec handle with the codec parameters given */
   if (ce_imgenc->codec_handle) {
@@ -302,18 +651,16 @@ gst_ce_imgenc_configure_codec (GstCeImgEnc * ce_imgenc)
     goto fail_open_codec;
 
   /* Set codec dynamic parameters */
-  enc_status.size = sizeof (IMGENC1_Status);
-  enc_status.data.buf = NULL;
+  dyn_params = gst_ce_imgenc_copy_dynamic_params (ce_imgenc);
+  GST_OBJECT_UNLOCK (ce_imgenc);
 
   GST_DEBUG_OBJECT (ce_imgenc, "Set codec dynamic parameters");
-  if (!gst_ce_imgenc_set_dynamic_params (ce_imgenc))
+  if (!gst_ce_imgenc_set_dynamic_params (ce_imgenc, dyn_params))
     goto fail_out;
 
-  if (!gst_ce_imgenc_get_buffer_info (ce_imgenc))
+  if (!gst_ce_imgenc_get_buffer_info (ce_imgenc, dyn_params))
     goto fail_out;
 
-  GST_OBJECT_UNLOCK (ce_imgenc);
-
   return TRUE;
 
 fail_open_codec:
@@ -326,7 +673,6 @@ fail_out:
   {
     IMGENC1_delete (ce_imgenc->codec_handle);
     ce_imgenc->codec_handle = NULL;
-    GST_OBJECT_UNLOCK (ce_imgenc);
     return FALSE;
   }
 }
@@ -338,8 +684,10 @@ fail_out:
 static gboolean
 gst_ce_imgenc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
 {
-  GstCaps *allowed_caps = NULL;
+  GstCaps *allowed_caps = NULL, *template_caps;
   GstBuffer *codec_data = NULL;
+  GstVideoInfo *info;
+  gint fps_num, fps_den, max_fps_num, max_fps_den;
 
   GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (encoder);
   GstCeImgEncClass *klass =
@@ -348,20 +696,80 @@ gst_ce_imgenc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
 
   GST_DEBUG_OBJECT (ce_imgenc, "Extracting common image information");
 
+  /* The images encoded in parallel with the old format go out first */
+  gst_ce_imgenc_finish_jobs (ce_imgenc, 0);
+  gst_ce_imgenc_stop_workers (ce_imgenc);
+
+  /* The formats the codec doesn't read are converted to one it does */
+  template_caps =
+      gst_pad_get_pad_template_caps (GST_VIDEO_ENCODER_SINK_PAD (encoder));
+  priv->video_format =
+      gst_ce_convert_get_format (GST_VIDEO_INFO_FORMAT (&state->info),
+      template_caps);
+  gst_caps_unref (template_caps);
+
+  if (priv->video_format == GST_VIDEO_FORMAT_UNKNOWN)
+    goto fail_configure_codec;
+
+  if (priv->video_format != GST_VIDEO_INFO_FORMAT (&state->info))
+    GST_DEBUG_OBJECT (ce_imgenc, "converting the %s input to %s",
+        gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (&state->info)),
+        gst_video_format_to_string (priv->video_format));
+
+  /* Default layout for the frames that need to be copied */
+  gst_video_info_set_format (&priv->staging_info, priv->video_format,
+      GST_VIDEO_INFO_WIDTH (&state->info), GST_VIDEO_INFO_HEIGHT (&state->info));
+  gst_ce_imgenc_free_staging (ce_imgenc);
+
+  /* The codec reads the converted frames out of the staging buffers */
+  info = &state->info;
+  if (priv->video_format != GST_VIDEO_INFO_FORMAT (&state->info))
+    info = &priv->staging_info;
+
   /* Prepare the input buffer descriptor */
-  priv->frame_width = GST_VIDEO_INFO_WIDTH (&state->info);
-  priv->frame_height = GST_VIDEO_INFO_HEIGHT (&state->info);
-  priv->frame_pitch = GST_VIDEO_INFO_PLANE_STRIDE (&state->info, 0);
-  priv->inbuf_desc.numBufs = GST_VIDEO_INFO_N_PLANES (&state->info);
-  priv->video_format = GST_VIDEO_INFO_FORMAT (&state->info);
+  priv->frame_width = GST_VIDEO_INFO_WIDTH (info);
+  priv->frame_height = GST_VIDEO_INFO_HEIGHT (info);
+  priv->frame_pitch = GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+  priv->inbuf_desc.numBufs = GST_VIDEO_INFO_N_PLANES (info);
+
+  /* Faster or variable rate input is decimated to the maximum rate */
+  fps_num = GST_VIDEO_INFO_FPS_N (&state->info);
+  fps_den = GST_VIDEO_INFO_FPS_D (&state->info);
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  max_fps_num = priv->max_fps_num;
+  max_fps_den = priv->max_fps_den;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  priv->decimate_period = GST_CLOCK_TIME_NONE;
+  priv->decimate_next = GST_CLOCK_TIME_NONE;
+  if (max_fps_num > 0 && (fps_num <= 0 ||
+          gst_util_fraction_compare (fps_num, fps_den, max_fps_num,
+              max_fps_den) > 0)) {
+    GST_DEBUG_OBJECT (ce_imgenc, "decimating %d/%d fps to %d/%d fps",
+        fps_num, fps_den, max_fps_num, max_fps_den);
+    fps_num = max_fps_num;
+    fps_den = max_fps_den;
+    priv->decimate_period = gst_util_uint64_scale_int (GST_SECOND,
+        max_fps_den, max_fps_num);
+  }
 
   GST_DEBUG_OBJECT (ce_imgenc, "input buffer format: width=%i, height=%i,"
       " pitch=%i", priv->frame_width, priv->frame_height, priv->frame_pitch);
 
+  if (!gst_ce_imgenc_set_tiling (ce_imgenc))
+    goto fail_configure_codec;
+
+  /* The thumbnail codec follows on the next image */
+  gst_ce_imgenc_close_thumbnail (ce_imgenc);
+
   /* Configure codec with obtained information */
   if (!gst_ce_imgenc_configure_codec (ce_imgenc))
     goto fail_configure_codec;
 
+  if (!gst_ce_imgenc_start_workers (ce_imgenc))
+    goto fail_configure_codec;
+
   /* Some codecs support more than one format (JPEG encoder not), first auto-choose one */
   GST_DEBUG_OBJECT (ce_imgenc, "choosing an output format...");
   allowed_caps = gst_pad_get_allowed_caps (GST_VIDEO_ENCODER_SRC_PAD (encoder));
@@ -399,6 +807,14 @@ gst_ce_imgenc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
   if (!priv->output_state)
     goto fail_set_output_state;
 
+  priv->output_state->info.fps_n = fps_num;
+  priv->output_state->info.fps_d = fps_den;
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  priv->fps_num = fps_num;
+  priv->fps_den = fps_den;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
   if (codec_data) {
     GST_DEBUG_OBJECT (ce_imgenc, "setting the codec data");
     priv->output_state->codec_data = codec_data;
@@ -419,6 +835,52 @@ fail_set_output_state:
   return FALSE;
 }
 
+/*
+ * gst_ce_imgenc_set_tiling
+ *
+ * Splits the images in horizontal tiles when asked to, or when they are
+ * taller than the codec takes. Only subclasses able to join the tiles
+ * get tiled images.
+ */
+static gboolean
+gst_ce_imgenc_set_tiling (GstCeImgEnc * ce_imgenc)
+{
+  GstCeImgEncClass *klass =
+      GST_CE_IMGENC_CLASS (G_OBJECT_GET_CLASS (ce_imgenc));
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  gint rows = priv->frame_height;
+  guint tile_height;
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  tile_height = priv->tile_height;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  if (klass->join_tile) {
+    if (tile_height)
+      rows = tile_height;
+    else if (priv->max_height && priv->frame_height > priv->max_height)
+      rows = priv->max_height;
+
+    rows = MAX (TILE_ROWS_ALIGN, rows - rows % TILE_ROWS_ALIGN);
+    rows = MIN (rows, priv->frame_height);
+  }
+
+  priv->tile_rows = rows;
+  priv->n_tiles = (priv->frame_height + rows - 1) / rows;
+
+  if (priv->n_tiles > 1)
+    GST_DEBUG_OBJECT (ce_imgenc, "encoding in %u tiles of %d rows",
+        priv->n_tiles, rows);
+
+  if (klass->set_tiling && !klass->set_tiling (ce_imgenc, priv->frame_width,
+          priv->n_tiles > 1 ? rows : 0)) {
+    GST_ERROR_OBJECT (ce_imgenc, "can't encode in tiles of %d rows", rows);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 /**
  * Suggest allocation parameters
  */
@@ -526,159 +988,1629 @@ gst_ce_imgenc_allocate_output_frame (GstCeImgEnc * ce_imgenc, GstBuffer ** buf)
   return TRUE;
 }
 
-/**
- *  Encodes the input data from GstVideoEncoder class
+/*
+ * gst_ce_imgenc_update_latency
+ *
+ * Tracks the time the codec and the post-process took for the last
+ * image and reports the latency again when it drifts.
  */
-static GstFlowReturn
-gst_ce_imgenc_handle_frame (GstVideoEncoder * encoder,
-    GstVideoCodecFrame * frame)
+static void
+gst_ce_imgenc_update_latency (GstCeImgEnc * ce_imgenc, GstClockTime sample)
 {
-  GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (encoder);
   GstCeImgEncPrivate *priv = ce_imgenc->priv;
-  GstCeImgEncClass *klass =
-      GST_CE_IMGENC_CLASS (G_OBJECT_GET_CLASS (ce_imgenc));
-  GstVideoInfo *info = &priv->input_state->info;
-  GstVideoFrame vframe;
-  GstMapInfo info_out;
-  GstBuffer *outbuf = NULL;
-  GstCeContigBufMeta *meta;
-  IMGENC1_InArgs in_args;
-  IMGENC1_OutArgs out_args;
-  gint ret = IMGENC1_EFAIL;
-  gint i = 0;
-  gint current_pitch;
+  GstClockTime latency;
+  gboolean low_latency;
 
-  /* $
-   * TODO
-   * Failing if input buffer is not contiguous. Should it copy the
-   * buffer instead?
-   */
-  if (!gst_ce_is_buffer_contiguous (frame->input_buffer))
-    goto fail_no_contiguous_buffer;
+  GST_OBJECT_LOCK (ce_imgenc);
+  low_latency = priv->low_latency;
+  GST_OBJECT_UNLOCK (ce_imgenc);
 
-  /* Fill planes pointer */
-  if (!gst_video_frame_map (&vframe, info, frame->input_buffer, GST_MAP_READ))
-    goto fail_map;
+  if (!gst_ce_latency_add (&priv->latency, sample, &latency) &&
+      low_latency == priv->latency_reported_low)
+    return;
 
-  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (&vframe); i++) {
-    priv->inbuf_desc.descs[i].buf =
-        (XDAS_Int8 *) GST_VIDEO_FRAME_PLANE_DATA (&vframe, i);
+  priv->latency_reported_low = low_latency;
+
+  GST_DEBUG_OBJECT (ce_imgenc, "reporting a latency of %" GST_TIME_FORMAT
+      "%s", GST_TIME_ARGS (latency), low_latency ? " (low latency)" : "");
+  gst_video_encoder_set_latency (GST_VIDEO_ENCODER (ce_imgenc), latency,
+      low_latency ? latency : GST_CLOCK_TIME_NONE);
+}
+
+/*
+ * gst_ce_imgenc_rate_control
+ *
+ * Steers the quality towards the byte budget of each image, never above
+ * the quality set by the user. The sizes are averaged over a few images
+ * so the codec params are not set for every one, unless an image goes
+ * way over the budget.
+ */
+static void
+gst_ce_imgenc_rate_control (GstCeImgEnc * ce_imgenc, gsize bytes)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  IMGENC1_DynamicParams *dyn_params = ce_imgenc->codec_dyn_params;
+  guint64 budget = 0, average;
+  gint64 error;
+  gint step, quality;
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  if (priv->frame_budget)
+    budget = priv->frame_budget;
+  else if (priv->target_bitrate && priv->fps_num > 0)
+    budget = gst_util_uint64_scale (priv->target_bitrate / 8,
+        priv->fps_den, priv->fps_num);
+
+  if (!budget) {
+    priv->rc_bytes = 0;
+    priv->rc_frames = 0;
+    goto done;
   }
 
-  current_pitch = GST_VIDEO_FRAME_PLANE_STRIDE (&vframe, 0);
+  priv->rc_bytes += bytes;
+  priv->rc_frames++;
+  if (priv->rc_frames < RATE_CONTROL_WINDOW && bytes < 2 * budget)
+    goto done;
+
+  average = priv->rc_bytes / priv->rc_frames;
+  priv->rc_bytes = 0;
+  priv->rc_frames = 0;
+
+  error = ((gint64) budget - (gint64) average) * 100 / (gint64) budget;
+  if (ABS (error) <= RATE_CONTROL_DEAD_BAND)
+    goto done;
+
+  step = CLAMP (error / 5, -(gint) priv->max_quality_step,
+      (gint) priv->max_quality_step);
+  if (!step)
+    step = error > 0 ? 1 : -1;
+
+  quality = CLAMP (dyn_params->qValue + step,
+      MIN (priv->min_quality, priv->quality), priv->quality);
+  if (quality != dyn_params->qValue) {
+    GST_DEBUG_OBJECT (ce_imgenc, "%" G_GUINT64_FORMAT " bytes per image for "
+        "a budget of %" G_GUINT64_FORMAT ", quality %li -> %d", average,
+        budget, dyn_params->qValue, quality);
+    dyn_params->qValue = quality;
+    priv->dyn_params_pending = TRUE;
+  }
 
-  gst_video_frame_unmap (&vframe);
+done:
+  GST_OBJECT_UNLOCK (ce_imgenc);
+}
 
-  if (priv->frame_pitch != current_pitch) {
-    priv->frame_pitch = current_pitch;
-    switch (priv->video_format) {
-      case GST_VIDEO_FORMAT_UYVY:
-        ce_imgenc->codec_dyn_params->captureWidth = priv->frame_pitch / 2;
-        break;
-      case GST_VIDEO_FORMAT_NV12:
-        ce_imgenc->codec_dyn_params->captureWidth = priv->frame_pitch;
-        break;
-      default:
-        ce_imgenc->codec_dyn_params->captureWidth = 0;
-    }
-    if (!gst_ce_imgenc_set_dynamic_params (ce_imgenc))
-      goto fail_set_buffer_stride;
+/*
+ * gst_ce_imgenc_decimate
+ *
+ * Drops the images that come ahead of the maximum frame rate, looking
+ * at their timestamps only. An image within half an input frame of its
+ * slot takes the slot, and the slots start over on the first image,
+ * after a gap or when time goes back.
+ */
+static gboolean
+gst_ce_imgenc_decimate (GstCeImgEnc * ce_imgenc, GstVideoCodecFrame * frame)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstClockTime next = priv->decimate_next;
+  GstClockTime slack = 0;
 
-    if (!gst_ce_imgenc_get_buffer_info (ce_imgenc))
-      goto fail_set_buffer_stride;
+  if (!GST_CLOCK_TIME_IS_VALID (priv->decimate_period) ||
+      !GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return FALSE;
+
+  if (GST_CLOCK_TIME_IS_VALID (frame->duration))
+    slack = frame->duration / 2;
+
+  if (GST_CLOCK_TIME_IS_VALID (next) && frame->pts + slack < next &&
+      frame->pts + priv->decimate_period >= next) {
+    GST_LOG_OBJECT (ce_imgenc, "decimating image %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (frame->pts));
+    return TRUE;
   }
 
-  /* Making sure the output buffer pool is configured */
-  if (priv->first_buffer && gst_pad_check_reconfigure (encoder->srcpad)) {
-    gst_video_encoder_negotiate (GST_VIDEO_ENCODER (encoder));
-    priv->first_buffer = FALSE;
+  if (!GST_CLOCK_TIME_IS_VALID (next) || frame->pts + slack < next ||
+      frame->pts >= next + priv->decimate_period)
+    next = frame->pts;
+
+  priv->decimate_next = next + priv->decimate_period;
+  frame->duration = priv->decimate_period;
+
+  return FALSE;
+}
+
+/*
+ * gst_ce_imgenc_static_drop
+ *
+ * Checks whether the raw image shows the same scene as the last encoded
+ * one, in which case it is to be dropped.
+ * Requested keyframes are always encoded.
+ */
+static gboolean
+gst_ce_imgenc_static_drop (GstCeImgEnc * ce_imgenc, GstVideoCodecFrame * frame)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstVideoFrame vframe;
+  gboolean skip, force, is_static;
+  guint threshold, max_skip;
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  skip = priv->skip_static;
+  threshold = priv->static_threshold;
+  max_skip = priv->static_max_skip;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  if (!skip) {
+    gst_ce_static_scene_reset (&priv->static_scene);
+    return FALSE;
   }
 
-  /* Allocate output buffer */
-  if (gst_buffer_pool_acquire_buffer (GST_BUFFER_POOL_CAST (priv->outbuf_pool),
-          &outbuf, NULL) != GST_FLOW_OK) {
-    frame->output_buffer = NULL;
-    gst_video_encoder_finish_frame (encoder, frame);
-    goto fail_alloc;
+  force = GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame) ||
+      (max_skip && priv->static_skipped >= max_skip);
+
+  if (!gst_video_frame_map (&vframe, &priv->input_state->info,
+          frame->input_buffer, GST_MAP_READ))
+    return FALSE;
+
+  is_static = gst_ce_static_scene_update (&priv->static_scene, &vframe,
+      threshold, force);
+
+  gst_video_frame_unmap (&vframe);
+
+  if (!is_static) {
+    priv->static_skipped = 0;
+    return FALSE;
   }
 
-  if (!gst_buffer_map (outbuf, &info_out, GST_MAP_WRITE))
-    goto fail_alloc;
+  priv->static_skipped++;
 
-  priv->outbuf_desc.descs[0].buf = (XDAS_Int8 *) info_out.data;
+  GST_LOG_OBJECT (ce_imgenc, "dropping static image %" GST_TIME_FORMAT
+      " (%u consecutive)", GST_TIME_ARGS (frame->pts), priv->static_skipped);
 
-  /* Set output and input arguments for the encode process */
-  in_args.size = sizeof (IIMGENC1_InArgs);
-  out_args.size = sizeof (IMGENC1_OutArgs);
+  return TRUE;
+}
 
-  /* Pre-encode process */
-  if (klass->pre_process
-      && !klass->pre_process (ce_imgenc, frame->input_buffer))
-    goto fail_pre_encode;
+/*
+ * gst_ce_imgenc_finish_static
+ *
+ * Finishes a dropped static image and sends a gap event in its place.
+ * The gap goes after the frame is finished, which pushes any pending
+ * caps and segment events first.
+ */
+static GstFlowReturn
+gst_ce_imgenc_finish_static (GstCeImgEnc * ce_imgenc,
+    GstVideoCodecFrame * frame)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (ce_imgenc);
+  GstClockTime pts = frame->pts;
+  GstClockTime duration = frame->duration;
+  GstFlowReturn ret;
 
-  /* Encode process */
-  ret = IMGENC1_process (ce_imgenc->codec_handle, &priv->inbuf_desc,
-      &priv->outbuf_desc, &in_args, &out_args);
+  frame->output_buffer = NULL;
+  ret = gst_video_encoder_finish_frame (encoder, frame);
 
-  if (IMGENC1_EOK != ret)
-    goto fail_encode;
+  if (GST_CLOCK_TIME_IS_VALID (pts))
+    gst_pad_push_event (GST_VIDEO_ENCODER_SRC_PAD (encoder),
+        gst_event_new_gap (pts, duration));
 
-  GST_DEBUG_OBJECT (ce_imgenc,
-      "encoded an output buffer of size %li at addr %p",
-      out_args.bytesGenerated, priv->outbuf_desc.descs->buf);
+  return ret;
+}
 
-  gst_buffer_unmap (outbuf, &info_out);
-  gst_ce_slice_buffer_resize (GST_CE_SLICE_BUFFER_POOL_CAST (priv->outbuf_pool),
-      outbuf, out_args.bytesGenerated);
-  /* Post-encode process (JPEG encoder doesn't have a post-encode process) */
-  if (klass->post_process && !klass->post_process (ce_imgenc, outbuf))
-    goto fail_post_encode;
+/*
+ * gst_ce_imgenc_close_thumbnail
+ *
+ * Deletes the thumbnail codec instance, it is created again with the
+ * current format for the next thumbnail.
+ */
+static void
+gst_ce_imgenc_close_thumbnail (GstCeImgEnc * ce_imgenc)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
 
-  GST_DEBUG_OBJECT (ce_imgenc, "frame encoded succesfully");
+  if (priv->thumb_handle) {
+    IMGENC1_delete (priv->thumb_handle);
+    priv->thumb_handle = NULL;
+  }
 
-  frame->output_buffer = outbuf;
+  gst_buffer_replace (&priv->thumb_inbuf, NULL);
+  g_free (priv->thumb_params);
+  priv->thumb_params = NULL;
+  g_free (priv->thumb_dyn_params);
+  priv->thumb_dyn_params = NULL;
+}
 
-  return gst_video_encoder_finish_frame (encoder, frame);
+/*
+ * gst_ce_imgenc_configure_thumbnail
+ *
+ * Creates the thumbnail codec instance from the params of the main one,
+ * along with the contiguous buffer the input is scaled down into.
+ */
+static gboolean
+gst_ce_imgenc_configure_thumbnail (GstCeImgEnc * ce_imgenc, GstPad * pad)
+{
+  GstCeImgEncClass *klass =
+      GST_CE_IMGENC_CLASS (G_OBJECT_GET_CLASS (ce_imgenc));
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstVideoInfo *info = &priv->input_state->info;
+  IMGENC1_Status enc_status;
+  GstEvent *stream_start;
+  GstCaps *caps;
+  gchar *stream_id;
+  guint factor;
+  gint width, height, i;
 
-fail_map:
-  {
-    GST_ERROR_OBJECT (encoder, "failed to map input buffer");
-    return GST_FLOW_ERROR;
+  GST_OBJECT_LOCK (ce_imgenc);
+  factor = priv->thumb_factor;
+  priv->thumb_params = g_memdup (ce_imgenc->codec_params,
+      ce_imgenc->codec_params->size);
+  priv->thumb_dyn_params = g_memdup (ce_imgenc->codec_dyn_params,
+      ce_imgenc->codec_dyn_params->size);
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  width = GST_ROUND_DOWN_2 (priv->frame_width / factor);
+  height = GST_ROUND_DOWN_2 (priv->frame_height / factor);
+  if (width < 2 || height < 2 ||
+      (priv->max_height && height > priv->max_height))
+    goto fail_size;
+
+  gst_video_info_set_format (&priv->thumb_info, priv->video_format, width,
+      height);
+  priv->thumb_inbuf = gst_buffer_new_allocate (priv->allocator,
+      GST_VIDEO_INFO_SIZE (&priv->thumb_info), &priv->alloc_params);
+  if (!priv->thumb_inbuf)
+    goto fail_alloc;
+
+  priv->thumb_params->maxWidth = width;
+  priv->thumb_params->maxHeight = height;
+  priv->thumb_dyn_params->inputWidth = width;
+  priv->thumb_dyn_params->inputHeight = height;
+  if (priv->video_format == GST_VIDEO_FORMAT_UYVY)
+    priv->thumb_dyn_params->captureWidth =
+        GST_VIDEO_INFO_PLANE_STRIDE (&priv->thumb_info, 0) / 2;
+  else
+    priv->thumb_dyn_params->captureWidth =
+        GST_VIDEO_INFO_PLANE_STRIDE (&priv->thumb_info, 0);
+
+  priv->thumb_handle = IMGENC1_create (priv->engine_handle,
+      (Char *) klass->codec_name, priv->thumb_params);
+  if (!priv->thumb_handle)
+    goto fail_open_codec;
+
+  enc_status.size = sizeof (IMGENC1_Status);
+  enc_status.data.buf = NULL;
+
+  if (IMGENC1_control (priv->thumb_handle, XDM_SETPARAMS,
+          priv->thumb_dyn_params, &enc_status) != IMGENC1_EOK ||
+      IMGENC1_control (priv->thumb_handle, XDM_GETBUFINFO,
+          priv->thumb_dyn_params, &enc_status) != IMGENC1_EOK)
+    goto fail_control;
+
+  priv->thumb_inbuf_desc.numBufs = priv->inbuf_desc.numBufs;
+  for (i = 0; i < enc_status.bufInfo.minNumInBufs; i++)
+    priv->thumb_inbuf_desc.descs[i].bufSize =
+        enc_status.bufInfo.minInBufSize[i];
+
+  priv->thumb_outbuf_size = enc_status.bufInfo.minOutBufSize[0];
+  priv->thumb_outbuf_desc.numBufs = 1;
+  priv->thumb_outbuf_desc.descs[0].bufSize = priv->thumb_outbuf_size;
+
+  GST_DEBUG_OBJECT (ce_imgenc, "thumbnail of %dx%d, scaled down %u times",
+      width, height, factor);
+
+  /* Start the thumbnail stream, or tell it about the new format */
+  stream_start = gst_pad_get_sticky_event (pad, GST_EVENT_STREAM_START, 0);
+  if (stream_start) {
+    gst_event_unref (stream_start);
+  } else {
+    stream_id = gst_pad_create_stream_id (pad, GST_ELEMENT (ce_imgenc),
+        GST_CE_IMGENC_THUMBNAIL);
+    gst_pad_push_event (pad, gst_event_new_stream_start (stream_id));
+    g_free (stream_id);
   }
-fail_set_buffer_stride:
+
+  caps = gst_caps_make_writable (gst_pad_get_pad_template_caps (pad));
+  gst_caps_set_simple (caps, "width", G_TYPE_INT, width,
+      "height", G_TYPE_INT, height, "framerate", GST_TYPE_FRACTION,
+      priv->fps_num, priv->fps_den, "pixel-aspect-ratio", GST_TYPE_FRACTION,
+      GST_VIDEO_INFO_PAR_N (info), GST_VIDEO_INFO_PAR_D (info), NULL);
+  caps = gst_caps_fixate (caps);
+  gst_pad_push_event (pad, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  priv->thumb_segment_pending = TRUE;
+
+  return TRUE;
+
+fail_size:
   {
-    GST_ERROR_OBJECT (encoder, "failed to set buffer stride");
-    return GST_FLOW_ERROR;
+    GST_WARNING_OBJECT (ce_imgenc, "can't encode a thumbnail of %dx%d",
+        width, height);
+    gst_ce_imgenc_close_thumbnail (ce_imgenc);
+    return FALSE;
   }
-fail_no_contiguous_buffer:
+fail_alloc:
   {
-    GST_ERROR_OBJECT (encoder, "input buffer should be contiguous");
-    return GST_FLOW_ERROR;
+    GST_ERROR_OBJECT (ce_imgenc, "failed to get the thumbnail input buffer");
+    gst_ce_imgenc_close_thumbnail (ce_imgenc);
+    return FALSE;
   }
-fail_alloc:
+fail_open_codec:
   {
-    GST_INFO_OBJECT (ce_imgenc, "Failed to get output buffer, frame dropped");
-    return GST_FLOW_OK;
+    GST_ERROR_OBJECT (ce_imgenc, "failed to open thumbnail codec %s",
+        klass->codec_name);
+    gst_ce_imgenc_close_thumbnail (ce_imgenc);
+    return FALSE;
   }
-fail_pre_encode:
+fail_control:
   {
-    gst_buffer_unmap (outbuf, &info_out);
-    GST_ERROR_OBJECT (ce_imgenc, "failed pre-encode process");
+    GST_ERROR_OBJECT (ce_imgenc, "failed to configure thumbnail codec, "
+        "status error %x", (guint) enc_status.extendedError);
+    gst_ce_imgenc_close_thumbnail (ce_imgenc);
+    return FALSE;
+  }
+}
+
+/*
+ * gst_ce_imgenc_encode_thumbnail
+ *
+ * Scales the input of the job down and encodes it as a thumbnail, which
+ * is pushed on the thumbnail pad with the timestamps of the frame so both
+ * outputs can be paired. The main output doesn't depend on the thumbnail,
+ * so its failures are only logged.
+ */
+static void
+gst_ce_imgenc_encode_thumbnail (GstCeImgEnc * ce_imgenc,
+    GstCeImgEncJob * job)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstVideoCodecFrame *frame = job->frame;
+  GstVideoInfo *info = &priv->input_state->info;
+  GstBuffer *inbuf = frame->input_buffer;
+  GstVideoFrame src, dest;
+  gboolean scaled;
+  IMGENC1_InArgs in_args;
+  IMGENC1_OutArgs out_args;
+  IMGENC1_Status enc_status;
+  GstBuffer *outbuf;
+  GstMapInfo map;
+  GstFlowReturn flow_ret;
+  GstPad *pad = NULL;
+  gboolean update = FALSE;
+  gint ret, i;
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  if (priv->thumb_pad)
+    pad = gst_object_ref (priv->thumb_pad);
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  if (!pad)
+    return;
+
+  if (!priv->thumb_handle && !gst_ce_imgenc_configure_thumbnail (ce_imgenc,
+          pad))
+    goto out;
+
+  /* The thumbnail follows the quality of the main image */
+  GST_OBJECT_LOCK (ce_imgenc);
+  if (priv->thumb_dyn_params->qValue != ce_imgenc->codec_dyn_params->qValue) {
+    priv->thumb_dyn_params->qValue = ce_imgenc->codec_dyn_params->qValue;
+    update = TRUE;
+  }
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  enc_status.size = sizeof (IMGENC1_Status);
+  enc_status.data.buf = NULL;
+  if (update && IMGENC1_control (priv->thumb_handle, XDM_SETPARAMS,
+          priv->thumb_dyn_params, &enc_status) != IMGENC1_EOK)
+    GST_WARNING_OBJECT (ce_imgenc, "failed to set the thumbnail quality");
+
+  if (priv->thumb_segment_pending) {
+    gst_pad_push_event (pad,
+        gst_event_new_segment (&GST_VIDEO_ENCODER (ce_imgenc)->input_segment));
+    priv->thumb_segment_pending = FALSE;
+  }
+
+  /* The codec reads what the main codec read, converted if it was */
+  if (job->staging) {
+    info = &priv->staging_info;
+    inbuf = job->staging;
+  }
+
+  if (!gst_video_frame_map (&src, info, inbuf, GST_MAP_READ))
+    goto fail_scale;
+  if (!gst_video_frame_map (&dest, &priv->thumb_info, priv->thumb_inbuf,
+          GST_MAP_WRITE)) {
+    gst_video_frame_unmap (&src);
+    goto fail_scale;
+  }
+  scaled = gst_ce_convert_downscale (&dest, &src);
+  gst_video_frame_unmap (&src);
+  if (!scaled) {
+    gst_video_frame_unmap (&dest);
+    goto fail_scale;
+  }
+
+  outbuf = gst_buffer_new_allocate (priv->allocator, priv->thumb_outbuf_size,
+      &priv->alloc_params);
+  if (!outbuf || !gst_buffer_map (outbuf, &map, GST_MAP_WRITE)) {
+    gst_video_frame_unmap (&dest);
+    goto fail_alloc;
+  }
+
+  for (i = 0; i < priv->thumb_inbuf_desc.numBufs; i++)
+    priv->thumb_inbuf_desc.descs[i].buf =
+        (XDAS_Int8 *) GST_VIDEO_FRAME_PLANE_DATA (&dest, i);
+  priv->thumb_outbuf_desc.descs[0].buf = (XDAS_Int8 *) map.data;
+
+  in_args.size = sizeof (IIMGENC1_InArgs);
+  out_args.size = sizeof (IMGENC1_OutArgs);
+
+  ret = IMGENC1_process (priv->thumb_handle, &priv->thumb_inbuf_desc,
+      &priv->thumb_outbuf_desc, &in_args, &out_args);
+  gst_buffer_unmap (outbuf, &map);
+  gst_video_frame_unmap (&dest);
+
+  if (IMGENC1_EOK != ret)
+    goto fail_encode;
+
+  gst_buffer_resize (outbuf, 0, out_args.bytesGenerated);
+  GST_BUFFER_PTS (outbuf) = frame->pts;
+  GST_BUFFER_DTS (outbuf) = frame->dts;
+  GST_BUFFER_DURATION (outbuf) = frame->duration;
+
+  flow_ret = gst_pad_push (pad, outbuf);
+  if (flow_ret != GST_FLOW_OK)
+    GST_DEBUG_OBJECT (ce_imgenc, "thumbnail push returned %s",
+        gst_flow_get_name (flow_ret));
+
+out:
+  gst_object_unref (pad);
+  return;
+
+fail_scale:
+  {
+    GST_WARNING_OBJECT (ce_imgenc, "failed to scale the thumbnail down");
+    goto out;
+  }
+fail_alloc:
+  {
+    GST_WARNING_OBJECT (ce_imgenc, "failed to get thumbnail buffer");
+    if (outbuf)
+      gst_buffer_unref (outbuf);
+    goto out;
+  }
+fail_encode:
+  {
+    GST_WARNING_OBJECT (ce_imgenc, "failed to encode thumbnail with "
+        "extended error: 0x%x", (guint) out_args.extendedError);
+    gst_buffer_unref (outbuf);
+    goto out;
+  }
+}
+
+/*
+ * gst_ce_imgenc_set_tile
+ *
+ * Points the codec to the rows of the tile in the input planes, no copy
+ * is needed, and to the room left in the output behind the previous
+ * tiles. The last tile may be shorter than the rest.
+ */
+static gboolean
+gst_ce_imgenc_set_tile (GstCeImgEnc * ce_imgenc, XDAS_Int8 ** planes,
+    gint * strides, guint8 * out, gsize offset, guint tile)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  gint row = tile * priv->tile_rows;
+  gint rows = MIN (priv->tile_rows, priv->frame_height - row);
+  gboolean ret = TRUE;
+  gint i;
+
+  /* Only NV12 has a second plane, with half the rows */
+  for (i = 0; i < priv->inbuf_desc.numBufs; i++)
+    priv->inbuf_desc.descs[i].buf = planes[i] + (i ? row / 2 : row) *
+        strides[i];
+
+  priv->outbuf_desc.descs[0].buf = (XDAS_Int8 *) out + offset;
+  priv->outbuf_desc.descs[0].bufSize = priv->outbuf_size - offset;
+
+  /* The params were taken once for the whole image, a change made
+   * meanwhile waits for the next one instead of mixing in */
+  if (priv->dyn_params_copy->inputHeight != rows) {
+    priv->dyn_params_copy->inputHeight = rows;
+    ret = gst_ce_imgenc_set_dynamic_params (ce_imgenc, priv->dyn_params_copy);
+  }
+
+  return ret;
+}
+
+/*
+ * gst_ce_imgenc_free_staging
+ *
+ * Drops the staging buffers, which are allocated again with the current
+ * staging layout when needed.
+ */
+static void
+gst_ce_imgenc_free_staging (GstCeImgEnc * ce_imgenc)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+
+  if (priv->staging_pool) {
+    gst_buffer_pool_set_active (priv->staging_pool, FALSE);
+    gst_object_unref (priv->staging_pool);
+    priv->staging_pool = NULL;
+  }
+  priv->staging_reason = NULL;
+}
+
+/*
+ * gst_ce_imgenc_check_layout
+ *
+ * The codec reads the image in place through a single pitch, so the
+ * buffer must be physically contiguous, in the codec format, and all
+ * its planes must share the same stride.
+ *
+ * Returns: %NULL if the codec can read the frame, or why it can't.
+ */
+static const gchar *
+gst_ce_imgenc_check_layout (GstCeImgEnc * ce_imgenc, GstVideoFrame * vframe,
+    gboolean contiguous)
+{
+  gint i, stride;
+
+  if (GST_VIDEO_FRAME_FORMAT (vframe) != ce_imgenc->priv->video_format)
+    return "the codec reads another format";
+
+  if (!contiguous)
+    return "the buffer is not physically contiguous";
+
+  stride = GST_VIDEO_FRAME_PLANE_STRIDE (vframe, 0);
+  for (i = 1; i < GST_VIDEO_FRAME_N_PLANES (vframe); i++)
+    if (GST_VIDEO_FRAME_PLANE_STRIDE (vframe, i) != stride)
+      return "the planes have different strides";
+
+  return NULL;
+}
+
+/*
+ * gst_ce_imgenc_stage_frame
+ *
+ * Copies a frame the codec can't read in place into a contiguous buffer
+ * of the staging pool, converting it in the same pass if needed, and
+ * replaces the mapping of @vframe. The buffer is kept by the job until
+ * the image is encoded, images in flight have a buffer each.
+ */
+static gboolean
+gst_ce_imgenc_stage_frame (GstCeImgEnc * ce_imgenc, GstVideoFrame * vframe,
+    const gchar * reason, GstCeImgEncJob * job)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstVideoFrame staging;
+  GstAllocationParams params;
+  GstStructure *config;
+
+  if (reason != priv->staging_reason) {
+    if (GST_VIDEO_FRAME_FORMAT (vframe) != priv->video_format)
+      GST_INFO_OBJECT (ce_imgenc, "converting the input frames to %s",
+          gst_video_format_to_string (priv->video_format));
+    else
+      GST_WARNING_OBJECT (ce_imgenc, "copying the input frames, %s", reason);
+    priv->staging_reason = reason;
+  }
+
+  if (!priv->staging_pool) {
+    gst_allocation_params_init (&params);
+    params.align = 31;
+
+    priv->staging_pool = gst_buffer_pool_new ();
+    config = gst_buffer_pool_get_config (priv->staging_pool);
+    gst_buffer_pool_config_set_params (config, NULL,
+        GST_VIDEO_INFO_SIZE (&priv->staging_info), 1, 0);
+    gst_buffer_pool_config_set_allocator (config, priv->allocator, &params);
+    if (!gst_buffer_pool_set_config (priv->staging_pool, config) ||
+        !gst_buffer_pool_set_active (priv->staging_pool, TRUE)) {
+      gst_object_unref (priv->staging_pool);
+      priv->staging_pool = NULL;
+      return FALSE;
+    }
+  }
+
+  if (gst_buffer_pool_acquire_buffer (priv->staging_pool, &job->staging,
+          NULL) != GST_FLOW_OK)
+    return FALSE;
+
+  if (!gst_video_frame_map (&staging, &priv->staging_info, job->staging,
+          GST_MAP_WRITE))
+    goto fail;
+
+  if (!gst_ce_convert_frame (&staging, vframe)) {
+    gst_video_frame_unmap (&staging);
+    goto fail;
+  }
+
+  gst_video_frame_unmap (vframe);
+  *vframe = staging;
+
+  return TRUE;
+
+fail:
+  gst_buffer_replace (&job->staging, NULL);
+  return FALSE;
+}
+
+/*
+ * gst_ce_imgenc_prepare_job
+ *
+ * Gets the input planes of the frame and an output buffer for it, and
+ * gives the codec the params changed since the last image. The job is
+ * marked dropped if there is no output buffer, its frame is left for the
+ * caller to finish in order.
+ */
+static GstFlowReturn
+gst_ce_imgenc_prepare_job (GstCeImgEnc * ce_imgenc,
+    GstVideoCodecFrame * frame, GstCeImgEncJob * job)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (ce_imgenc);
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncClass *klass =
+      GST_CE_IMGENC_CLASS (G_OBJECT_GET_CLASS (ce_imgenc));
+  GstVideoInfo *info = &priv->input_state->info;
+  GstVideoFrame vframe;
+  GstCeContigBufMeta *meta;
+  gint i = 0;
+  gint current_pitch;
+  gboolean contiguous;
+  const gchar *reason;
+  gboolean update_buffer_info = FALSE;
+  IMGENC1_DynamicParams *dyn_params;
+  GstCeStats *stats = NULL;
+  GstClockTime last = 0;
+
+  job->frame = frame;
+  job->staging = NULL;
+  job->outbuf = NULL;
+  job->bytes = 0;
+  job->done = FALSE;
+  job->failed = FALSE;
+  job->dropped = FALSE;
+
+  if (priv->stats_enabled)
+    stats = priv->stats;
+
+  GST_CE_STATS_START (stats, last);
+
+  contiguous = gst_ce_is_buffer_contiguous (frame->input_buffer);
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_CONTIGUITY, last);
+
+  /* Fill planes pointer */
+  if (!gst_video_frame_map (&vframe, info, frame->input_buffer, GST_MAP_READ))
+    goto fail_map;
+
+  /* Only copy the layouts the codec can't read in place */
+  reason = gst_ce_imgenc_check_layout (ce_imgenc, &vframe, contiguous);
+  if (reason) {
+    if (!gst_ce_imgenc_stage_frame (ce_imgenc, &vframe, reason, job)) {
+      gst_video_frame_unmap (&vframe);
+      goto fail_copy;
+    }
+    GST_CE_STATS_LAP (stats, GST_CE_STATS_COPY, last);
+  } else if (priv->staging_reason) {
+    GST_INFO_OBJECT (ce_imgenc, "input frames read in place again");
+    priv->staging_reason = NULL;
+  }
+
+  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (&vframe); i++) {
+    job->planes[i] = (XDAS_Int8 *) GST_VIDEO_FRAME_PLANE_DATA (&vframe, i);
+    job->strides[i] = GST_VIDEO_FRAME_PLANE_STRIDE (&vframe, i);
+    priv->inbuf_desc.descs[i].buf = job->planes[i];
+  }
+
+  current_pitch = GST_VIDEO_FRAME_PLANE_STRIDE (&vframe, 0);
+
+  gst_video_frame_unmap (&vframe);
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_MAP, last);
+
+  if (priv->frame_pitch != current_pitch) {
+    GST_OBJECT_LOCK (ce_imgenc);
+    priv->frame_pitch = current_pitch;
+    switch (priv->video_format) {
+      case GST_VIDEO_FORMAT_UYVY:
+        ce_imgenc->codec_dyn_params->captureWidth = priv->frame_pitch / 2;
+        break;
+      case GST_VIDEO_FORMAT_NV12:
+        ce_imgenc->codec_dyn_params->captureWidth = priv->frame_pitch;
+        break;
+      default:
+        ce_imgenc->codec_dyn_params->captureWidth = 0;
+    }
+    priv->dyn_params_pending = TRUE;
+    update_buffer_info = TRUE;
+    GST_OBJECT_UNLOCK (ce_imgenc);
+  }
+
+  /* Pre-encode process */
+  GST_CE_STATS_START (stats, last);
+  if (klass->pre_process
+      && !klass->pre_process (ce_imgenc, frame->input_buffer))
+    goto fail_pre_encode;
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_PRE_PROCESS, last);
+
+  /* Apply all the dynamic params changed since the last frame at once */
+  dyn_params = NULL;
+  GST_OBJECT_LOCK (ce_imgenc);
+  if (priv->dyn_params_pending)
+    dyn_params = gst_ce_imgenc_copy_dynamic_params (ce_imgenc);
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  if (dyn_params) {
+    if (!gst_ce_imgenc_set_dynamic_params (ce_imgenc, dyn_params)
+        && update_buffer_info)
+      goto fail_set_buffer_stride;
+
+    if (update_buffer_info
+        && !gst_ce_imgenc_get_buffer_info (ce_imgenc, dyn_params))
+      goto fail_set_buffer_stride;
+  }
+
+  /* Making sure the output buffer pool is configured */
+  if (priv->first_buffer && gst_pad_check_reconfigure (encoder->srcpad)) {
+    gst_video_encoder_negotiate (GST_VIDEO_ENCODER (encoder));
+    priv->first_buffer = FALSE;
+  }
+
+  /* Allocate output buffer */
+  GST_CE_STATS_START (stats, last);
+  if (gst_buffer_pool_acquire_buffer (GST_BUFFER_POOL_CAST (priv->outbuf_pool),
+          &job->outbuf, NULL) != GST_FLOW_OK) {
+    job->outbuf = NULL;
+    goto fail_alloc;
+  }
+
+  if (!gst_buffer_map (job->outbuf, &job->info_out, GST_MAP_WRITE)) {
+    gst_buffer_unref (job->outbuf);
+    job->outbuf = NULL;
+    goto fail_alloc;
+  }
+
+  priv->outbuf_desc.descs[0].buf = (XDAS_Int8 *) job->info_out.data;
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_ALLOC, last);
+
+  return GST_FLOW_OK;
+
+fail_map:
+  {
+    GST_ERROR_OBJECT (encoder, "failed to map input buffer");
+    return GST_FLOW_ERROR;
+  }
+fail_copy:
+  {
+    GST_ERROR_OBJECT (encoder, "failed to copy the input frame");
+    return GST_FLOW_ERROR;
+  }
+fail_set_buffer_stride:
+  {
+    gst_buffer_replace (&job->staging, NULL);
+    GST_ERROR_OBJECT (encoder, "failed to set buffer stride");
+    return GST_FLOW_ERROR;
+  }
+fail_alloc:
+  {
+    gst_buffer_replace (&job->staging, NULL);
+    GST_INFO_OBJECT (ce_imgenc, "Failed to get output buffer, frame dropped");
+    job->dropped = TRUE;
+    return GST_FLOW_OK;
+  }
+fail_pre_encode:
+  {
+    gst_buffer_replace (&job->staging, NULL);
+    GST_ERROR_OBJECT (ce_imgenc, "failed pre-encode process");
+    return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * gst_ce_imgenc_finish_job
+ *
+ * Wraps up the encoded image of the job and finishes its frame.
+ */
+static GstFlowReturn
+gst_ce_imgenc_finish_job (GstCeImgEnc * ce_imgenc, GstCeImgEncJob * job)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (ce_imgenc);
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncClass *klass =
+      GST_CE_IMGENC_CLASS (G_OBJECT_GET_CLASS (ce_imgenc));
+  GstVideoCodecFrame *frame = job->frame;
+  GstBuffer *outbuf = job->outbuf;
+  GstFlowReturn flow_ret;
+  GstCeStats *stats = NULL;
+  GstClockTime last = 0;
+  GstClockTime post_start;
+  GstCeEncodeMeta *encode_meta;
+
+  if (priv->stats_enabled)
+    stats = priv->stats;
+
+  GST_CE_STATS_START (stats, last);
+
+  GST_DEBUG_OBJECT (ce_imgenc,
+      "encoded an output buffer of size %" G_GSIZE_FORMAT " at addr %p",
+      job->bytes, job->info_out.data);
+
+  gst_buffer_unmap (outbuf, &job->info_out);
+  gst_ce_slice_buffer_resize (GST_CE_SLICE_BUFFER_POOL_CAST (priv->outbuf_pool),
+      outbuf, job->bytes);
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_RESIZE, last);
+
+  /* Every image is an intra frame */
+  encode_meta = gst_ce_encode_meta_set (outbuf);
+  encode_meta->frame_type = GST_CE_ENCODE_FRAME_I;
+  encode_meta->bytes = job->bytes;
+  encode_meta->encode_duration = job->duration;
+
+  gst_ce_imgenc_rate_control (ce_imgenc, job->bytes);
+
+  /* Post-encode process (JPEG encoder doesn't have a post-encode process) */
+  post_start = gst_util_get_timestamp ();
+  if (klass->post_process && !klass->post_process (ce_imgenc, outbuf))
+    goto fail_post_encode;
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_POST_PROCESS, last);
+
+  gst_ce_imgenc_update_latency (ce_imgenc,
+      job->duration + gst_util_get_timestamp () - post_start);
+
+  GST_DEBUG_OBJECT (ce_imgenc, "frame encoded succesfully");
+
+  /* Before the frame is finished, while the input is still ours */
+  gst_ce_imgenc_encode_thumbnail (ce_imgenc, job);
+  gst_buffer_replace (&job->staging, NULL);
+
+  frame->output_buffer = outbuf;
+
+  if (priv->snapshot_capture)
+    priv->snapshot_buffer = gst_buffer_ref (outbuf);
+
+  flow_ret = gst_video_encoder_finish_frame (encoder, frame);
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_PUSH, last);
+
+  return flow_ret;
+
+fail_post_encode:
+  {
+    gst_buffer_replace (&job->staging, NULL);
+    GST_ERROR_OBJECT (ce_imgenc, "failed post-encode process");
     return GST_FLOW_ERROR;
   }
-fail_encode:
-  {
-    gst_buffer_unmap (outbuf, &info_out);
-    GST_ERROR_OBJECT (ce_imgenc,
-        "failed encode process with extended error: 0x%x",
-        (unsigned int) out_args.extendedError);
-    return GST_FLOW_ERROR;
+}
+
+/*
+ * gst_ce_imgenc_encode_frame
+ *
+ * Encodes the frame with the codec and finishes it.
+ */
+static GstFlowReturn
+gst_ce_imgenc_encode_frame (GstCeImgEnc * ce_imgenc,
+    GstVideoCodecFrame * frame)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncClass *klass =
+      GST_CE_IMGENC_CLASS (G_OBJECT_GET_CLASS (ce_imgenc));
+  GstCeImgEncJob job;
+  IMGENC1_InArgs in_args;
+  IMGENC1_OutArgs out_args;
+  GstFlowReturn flow_ret;
+  gint ret = IMGENC1_EFAIL;
+  GstCeStats *stats = NULL;
+  GstClockTime last = 0;
+  GstClockTime start;
+  gsize tile_bytes;
+  guint tile;
+
+  /* The images still encoded in parallel go out first */
+  flow_ret = gst_ce_imgenc_finish_jobs (ce_imgenc, 0);
+  if (flow_ret != GST_FLOW_OK)
+    return flow_ret;
+
+  flow_ret = gst_ce_imgenc_prepare_job (ce_imgenc, frame, &job);
+  if (flow_ret != GST_FLOW_OK)
+    return flow_ret;
+
+  if (job.dropped) {
+    frame->output_buffer = NULL;
+    return gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (ce_imgenc),
+        frame);
+  }
+
+  if (priv->stats_enabled)
+    stats = priv->stats;
+
+  /* Set output and input arguments for the encode process */
+  in_args.size = sizeof (IIMGENC1_InArgs);
+  out_args.size = sizeof (IMGENC1_OutArgs);
+
+  /* Encode process, a call per tile joined behind the previous ones */
+  GST_CE_STATS_START (stats, last);
+  start = gst_util_get_timestamp ();
+  for (tile = 0; tile < priv->n_tiles; tile++) {
+    if (priv->n_tiles > 1 && !gst_ce_imgenc_set_tile (ce_imgenc, job.planes,
+            job.strides, job.info_out.data, job.bytes, tile))
+      goto fail_set_tile;
+
+    ret = IMGENC1_process (ce_imgenc->codec_handle, &priv->inbuf_desc,
+        &priv->outbuf_desc, &in_args, &out_args);
+
+    if (IMGENC1_EOK != ret)
+      goto fail_encode;
+
+    tile_bytes = out_args.bytesGenerated;
+    if (priv->n_tiles > 1 && !klass->join_tile (ce_imgenc, job.info_out.data,
+            job.bytes, &tile_bytes, tile, priv->n_tiles))
+      goto fail_join_tile;
+    job.bytes += tile_bytes;
+  }
+
+  /* The next image starts with a whole tile again, its first tile
+   * gives the height back to the codec */
+  if (priv->n_tiles > 1)
+    priv->outbuf_desc.descs[0].bufSize = priv->outbuf_size;
+
+  job.duration = gst_util_get_timestamp () - start;
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_PROCESS, last);
+
+  return gst_ce_imgenc_finish_job (ce_imgenc, &job);
+
+fail_encode:
+  {
+    gst_buffer_unmap (job.outbuf, &job.info_out);
+    gst_buffer_replace (&job.staging, NULL);
+    GST_ERROR_OBJECT (ce_imgenc,
+        "failed encode process with extended error: 0x%x",
+        (unsigned int) out_args.extendedError);
+    return GST_FLOW_ERROR;
+  }
+fail_set_tile:
+  {
+    gst_buffer_unmap (job.outbuf, &job.info_out);
+    gst_buffer_replace (&job.staging, NULL);
+    GST_ERROR_OBJECT (ce_imgenc, "failed to set tile %u", tile);
+    return GST_FLOW_ERROR;
+  }
+fail_join_tile:
+  {
+    gst_buffer_unmap (job.outbuf, &job.info_out);
+    gst_buffer_replace (&job.staging, NULL);
+    GST_ERROR_OBJECT (ce_imgenc, "failed to join tile %u", tile);
+    return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * gst_ce_imgenc_worker_loop
+ *
+ * Encodes the images handed to the worker with its own codec instance,
+ * until it is asked to quit by pushing the worker itself.
+ */
+static gpointer
+gst_ce_imgenc_worker_loop (gpointer data)
+{
+  GstCeImgEncWorker *worker = data;
+  GstCeImgEnc *ce_imgenc = worker->ce_imgenc;
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncJob *job;
+  IMGENC1_InArgs in_args;
+  IMGENC1_OutArgs out_args;
+  IMGENC1_Status enc_status;
+  GstClockTime start;
+  gboolean update;
+  gint ret, i;
+
+  in_args.size = sizeof (IIMGENC1_InArgs);
+  out_args.size = sizeof (IMGENC1_OutArgs);
+  enc_status.size = sizeof (IMGENC1_Status);
+  enc_status.data.buf = NULL;
+
+  while ((job = g_async_queue_pop (worker->queue)) != (gpointer) worker) {
+    /* Catch up with the params given to the main codec instance */
+    update = FALSE;
+    GST_OBJECT_LOCK (ce_imgenc);
+    if (worker->dyn_params_serial != priv->dyn_params_serial) {
+      memcpy (worker->dyn_params, priv->dyn_params_copy,
+          priv->dyn_params_copy->size);
+      for (i = 0; i < priv->inbuf_desc.numBufs; i++)
+        worker->inbuf_desc.descs[i].bufSize =
+            priv->inbuf_desc.descs[i].bufSize;
+      worker->outbuf_desc.descs[0].bufSize = priv->outbuf_size;
+      worker->dyn_params_serial = priv->dyn_params_serial;
+      update = TRUE;
+    }
+    GST_OBJECT_UNLOCK (ce_imgenc);
+
+    if (update && IMGENC1_control (worker->codec_handle, XDM_SETPARAMS,
+            worker->dyn_params, &enc_status) != IMGENC1_EOK)
+      GST_WARNING_OBJECT (ce_imgenc, "worker %u failed to set dynamic "
+          "parameters, status error %x", worker->index,
+          (guint) enc_status.extendedError);
+
+    for (i = 0; i < worker->inbuf_desc.numBufs; i++)
+      worker->inbuf_desc.descs[i].buf = job->planes[i];
+    worker->outbuf_desc.descs[0].buf = (XDAS_Int8 *) job->info_out.data;
+
+    start = gst_util_get_timestamp ();
+    ret = IMGENC1_process (worker->codec_handle, &worker->inbuf_desc,
+        &worker->outbuf_desc, &in_args, &out_args);
+    job->duration = gst_util_get_timestamp () - start;
+    job->bytes = out_args.bytesGenerated;
+    job->error = out_args.extendedError;
+    job->failed = IMGENC1_EOK != ret;
+
+    GST_LOG_OBJECT (ce_imgenc, "worker %u encoded %" G_GSIZE_FORMAT
+        " bytes", worker->index, job->bytes);
+
+    g_mutex_lock (&priv->jobs_lock);
+    job->done = TRUE;
+    g_cond_broadcast (&priv->jobs_cond);
+    g_mutex_unlock (&priv->jobs_lock);
+  }
+
+  return NULL;
+}
+
+/*
+ * gst_ce_imgenc_start_workers
+ *
+ * Creates the workers of the n-instances mode, each one with its own
+ * engine handle, codec instance and thread. The main codec instance
+ * keeps the configuration and encodes the tiled images, which are never
+ * encoded in parallel.
+ */
+static gboolean
+gst_ce_imgenc_start_workers (GstCeImgEnc * ce_imgenc)
+{
+  GstCeImgEncClass *klass =
+      GST_CE_IMGENC_CLASS (G_OBJECT_GET_CLASS (ce_imgenc));
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncWorker *worker;
+  guint n_instances, i;
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  n_instances = priv->n_instances;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  if (n_instances < 2)
+    return TRUE;
+
+  if (priv->n_tiles > 1) {
+    GST_WARNING_OBJECT (ce_imgenc, "tiled images are encoded serially");
+    return TRUE;
+  }
+
+  priv->workers = g_new0 (GstCeImgEncWorker *, n_instances);
+  for (i = 0; i < n_instances; i++) {
+    worker = g_slice_new0 (GstCeImgEncWorker);
+    priv->workers[priv->n_workers++] = worker;
+    worker->ce_imgenc = ce_imgenc;
+    worker->index = i;
+
+    worker->engine_handle = Engine_open ((Char *) CODEC_ENGINE, NULL, NULL);
+    if (!worker->engine_handle)
+      goto fail_open;
+
+    worker->codec_handle = IMGENC1_create (worker->engine_handle,
+        (Char *) klass->codec_name, ce_imgenc->codec_params);
+    if (!worker->codec_handle)
+      goto fail_open;
+
+    /* The params are taken along with the first image */
+    worker->dyn_params = g_malloc0 (ce_imgenc->codec_dyn_params->size);
+    worker->dyn_params_serial = priv->dyn_params_serial - 1;
+    worker->inbuf_desc.numBufs = priv->inbuf_desc.numBufs;
+    worker->outbuf_desc.numBufs = 1;
+
+    worker->queue = g_async_queue_new ();
+    worker->thread = g_thread_new ("ce_imgenc", gst_ce_imgenc_worker_loop,
+        worker);
+  }
+
+  /* Each image in flight holds a whole output buffer */
+  priv->next_worker = 0;
+  priv->max_jobs = CLAMP (priv->num_out_buffers - 1, 1, 2 * n_instances);
+
+  GST_DEBUG_OBJECT (ce_imgenc, "encoding with %u codec instances, up to %u "
+      "images in flight", n_instances, priv->max_jobs);
+
+  return TRUE;
+
+fail_open:
+  {
+    GST_ERROR_OBJECT (ce_imgenc, "failed to open codec instance %u", i);
+    gst_ce_imgenc_stop_workers (ce_imgenc);
+    return FALSE;
+  }
+}
+
+/*
+ * gst_ce_imgenc_stop_workers
+ *
+ * Lets the workers encode what they were given and closes them. Their
+ * images are dropped, for those worth keeping call
+ * gst_ce_imgenc_finish_jobs() first.
+ */
+static void
+gst_ce_imgenc_stop_workers (GstCeImgEnc * ce_imgenc)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncWorker *worker;
+  guint i;
+
+  for (i = 0; i < priv->n_workers; i++) {
+    worker = priv->workers[i];
+    if (worker->thread) {
+      g_async_queue_push (worker->queue, worker);
+      g_thread_join (worker->thread);
+    }
+  }
+
+  gst_ce_imgenc_drop_jobs (ce_imgenc);
+
+  for (i = 0; i < priv->n_workers; i++) {
+    worker = priv->workers[i];
+    if (worker->queue)
+      g_async_queue_unref (worker->queue);
+    if (worker->codec_handle)
+      IMGENC1_delete (worker->codec_handle);
+    if (worker->engine_handle)
+      Engine_close (worker->engine_handle);
+    g_free (worker->dyn_params);
+    g_slice_free (GstCeImgEncWorker, worker);
+  }
+
+  g_free (priv->workers);
+  priv->workers = NULL;
+  priv->n_workers = 0;
+}
+
+/*
+ * gst_ce_imgenc_finish_jobs
+ *
+ * Finishes the frames encoded in parallel in their input order, waiting
+ * for the oldest ones until no more than max_jobs are left in flight.
+ */
+static GstFlowReturn
+gst_ce_imgenc_finish_jobs (GstCeImgEnc * ce_imgenc, guint max_jobs)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncJob *job;
+  GstFlowReturn flow_ret = GST_FLOW_OK, ret;
+
+  g_mutex_lock (&priv->jobs_lock);
+  while ((job = g_queue_peek_head (&priv->jobs))) {
+    if (!job->done) {
+      if (g_queue_get_length (&priv->jobs) <= max_jobs)
+        break;
+      g_cond_wait (&priv->jobs_cond, &priv->jobs_lock);
+      continue;
+    }
+    g_queue_pop_head (&priv->jobs);
+    g_mutex_unlock (&priv->jobs_lock);
+
+    if (job->failed) {
+      GST_ERROR_OBJECT (ce_imgenc,
+          "failed encode process with extended error: 0x%x",
+          (guint) job->error);
+      gst_buffer_unmap (job->outbuf, &job->info_out);
+      gst_buffer_unref (job->outbuf);
+      gst_buffer_replace (&job->staging, NULL);
+      job->frame->output_buffer = NULL;
+      gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (ce_imgenc),
+          job->frame);
+      ret = GST_FLOW_ERROR;
+    } else if (job->dropped) {
+      job->frame->output_buffer = NULL;
+      ret = gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (ce_imgenc),
+          job->frame);
+    } else {
+      ret = gst_ce_imgenc_finish_job (ce_imgenc, job);
+    }
+    g_slice_free (GstCeImgEncJob, job);
+
+    if (flow_ret == GST_FLOW_OK)
+      flow_ret = ret;
+
+    g_mutex_lock (&priv->jobs_lock);
+  }
+  g_mutex_unlock (&priv->jobs_lock);
+
+  return flow_ret;
+}
+
+/*
+ * gst_ce_imgenc_drop_jobs
+ *
+ * Waits for the images in flight and drops them, along with their
+ * frames.
+ */
+static void
+gst_ce_imgenc_drop_jobs (GstCeImgEnc * ce_imgenc)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncJob *job;
+
+  g_mutex_lock (&priv->jobs_lock);
+  while ((job = g_queue_peek_head (&priv->jobs))) {
+    if (!job->done) {
+      g_cond_wait (&priv->jobs_cond, &priv->jobs_lock);
+      continue;
+    }
+    g_queue_pop_head (&priv->jobs);
+
+    if (job->outbuf) {
+      gst_buffer_unmap (job->outbuf, &job->info_out);
+      gst_buffer_unref (job->outbuf);
+    }
+    gst_buffer_replace (&job->staging, NULL);
+    gst_video_codec_frame_unref (job->frame);
+    g_slice_free (GstCeImgEncJob, job);
   }
-fail_post_encode:
-  {
-    GST_ERROR_OBJECT (ce_imgenc, "failed post-encode process");
-    return GST_FLOW_ERROR;
+  g_mutex_unlock (&priv->jobs_lock);
+}
+
+/*
+ * gst_ce_imgenc_dispatch_frame
+ *
+ * Hands the frame to the next worker, round-robin, and finishes the
+ * frames whose images are ready. Waits for the oldest image first if
+ * max_jobs are in flight already.
+ */
+static GstFlowReturn
+gst_ce_imgenc_dispatch_frame (GstCeImgEnc * ce_imgenc,
+    GstVideoCodecFrame * frame)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstCeImgEncWorker *worker;
+  GstCeImgEncJob *job;
+  GstFlowReturn flow_ret;
+
+  flow_ret = gst_ce_imgenc_finish_jobs (ce_imgenc, priv->max_jobs - 1);
+  if (flow_ret != GST_FLOW_OK)
+    return flow_ret;
+
+  job = g_slice_new0 (GstCeImgEncJob);
+  flow_ret = gst_ce_imgenc_prepare_job (ce_imgenc, frame, job);
+  if (flow_ret != GST_FLOW_OK) {
+    g_slice_free (GstCeImgEncJob, job);
+    return flow_ret;
+  }
+
+  /* A dropped frame still goes out behind the images in flight */
+  if (job->dropped)
+    job->done = TRUE;
+
+  g_mutex_lock (&priv->jobs_lock);
+  g_queue_push_tail (&priv->jobs, job);
+  g_mutex_unlock (&priv->jobs_lock);
+
+  if (!job->dropped) {
+    worker = priv->workers[priv->next_worker];
+    priv->next_worker = (priv->next_worker + 1) % priv->n_workers;
+    g_async_queue_push (worker->queue, job);
+  }
+
+  return gst_ce_imgenc_finish_jobs (ce_imgenc, G_MAXUINT);
+}
+
+/*
+ * gst_ce_imgenc_restore_quality
+ *
+ * Goes back to the quality set by the user once the rate control is
+ * turned off. Call with the object lock held.
+ */
+static void
+gst_ce_imgenc_restore_quality (GstCeImgEnc * ce_imgenc)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+
+  if (priv->frame_budget || priv->target_bitrate)
+    return;
+
+  priv->rc_bytes = 0;
+  priv->rc_frames = 0;
+
+  if (ce_imgenc->codec_dyn_params->qValue != priv->quality) {
+    ce_imgenc->codec_dyn_params->qValue = priv->quality;
+    priv->dyn_params_pending = TRUE;
+  }
+}
+
+/*
+ * gst_ce_imgenc_drop_snapshot_frame
+ *
+ * Lets go of the frame held for a snapshot, if any.
+ */
+static GstFlowReturn
+gst_ce_imgenc_drop_snapshot_frame (GstCeImgEnc * ce_imgenc)
+{
+  GstVideoCodecFrame *frame = ce_imgenc->priv->snapshot_frame;
+
+  if (!frame)
+    return GST_FLOW_OK;
+
+  ce_imgenc->priv->snapshot_frame = NULL;
+  frame->output_buffer = NULL;
+  return gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (ce_imgenc), frame);
+}
+
+/**
+ *  Encodes the input data from GstVideoEncoder class
+ */
+static GstFlowReturn
+gst_ce_imgenc_handle_frame (GstVideoEncoder * encoder,
+    GstVideoCodecFrame * frame)
+{
+  GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (encoder);
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstFlowReturn ret;
+  gboolean snapshot, skip_static;
+
+  if (gst_ce_imgenc_decimate (ce_imgenc, frame)) {
+    frame->output_buffer = NULL;
+    return gst_video_encoder_finish_frame (encoder, frame);
+  }
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  snapshot = priv->snapshot;
+  skip_static = priv->skip_static;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  /* Frames asked for by a burst are encoded no matter what */
+  if (priv->snapshot_burst) {
+    priv->snapshot_burst--;
+    return gst_ce_imgenc_encode_frame (ce_imgenc, frame);
+  }
+
+  /* Holding the latest frame is all it takes until a snapshot is taken */
+  ret = gst_ce_imgenc_drop_snapshot_frame (ce_imgenc);
+  if (snapshot) {
+    priv->snapshot_frame = frame;
+    return ret;
+  }
+
+  /* The gap events must not overtake the images in flight */
+  if (skip_static && priv->n_workers) {
+    ret = gst_ce_imgenc_finish_jobs (ce_imgenc, 0);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  if (gst_ce_imgenc_static_drop (ce_imgenc, frame))
+    return gst_ce_imgenc_finish_static (ce_imgenc, frame);
+
+  if (priv->n_workers)
+    return gst_ce_imgenc_dispatch_frame (ce_imgenc, frame);
+
+  return gst_ce_imgenc_encode_frame (ce_imgenc, frame);
+}
+
+/*
+ * gst_ce_imgenc_snapshot
+ *
+ * Class handler of the snapshot signal. Takes the stream lock, so the
+ * held frame is encoded in between the frames of the streaming thread.
+ */
+static GstSample *
+gst_ce_imgenc_snapshot (GstCeImgEnc * ce_imgenc, guint frames)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (ce_imgenc);
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  GstVideoCodecFrame *frame;
+  GstSample *sample = NULL;
+  GstFlowReturn ret;
+  GstCaps *caps;
+
+  frames = MAX (frames, 1);
+
+  GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+
+  frame = priv->snapshot_frame;
+  priv->snapshot_frame = NULL;
+
+  if (!frame) {
+    GST_DEBUG_OBJECT (ce_imgenc, "no image held, encoding the next %u",
+        frames);
+    priv->snapshot_burst = frames;
+    goto done;
+  }
+
+  GST_DEBUG_OBJECT (ce_imgenc, "taking a snapshot of %u images", frames);
+  priv->snapshot_burst = frames - 1;
+
+  priv->snapshot_capture = TRUE;
+  ret = gst_ce_imgenc_encode_frame (ce_imgenc, frame);
+  priv->snapshot_capture = FALSE;
+
+  if (ret != GST_FLOW_OK)
+    GST_WARNING_OBJECT (ce_imgenc, "pushing the snapshot returned %s",
+        gst_flow_get_name (ret));
+
+  if (priv->snapshot_buffer) {
+    caps = gst_pad_get_current_caps (GST_VIDEO_ENCODER_SRC_PAD (encoder));
+    sample = gst_sample_new (priv->snapshot_buffer, caps,
+        &encoder->output_segment, NULL);
+    if (caps)
+      gst_caps_unref (caps);
+    gst_buffer_unref (priv->snapshot_buffer);
+    priv->snapshot_buffer = NULL;
+  }
+
+done:
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+
+  return sample;
+}
+
+/*
+ * gst_ce_imgenc_request_new_pad
+ *
+ * Adds the thumbnail pad, if the subclass has a template for it.
+ */
+static GstPad *
+gst_ce_imgenc_request_new_pad (GstElement * element, GstPadTemplate * templ,
+    const gchar * name, const GstCaps * caps)
+{
+  GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (element);
+  GstPad *pad;
+
+  if (GST_PAD_TEMPLATE_DIRECTION (templ) != GST_PAD_SRC ||
+      g_strcmp0 (GST_PAD_TEMPLATE_NAME_TEMPLATE (templ),
+          GST_CE_IMGENC_THUMBNAIL))
+    return NULL;
+
+  GST_OBJECT_LOCK (ce_imgenc);
+  if (ce_imgenc->priv->thumb_pad) {
+    GST_OBJECT_UNLOCK (ce_imgenc);
+    GST_WARNING_OBJECT (ce_imgenc, "there is a thumbnail pad already");
+    return NULL;
+  }
+  pad = gst_pad_new_from_template (templ, GST_CE_IMGENC_THUMBNAIL);
+  ce_imgenc->priv->thumb_pad = pad;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  if (GST_PAD_IS_ACTIVE (GST_VIDEO_ENCODER_SINK_PAD (ce_imgenc)))
+    gst_pad_set_active (pad, TRUE);
+  gst_element_add_pad (element, pad);
+
+  return pad;
+}
+
+/*
+ * gst_ce_imgenc_release_pad
+ *
+ * Removes the thumbnail pad along with its codec instance.
+ */
+static void
+gst_ce_imgenc_release_pad (GstElement * element, GstPad * pad)
+{
+  GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (element);
+
+  GST_VIDEO_ENCODER_STREAM_LOCK (ce_imgenc);
+  GST_OBJECT_LOCK (ce_imgenc);
+  if (ce_imgenc->priv->thumb_pad != pad) {
+    GST_OBJECT_UNLOCK (ce_imgenc);
+    GST_VIDEO_ENCODER_STREAM_UNLOCK (ce_imgenc);
+    return;
+  }
+  ce_imgenc->priv->thumb_pad = NULL;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  gst_ce_imgenc_close_thumbnail (ce_imgenc);
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (ce_imgenc);
+
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (element, pad);
+}
+
+/*
+ * gst_ce_imgenc_snapshot_event
+ *
+ * Takes a snapshot if the event asks for it, consuming the event.
+ */
+static gboolean
+gst_ce_imgenc_snapshot_event (GstCeImgEnc * ce_imgenc, GstEvent * event)
+{
+  const GstStructure *structure;
+  GstSample *sample;
+  guint frames = 1;
+
+  if (!gst_event_has_name (event, GST_CE_IMGENC_SNAPSHOT))
+    return FALSE;
+
+  structure = gst_event_get_structure (event);
+  gst_structure_get_uint (structure, "frames", &frames);
+
+  sample = gst_ce_imgenc_snapshot (ce_imgenc, frames);
+  if (sample)
+    gst_sample_unref (sample);
+
+  gst_event_unref (event);
+  return TRUE;
+}
+
+static gboolean
+gst_ce_imgenc_sink_event (GstVideoEncoder * encoder, GstEvent * event)
+{
+  GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (encoder);
+
+  GstPad *pad = NULL;
+
+  if ((GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM ||
+          GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM_OOB) &&
+      gst_ce_imgenc_snapshot_event (ce_imgenc, event))
+    return TRUE;
+
+  /* The thumbnail stream follows the main one */
+  GST_OBJECT_LOCK (ce_imgenc);
+  if (ce_imgenc->priv->thumb_pad)
+    pad = gst_object_ref (ce_imgenc->priv->thumb_pad);
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
+  if (pad) {
+    switch (GST_EVENT_TYPE (event)) {
+      case GST_EVENT_SEGMENT:
+        ce_imgenc->priv->thumb_segment_pending = TRUE;
+        break;
+      case GST_EVENT_EOS:
+      case GST_EVENT_FLUSH_START:
+      case GST_EVENT_FLUSH_STOP:
+        gst_pad_push_event (pad, gst_event_ref (event));
+        break;
+      default:
+        break;
+    }
+    gst_object_unref (pad);
+  }
+
+  /* The images in flight and the one held for a snapshot belong to the
+   * flushed frames */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+    gst_ce_imgenc_drop_jobs (ce_imgenc);
+
+    GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+    if (ce_imgenc->priv->snapshot_frame) {
+      gst_video_codec_frame_unref (ce_imgenc->priv->snapshot_frame);
+      ce_imgenc->priv->snapshot_frame = NULL;
+    }
+    GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+  }
+
+  return GST_VIDEO_ENCODER_CLASS (parent_class)->sink_event (encoder, event);
+}
+
+static gboolean
+gst_ce_imgenc_src_event (GstVideoEncoder * encoder, GstEvent * event)
+{
+  GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (encoder);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM &&
+      gst_ce_imgenc_snapshot_event (ce_imgenc, event))
+    return TRUE;
+
+  return GST_VIDEO_ENCODER_CLASS (parent_class)->src_event (encoder, event);
+}
+
+static GstFlowReturn
+gst_ce_imgenc_finish (GstVideoEncoder * encoder)
+{
+  GstCeImgEnc *ce_imgenc = GST_CE_IMGENC (encoder);
+  GstFlowReturn ret;
+
+  ret = gst_ce_imgenc_finish_jobs (ce_imgenc, 0);
+  if (ret != GST_FLOW_OK) {
+    gst_ce_imgenc_drop_snapshot_frame (ce_imgenc);
+    return ret;
   }
+
+  return gst_ce_imgenc_drop_snapshot_frame (ce_imgenc);
 }
 
 /**
@@ -692,9 +2624,6 @@ gst_ce_imgenc_set_property (GObject * object,
   GstCeImgEncClass *klass;
   IMGENC1_Params *params;
   IMGENC1_DynamicParams *dyn_params;
-  IMGENC1_Status enc_status;
-
-  gint ret = IMGENC1_EFAIL;
 
   /* Get a pointer of the right type */
   ce_imgenc = GST_CE_IMGENC (object);
@@ -712,9 +2641,11 @@ gst_ce_imgenc_set_property (GObject * object,
   /* Check the argument id to see which argument we're setting */
   switch (prop_id) {
     case PROP_QUALITY_VALUE:
-      dyn_params->qValue = g_value_get_int (value);
+      dyn_params->qValue = ce_imgenc->priv->quality = g_value_get_int (value);
       GST_LOG_OBJECT (ce_imgenc,
           "setting quality value to %li", dyn_params->qValue);
+      /* Applied by the streaming thread before encoding the next frame */
+      ce_imgenc->priv->dyn_params_pending = TRUE;
       break;
     case PROP_NUM_OUT_BUFFERS:
       ce_imgenc->priv->num_out_buffers = g_value_get_int (value);
@@ -727,21 +2658,88 @@ gst_ce_imgenc_set_property (GObject * object,
       GST_LOG_OBJECT (ce_imgenc,
           "setting min output buffer size percentage to %d",
           ce_imgenc->priv->outbuf_size_percentage);
+      break;
+    case PROP_ENABLE_STATS:
+      ce_imgenc->priv->stats_enabled = g_value_get_boolean (value);
+      if (ce_imgenc->priv->stats_enabled)
+        gst_ce_stats_reset (ce_imgenc->priv->stats);
+      GST_LOG_OBJECT (ce_imgenc, "setting stats enabled to %d",
+          ce_imgenc->priv->stats_enabled);
+      break;
+    case PROP_LOW_LATENCY:
+      ce_imgenc->priv->low_latency = g_value_get_boolean (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting low latency to %d",
+          ce_imgenc->priv->low_latency);
+      break;
+    case PROP_SKIP_STATIC:
+      ce_imgenc->priv->skip_static = g_value_get_boolean (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting skip static to %d",
+          ce_imgenc->priv->skip_static);
+      break;
+    case PROP_STATIC_THRESHOLD:
+      ce_imgenc->priv->static_threshold = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting static threshold to %u",
+          ce_imgenc->priv->static_threshold);
+      break;
+    case PROP_STATIC_MAX_SKIP:
+      ce_imgenc->priv->static_max_skip = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting static max skip to %u",
+          ce_imgenc->priv->static_max_skip);
+      break;
+    case PROP_MAX_FRAMERATE:
+      ce_imgenc->priv->max_fps_num = gst_value_get_fraction_numerator (value);
+      ce_imgenc->priv->max_fps_den =
+          gst_value_get_fraction_denominator (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting max framerate to %d/%d",
+          ce_imgenc->priv->max_fps_num, ce_imgenc->priv->max_fps_den);
+      break;
+    case PROP_TARGET_BITRATE:
+      ce_imgenc->priv->target_bitrate = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting target bitrate to %u",
+          ce_imgenc->priv->target_bitrate);
+      gst_ce_imgenc_restore_quality (ce_imgenc);
+      break;
+    case PROP_FRAME_BUDGET:
+      ce_imgenc->priv->frame_budget = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting frame budget to %u",
+          ce_imgenc->priv->frame_budget);
+      gst_ce_imgenc_restore_quality (ce_imgenc);
+      break;
+    case PROP_MIN_QUALITY:
+      ce_imgenc->priv->min_quality = g_value_get_int (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting min quality to %d",
+          ce_imgenc->priv->min_quality);
+      break;
+    case PROP_MAX_QUALITY_STEP:
+      ce_imgenc->priv->max_quality_step = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting max quality step to %u",
+          ce_imgenc->priv->max_quality_step);
+      break;
+    case PROP_SNAPSHOT:
+      ce_imgenc->priv->snapshot = g_value_get_boolean (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting snapshot mode to %d",
+          ce_imgenc->priv->snapshot);
+      break;
+    case PROP_TILE_HEIGHT:
+      ce_imgenc->priv->tile_height = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting tile height to %u",
+          ce_imgenc->priv->tile_height);
+      break;
+    case PROP_THUMBNAIL_FACTOR:
+      ce_imgenc->priv->thumb_factor = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting thumbnail factor to %u",
+          ce_imgenc->priv->thumb_factor);
+      break;
+    case PROP_N_INSTANCES:
+      ce_imgenc->priv->n_instances = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_imgenc, "setting number of instances to %u",
+          ce_imgenc->priv->n_instances);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 
-  if (ce_imgenc->codec_handle) {
-    enc_status.size = sizeof (IMGENC1_Status);
-    enc_status.data.buf = NULL;
-    ret = IMGENC1_control (ce_imgenc->codec_handle, XDM_SETPARAMS,
-        dyn_params, &enc_status);
-    if (IMGENC1_EOK != ret)
-      GST_WARNING_OBJECT (ce_imgenc, "failed to set dynamic parameters, "
-          "status error %x, %d", (guint) enc_status.extendedError, ret);
-  }
-
   GST_OBJECT_UNLOCK (ce_imgenc);
   return;
 }
@@ -781,6 +2779,53 @@ gst_ce_imgenc_get_property (GObject * object,
     case PROP_MIN_SIZE_PERCENTAGE:
       g_value_set_int (value, ce_imgenc->priv->outbuf_size_percentage);
       break;
+    case PROP_ENABLE_STATS:
+      g_value_set_boolean (value, ce_imgenc->priv->stats_enabled);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value,
+          gst_ce_stats_get_structure (ce_imgenc->priv->stats));
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, ce_imgenc->priv->low_latency);
+      break;
+    case PROP_SKIP_STATIC:
+      g_value_set_boolean (value, ce_imgenc->priv->skip_static);
+      break;
+    case PROP_STATIC_THRESHOLD:
+      g_value_set_uint (value, ce_imgenc->priv->static_threshold);
+      break;
+    case PROP_STATIC_MAX_SKIP:
+      g_value_set_uint (value, ce_imgenc->priv->static_max_skip);
+      break;
+    case PROP_MAX_FRAMERATE:
+      gst_value_set_fraction (value, ce_imgenc->priv->max_fps_num,
+          ce_imgenc->priv->max_fps_den);
+      break;
+    case PROP_TARGET_BITRATE:
+      g_value_set_uint (value, ce_imgenc->priv->target_bitrate);
+      break;
+    case PROP_FRAME_BUDGET:
+      g_value_set_uint (value, ce_imgenc->priv->frame_budget);
+      break;
+    case PROP_MIN_QUALITY:
+      g_value_set_int (value, ce_imgenc->priv->min_quality);
+      break;
+    case PROP_MAX_QUALITY_STEP:
+      g_value_set_uint (value, ce_imgenc->priv->max_quality_step);
+      break;
+    case PROP_SNAPSHOT:
+      g_value_set_boolean (value, ce_imgenc->priv->snapshot);
+      break;
+    case PROP_TILE_HEIGHT:
+      g_value_set_uint (value, ce_imgenc->priv->tile_height);
+      break;
+    case PROP_THUMBNAIL_FACTOR:
+      g_value_set_uint (value, ce_imgenc->priv->thumb_factor);
+      break;
+    case PROP_N_INSTANCES:
+      g_value_set_uint (value, ce_imgenc->priv->n_instances);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -903,6 +2948,21 @@ gst_ce_imgenc_reset (GstVideoEncoder * encoder)
     IMGENC1_delete (ce_imgenc->codec_handle);
     ce_imgenc->codec_handle = NULL;
   }
+  gst_ce_imgenc_close_thumbnail (ce_imgenc);
+  gst_ce_imgenc_stop_workers (ce_imgenc);
+  gst_ce_imgenc_free_staging (ce_imgenc);
+
+  gst_ce_latency_reset (&priv->latency);
+  priv->latency_reported_low = FALSE;
+  gst_ce_static_scene_reset (&priv->static_scene);
+  priv->static_skipped = 0;
+  if (priv->snapshot_frame) {
+    gst_video_codec_frame_unref (priv->snapshot_frame);
+    priv->snapshot_frame = NULL;
+  }
+  priv->snapshot_burst = 0;
+  priv->decimate_period = GST_CLOCK_TIME_NONE;
+  priv->decimate_next = GST_CLOCK_TIME_NONE;
 
   GST_OBJECT_LOCK (ce_imgenc);
 
@@ -914,7 +2974,9 @@ gst_ce_imgenc_reset (GstVideoEncoder * encoder)
   params->maxScans = XDM_DEFAULT;
 
   /* Set default values for codec dynamic params */
-  dyn_params->qValue = PROP_QUALITY_VALUE_DEFAULT;
+  dyn_params->qValue = priv->quality = PROP_QUALITY_VALUE_DEFAULT;
+  priv->rc_bytes = 0;
+  priv->rc_frames = 0;
   dyn_params->numAU = XDM_DEFAULT;
   dyn_params->generateHeader = XDM_DEFAULT;
 
@@ -930,28 +2992,57 @@ gst_ce_imgenc_reset (GstVideoEncoder * encoder)
 }
 
 /**
- * Set current dynamic parameters 
+ * Takes a snapshot of codec_dyn_params, with all the pending changes,
+ * for the codec calls made without the object lock. The changes are
+ * no longer pending afterwards.
+ * Call with the object lock held.
+ */
+static IMGENC1_DynamicParams *
+gst_ce_imgenc_copy_dynamic_params (GstCeImgEnc * ce_imgenc)
+{
+  GstCeImgEncPrivate *priv = ce_imgenc->priv;
+  gsize size = ce_imgenc->codec_dyn_params->size;
+
+  if (!priv->dyn_params_copy || priv->dyn_params_copy->size != size)
+    priv->dyn_params_copy = g_realloc (priv->dyn_params_copy, size);
+  memcpy (priv->dyn_params_copy, ce_imgenc->codec_dyn_params, size);
+  priv->dyn_params_pending = FALSE;
+
+  return priv->dyn_params_copy;
+}
+
+/**
+ * Set the dynamic parameters taken by gst_ce_imgenc_copy_dynamic_params().
+ * A change the codec refused is dropped, it isn't tried again with every
+ * image.
+ * Call without the object lock.
  */
 static gboolean
-gst_ce_imgenc_set_dynamic_params (GstCeImgEnc * ce_imgenc)
+gst_ce_imgenc_set_dynamic_params (GstCeImgEnc * ce_imgenc,
+    IMGENC1_DynamicParams * dyn_params)
 {
   IMGENC1_Status enc_status;
   gint ret = IMGENC1_EFAIL;
 
   g_return_val_if_fail (ce_imgenc->codec_handle, FALSE);
-  g_return_val_if_fail (ce_imgenc->codec_dyn_params, FALSE);
+  g_return_val_if_fail (dyn_params, FALSE);
 
   enc_status.size = sizeof (IMGENC1_Status);
   enc_status.data.buf = NULL;
 
   ret = IMGENC1_control (ce_imgenc->codec_handle, XDM_SETPARAMS,
-      ce_imgenc->codec_dyn_params, &enc_status);
+      dyn_params, &enc_status);
   if (IMGENC1_EOK != ret) {
     GST_WARNING_OBJECT (ce_imgenc, "Failed to set dynamic parameters, "
-        "status error %x, %d", (unsigned int) enc_status.extendedError, ret);
+        "status error %x, %d, dropping the change",
+        (unsigned int) enc_status.extendedError, ret);
     return FALSE;
   }
 
+  GST_OBJECT_LOCK (ce_imgenc);
+  ce_imgenc->priv->dyn_params_serial++;
+  GST_OBJECT_UNLOCK (ce_imgenc);
+
   return TRUE;
 }
 
@@ -959,7 +3050,8 @@ gst_ce_imgenc_set_dynamic_params (GstCeImgEnc * ce_imgenc)
  * Get buffer information from video codec 
  */
 static gboolean
-gst_ce_imgenc_get_buffer_info (GstCeImgEnc * ce_imgenc)
+gst_ce_imgenc_get_buffer_info (GstCeImgEnc * ce_imgenc,
+    IMGENC1_DynamicParams * dyn_params)
 {
   GstCeImgEncPrivate *priv = ce_imgenc->priv;
   IMGENC1_Status enc_status;
@@ -967,13 +3059,13 @@ gst_ce_imgenc_get_buffer_info (GstCeImgEnc * ce_imgenc)
   gint ret = IMGENC1_EFAIL;
 
   g_return_val_if_fail (ce_imgenc->codec_handle, FALSE);
-  g_return_val_if_fail (ce_imgenc->codec_dyn_params, FALSE);
+  g_return_val_if_fail (dyn_params, FALSE);
 
   enc_status.size = sizeof (IMGENC1_Status);
   enc_status.data.buf = NULL;
 
   ret = IMGENC1_control (ce_imgenc->codec_handle, XDM_GETBUFINFO,
-      ce_imgenc->codec_dyn_params, &enc_status);
+      dyn_params, &enc_status);
   if (IMGENC1_EOK != ret) {
     GST_ERROR_OBJECT (ce_imgenc, "failed to get buffer information, "
         "status error %x, %d", (guint) enc_status.extendedError, ret);
@@ -986,7 +3078,8 @@ gst_ce_imgenc_get_buffer_info (GstCeImgEnc * ce_imgenc)
         priv->inbuf_desc.descs[i].bufSize);
   }
 
-  priv->outbuf_size = enc_status.bufInfo.minOutBufSize[0];
+  /* Room for all the tiles of the image */
+  priv->outbuf_size = enc_status.bufInfo.minOutBufSize[0] * priv->n_tiles;
   priv->outbuf_desc.numBufs = 1;
   priv->outbuf_desc.descs[0].bufSize = (XDAS_Int32) priv->outbuf_size;
 
@@ -994,3 +3087,40 @@ gst_ce_imgenc_get_buffer_info (GstCeImgEnc * ce_imgenc)
 
   return TRUE;
 }
+
+/**
+ * gst_ce_imgenc_update_dynamic_params:
+ * @ce_imgenc: a #GstCeImgEnc
+ *
+ * Lets #GstCeImgEnc sub-classes notify that they modified
+ * codec_dyn_params. All the changes made since the last encoded image
+ * are given to the codec in a single call right before encoding the
+ * next one, from the streaming thread.
+ *
+ * Call with the object lock held, the same lock must be held while
+ * modifying codec_dyn_params.
+ */
+void
+gst_ce_imgenc_update_dynamic_params (GstCeImgEnc * ce_imgenc)
+{
+  g_return_if_fail (GST_IS_CE_IMGENC (ce_imgenc));
+
+  ce_imgenc->priv->dyn_params_pending = TRUE;
+}
+
+/**
+ * gst_ce_imgenc_set_max_height:
+ * @ce_imgenc: a #GstCeImgEnc
+ * @max_height: tallest image the codec takes, or 0 if there is no limit
+ *
+ * Lets #GstCeImgEnc sub-classes tell about the height limit of their
+ * codec. Taller images are encoded in horizontal tiles if the sub-class
+ * implements join_tile. Call it from the sub-class init function.
+ */
+void
+gst_ce_imgenc_set_max_height (GstCeImgEnc * ce_imgenc, guint max_height)
+{
+  g_return_if_fail (GST_IS_CE_IMGENC (ce_imgenc));
+
+  ce_imgenc->priv->max_height = max_height;
+}
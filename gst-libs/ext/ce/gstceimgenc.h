@@ -33,6 +33,25 @@ G_BEGIN_DECLS typedef struct _GstCeImgEnc GstCeImgEnc;
 typedef struct _GstCeImgEncClass GstCeImgEncClass;
 typedef struct _GstCeImgEncPrivate GstCeImgEncPrivate;
 
+/**
+ * GST_CE_IMGENC_SNAPSHOT:
+ *
+ * Name of the custom event that takes a snapshot when the snapshot
+ * property is enabled. It is accepted both upstream on the src pad and
+ * downstream on the sink pad. Its optional "frames" unsigned integer
+ * field asks for a burst of consecutive images.
+ */
+#define GST_CE_IMGENC_SNAPSHOT "GstCeSnapshot"
+
+/**
+ * GST_CE_IMGENC_THUMBNAIL:
+ *
+ * Name of the src request pad template a subclass may add to get a
+ * thumbnail of every encoded image, scaled down from the same input
+ * buffer and encoded by a second codec instance.
+ */
+#define GST_CE_IMGENC_THUMBNAIL "thumbnail"
+
 struct _GstCeImgEnc
 {
   GstVideoEncoder parent;
@@ -66,6 +85,16 @@ struct _GstCeImgEnc
  * @post_process:   Optional.
  *                  Called after the base class finished the encoding 
  *                  process. Allows output buffer transformations.
+ * @set_tiling:     Optional.
+ *                  Called when the format is set with the width of the
+ *                  image and the height of its tiles, or 0 if the image is
+ *                  encoded whole. Allows subclass to adapt the codec
+ *                  params to the tiles.
+ * @join_tile:      Optional, tiled encoding is only done if available.
+ *                  Called after each tile is encoded, right behind the
+ *                  previous ones at offset of data. Allows subclass to join
+ *                  it to them, updating size to the bytes left.
+ * @snapshot:       Class handler of the "snapshot" action signal.
  * 
  * Subclasses can override any of the available virtual methods or not, as
  * needed. At minimum @codec_name should be filled.
@@ -85,9 +114,16 @@ struct _GstCeImgEncClass
     gboolean (*pre_process) (GstCeImgEnc * ce_imgenc, GstBuffer * input_buffer);
     gboolean (*post_process) (GstCeImgEnc * ce_imgenc,
       GstBuffer * output_buffer);
+    gboolean (*set_tiling) (GstCeImgEnc * ce_imgenc, gint width,
+      gint tile_height);
+    gboolean (*join_tile) (GstCeImgEnc * ce_imgenc, guint8 * data,
+      gsize offset, gsize * size, guint tile, guint n_tiles);
+
+  /* action signals */
+  GstSample *(*snapshot) (GstCeImgEnc * ce_imgenc, guint frames);
 
   /*< private > */
-  gpointer _gst_reserved[GST_PADDING_LARGE];
+  gpointer _gst_reserved[GST_PADDING_LARGE - 3];
 };
 
 #define GST_TYPE_CE_IMGENC \
@@ -103,5 +139,10 @@ struct _GstCeImgEncClass
 
 GType gst_ce_imgenc_get_type (void);
 
+void gst_ce_imgenc_update_dynamic_params (GstCeImgEnc * ce_imgenc);
+
+void gst_ce_imgenc_set_max_height (GstCeImgEnc * ce_imgenc,
+    guint max_height);
+
 G_END_DECLS
 #endif /* __GST_CE_IMGENC_H__ */
@@ -0,0 +1,142 @@
+/*
+ * gstcestartcode.c
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+/*
+ * Start code scanner for the byte-stream output of the codecs.
+ *
+ * Every start code has three zero bytes, while the payload of a NAL unit
+ * rarely has zeros thanks to the emulation prevention bytes. The scanner
+ * tests whole blocks for zero bytes and only looks at the bytes of the
+ * blocks that have any. The block test is picked at build time: NEON or
+ * SSE2 when the compiler targets them, or a word at a time otherwise,
+ * which is what the ARM9 core of the DM36x ends up using.
+ */
+
+#include "gstcestartcode.h"
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define START_CODE_NEON
+#define START_CODE_BLOCK 16
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#define START_CODE_SSE2
+#define START_CODE_BLOCK 16
+#else
+#define START_CODE_BLOCK sizeof (gulong)
+#endif
+
+#define IS_START_CODE(p) \
+    ((p)[0] == 0 && (p)[1] == 0 && (p)[2] == 0 && (p)[3] == 1)
+
+/*
+ * gst_ce_block_has_zero
+ *
+ * Whether any of the START_CODE_BLOCK bytes at @data is zero. @data is
+ * aligned to the block size.
+ */
+static inline gboolean
+gst_ce_block_has_zero (const guint8 * data)
+{
+#if defined (START_CODE_NEON)
+  uint8x16_t zeros = vceqq_u8 (vld1q_u8 (data), vdupq_n_u8 (0));
+  uint64x2_t halves = vreinterpretq_u64_u8 (zeros);
+
+  return (vgetq_lane_u64 (halves, 0) | vgetq_lane_u64 (halves, 1)) != 0;
+#elif defined (START_CODE_SSE2)
+  __m128i block = _mm_load_si128 ((const __m128i *) data);
+
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (block, _mm_setzero_si128 ())) != 0;
+#else
+  const gulong ones = ~0UL / 0xff;
+  const gulong highs = ones << 7;
+  gulong word = *(const gulong *) data;
+
+  return ((word - ones) & ~word & highs) != 0;
+#endif
+}
+
+/**
+ * gst_ce_find_start_code:
+ * @data: the byte-stream data
+ * @size: size of @data in bytes
+ *
+ * Looks for the first 0x00000001 start code that fits entirely in the
+ * first @size bytes of @data.
+ *
+ * Returns: the offset of the start code or -1 if there is none
+ */
+gint
+gst_ce_find_start_code (const guint8 * data, gint size)
+{
+  const guint8 *p, *block, *last;
+
+  if (!data || size < GST_CE_START_CODE_LENGTH)
+    return -1;
+
+  p = data;
+  /* Last position where a start code still fits */
+  last = data + size - GST_CE_START_CODE_LENGTH;
+
+  /* Head, until the blocks are aligned */
+  while (p <= last && ((gsize) p & (START_CODE_BLOCK - 1))) {
+    if (IS_START_CODE (p))
+      return p - data;
+    p++;
+  }
+
+  /* The first zero of a start code lives in a block with zeros, so the
+   * other blocks can be skipped altogether */
+  while (p + START_CODE_BLOCK <= data + size) {
+    block = p;
+    p += START_CODE_BLOCK;
+
+    if (!gst_ce_block_has_zero (block))
+      continue;
+
+    for (; block < p && block <= last; block++)
+      if (block[0] == 0 && IS_START_CODE (block))
+        return block - data;
+  }
+
+  /* Tail */
+  for (; p <= last; p++)
+    if (IS_START_CODE (p))
+      return p - data;
+
+  return -1;
+}
+
+/**
+ * gst_ce_start_code_impl:
+ *
+ * Returns: the name of the block test the scanner was built with
+ */
+const gchar *
+gst_ce_start_code_impl (void)
+{
+#if defined (START_CODE_NEON)
+  return "neon";
+#elif defined (START_CODE_SSE2)
+  return "sse2";
+#else
+  return "word";
+#endif
+}
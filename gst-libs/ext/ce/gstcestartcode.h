@@ -0,0 +1,36 @@
+/*
+ * gstcestartcode.h
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifndef __GST_CE_START_CODE_H__
+#define __GST_CE_START_CODE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Length of the 0x00000001 start code in front of each NAL unit */
+#define GST_CE_START_CODE_LENGTH 4
+
+gint gst_ce_find_start_code (const guint8 * data, gint size);
+
+const gchar *gst_ce_start_code_impl (void);
+
+G_END_DECLS
+#endif /*__GST_CE_START_CODE_H__*/
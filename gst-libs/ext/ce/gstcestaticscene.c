@@ -0,0 +1,101 @@
+/*
+ * gstcestaticscene.c
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+/*
+ * Static scene detector for the input of the encoders.
+ *
+ * Comparing whole frames would cost as much ARM time as the encode saves,
+ * so only a sparse grid of the luma plane is looked at: each point sums a
+ * short run of bytes, which also averages out most of the sensor noise.
+ * A frame is static when no more than threshold points moved away from
+ * the reference, which is the last frame that was not found static.
+ */
+
+#include <string.h>
+
+#include "gstcestaticscene.h"
+
+void
+gst_ce_static_scene_reset (GstCeStaticScene * scene)
+{
+  g_return_if_fail (scene);
+
+  scene->valid = FALSE;
+}
+
+/**
+ * gst_ce_static_scene_update:
+ *
+ * Samples the luma plane of frame and compares it with the reference.
+ * Returns TRUE if the frame is static. Otherwise, or when force is set,
+ * the frame becomes the new reference.
+ */
+gboolean
+gst_ce_static_scene_update (GstCeStaticScene * scene, GstVideoFrame * frame,
+    guint threshold, gboolean force)
+{
+  guint32 samples[GST_CE_STATIC_SCENE_GRID * GST_CE_STATIC_SCENE_GRID];
+  const guint8 *data, *run;
+  gint stride, row_bytes, height;
+  guint changed = 0;
+  guint32 sum;
+  gint x, y, i, j;
+
+  g_return_val_if_fail (scene, FALSE);
+  g_return_val_if_fail (frame, FALSE);
+
+  data = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
+  stride = GST_VIDEO_FRAME_PLANE_STRIDE (frame, 0);
+  height = GST_VIDEO_FRAME_COMP_HEIGHT (frame, 0);
+  /* Packed formats interleave the chroma, which is sampled as well */
+  row_bytes = GST_VIDEO_FRAME_COMP_WIDTH (frame, 0) *
+      GST_VIDEO_FRAME_COMP_PSTRIDE (frame, 0);
+
+  if (row_bytes < GST_CE_STATIC_SCENE_RUN || height < 1) {
+    scene->valid = FALSE;
+    return FALSE;
+  }
+
+  for (i = 0, y = 0; y < GST_CE_STATIC_SCENE_GRID; y++) {
+    const guint8 *line = data +
+        (2 * y + 1) * height / (2 * GST_CE_STATIC_SCENE_GRID) * stride;
+
+    for (x = 0; x < GST_CE_STATIC_SCENE_GRID; x++, i++) {
+      run = line + (2 * x + 1) * (row_bytes - GST_CE_STATIC_SCENE_RUN) /
+          (2 * GST_CE_STATIC_SCENE_GRID);
+
+      for (sum = 0, j = 0; j < GST_CE_STATIC_SCENE_RUN; j++)
+        sum += run[j];
+      samples[i] = sum;
+
+      if (ABS ((gint32) sum - (gint32) scene->samples[i]) >
+          GST_CE_STATIC_SCENE_RUN * GST_CE_STATIC_SCENE_NOISE)
+        changed++;
+    }
+  }
+
+  if (scene->valid && !force && changed <= threshold)
+    return TRUE;
+
+  memcpy (scene->samples, samples, sizeof (samples));
+  scene->valid = TRUE;
+
+  return FALSE;
+}
@@ -0,0 +1,51 @@
+/*
+ * gstcestaticscene.h
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifndef __GST_CE_STATIC_SCENE_H__
+#define __GST_CE_STATIC_SCENE_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/* Points sampled on each row and column of the luma plane */
+#define GST_CE_STATIC_SCENE_GRID 32
+/* Consecutive luma bytes summed at each point */
+#define GST_CE_STATIC_SCENE_RUN 8
+/* Mean luma change per byte a point tolerates before it counts as changed */
+#define GST_CE_STATIC_SCENE_NOISE 4
+
+typedef struct _GstCeStaticScene GstCeStaticScene;
+
+struct _GstCeStaticScene
+{
+  /*< private > */
+  gboolean valid;
+  guint32 samples[GST_CE_STATIC_SCENE_GRID * GST_CE_STATIC_SCENE_GRID];
+};
+
+void gst_ce_static_scene_reset (GstCeStaticScene * scene);
+
+gboolean gst_ce_static_scene_update (GstCeStaticScene * scene,
+    GstVideoFrame * frame, guint threshold, gboolean force);
+
+G_END_DECLS
+#endif /*__GST_CE_STATIC_SCENE_H__*/
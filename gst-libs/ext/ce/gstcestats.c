@@ -0,0 +1,288 @@
+/*
+ * gstcestats.c
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+/*
+ * Per phase encoding time statistics.
+ *
+ * Minimum, maximum and average are kept over all the samples since the
+ * last reset, while the 99th percentile is computed over a window with
+ * the most recent samples, so reading the stats stays cheap.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gstcestats.h"
+
+/* The reported latency has this fraction of headroom over the maximum,
+ * so small increases don't trigger a new report for every frame */
+#define GST_CE_LATENCY_HEADROOM 8
+
+/* Number of recent samples used to compute the percentile */
+#define GST_CE_STATS_WINDOW 512
+
+typedef struct
+{
+  guint64 count;
+  GstClockTime total;
+  GstClockTime min;
+  GstClockTime max;
+
+  GstClockTime window[GST_CE_STATS_WINDOW];
+  guint next;
+} GstCeStatsEntry;
+
+struct _GstCeStats
+{
+  GMutex lock;
+  GstCeStatsEntry entries[GST_CE_STATS_N_PHASES];
+};
+
+static const gchar *phase_names[GST_CE_STATS_N_PHASES] = {
+  "contiguity",
+  "map",
+  "copy",
+  "alloc",
+  "pre-process",
+  "process",
+  "post-process",
+  "resize",
+  "push"
+};
+
+/**
+ * gst_ce_stats_new:
+ *
+ * Returns: (transfer full): a new #GstCeStats, free with
+ * gst_ce_stats_free().
+ */
+GstCeStats *
+gst_ce_stats_new (void)
+{
+  GstCeStats *stats;
+
+  stats = g_slice_new0 (GstCeStats);
+  g_mutex_init (&stats->lock);
+  gst_ce_stats_reset (stats);
+
+  return stats;
+}
+
+void
+gst_ce_stats_free (GstCeStats * stats)
+{
+  g_return_if_fail (stats);
+
+  g_mutex_clear (&stats->lock);
+  g_slice_free (GstCeStats, stats);
+}
+
+/**
+ * gst_ce_stats_reset:
+ * @stats: a #GstCeStats
+ *
+ * Discards all the samples collected so far.
+ */
+void
+gst_ce_stats_reset (GstCeStats * stats)
+{
+  gint i;
+
+  g_return_if_fail (stats);
+
+  g_mutex_lock (&stats->lock);
+  memset (stats->entries, 0, sizeof (stats->entries));
+  for (i = 0; i < GST_CE_STATS_N_PHASES; i++)
+    stats->entries[i].min = GST_CLOCK_TIME_NONE;
+  g_mutex_unlock (&stats->lock);
+}
+
+/**
+ * gst_ce_stats_add:
+ * @stats: a #GstCeStats
+ * @phase: the timed phase
+ * @duration: the time spent on @phase
+ *
+ * Adds a new sample for @phase.
+ */
+void
+gst_ce_stats_add (GstCeStats * stats, GstCeStatsPhase phase,
+    GstClockTime duration)
+{
+  GstCeStatsEntry *entry;
+
+  g_return_if_fail (stats);
+  g_return_if_fail (phase < GST_CE_STATS_N_PHASES);
+
+  entry = &stats->entries[phase];
+
+  g_mutex_lock (&stats->lock);
+  entry->count++;
+  entry->total += duration;
+  entry->min = MIN (entry->min, duration);
+  entry->max = MAX (entry->max, duration);
+  entry->window[entry->next] = duration;
+  entry->next = (entry->next + 1) % GST_CE_STATS_WINDOW;
+  g_mutex_unlock (&stats->lock);
+}
+
+/**
+ * gst_ce_stats_lap:
+ * @stats: a #GstCeStats
+ * @phase: the phase that just finished
+ * @last: (inout): the time @phase started, updated to the current time
+ *
+ * Adds a sample for @phase with the time elapsed since @last, so
+ * consecutive phases can be timed with a single clock read each.
+ */
+void
+gst_ce_stats_lap (GstCeStats * stats, GstCeStatsPhase phase,
+    GstClockTime * last)
+{
+  GstClockTime now;
+
+  g_return_if_fail (last);
+
+  now = gst_util_get_timestamp ();
+  gst_ce_stats_add (stats, phase, now - *last);
+  *last = now;
+}
+
+static gint
+gst_ce_stats_compare (gconstpointer a, gconstpointer b)
+{
+  GstClockTime ta = *(const GstClockTime *) a;
+  GstClockTime tb = *(const GstClockTime *) b;
+
+  return (ta > tb) - (ta < tb);
+}
+
+/**
+ * gst_ce_stats_get_structure:
+ * @stats: a #GstCeStats
+ *
+ * Builds a "GstCeStats" structure with a field for each phase. Each
+ * field holds a structure with the number of samples and the minimum,
+ * average, maximum and 99th percentile durations in nanoseconds.
+ *
+ * Returns: (transfer full): the stats structure.
+ */
+GstStructure *
+gst_ce_stats_get_structure (GstCeStats * stats)
+{
+  GstClockTime window[GST_CE_STATS_WINDOW];
+  GstStructure *structure, *phase;
+  GstCeStatsEntry *entry;
+  guint64 count;
+  GstClockTime min, avg, max, p99;
+  guint samples;
+  gint i;
+
+  g_return_val_if_fail (stats, NULL);
+
+  structure = gst_structure_new_empty ("GstCeStats");
+
+  for (i = 0; i < GST_CE_STATS_N_PHASES; i++) {
+    entry = &stats->entries[i];
+
+    g_mutex_lock (&stats->lock);
+    count = entry->count;
+    min = count ? entry->min : 0;
+    max = entry->max;
+    avg = count ? entry->total / count : 0;
+    samples = MIN (count, GST_CE_STATS_WINDOW);
+    memcpy (window, entry->window, samples * sizeof (GstClockTime));
+    g_mutex_unlock (&stats->lock);
+
+    p99 = 0;
+    if (samples) {
+      qsort (window, samples, sizeof (GstClockTime), gst_ce_stats_compare);
+      p99 = window[(samples * 99 - 1) / 100];
+    }
+
+    phase = gst_structure_new (phase_names[i],
+        "count", G_TYPE_UINT64, count,
+        "min", G_TYPE_UINT64, min,
+        "avg", G_TYPE_UINT64, avg,
+        "max", G_TYPE_UINT64, max, "p99", G_TYPE_UINT64, p99, NULL);
+    gst_structure_set (structure, phase_names[i], GST_TYPE_STRUCTURE, phase,
+        NULL);
+    gst_structure_free (phase);
+  }
+
+  return structure;
+}
+
+/**
+ * gst_ce_latency_reset:
+ * @latency: a #GstCeLatency
+ *
+ * Discards all the samples and the reported latency.
+ */
+void
+gst_ce_latency_reset (GstCeLatency * latency)
+{
+  g_return_if_fail (latency);
+
+  memset (latency, 0, sizeof (GstCeLatency));
+  latency->reported = GST_CLOCK_TIME_NONE;
+}
+
+/**
+ * gst_ce_latency_add:
+ * @latency: a #GstCeLatency
+ * @sample: the time spent encoding the last frame
+ * @report: (out): the latency currently reported
+ *
+ * Adds the encoding time of a new frame. A new latency is reported
+ * as soon as the maximum over the window exceeds the last one reported,
+ * and when it drops below half of it.
+ *
+ * Returns: %TRUE if the latency has to be reported again.
+ */
+gboolean
+gst_ce_latency_add (GstCeLatency * latency, GstClockTime sample,
+    GstClockTime * report)
+{
+  GstClockTime max = 0;
+  guint i;
+
+  g_return_val_if_fail (latency, FALSE);
+  g_return_val_if_fail (report, FALSE);
+
+  latency->samples[latency->next] = sample;
+  latency->next = (latency->next + 1) % GST_CE_LATENCY_WINDOW;
+  if (latency->count < GST_CE_LATENCY_WINDOW)
+    latency->count++;
+
+  for (i = 0; i < latency->count; i++)
+    max = MAX (max, latency->samples[i]);
+
+  if (GST_CLOCK_TIME_IS_VALID (latency->reported) &&
+      max <= latency->reported && max >= latency->reported / 2) {
+    *report = latency->reported;
+    return FALSE;
+  }
+
+  latency->reported = max + max / GST_CE_LATENCY_HEADROOM;
+  *report = latency->reported;
+
+  return TRUE;
+}
@@ -0,0 +1,109 @@
+/*
+ * gstcestats.h
+ *
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifndef __GST_CE_STATS_H__
+#define __GST_CE_STATS_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstCeStatsPhase:
+ * @GST_CE_STATS_CONTIGUITY: checking or making the input contiguous
+ * @GST_CE_STATS_MAP: mapping the input buffer
+ * @GST_CE_STATS_COPY: copying an input the codec can't read in place
+ * @GST_CE_STATS_ALLOC: acquiring and mapping the output buffer
+ * @GST_CE_STATS_PRE_PROCESS: sub-class pre-encode process
+ * @GST_CE_STATS_PROCESS: the codec process call
+ * @GST_CE_STATS_POST_PROCESS: sub-class post-encode process
+ * @GST_CE_STATS_RESIZE: resizing the output slice
+ * @GST_CE_STATS_PUSH: finishing the frame and pushing it downstream
+ *
+ * Phases of the encoding of a frame that are timed separately.
+ */
+typedef enum
+{
+  GST_CE_STATS_CONTIGUITY,
+  GST_CE_STATS_MAP,
+  GST_CE_STATS_COPY,
+  GST_CE_STATS_ALLOC,
+  GST_CE_STATS_PRE_PROCESS,
+  GST_CE_STATS_PROCESS,
+  GST_CE_STATS_POST_PROCESS,
+  GST_CE_STATS_RESIZE,
+  GST_CE_STATS_PUSH,
+  GST_CE_STATS_N_PHASES
+} GstCeStatsPhase;
+
+typedef struct _GstCeStats GstCeStats;
+
+/* Number of recent frames the encoding latency is tracked over */
+#define GST_CE_LATENCY_WINDOW 32
+
+typedef struct _GstCeLatency GstCeLatency;
+
+/**
+ * GstCeLatency:
+ *
+ * Rolling maximum of the time spent encoding the most recent frames,
+ * used to report the latency of the encoders. Embedded in the element,
+ * only touched from the streaming thread.
+ */
+struct _GstCeLatency
+{
+  /*< private > */
+  GstClockTime samples[GST_CE_LATENCY_WINDOW];
+  guint next;
+  guint count;
+  GstClockTime reported;
+};
+
+GstCeStats *gst_ce_stats_new (void);
+void gst_ce_stats_free (GstCeStats * stats);
+void gst_ce_stats_reset (GstCeStats * stats);
+
+void gst_ce_stats_add (GstCeStats * stats, GstCeStatsPhase phase,
+    GstClockTime duration);
+void gst_ce_stats_lap (GstCeStats * stats, GstCeStatsPhase phase,
+    GstClockTime * last);
+
+GstStructure *gst_ce_stats_get_structure (GstCeStats * stats);
+
+void gst_ce_latency_reset (GstCeLatency * latency);
+gboolean gst_ce_latency_add (GstCeLatency * latency, GstClockTime sample,
+    GstClockTime * report);
+
+/*
+ * Timing helpers for the encoding loops. Stats are disabled by passing
+ * a NULL @stats, in which case the clock is not even read.
+ */
+#define GST_CE_STATS_START(stats, last) G_STMT_START {   \
+  if (G_UNLIKELY (stats))                                 \
+    last = gst_util_get_timestamp ();                     \
+} G_STMT_END
+
+#define GST_CE_STATS_LAP(stats, phase, last) G_STMT_START { \
+  if (G_UNLIKELY (stats))                                    \
+    gst_ce_stats_lap (stats, phase, &last);                  \
+} G_STMT_END
+
+G_END_DECLS
+#endif /*__GST_CE_STATS_H__*/
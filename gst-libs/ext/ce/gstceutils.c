@@ -116,6 +116,226 @@ gst_ce_contig_buf_meta_get_info (void)
   return meta_info;
 }
 
+GType
+gst_ce_encode_meta_api_get_type (void)
+{
+  static volatile GType type;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("GstCeEncodeMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+  return type;
+}
+
+static gboolean
+gst_ce_encode_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  GstCeEncodeMeta *emeta = (GstCeEncodeMeta *) meta;
+
+  emeta->frame_type = GST_CE_ENCODE_FRAME_NONE;
+  emeta->bytes = 0;
+  emeta->encode_duration = GST_CLOCK_TIME_NONE;
+  emeta->bitrate = 0;
+  emeta->qp = -1;
+  emeta->temporal_layer = 0;
+  emeta->n_fields = 1;
+  emeta->field_duration[0] = GST_CLOCK_TIME_NONE;
+  emeta->field_duration[1] = GST_CLOCK_TIME_NONE;
+
+  return TRUE;
+}
+
+static gboolean
+gst_ce_encode_meta_transform (GstBuffer * dest, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  GstCeEncodeMeta *emeta = (GstCeEncodeMeta *) meta;
+  GstCeEncodeMeta *dmeta;
+
+  /* The facts still hold for copies of the encoded buffer */
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  dmeta = GST_CE_ENCODE_META_ADD (dest);
+  if (!dmeta)
+    return FALSE;
+
+  dmeta->frame_type = emeta->frame_type;
+  dmeta->bytes = emeta->bytes;
+  dmeta->encode_duration = emeta->encode_duration;
+  dmeta->bitrate = emeta->bitrate;
+  dmeta->qp = emeta->qp;
+  dmeta->temporal_layer = emeta->temporal_layer;
+  dmeta->n_fields = emeta->n_fields;
+  dmeta->field_duration[0] = emeta->field_duration[0];
+  dmeta->field_duration[1] = emeta->field_duration[1];
+
+  return TRUE;
+}
+
+const GstMetaInfo *
+gst_ce_encode_meta_get_info (void)
+{
+  static const GstMetaInfo *meta_info = NULL;
+
+  if (g_once_init_enter (&meta_info)) {
+    const GstMetaInfo *meta =
+        gst_meta_register (gst_ce_encode_meta_api_get_type (),
+        "GstCeEncodeMeta",
+        sizeof (GstCeEncodeMeta),
+        (GstMetaInitFunction) gst_ce_encode_meta_init,
+        (GstMetaFreeFunction) NULL,
+        (GstMetaTransformFunction) gst_ce_encode_meta_transform);
+    g_once_init_leave (&meta_info, meta);
+  }
+  return meta_info;
+}
+
+/**
+ * gst_ce_encode_meta_set:
+ *
+ * Gets the encode meta of an output buffer, adding it if needed. Pooled
+ * buffers may still carry the meta from their previous use, which is
+ * reset to the defaults.
+ */
+GstCeEncodeMeta *
+gst_ce_encode_meta_set (GstBuffer * buffer)
+{
+  GstCeEncodeMeta *meta;
+
+  meta = GST_CE_ENCODE_META_GET (buffer);
+  if (meta)
+    gst_ce_encode_meta_init ((GstMeta *) meta, NULL, buffer);
+  else
+    meta = GST_CE_ENCODE_META_ADD (buffer);
+
+  return meta;
+}
+
+GType
+gst_ce_nal_meta_api_get_type (void)
+{
+  static volatile GType type;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("GstCeNalMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+  return type;
+}
+
+static gboolean
+gst_ce_nal_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  GstCeNalMeta *nmeta = (GstCeNalMeta *) meta;
+
+  nmeta->n_nals = 0;
+  nmeta->nals = NULL;
+  nmeta->allocated = 0;
+
+  return TRUE;
+}
+
+static void
+gst_ce_nal_meta_free (GstMeta * meta, GstBuffer * buffer)
+{
+  GstCeNalMeta *nmeta = (GstCeNalMeta *) meta;
+
+  g_free (nmeta->nals);
+}
+
+static gboolean
+gst_ce_nal_meta_transform (GstBuffer * dest, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  GstCeNalMeta *nmeta = (GstCeNalMeta *) meta;
+  GstCeNalMeta *dmeta;
+  guint i;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  /* The offsets are only valid for copies of the whole buffer */
+  if (((GstMetaTransformCopy *) data)->region)
+    return FALSE;
+
+  dmeta = GST_CE_NAL_META_ADD (dest);
+  if (!dmeta)
+    return FALSE;
+
+  for (i = 0; i < nmeta->n_nals; i++)
+    gst_ce_nal_meta_add_nal (dmeta, nmeta->nals[i].offset,
+        nmeta->nals[i].size, nmeta->nals[i].type);
+
+  return TRUE;
+}
+
+const GstMetaInfo *
+gst_ce_nal_meta_get_info (void)
+{
+  static const GstMetaInfo *meta_info = NULL;
+
+  if (g_once_init_enter (&meta_info)) {
+    const GstMetaInfo *meta =
+        gst_meta_register (gst_ce_nal_meta_api_get_type (),
+        "GstCeNalMeta",
+        sizeof (GstCeNalMeta),
+        (GstMetaInitFunction) gst_ce_nal_meta_init,
+        (GstMetaFreeFunction) gst_ce_nal_meta_free,
+        (GstMetaTransformFunction) gst_ce_nal_meta_transform);
+    g_once_init_leave (&meta_info, meta);
+  }
+  return meta_info;
+}
+
+/**
+ * gst_ce_nal_meta_set:
+ *
+ * Gets the NAL index of an output buffer, adding it if needed. The NAL
+ * units a pooled buffer may still carry from its previous use are
+ * dropped.
+ */
+GstCeNalMeta *
+gst_ce_nal_meta_set (GstBuffer * buffer)
+{
+  GstCeNalMeta *meta;
+
+  meta = GST_CE_NAL_META_GET (buffer);
+  if (meta)
+    meta->n_nals = 0;
+  else
+    meta = GST_CE_NAL_META_ADD (buffer);
+
+  return meta;
+}
+
+/**
+ * gst_ce_nal_meta_add_nal:
+ *
+ * Appends a NAL unit to the index.
+ */
+void
+gst_ce_nal_meta_add_nal (GstCeNalMeta * meta, guint offset, guint size,
+    guint8 type)
+{
+  GstCeNal *nal;
+
+  g_return_if_fail (meta);
+
+  if (meta->n_nals == meta->allocated) {
+    meta->allocated = MAX (8, meta->allocated * 2);
+    meta->nals = g_renew (GstCeNal, meta->nals, meta->allocated);
+  }
+
+  nal = &meta->nals[meta->n_nals++];
+  nal->offset = offset;
+  nal->size = size;
+  nal->type = type;
+}
+
 gboolean
 gst_ce_is_buffer_contiguous (GstBuffer * buffer)
 {
@@ -48,6 +48,98 @@ struct _GstCeContigBufMeta
   guint32 size;
 };
 
+typedef struct _GstCeEncodeMeta GstCeEncodeMeta;
+
+/**
+ * GstCeEncodeFrameType:
+ * @GST_CE_ENCODE_FRAME_NONE: no frame type, as for audio
+ * @GST_CE_ENCODE_FRAME_I: intra frame
+ * @GST_CE_ENCODE_FRAME_P: predicted frame
+ * @GST_CE_ENCODE_FRAME_B: bi-directionally predicted frame
+ * @GST_CE_ENCODE_FRAME_IDR: instantaneous decoder refresh frame
+ *
+ * Type of an encoded frame.
+ */
+typedef enum
+{
+  GST_CE_ENCODE_FRAME_NONE,
+  GST_CE_ENCODE_FRAME_I,
+  GST_CE_ENCODE_FRAME_P,
+  GST_CE_ENCODE_FRAME_B,
+  GST_CE_ENCODE_FRAME_IDR
+} GstCeEncodeFrameType;
+
+/**
+ * GstCeEncodeMeta:
+ * @meta: parent #GstMeta
+ * @frame_type: type of the encoded frame
+ * @bytes: bytes generated by the codec
+ * @encode_duration: time the codec took to encode the frame
+ * @bitrate: target bit rate in force, or 0 if the codec has none
+ * @qp: quantization parameter in force, or -1 if unknown
+ * @temporal_layer: temporal layer the frame belongs to
+ * @n_fields: number of fields in the buffer, 2 for an interlaced field
+ *   pair or 1 otherwise
+ * @field_duration: time the codec took to encode each of the fields
+ *
+ * Metadata
+ * Facts about the encoding of an output buffer, so downstream doesn't
+ * need to parse the bitstream to get them.
+ */
+struct _GstCeEncodeMeta
+{
+  GstMeta meta;
+
+  GstCeEncodeFrameType frame_type;
+  guint32 bytes;
+  GstClockTime encode_duration;
+  gint bitrate;
+  gint qp;
+  guint temporal_layer;
+  guint n_fields;
+  GstClockTime field_duration[2];
+};
+
+typedef struct _GstCeNal GstCeNal;
+typedef struct _GstCeNalMeta GstCeNalMeta;
+
+/**
+ * GstCeNal:
+ * @offset: offset in the buffer of the NAL unit header, after the start
+ *   code or the length prefix
+ * @size: size of the NAL unit, without the start code or length prefix
+ * @type: the nal_unit_type
+ *
+ * Location of a NAL unit in an encoded buffer.
+ */
+struct _GstCeNal
+{
+  guint32 offset;
+  guint32 size;
+  guint8 type;
+};
+
+/**
+ * GstCeNalMeta:
+ * @meta: parent #GstMeta
+ * @n_nals: number of NAL units in the buffer
+ * @nals: the NAL units, in bitstream order
+ *
+ * Metadata
+ * Index of the NAL units of an encoded buffer, so downstream can split
+ * it without scanning the bitstream again.
+ */
+struct _GstCeNalMeta
+{
+  GstMeta meta;
+
+  guint n_nals;
+  GstCeNal *nals;
+
+  /*< private > */
+  guint allocated;
+};
+
 gboolean gst_ce_is_buffer_contiguous (GstBuffer * buffer);
 GType gst_ce_contig_buf_meta_api_get_type (void);
 const GstMetaInfo *gst_ce_contig_buf_meta_get_info (void);
@@ -55,5 +147,21 @@ const GstMetaInfo *gst_ce_contig_buf_meta_get_info (void);
 #define GST_CE_CONTIG_BUF_META_GET(buf) ((GstCeContigBufMeta *)gst_buffer_get_meta(buf, gst_ce_contig_buf_meta_api_get_type()))
 #define GST_CE_CONTIG_BUF_META_ADD(buf) ((GstCeContigBufMeta *)gst_buffer_add_meta(buf, gst_ce_contig_buf_meta_get_info(), NULL))
 
+GType gst_ce_encode_meta_api_get_type (void);
+const GstMetaInfo *gst_ce_encode_meta_get_info (void);
+GstCeEncodeMeta *gst_ce_encode_meta_set (GstBuffer * buffer);
+#define GST_CE_ENCODE_META_API_TYPE (gst_ce_encode_meta_api_get_type())
+#define GST_CE_ENCODE_META_GET(buf) ((GstCeEncodeMeta *)gst_buffer_get_meta(buf, gst_ce_encode_meta_api_get_type()))
+#define GST_CE_ENCODE_META_ADD(buf) ((GstCeEncodeMeta *)gst_buffer_add_meta(buf, gst_ce_encode_meta_get_info(), NULL))
+
+GType gst_ce_nal_meta_api_get_type (void);
+const GstMetaInfo *gst_ce_nal_meta_get_info (void);
+GstCeNalMeta *gst_ce_nal_meta_set (GstBuffer * buffer);
+void gst_ce_nal_meta_add_nal (GstCeNalMeta * meta, guint offset, guint size,
+    guint8 type);
+#define GST_CE_NAL_META_API_TYPE (gst_ce_nal_meta_api_get_type())
+#define GST_CE_NAL_META_GET(buf) ((GstCeNalMeta *)gst_buffer_get_meta(buf, gst_ce_nal_meta_api_get_type()))
+#define GST_CE_NAL_META_ADD(buf) ((GstCeNalMeta *)gst_buffer_add_meta(buf, gst_ce_nal_meta_get_info(), NULL))
+
 G_END_DECLS
 #endif /*__GST_CE_UTILS_H__*/
@@ -44,9 +44,14 @@
 
 #include <gst/gst.h>
 #include <gst/video/gstvideometa.h>
+#include <gst/video/gstvideosink.h>
 #include <ext/cmem/gstceslicepool.h>
 
 #include "gstcevidenc.h"
+#include "gstcecodeccache.h"
+#include "gstceconvert.h"
+#include "gstcestats.h"
+#include "gstcestaticscene.h"
 
 #include <ti/sdo/ce/osal/Memory.h>
 
@@ -63,7 +68,25 @@ enum
   PROP_INTRA_FRAME_INTERVAL,
   PROP_FORCE_FRAME,
   PROP_NUM_OUT_BUFFERS,
-  PROP_MIN_SIZE_PERCENTAGE
+  PROP_MIN_SIZE_PERCENTAGE,
+  PROP_CODEC_CACHE_SIZE,
+  PROP_CODEC_CACHE_TIMEOUT,
+  PROP_ENABLE_STATS,
+  PROP_STATS,
+  PROP_QOS_DROP,
+  PROP_QOS_MAX_SKIP,
+  PROP_BITRATE_ADAPTATION,
+  PROP_MIN_BITRATE,
+  PROP_BITRATE_ADAPTATION_INTERVAL,
+  PROP_ADAPTIVE_COMPLEXITY,
+  PROP_COMPLEXITY_LEVEL,
+  PROP_CROP,
+  PROP_LOW_LATENCY,
+  PROP_FIELD_PAIR,
+  PROP_SKIP_STATIC,
+  PROP_STATIC_THRESHOLD,
+  PROP_STATIC_MAX_SKIP,
+  PROP_MAX_FRAMERATE
 };
 
 #define PROP_ENCODING_PRESET_DEFAULT      XDM_HIGH_SPEED
@@ -74,6 +97,47 @@ enum
 #define PROP_FORCE_FRAME_DEFAULT          IVIDEO_NA_FRAME
 #define PROP_NUM_OUT_BUFFERS_DEFAULT      3
 #define PROP_MIN_SIZE_PERCENTAGE_DEFAULT  100
+#define PROP_CODEC_CACHE_SIZE_DEFAULT     0
+#define PROP_CODEC_CACHE_TIMEOUT_DEFAULT  10000
+#define PROP_ENABLE_STATS_DEFAULT         FALSE
+#define PROP_QOS_DROP_DEFAULT             FALSE
+#define PROP_QOS_MAX_SKIP_DEFAULT         8
+#define PROP_BITRATE_ADAPTATION_DEFAULT   GST_CE_VIDENC_BITRATE_ADAPTATION_NONE
+#define PROP_MIN_BITRATE_DEFAULT          128000
+#define PROP_BITRATE_ADAPTATION_INTERVAL_DEFAULT 1000
+#define PROP_ADAPTIVE_COMPLEXITY_DEFAULT  FALSE
+#define PROP_LOW_LATENCY_DEFAULT          FALSE
+#define PROP_FIELD_PAIR_DEFAULT           FALSE
+#define PROP_SKIP_STATIC_DEFAULT          FALSE
+#define PROP_STATIC_THRESHOLD_DEFAULT     0
+#define PROP_STATIC_MAX_SKIP_DEFAULT      30
+#define PROP_MAX_FRAMERATE_N_DEFAULT      0
+#define PROP_MAX_FRAMERATE_D_DEFAULT      1
+
+/* Weight of a new bandwidth estimate on the smoothed one */
+#define BITRATE_ESTIMATE_WEIGHT           0.25
+/* Target bit rate changes smaller than this fraction are ignored */
+#define BITRATE_MIN_CHANGE                0.05
+
+/* Weight of a new frame on the smoothed encoder load */
+#define COMPLEXITY_LOAD_WEIGHT            0.1
+/* Encoder load, as a fraction of the frame interval, considered overload */
+#define COMPLEXITY_OVERLOAD               0.9
+/* Encoder load below which the complexity can be raised again */
+#define COMPLEXITY_HEADROOM               0.6
+/* Frames to measure at a complexity level before changing it again */
+#define COMPLEXITY_MIN_FRAMES             60
+
+/* The codecs encode whole macroblocks out of even chroma positions */
+#define CROP_SIZE_ALIGN                   16
+#define CROP_OFFSET_ALIGN                 2
+
+typedef enum
+{
+  GST_CE_VIDENC_BITRATE_ADAPTATION_NONE,
+  GST_CE_VIDENC_BITRATE_ADAPTATION_EVENT,
+  GST_CE_VIDENC_BITRATE_ADAPTATION_AUTO
+} GstCeVidEncBitrateAdaptation;
 
 #define GST_CE_VIDENC_RATE_CONTROL_TYPE (gst_ce_videnc_rate_control_get_type())
 static GType
@@ -98,6 +162,32 @@ gst_ce_videnc_rate_control_get_type (void)
   return rate_type;
 }
 
+#define GST_CE_VIDENC_BITRATE_ADAPTATION_TYPE \
+    (gst_ce_videnc_bitrate_adaptation_get_type())
+static GType
+gst_ce_videnc_bitrate_adaptation_get_type (void)
+{
+  static GType adaptation_type = 0;
+
+  static const GEnumValue adaptation_types[] = {
+    {GST_CE_VIDENC_BITRATE_ADAPTATION_NONE, "Keep the target bit rate",
+        "none"},
+    {GST_CE_VIDENC_BITRATE_ADAPTATION_EVENT,
+          "Follow the bandwidth estimate events from downstream",
+        "event"},
+    {GST_CE_VIDENC_BITRATE_ADAPTATION_AUTO,
+          "Follow the bandwidth estimate events or, lacking them, "
+          "the QoS events from downstream", "auto"},
+    {0, NULL, NULL}
+  };
+
+  if (!adaptation_type) {
+    adaptation_type = g_enum_register_static ("GstCeVidEncBitrateAdaptation",
+        adaptation_types);
+  }
+  return adaptation_type;
+}
+
 #define GST_CE_VIDENC_ENCODING_PRESET_TYPE (gst_ce_videnc_preset_get_type())
 static GType
 gst_ce_videnc_preset_get_type (void)
@@ -145,11 +235,22 @@ gst_ce_videnc_force_frame_get_type (void)
 struct _GstCeVidEncPrivate
 {
   gboolean first_buffer;
+  /* The output caps wait for the codec data of the first frame */
+  gboolean codec_data_wait;
   gboolean interlace;
+  gboolean field_pair;
+  /* The output pool has room for both fields of a frame */
+  gboolean field_pair_pool;
 
   /* Video Data */
   gint fps_num;
   gint fps_den;
+
+  /* Frame rate decimation */
+  gint max_fps_num;
+  gint max_fps_den;
+  GstClockTime decimate_period;
+  GstClockTime decimate_next;
   gint par_num;
   gint par_den;
   gint bpp;
@@ -158,6 +259,8 @@ struct _GstCeVidEncPrivate
   guint outbuf_size_percentage;
   gint num_out_buffers;
   GstBufferPool *outbuf_pool;
+  /* Buffer size outbuf_pool is active with, 0 until it is configured */
+  guint outbuf_pool_size;
 
   GstVideoFormat video_format;
   GstVideoCodecState *input_state;
@@ -171,6 +274,81 @@ struct _GstCeVidEncPrivate
   Engine_Handle engine_handle;
   IVIDEO1_BufDescIn inbuf_desc;
   XDM_BufDesc outbuf_desc;
+
+  /* codec_dyn_params changed since they were last given to the codec */
+  gboolean dyn_params_pending;
+  /* Snapshot of codec_dyn_params the codec calls are made with, so they
+   * don't run under the object lock */
+  VIDENC1_DynamicParams *dyn_params_copy;
+
+  /* Idle codec instances cache */
+  guint codec_cache_size;
+  guint codec_cache_timeout;
+  gboolean codec_cached;
+  /* Static params the running instance was created with, its cache key */
+  VIDENC1_Params *codec_key;
+  /* A warm instance starts the new stream with an IDR */
+  gboolean cached_force_idr;
+
+  /* Startup latency */
+  GstClockTime start_time;
+  gboolean first_keyframe;
+
+  /* Encoding time statistics */
+  GstCeStats *stats;
+  gboolean stats_enabled;
+
+  /* Reported latency */
+  GstCeLatency latency;
+  gboolean low_latency;
+  gboolean latency_reported_low;
+
+  /* Quality of service */
+  gboolean qos_drop;
+  guint qos_max_skip;
+  gdouble qos_proportion;
+  GstClockTime qos_earliest_time;
+  guint qos_skipped;
+  gboolean qos_force_idr;
+  guint64 qos_processed;
+  guint64 qos_dropped;
+  guint frames_since_key;
+
+  /* Static scene skipping */
+  gboolean skip_static;
+  guint static_threshold;
+  guint static_max_skip;
+  guint static_skipped;
+  GstCeStaticScene static_scene;
+
+  /* Bit rate adaptation */
+  GstCeVidEncBitrateAdaptation bitrate_adaptation;
+  gint min_bitrate;
+  guint bitrate_adaptation_interval;
+  gdouble bitrate_estimate;
+  gboolean bitrate_events;
+  GstClockTime bitrate_last_change;
+
+  /* Adaptive complexity */
+  gboolean complexity_enabled;
+  guint complexity_level;
+  gint complexity_pending;
+  gint complexity_max;
+  gdouble complexity_load;
+  guint complexity_frames;
+  GstClockTime process_time;
+
+  /* Region of the input frames being encoded */
+  gboolean crop_set;
+  GstVideoRectangle crop_prop;
+  GstVideoRectangle crop;
+  GstVideoRectangle crop_warned;
+
+  /* Copy of the frames the codec can't read in place, converted to the
+   * codec format if the input has another one */
+  GstVideoInfo staging_info;
+  GstBuffer *staging_buf;
+  const gchar *staging_reason;
 };
 
 /* A number of function prototypes are given so we can refer to them later. */
@@ -193,8 +371,20 @@ static void gst_ce_videnc_get_property (GObject * object,
 static void gst_ce_videnc_finalize (GObject * object);
 
 static gboolean gst_ce_videnc_reset (GstVideoEncoder * encoder);
-static gboolean gst_ce_videnc_set_dynamic_params (GstCeVidEnc * ce_videnc);
-static gboolean gst_ce_videnc_get_buffer_info (GstCeVidEnc * ce_videnc);
+static VIDENC1_DynamicParams *gst_ce_videnc_copy_dynamic_params (GstCeVidEnc *
+    ce_videnc);
+static gboolean gst_ce_videnc_set_dynamic_params (GstCeVidEnc * ce_videnc,
+    VIDENC1_DynamicParams * dyn_params);
+static gboolean gst_ce_videnc_get_buffer_info (GstCeVidEnc * ce_videnc,
+    VIDENC1_DynamicParams * dyn_params);
+static gboolean gst_ce_videnc_configure_pool (GstCeVidEnc * ce_videnc);
+static void gst_ce_videnc_release_codec (GstCeVidEnc * ce_videnc);
+static GstStateChangeReturn gst_ce_videnc_change_state (GstElement * element,
+    GstStateChange transition);
+static gboolean gst_ce_videnc_sink_event (GstVideoEncoder * encoder,
+    GstEvent * event);
+static gboolean gst_ce_videnc_src_event (GstVideoEncoder * encoder,
+    GstEvent * event);
 
 #define gst_ce_videnc_parent_class parent_class
 G_DEFINE_TYPE (GstCeVidEnc, gst_ce_videnc, GST_TYPE_VIDEO_ENCODER);
@@ -203,9 +393,11 @@ static void
 gst_ce_videnc_class_init (GstCeVidEncClass * klass)
 {
   GObjectClass *gobject_class;
+  GstElementClass *element_class;
   GstVideoEncoderClass *venc_class;
 
   gobject_class = G_OBJECT_CLASS (klass);
+  element_class = GST_ELEMENT_CLASS (klass);
   venc_class = GST_VIDEO_ENCODER_CLASS (klass);
 
   GST_DEBUG_CATEGORY_INIT (gst_ce_videnc_debug, "ce_videnc", 0,
@@ -275,10 +467,149 @@ gst_ce_videnc_class_init (GstCeVidEncClass * klass)
           "and you don't want to drop buffers",
           10, 100, PROP_MIN_SIZE_PERCENTAGE_DEFAULT, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_CODEC_CACHE_SIZE,
+      g_param_spec_uint ("codec-cache-size",
+          "Codec instance cache size",
+          "Maximum number of idle codec instances kept warm in the process "
+          "when the element stops, so a restart with the same static "
+          "parameters skips the engine and codec creation (0 = disabled)",
+          0, 16, PROP_CODEC_CACHE_SIZE_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_CODEC_CACHE_TIMEOUT,
+      g_param_spec_uint ("codec-cache-timeout",
+          "Codec instance cache timeout",
+          "Time in milliseconds an idle codec instance is kept warm "
+          "before being destroyed (0 = no timeout)",
+          0, G_MAXUINT, PROP_CODEC_CACHE_TIMEOUT_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ENABLE_STATS,
+      g_param_spec_boolean ("enable-stats",
+          "Enable statistics",
+          "Time each phase of the encoding process, enabling them "
+          "resets the statistics",
+          PROP_ENABLE_STATS_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats",
+          "Statistics",
+          "Minimum, average, maximum and 99th percentile time in "
+          "nanoseconds spent on each phase of the encoding process",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_QOS_DROP,
+      g_param_spec_boolean ("qos-drop",
+          "QoS frame dropping",
+          "Drop frames that are already late before encoding them, "
+          "based on the QoS events from downstream",
+          PROP_QOS_DROP_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_QOS_MAX_SKIP,
+      g_param_spec_uint ("qos-max-skip",
+          "QoS maximum consecutive drops",
+          "Force an IDR frame after dropping this many consecutive frames "
+          "because of QoS (0 = never force)",
+          0, G_MAXUINT, PROP_QOS_MAX_SKIP_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_BITRATE_ADAPTATION,
+      g_param_spec_enum ("bitrate-adaptation",
+          "Bit rate adaptation",
+          "Adapt the target bit rate to the bandwidth available downstream, "
+          "within min-bitrate and max-bitrate",
+          GST_CE_VIDENC_BITRATE_ADAPTATION_TYPE,
+          PROP_BITRATE_ADAPTATION_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MIN_BITRATE,
+      g_param_spec_int ("min-bitrate",
+          "Minimum bit rate",
+          "Lowest target bit rate in bits per second the bit rate "
+          "adaptation can select",
+          1000, 20000000, PROP_MIN_BITRATE_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class,
+      PROP_BITRATE_ADAPTATION_INTERVAL,
+      g_param_spec_uint ("bitrate-adaptation-interval",
+          "Bit rate adaptation interval",
+          "Minimum time in milliseconds between two target bit rate changes",
+          0, G_MAXUINT, PROP_BITRATE_ADAPTATION_INTERVAL_DEFAULT,
+          G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_COMPLEXITY,
+      g_param_spec_boolean ("adaptive-complexity",
+          "Adaptive complexity",
+          "Lower the encoding complexity at the next IDR frame when encoding "
+          "takes most of the frame interval, and raise it back when there "
+          "is headroom again",
+          PROP_ADAPTIVE_COMPLEXITY_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_COMPLEXITY_LEVEL,
+      g_param_spec_uint ("complexity-level",
+          "Complexity level",
+          "Complexity reduction currently applied by the adaptive "
+          "complexity (0 = as configured)",
+          0, G_MAXUINT, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_CROP,
+      g_param_spec_string ("crop",
+          "Crop region",
+          "Region of the input frames to encode as \"x,y,width,height\", "
+          "used when the buffers carry no crop meta (empty = whole frame)",
+          NULL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency",
+          "Low latency",
+          "Report a maximum latency equal to the encoding latency, so no "
+          "buffering is added behind the encoder",
+          PROP_LOW_LATENCY_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_FIELD_PAIR,
+      g_param_spec_boolean ("field-pair",
+          "Field pair",
+          "Encode both fields of an interlaced frame into a single output "
+          "buffer, one after the other, instead of one buffer per field. "
+          "Takes effect on the next negotiation",
+          PROP_FIELD_PAIR_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_SKIP_STATIC,
+      g_param_spec_boolean ("skip-static",
+          "Skip static scenes",
+          "Drop the frames that did not change since the last encoded one "
+          "and send a gap event in their place",
+          PROP_SKIP_STATIC_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_STATIC_THRESHOLD,
+      g_param_spec_uint ("static-threshold",
+          "Static scene threshold",
+          "Number of the sampled luma points that may change in a frame "
+          "still considered static",
+          0, GST_CE_STATIC_SCENE_GRID * GST_CE_STATIC_SCENE_GRID,
+          PROP_STATIC_THRESHOLD_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_STATIC_MAX_SKIP,
+      g_param_spec_uint ("static-max-skip",
+          "Static scene maximum consecutive drops",
+          "Encode a frame after dropping this many consecutive static "
+          "frames (0 = unlimited)",
+          0, G_MAXUINT, PROP_STATIC_MAX_SKIP_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAMERATE,
+      gst_param_spec_fraction ("max-framerate",
+          "Maximum frame rate",
+          "Drop the input frames that exceed this frame rate, based on "
+          "their timestamps (0/1 = no limit). Takes effect on the next "
+          "negotiation",
+          0, 1, G_MAXINT, 1, PROP_MAX_FRAMERATE_N_DEFAULT,
+          PROP_MAX_FRAMERATE_D_DEFAULT, G_PARAM_READWRITE));
+
+  element_class->change_state = GST_DEBUG_FUNCPTR (gst_ce_videnc_change_state);
+
   venc_class->open = GST_DEBUG_FUNCPTR (gst_ce_videnc_open);
   venc_class->close = GST_DEBUG_FUNCPTR (gst_ce_videnc_close);
   venc_class->stop = GST_DEBUG_FUNCPTR (gst_ce_videnc_stop);
   venc_class->handle_frame = GST_DEBUG_FUNCPTR (gst_ce_videnc_handle_frame);
+  venc_class->sink_event = GST_DEBUG_FUNCPTR (gst_ce_videnc_sink_event);
+  venc_class->src_event = GST_DEBUG_FUNCPTR (gst_ce_videnc_src_event);
   venc_class->set_format = GST_DEBUG_FUNCPTR (gst_ce_videnc_set_format);
   venc_class->propose_allocation =
       GST_DEBUG_FUNCPTR (gst_ce_videnc_propose_allocation);
@@ -325,6 +656,27 @@ gst_ce_videnc_init (GstCeVidEnc * ce_videnc)
   priv->engine_handle = NULL;
   priv->allocator = NULL;
   priv->interlace = FALSE;
+  priv->field_pair = PROP_FIELD_PAIR_DEFAULT;
+  priv->field_pair_pool = FALSE;
+  priv->dyn_params_pending = FALSE;
+  priv->codec_cache_size = PROP_CODEC_CACHE_SIZE_DEFAULT;
+  priv->codec_cache_timeout = PROP_CODEC_CACHE_TIMEOUT_DEFAULT;
+  priv->start_time = GST_CLOCK_TIME_NONE;
+  priv->first_keyframe = FALSE;
+  priv->stats = gst_ce_stats_new ();
+  priv->stats_enabled = PROP_ENABLE_STATS_DEFAULT;
+  priv->qos_drop = PROP_QOS_DROP_DEFAULT;
+  priv->qos_max_skip = PROP_QOS_MAX_SKIP_DEFAULT;
+  priv->bitrate_adaptation = PROP_BITRATE_ADAPTATION_DEFAULT;
+  priv->min_bitrate = PROP_MIN_BITRATE_DEFAULT;
+  priv->bitrate_adaptation_interval = PROP_BITRATE_ADAPTATION_INTERVAL_DEFAULT;
+  priv->complexity_enabled = PROP_ADAPTIVE_COMPLEXITY_DEFAULT;
+  priv->low_latency = PROP_LOW_LATENCY_DEFAULT;
+  priv->skip_static = PROP_SKIP_STATIC_DEFAULT;
+  priv->static_threshold = PROP_STATIC_THRESHOLD_DEFAULT;
+  priv->static_max_skip = PROP_STATIC_MAX_SKIP_DEFAULT;
+  priv->max_fps_num = PROP_MAX_FRAMERATE_N_DEFAULT;
+  priv->max_fps_den = PROP_MAX_FRAMERATE_D_DEFAULT;
 
   gst_ce_videnc_reset ((GstVideoEncoder *) ce_videnc);
 }
@@ -345,6 +697,17 @@ gst_ce_videnc_finalize (GObject * object)
     ce_videnc->codec_dyn_params = NULL;
   }
 
+  if (ce_videnc->priv->stats) {
+    gst_ce_stats_free (ce_videnc->priv->stats);
+    ce_videnc->priv->stats = NULL;
+  }
+
+  g_free (ce_videnc->priv->codec_key);
+  ce_videnc->priv->codec_key = NULL;
+
+  g_free (ce_videnc->priv->dyn_params_copy);
+  ce_videnc->priv->dyn_params_copy = NULL;
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -373,6 +736,12 @@ gst_ce_videnc_configure_codec (GstCeVidEnc * ce_videnc)
 
   GST_OBJECT_LOCK (ce_videnc);
 
+  /* The static params of the running instance are about to change */
+  if (ce_videnc->codec_handle) {
+    GST_DEBUG_OBJECT (ce_videnc, "Closing old codec session");
+    gst_ce_videnc_release_codec (ce_videnc);
+  }
+
   /* Set the caps on the parameters of the encoder */
   switch (priv->video_format) {
     case GST_VIDEO_FORMAT_UYVY:
@@ -384,6 +753,7 @@ gst_ce_videnc_configure_codec (GstCeVidEnc * ce_videnc)
       dyn_params->captureWidth = priv->inbuf_desc.framePitch;
       break;
     default:
+      GST_OBJECT_UNLOCK (ce_videnc);
       GST_ELEMENT_ERROR (ce_videnc, STREAM, NOT_IMPLEMENTED,
           ("unsupported format in video stream: %d\n",
               priv->video_format), (NULL));
@@ -405,32 +775,72 @@ gst_ce_videnc_configure_codec (GstCeVidEnc * ce_videnc)
   dyn_params->inputHeight = priv->inbuf_desc.frameHeight;
   dyn_params->refFrameRate = dyn_params->targetFrameRate = fps;
 
-  if (ce_videnc->codec_handle) {
-    /* TODO: test this use case to verify its properly handled */
-    GST_DEBUG_OBJECT (ce_videnc, "Closing old codec session");
-    VIDENC1_delete (ce_videnc->codec_handle);
+  /* Try to adopt a warm instance created with the same static params */
+  priv->codec_cached = FALSE;
+  if (priv->codec_cache_size) {
+    Engine_Handle engine = NULL;
+
+    ce_videnc->codec_handle = gst_ce_codec_cache_acquire (klass->codec_name,
+        params, params->size, &engine);
+    if (ce_videnc->codec_handle) {
+      GST_DEBUG_OBJECT (ce_videnc, "Reusing warm codec handle %p",
+          ce_videnc->codec_handle);
+      if (priv->engine_handle)
+        Engine_close (priv->engine_handle);
+      priv->engine_handle = engine;
+      priv->codec_cached = TRUE;
+
+      /* Drop the references and rate control state of the last session,
+       * the current dynamic params are set right below */
+      enc_status.size = sizeof (VIDENC1_Status);
+      enc_status.data.buf = NULL;
+      if (VIDENC1_control (ce_videnc->codec_handle, XDM_RESET, dyn_params,
+              &enc_status) != VIDENC1_EOK)
+        GST_WARNING_OBJECT (ce_videnc, "failed to reset the warm codec, "
+            "status error %x", (guint) enc_status.extendedError);
+      priv->cached_force_idr = TRUE;
+    }
   }
 
-  GST_DEBUG_OBJECT (ce_videnc, "Create the codec handle");
-  ce_videnc->codec_handle = VIDENC1_create (priv->engine_handle,
-      (Char *) klass->codec_name, params);
-  if (!ce_videnc->codec_handle)
-    goto fail_open_codec;
+  if (!ce_videnc->codec_handle) {
+    if (!priv->engine_handle) {
+      GST_DEBUG_OBJECT (ce_videnc, "opening %s Engine", CODEC_ENGINE);
+      priv->engine_handle = Engine_open ((Char *) CODEC_ENGINE, NULL, NULL);
+      if (!priv->engine_handle)
+        goto fail_engine_open;
+    }
 
-  enc_status.size = sizeof (VIDENC1_Status);
-  enc_status.data.buf = NULL;
+    GST_DEBUG_OBJECT (ce_videnc, "Create the codec handle");
+    ce_videnc->codec_handle = VIDENC1_create (priv->engine_handle,
+        (Char *) klass->codec_name, params);
+    if (!ce_videnc->codec_handle)
+      goto fail_open_codec;
+  }
+
+  /* The params may change before the instance is released, e.g. by the
+   * complexity control, so the cache gets the ones it was created with */
+  g_free (priv->codec_key);
+  priv->codec_key = g_memdup (params, params->size);
+
+  dyn_params = gst_ce_videnc_copy_dynamic_params (ce_videnc);
+  GST_OBJECT_UNLOCK (ce_videnc);
 
   GST_DEBUG_OBJECT (ce_videnc, "Set codec dynamic parameters");
-  if (!gst_ce_videnc_set_dynamic_params (ce_videnc))
+  if (!gst_ce_videnc_set_dynamic_params (ce_videnc, dyn_params))
     goto fail_out;
 
-  if (!gst_ce_videnc_get_buffer_info (ce_videnc))
+  if (!gst_ce_videnc_get_buffer_info (ce_videnc, dyn_params))
     goto fail_out;
 
-  GST_OBJECT_UNLOCK (ce_videnc);
-
   return TRUE;
 
+fail_engine_open:
+  {
+    GST_OBJECT_UNLOCK (ce_videnc);
+    GST_ELEMENT_ERROR (ce_videnc, STREAM, CODEC_NOT_FOUND, (NULL),
+        ("failed to open codec engine \"%s\"", CODEC_ENGINE));
+    return FALSE;
+  }
 fail_open_codec:
   {
     GST_ERROR_OBJECT (ce_videnc, "failed to open codec %s", klass->codec_name);
@@ -439,19 +849,153 @@ fail_open_codec:
   }
 fail_out:
   {
-    GST_OBJECT_UNLOCK (ce_videnc);
     VIDENC1_delete (ce_videnc->codec_handle);
     ce_videnc->codec_handle = NULL;
     return FALSE;
   }
 }
 
+/*
+ * gst_ce_videnc_get_crop
+ *
+ * Gets the region of the frame to encode from the buffer crop meta or
+ * the crop property, adjusted to what the codec can encode straight out
+ * of the full frame. Call with the object lock held.
+ */
+static void
+gst_ce_videnc_get_crop (GstCeVidEnc * ce_videnc, GstVideoInfo * info,
+    GstBuffer * buffer, GstVideoRectangle * rect)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstVideoCropMeta *meta = NULL;
+  GstVideoRectangle req;
+  gint width = GST_VIDEO_INFO_WIDTH (info);
+  gint height = GST_VIDEO_INFO_HEIGHT (info);
+  gint offset_align;
+
+  if (buffer)
+    meta = gst_buffer_get_video_crop_meta (buffer);
+
+  if (meta) {
+    req.x = meta->x;
+    req.y = meta->y;
+    req.w = meta->width;
+    req.h = meta->height;
+  } else if (priv->crop_set) {
+    req = priv->crop_prop;
+  } else {
+    req.x = req.y = 0;
+    req.w = width;
+    req.h = height;
+  }
+
+  if (req.x == 0 && req.y == 0 && req.w == width && req.h == height) {
+    *rect = req;
+    return;
+  }
+
+  /* Interlaced content is encoded per field, keep the field parity */
+  offset_align = priv->interlace ? 2 * CROP_OFFSET_ALIGN : CROP_OFFSET_ALIGN;
+
+  rect->x = GST_ROUND_DOWN_N (CLAMP (req.x, 0, width), CROP_OFFSET_ALIGN);
+  rect->y = GST_ROUND_DOWN_N (CLAMP (req.y, 0, height), offset_align);
+  rect->w = GST_ROUND_DOWN_N (MIN (req.w, width - rect->x), CROP_SIZE_ALIGN);
+  rect->h = GST_ROUND_DOWN_N (MIN (req.h, height - rect->y), CROP_SIZE_ALIGN);
+
+  if (rect->w <= 0 || rect->h <= 0) {
+    rect->x = rect->y = 0;
+    rect->w = width;
+    rect->h = height;
+  }
+
+  if ((rect->x == req.x && rect->y == req.y && rect->w == req.w &&
+          rect->h == req.h) || (priv->crop_warned.x == req.x &&
+          priv->crop_warned.y == req.y && priv->crop_warned.w == req.w &&
+          priv->crop_warned.h == req.h))
+    return;
+
+  /* Warn once per requested region, the meta may repeat it every frame */
+  priv->crop_warned = req;
+  GST_ELEMENT_WARNING (ce_videnc, STREAM, FORMAT, (NULL),
+      ("crop region %dx%d at (%d,%d) doesn't meet the codec constraints "
+          "(size multiple of %d, offset multiple of %d), encoding %dx%d "
+          "at (%d,%d) instead", req.w, req.h, req.x, req.y, CROP_SIZE_ALIGN,
+          offset_align, rect->w, rect->h, rect->x, rect->y));
+}
+
+/*
+ * gst_ce_videnc_codec_data_changed
+ *
+ * Checks whether @codec_data differs from the one in the output caps
+ */
+static gboolean
+gst_ce_videnc_codec_data_changed (GstCeVidEnc * ce_videnc,
+    GstBuffer * codec_data)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstMapInfo info;
+  gboolean changed = TRUE;
+
+  if (priv->output_state->codec_data &&
+      gst_buffer_get_size (priv->output_state->codec_data) ==
+      gst_buffer_get_size (codec_data) &&
+      gst_buffer_map (codec_data, &info, GST_MAP_READ)) {
+    changed = gst_buffer_memcmp (priv->output_state->codec_data, 0,
+        info.data, info.size) != 0;
+    gst_buffer_unmap (codec_data, &info);
+  }
+
+  return changed;
+}
+
+/*
+ * gst_ce_videnc_set_output_state
+ *
+ * Sets the output caps, taking ownership of them and of the codec data
+ */
+static gboolean
+gst_ce_videnc_set_output_state (GstCeVidEnc * ce_videnc, GstCaps * caps,
+    GstBuffer * codec_data)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+
+  /* Truncate to the first structure and fixate any unfixed fields */
+  caps = gst_caps_fixate (caps);
+
+  if (priv->output_state)
+    gst_video_codec_state_unref (priv->output_state);
+
+  priv->output_state =
+      gst_video_encoder_set_output_state (GST_VIDEO_ENCODER (ce_videnc), caps,
+      priv->input_state);
+  if (!priv->output_state) {
+    if (codec_data)
+      gst_buffer_unref (codec_data);
+    return FALSE;
+  }
+
+  /* Only the cropped region is encoded, at the decimated frame rate */
+  priv->output_state->info.width = priv->inbuf_desc.frameWidth;
+  priv->output_state->info.height = priv->inbuf_desc.frameHeight;
+  priv->output_state->info.fps_n = priv->fps_num;
+  priv->output_state->info.fps_d = priv->fps_den;
+
+  if (codec_data) {
+    GST_DEBUG_OBJECT (ce_videnc, "setting the codec data");
+    priv->output_state->codec_data = codec_data;
+  }
+
+  return TRUE;
+}
+
 static gboolean
 gst_ce_videnc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
 {
-  GstCaps *allowed_caps;
+  GstCaps *allowed_caps, *template_caps;
   GstBuffer *codec_data = NULL;
+  GstVideoInfo *info;
   gint i, bpp = 0;
+  gint max_fps_num, max_fps_den;
 
   GstCeVidEnc *ce_videnc = GST_CEVIDENC (encoder);
   GstCeVidEncClass *klass = GST_CEVIDENC_CLASS (G_OBJECT_GET_CLASS (ce_videnc));
@@ -459,11 +1003,44 @@ gst_ce_videnc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
 
   GST_DEBUG_OBJECT (ce_videnc, "extracting common video information");
 
-  /* Prepare the input buffer descriptor */
-  priv->inbuf_desc.frameWidth = GST_VIDEO_INFO_WIDTH (&state->info);
-  priv->inbuf_desc.frameHeight = GST_VIDEO_INFO_HEIGHT (&state->info);
-  priv->inbuf_desc.framePitch = GST_VIDEO_INFO_PLANE_STRIDE (&state->info, 0);
-  priv->inbuf_desc.numBufs = GST_VIDEO_INFO_N_PLANES (&state->info);
+  /* The formats the codec doesn't read are converted to one it does */
+  template_caps =
+      gst_pad_get_pad_template_caps (GST_VIDEO_ENCODER_SINK_PAD (encoder));
+  priv->video_format =
+      gst_ce_convert_get_format (GST_VIDEO_INFO_FORMAT (&state->info),
+      template_caps);
+  gst_caps_unref (template_caps);
+
+  if (priv->video_format == GST_VIDEO_FORMAT_UNKNOWN)
+    goto fail_set_caps;
+
+  if (priv->video_format != GST_VIDEO_INFO_FORMAT (&state->info))
+    GST_DEBUG_OBJECT (ce_videnc, "converting the %s input to %s",
+        gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (&state->info)),
+        gst_video_format_to_string (priv->video_format));
+
+  /* Default layout for the frames that need to be copied */
+  gst_video_info_set_format (&priv->staging_info, priv->video_format,
+      GST_VIDEO_INFO_WIDTH (&state->info), GST_VIDEO_INFO_HEIGHT (&state->info));
+  if (priv->staging_buf) {
+    gst_buffer_unref (priv->staging_buf);
+    priv->staging_buf = NULL;
+  }
+
+  /* The codec reads the converted frames out of the staging buffer */
+  info = &state->info;
+  if (priv->video_format != GST_VIDEO_INFO_FORMAT (&state->info))
+    info = &priv->staging_info;
+
+  /* Prepare the input buffer descriptor, buffers crop meta is unknown yet */
+  GST_OBJECT_LOCK (ce_videnc);
+  gst_ce_videnc_get_crop (ce_videnc, &state->info, NULL, &priv->crop);
+  GST_OBJECT_UNLOCK (ce_videnc);
+
+  priv->inbuf_desc.frameWidth = priv->crop.w;
+  priv->inbuf_desc.frameHeight = priv->crop.h;
+  priv->inbuf_desc.framePitch = GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+  priv->inbuf_desc.numBufs = GST_VIDEO_INFO_N_PLANES (info);
 
   for (i = 0; i < GST_VIDEO_INFO_N_COMPONENTS (&state->info); i++)
     bpp += GST_VIDEO_INFO_COMP_DEPTH (&state->info, i);
@@ -473,11 +1050,29 @@ gst_ce_videnc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
   priv->fps_num = GST_VIDEO_INFO_FPS_N (&state->info);
   priv->fps_den = GST_VIDEO_INFO_FPS_D (&state->info);
 
+  /* Faster or variable rate input is decimated to the maximum rate, which
+   * is the one the codec and downstream get told about */
+  GST_OBJECT_LOCK (ce_videnc);
+  max_fps_num = priv->max_fps_num;
+  max_fps_den = priv->max_fps_den;
+  GST_OBJECT_UNLOCK (ce_videnc);
+
+  priv->decimate_period = GST_CLOCK_TIME_NONE;
+  priv->decimate_next = GST_CLOCK_TIME_NONE;
+  if (max_fps_num > 0 && (priv->fps_num <= 0 ||
+          gst_util_fraction_compare (priv->fps_num, priv->fps_den,
+              max_fps_num, max_fps_den) > 0)) {
+    GST_DEBUG_OBJECT (ce_videnc, "decimating %d/%d fps to %d/%d fps",
+        priv->fps_num, priv->fps_den, max_fps_num, max_fps_den);
+    priv->fps_num = max_fps_num;
+    priv->fps_den = max_fps_den;
+    priv->decimate_period = gst_util_uint64_scale_int (GST_SECOND,
+        max_fps_den, max_fps_num);
+  }
+
   priv->par_num = GST_VIDEO_INFO_PAR_N (&state->info);
   priv->par_den = GST_VIDEO_INFO_PAR_D (&state->info);
 
-  priv->video_format = GST_VIDEO_INFO_FORMAT (&state->info);
-
   GST_DEBUG_OBJECT (ce_videnc, "input buffer format: width=%li, height=%li,"
       " pitch=%li, bpp=%d", priv->inbuf_desc.frameWidth,
       priv->inbuf_desc.frameHeight, priv->inbuf_desc.framePitch, priv->bpp);
@@ -485,6 +1080,11 @@ gst_ce_videnc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
   if (!gst_ce_videnc_configure_codec (ce_videnc))
     goto fail_set_caps;
 
+  /* Store input state */
+  if (priv->input_state)
+    gst_video_codec_state_unref (priv->input_state);
+  priv->input_state = gst_video_codec_state_ref (state);
+
   /* some codecs support more than one format, first auto-choose one */
   GST_DEBUG_OBJECT (ce_videnc, "choosing an output format...");
   allowed_caps = gst_pad_get_allowed_caps (GST_VIDEO_ENCODER_SRC_PAD (encoder));
@@ -495,40 +1095,78 @@ gst_ce_videnc_set_format (GstVideoEncoder * encoder, GstVideoCodecState * state)
   }
   GST_DEBUG_OBJECT (ce_videnc, "chose caps %" GST_PTR_FORMAT, allowed_caps);
 
+  priv->codec_data_wait = FALSE;
   if (klass->set_src_caps) {
     GST_DEBUG ("use custom set src caps");
     if (!klass->set_src_caps (ce_videnc, &allowed_caps, &codec_data))
       goto fail_set_caps;
   }
 
-  /* Truncate to the first structure and fixate any unfixed fields */
-  allowed_caps = gst_caps_fixate (allowed_caps);
+  if (!gst_ce_videnc_set_output_state (ce_videnc, allowed_caps, codec_data))
+    goto fail_set_caps;
 
-  /* Store input state and set output state */
-  if (priv->input_state)
-    gst_video_codec_state_unref (priv->input_state);
-  priv->input_state = gst_video_codec_state_ref (state);
+  return TRUE;
 
-  /* Set output state */
-  if (priv->output_state)
-    gst_video_codec_state_unref (priv->output_state);
+fail_set_caps:
+  GST_ERROR_OBJECT (ce_videnc, "couldn't set video format");
+  return FALSE;
+}
 
-  priv->output_state =
-      gst_video_encoder_set_output_state (encoder, allowed_caps, state);
-  if (!priv->output_state) {
-    goto fail_set_caps;
+/*
+ * gst_ce_videnc_reconfigure
+ *
+ * Re-creates the codec instance after its static parameters changed
+ * while streaming. The output caps are only renegotiated if the codec
+ * data changed along, so downstream is disrupted as little as possible.
+ */
+static gboolean
+gst_ce_videnc_reconfigure (GstCeVidEnc * ce_videnc)
+{
+  GstCeVidEncClass *klass = GST_CEVIDENC_CLASS (G_OBJECT_GET_CLASS (ce_videnc));
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstBuffer *codec_data = NULL;
+  GstCaps *caps;
+  gboolean changed;
+
+  GST_DEBUG_OBJECT (ce_videnc, "re-creating the codec");
+
+  if (!gst_ce_videnc_configure_codec (ce_videnc))
+    return FALSE;
+
+  /* The codec may now need larger output buffers */
+  if (priv->outbuf_pool_size && !gst_ce_videnc_configure_pool (ce_videnc))
+    return FALSE;
+
+  if (!priv->output_state)
+    return TRUE;
+
+  changed = priv->output_state->info.width != priv->inbuf_desc.frameWidth ||
+      priv->output_state->info.height != priv->inbuf_desc.frameHeight;
+
+  caps = gst_caps_copy (priv->output_state->caps);
+  if (klass->set_src_caps &&
+      !klass->set_src_caps (ce_videnc, &caps, &codec_data)) {
+    gst_caps_unref (caps);
+    return FALSE;
   }
 
-  if (codec_data) {
-    GST_DEBUG_OBJECT (ce_videnc, "setting the codec data");
-    priv->output_state->codec_data = codec_data;
+  if (!codec_data && !changed) {
+    gst_caps_unref (caps);
+    return TRUE;
   }
 
-  return TRUE;
+  if (!changed)
+    changed = gst_ce_videnc_codec_data_changed (ce_videnc, codec_data);
 
-fail_set_caps:
-  GST_ERROR_OBJECT (ce_videnc, "couldn't set video format");
-  return FALSE;
+  if (!changed) {
+    gst_buffer_unref (codec_data);
+    gst_caps_unref (caps);
+    return TRUE;
+  }
+
+  GST_DEBUG_OBJECT (ce_videnc, "output format changed, renegotiating");
+  return gst_ce_videnc_set_output_state (ce_videnc, caps, codec_data) &&
+      gst_video_encoder_negotiate (GST_VIDEO_ENCODER (ce_videnc));
 }
 
 static gboolean
@@ -549,6 +1187,7 @@ gst_ce_videnc_propose_allocation (GstVideoEncoder * encoder, GstQuery * query)
   params.align = 31;
 
   gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+  gst_query_add_allocation_meta (query, GST_VIDEO_CROP_META_API_TYPE, NULL);
   gst_query_add_allocation_param (query, priv->allocator, &params);
 
   return GST_VIDEO_ENCODER_CLASS (parent_class)->propose_allocation (encoder,
@@ -562,9 +1201,6 @@ gst_ce_videnc_decide_allocation (GstVideoEncoder * encoder, GstQuery * query)
   GstCeVidEncPrivate *priv = ce_videnc->priv;
   GstAllocator *allocator = NULL;
   GstAllocationParams params;
-  GstBufferPool *pool = NULL;
-  GstStructure *config;
-  GstCaps *caps;
 
   GST_LOG_OBJECT (ce_videnc, "decide allocation");
   if (!GST_VIDEO_ENCODER_CLASS (parent_class)->decide_allocation (encoder,
@@ -572,8 +1208,7 @@ gst_ce_videnc_decide_allocation (GstVideoEncoder * encoder, GstQuery * query)
     return FALSE;
 
   /* use our own pool */
-  pool = priv->outbuf_pool;
-  if (!pool)
+  if (!priv->outbuf_pool)
     return FALSE;
 
   /* we got configuration from our peer or the decide_allocation method,
@@ -590,21 +1225,90 @@ gst_ce_videnc_decide_allocation (GstVideoEncoder * encoder, GstQuery * query)
       params.align, params.padding, params.prefix);
   priv->alloc_params = params;
 
+  return gst_ce_videnc_configure_pool (ce_videnc);
+}
+
+/*
+ * gst_ce_videnc_configure_pool
+ *
+ * Configures the output buffer pool with the current allocation params
+ * and output buffer size, and activates it. The buffers of an active
+ * pool may still be downstream, which keeps its config from changing,
+ * so a new pool takes over when the size changes while streaming.
+ */
+static gboolean
+gst_ce_videnc_configure_pool (GstCeVidEnc * ce_videnc)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstBufferPool *pool = priv->outbuf_pool;
+  GstStructure *config;
+  GstCaps *caps = NULL;
+  guint size;
+
   if (priv->output_state)
     caps = priv->output_state->caps;
 
+  /* Field pairs need room for the second field after the first one */
+  GST_OBJECT_LOCK (ce_videnc);
+  priv->field_pair_pool = priv->field_pair &&
+      ce_videnc->codec_params->inputContentType == IVIDEO_INTERLACED;
+  GST_OBJECT_UNLOCK (ce_videnc);
+  size = priv->field_pair_pool ? 2 * priv->outbuf_size : priv->outbuf_size;
+
+  if (gst_buffer_pool_is_active (pool)) {
+    if (size == priv->outbuf_pool_size)
+      return TRUE;
+
+    GST_DEBUG_OBJECT (ce_videnc, "output buffers of %u bytes, replacing "
+        "the pool of %u bytes", size, priv->outbuf_pool_size);
+    if (!(pool = gst_ce_slice_buffer_pool_new ()))
+      goto fail_pool;
+  }
+
   GST_DEBUG_OBJECT (ce_videnc, "configuring output pool");
   config = gst_buffer_pool_get_config (pool);
-  gst_buffer_pool_config_set_params (config, caps, priv->outbuf_size, 1,
+  gst_buffer_pool_config_set_params (config, caps, size, 1,
       priv->num_out_buffers);
   gst_buffer_pool_config_set_allocator (config, priv->allocator,
       &priv->alloc_params);
-  gst_buffer_pool_set_config (GST_BUFFER_POOL_CAST (pool), config);
-  gst_buffer_pool_set_active (GST_BUFFER_POOL_CAST (pool), TRUE);
+  if (!gst_buffer_pool_set_config (pool, config))
+    goto fail_config;
+  if (!gst_buffer_pool_set_active (pool, TRUE))
+    goto fail_activate;
 
   gst_ce_slice_buffer_pool_set_min_size (GST_CE_SLICE_BUFFER_POOL_CAST (pool),
       priv->outbuf_size_percentage, TRUE);
+
+  /* The buffers of the old pool keep it alive until they are freed */
+  if (pool != priv->outbuf_pool) {
+    gst_buffer_pool_set_active (priv->outbuf_pool, FALSE);
+    gst_object_unref (priv->outbuf_pool);
+    priv->outbuf_pool = pool;
+  }
+  priv->outbuf_pool_size = size;
+
   return TRUE;
+
+fail_pool:
+  {
+    GST_ERROR_OBJECT (ce_videnc, "failed to create the output pool");
+    return FALSE;
+  }
+fail_config:
+  {
+    GST_ERROR_OBJECT (ce_videnc, "failed to configure the output pool "
+        "for buffers of %u bytes", size);
+    if (pool != priv->outbuf_pool)
+      gst_object_unref (pool);
+    return FALSE;
+  }
+fail_activate:
+  {
+    GST_ERROR_OBJECT (ce_videnc, "failed to activate the output pool");
+    if (pool != priv->outbuf_pool)
+      gst_object_unref (pool);
+    return FALSE;
+  }
 }
 
 /*
@@ -632,19 +1336,49 @@ gst_ce_videnc_allocate_output_frame (GstCeVidEnc * ce_videnc, GstBuffer ** buf)
   return TRUE;
 }
 
+static GstCeEncodeFrameType
+gst_ce_videnc_frame_type (XDAS_Int32 frame_type)
+{
+  switch (frame_type) {
+    case IVIDEO_I_FRAME:
+      return GST_CE_ENCODE_FRAME_I;
+    case IVIDEO_P_FRAME:
+      return GST_CE_ENCODE_FRAME_P;
+    case IVIDEO_B_FRAME:
+      return GST_CE_ENCODE_FRAME_B;
+    case IVIDEO_IDR_FRAME:
+      return GST_CE_ENCODE_FRAME_IDR;
+    default:
+      return GST_CE_ENCODE_FRAME_NONE;
+  }
+}
+
+/*
+ * gst_ce_videnc_encode_buffer
+ *
+ * Encodes the current input into a new output buffer. The @second_field
+ * of a field pair goes into @outbuf instead, after its first @offset
+ * bytes, which may be none if the first field came out empty.
+ * The output is shrunk to the encoded size unless @keep_room is set.
+ */
 static GstFlowReturn 
-gst_ce_videnc_encode_buffer (GstCeVidEnc *ce_videnc, GstBuffer **outbuf, VIDENC1_OutArgs *out_args) 
+gst_ce_videnc_encode_buffer (GstCeVidEnc *ce_videnc, GstBuffer **outbuf,
+    VIDENC1_OutArgs *out_args, gboolean second_field, gsize offset,
+    gboolean keep_room, GstCeStats * stats, GstClockTime * last)
 {
   GstCeVidEncPrivate *priv = ce_videnc->priv;
 
-
   GstMapInfo info_out;
   VIDENC1_InArgs in_args;
+  GstCeEncodeMeta *meta;
+  GstClockTime start, duration;
+  XDAS_Int8 *out_data;
+  XDAS_Int32 out_size;
   gint ret = 0;
 
   /* Allocate output buffer */
-  if (gst_buffer_pool_acquire_buffer (GST_BUFFER_POOL_CAST (priv->outbuf_pool),
-          outbuf, NULL) != GST_FLOW_OK) {
+  if (!second_field && gst_buffer_pool_acquire_buffer (GST_BUFFER_POOL_CAST
+          (priv->outbuf_pool), outbuf, NULL) != GST_FLOW_OK) {
     *outbuf = NULL;
     goto fail_alloc;
   }
@@ -652,7 +1386,14 @@ gst_ce_videnc_encode_buffer (GstCeVidEnc *ce_videnc, GstBuffer **outbuf, VIDENC1
   if (!gst_buffer_map (*outbuf, &info_out, GST_MAP_WRITE))
     goto fail_map;
 
-  priv->outbuf_desc.bufs = (XDAS_Int8 **) & (info_out.data);
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_ALLOC, *last);
+
+  out_data = (XDAS_Int8 *) info_out.data + offset;
+  priv->outbuf_desc.bufs = &out_data;
+  if (second_field) {
+    out_size = info_out.size - offset;
+    priv->outbuf_desc.bufSizes = &out_size;
+  }
 
   /* Set output and input arguments for the encoding process */
   in_args.size = sizeof (IVIDENC1_InArgs);
@@ -662,43 +1403,724 @@ gst_ce_videnc_encode_buffer (GstCeVidEnc *ce_videnc, GstBuffer **outbuf, VIDENC1
   out_args->size = sizeof (VIDENC1_OutArgs);
 
   /* Encode process */
+  start = gst_util_get_timestamp ();
+
   ret =
       VIDENC1_process (ce_videnc->codec_handle, &priv->inbuf_desc,
       &priv->outbuf_desc, &in_args, out_args);
+  priv->outbuf_desc.bufSizes = (XDAS_Int32 *) & priv->outbuf_size;
   if (ret != VIDENC1_EOK)
     goto fail_encode;
 
-  GST_DEBUG_OBJECT (ce_videnc,
-      "encoded an output buffer %p of size %li at addr %p", outbuf,
-      out_args->bytesGenerated, *priv->outbuf_desc.bufs);
+  duration = gst_util_get_timestamp () - start;
+  priv->process_time += duration;
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_PROCESS, *last);
+
+  GST_DEBUG_OBJECT (ce_videnc,
+      "encoded an output buffer %p of size %li at addr %p", outbuf,
+      out_args->bytesGenerated, *priv->outbuf_desc.bufs);
+
+  gst_buffer_unmap (*outbuf, &info_out);
+
+  if (!keep_room)
+    gst_ce_slice_buffer_resize (GST_CE_SLICE_BUFFER_POOL_CAST
+        (priv->outbuf_pool), *outbuf, offset + out_args->bytesGenerated);
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_RESIZE, *last);
+
+  /* The second field of a pair adds to the facts of the first one */
+  if (second_field && (meta = GST_CE_ENCODE_META_GET (*outbuf))) {
+    meta->bytes += out_args->bytesGenerated;
+    meta->encode_duration += duration;
+    meta->field_duration[1] = duration;
+    meta->n_fields = 2;
+    return GST_FLOW_OK;
+  }
+
+  /* Subclasses may complete the meta on their post-encode process */
+  meta = gst_ce_encode_meta_set (*outbuf);
+  meta->frame_type = gst_ce_videnc_frame_type (out_args->encodedFrameType);
+  meta->bytes = out_args->bytesGenerated;
+  meta->encode_duration = duration;
+  meta->field_duration[0] = duration;
+  meta->bitrate = ce_videnc->codec_dyn_params->targetBitRate;
+
+  return GST_FLOW_OK;
+
+  /*ERRORS*/
+fail_alloc:
+  {
+    GST_INFO_OBJECT (ce_videnc, "Failed to get output buffer, frame dropped");
+    return GST_FLOW_ERROR;
+  }
+fail_map:
+  {
+    GST_ERROR_OBJECT (ce_videnc, "Failed to map buffer");
+    return GST_FLOW_ERROR;
+  }
+fail_encode:
+  {
+    gst_buffer_unmap (*outbuf, &info_out);
+    GST_ERROR_OBJECT (ce_videnc,
+        "Failed encode process with extended error: 0x%x",
+        (unsigned int) out_args->extendedError);
+    return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * gst_ce_videnc_update_latency
+ *
+ * Tracks the time the codec and the post-process took for the last
+ * frame and reports the latency again when it drifts.
+ */
+static void
+gst_ce_videnc_update_latency (GstCeVidEnc * ce_videnc, GstClockTime sample)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstClockTime latency;
+  gboolean low_latency;
+
+  GST_OBJECT_LOCK (ce_videnc);
+  low_latency = priv->low_latency;
+  GST_OBJECT_UNLOCK (ce_videnc);
+
+  if (!gst_ce_latency_add (&priv->latency, sample, &latency) &&
+      low_latency == priv->latency_reported_low)
+    return;
+
+  priv->latency_reported_low = low_latency;
+
+  GST_DEBUG_OBJECT (ce_videnc, "reporting a latency of %" GST_TIME_FORMAT
+      "%s", GST_TIME_ARGS (latency), low_latency ? " (low latency)" : "");
+  gst_video_encoder_set_latency (GST_VIDEO_ENCODER (ce_videnc), latency,
+      low_latency ? latency : GST_CLOCK_TIME_NONE);
+}
+
+/*
+ * gst_ce_videnc_report_first_keyframe
+ *
+ * Reports how long it took to get the first keyframe out since the
+ * element started, which is dominated by the codec setup.
+ */
+static void
+gst_ce_videnc_report_first_keyframe (GstCeVidEnc * ce_videnc)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstClockTime latency;
+
+  priv->first_keyframe = TRUE;
+
+  if (!GST_CLOCK_TIME_IS_VALID (priv->start_time))
+    return;
+
+  latency = gst_util_get_timestamp () - priv->start_time;
+
+  GST_INFO_OBJECT (ce_videnc, "first keyframe encoded after %" GST_TIME_FORMAT
+      " using a %s codec instance", GST_TIME_ARGS (latency),
+      priv->codec_cached ? "warm" : "new");
+
+  gst_element_post_message (GST_ELEMENT_CAST (ce_videnc),
+      gst_message_new_element (GST_OBJECT_CAST (ce_videnc),
+          gst_structure_new ("GstCeVidEncFirstKeyframe",
+              "latency", G_TYPE_UINT64, latency,
+              "warm-codec", G_TYPE_BOOLEAN, priv->codec_cached, NULL)));
+}
+
+/*
+ * gst_ce_videnc_adapt_bitrate
+ *
+ * Smooths the bandwidth estimates and moves the target bit rate towards
+ * them, within the configured bounds and at most once per adaptation
+ * interval. Call with the object lock held.
+ */
+static void
+gst_ce_videnc_adapt_bitrate (GstCeVidEnc * ce_videnc, gdouble estimate)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  VIDENC1_DynamicParams *dyn_params = ce_videnc->codec_dyn_params;
+  GstClockTime now;
+  gint max_bitrate, bitrate;
+
+  if (priv->bitrate_estimate > 0)
+    priv->bitrate_estimate = BITRATE_ESTIMATE_WEIGHT * estimate +
+        (1.0 - BITRATE_ESTIMATE_WEIGHT) * priv->bitrate_estimate;
+  else
+    priv->bitrate_estimate = estimate;
+
+  now = gst_util_get_timestamp ();
+  if (GST_CLOCK_TIME_IS_VALID (priv->bitrate_last_change) &&
+      now - priv->bitrate_last_change <
+      priv->bitrate_adaptation_interval * GST_MSECOND)
+    return;
+
+  max_bitrate = ce_videnc->codec_params->maxBitRate;
+  bitrate = CLAMP ((gint) priv->bitrate_estimate,
+      MIN (priv->min_bitrate, max_bitrate), max_bitrate);
+
+  if (ABS (bitrate - dyn_params->targetBitRate) <
+      dyn_params->targetBitRate * BITRATE_MIN_CHANGE)
+    return;
+
+  GST_INFO_OBJECT (ce_videnc, "adapting target bit rate from %li to %d",
+      dyn_params->targetBitRate, bitrate);
+
+  dyn_params->targetBitRate = bitrate;
+  priv->dyn_params_pending = TRUE;
+  priv->bitrate_last_change = now;
+}
+
+static gboolean
+gst_ce_videnc_sink_event (GstVideoEncoder * encoder, GstEvent * event)
+{
+  GstCeVidEnc *ce_videnc = GST_CEVIDENC (encoder);
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+
+  /* The QoS feedback refers to the flushed data, start over */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+    GST_OBJECT_LOCK (ce_videnc);
+    priv->qos_proportion = 1.0;
+    priv->qos_earliest_time = GST_CLOCK_TIME_NONE;
+    priv->qos_skipped = 0;
+    GST_OBJECT_UNLOCK (ce_videnc);
+  }
+
+  return GST_VIDEO_ENCODER_CLASS (parent_class)->sink_event (encoder, event);
+}
+
+static gboolean
+gst_ce_videnc_src_event (GstVideoEncoder * encoder, GstEvent * event)
+{
+  GstCeVidEnc *ce_videnc = GST_CEVIDENC (encoder);
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  const GstStructure *structure;
+  GstQOSType type;
+  gdouble proportion;
+  GstClockTimeDiff diff;
+  GstClockTime timestamp;
+  gint bitrate;
+  gboolean handled = FALSE;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM &&
+      gst_event_has_name (event, GST_CE_VIDENC_BANDWIDTH_ESTIMATE)) {
+    structure = gst_event_get_structure (event);
+
+    if (gst_structure_get_int (structure, "bitrate", &bitrate) &&
+        bitrate > 0) {
+      GST_LOG_OBJECT (ce_videnc, "bandwidth estimate of %d bps", bitrate);
+
+      /* Without a rate control there is no target bit rate to adapt */
+      GST_OBJECT_LOCK (ce_videnc);
+      if (priv->bitrate_adaptation != GST_CE_VIDENC_BITRATE_ADAPTATION_NONE
+          && ce_videnc->codec_params->rateControlPreset != IVIDEO_NONE) {
+        priv->bitrate_events = TRUE;
+        gst_ce_videnc_adapt_bitrate (ce_videnc, bitrate);
+        handled = TRUE;
+      }
+      GST_OBJECT_UNLOCK (ce_videnc);
+    } else {
+      GST_WARNING_OBJECT (ce_videnc, "invalid bandwidth estimate event");
+    }
+
+    /* Left for an element upstream that may act on it otherwise */
+    if (handled) {
+      gst_event_unref (event);
+      return TRUE;
+    }
+  }
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_QOS) {
+    gst_event_parse_qos (event, &type, &proportion, &diff, &timestamp);
+
+    GST_OBJECT_LOCK (ce_videnc);
+    priv->qos_proportion = proportion;
+    if (G_LIKELY (GST_CLOCK_TIME_IS_VALID (timestamp))) {
+      /* Be more aggressive when downstream is late, it takes a while
+       * until the dropping is noticed */
+      if (G_UNLIKELY (diff > 0))
+        priv->qos_earliest_time = timestamp + 2 * diff;
+      else
+        priv->qos_earliest_time = timestamp + diff;
+    } else {
+      priv->qos_earliest_time = GST_CLOCK_TIME_NONE;
+    }
+
+    /*
+     * Without explicit estimates, back off multiplicatively while
+     * downstream can't keep up and probe for more bandwidth otherwise
+     */
+    if (priv->bitrate_adaptation == GST_CE_VIDENC_BITRATE_ADAPTATION_AUTO &&
+        !priv->bitrate_events) {
+      gdouble current = ce_videnc->codec_dyn_params->targetBitRate;
+
+      if (diff > 0 || proportion > 1.0)
+        gst_ce_videnc_adapt_bitrate (ce_videnc,
+            0.9 * current / MAX (proportion, 1.0));
+      else
+        gst_ce_videnc_adapt_bitrate (ce_videnc,
+            current + ce_videnc->codec_params->maxBitRate / 20);
+    }
+    GST_OBJECT_UNLOCK (ce_videnc);
+
+    GST_LOG_OBJECT (ce_videnc, "QoS proportion %g, earliest time %"
+        GST_TIME_FORMAT, proportion, GST_TIME_ARGS (priv->qos_earliest_time));
+  }
+
+  return GST_VIDEO_ENCODER_CLASS (parent_class)->src_event (encoder, event);
+}
+
+/*
+ * gst_ce_videnc_predict_keyframe
+ *
+ * Guesses whether the codec will encode the next frame as a keyframe.
+ * Call with the object lock held.
+ */
+static gboolean
+gst_ce_videnc_predict_keyframe (GstCeVidEnc * ce_videnc,
+    GstVideoCodecFrame * frame)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  gint interval = ce_videnc->codec_dyn_params->intraFrameInterval;
+
+  return !priv->first_keyframe || priv->qos_force_idr ||
+      priv->cached_force_idr ||
+      GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame) ||
+      (interval > 0 && priv->frames_since_key + 1 >= interval);
+}
+
+/*
+ * gst_ce_videnc_update_complexity
+ *
+ * Tracks the time the codec takes to encode a frame against the frame
+ * interval and decides whether the complexity should be lowered or
+ * raised. The change is applied at the next keyframe.
+ */
+static void
+gst_ce_videnc_update_complexity (GstCeVidEnc * ce_videnc)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstClockTime budget;
+  gdouble load;
+
+  if (!priv->complexity_enabled || priv->fps_num <= 0 || priv->fps_den <= 0)
+    return;
+
+  budget = gst_util_uint64_scale_int (GST_SECOND, priv->fps_den,
+      priv->fps_num);
+  load = (gdouble) priv->process_time / budget;
+
+  GST_OBJECT_LOCK (ce_videnc);
+  if (priv->complexity_frames)
+    priv->complexity_load = COMPLEXITY_LOAD_WEIGHT * load +
+        (1.0 - COMPLEXITY_LOAD_WEIGHT) * priv->complexity_load;
+  else
+    priv->complexity_load = load;
+
+  if (++priv->complexity_frames < COMPLEXITY_MIN_FRAMES ||
+      priv->complexity_pending >= 0)
+    goto out;
+
+  if (priv->complexity_load > COMPLEXITY_OVERLOAD && (priv->complexity_max < 0
+          || priv->complexity_level < priv->complexity_max))
+    priv->complexity_pending = priv->complexity_level + 1;
+  else if (priv->complexity_load < COMPLEXITY_HEADROOM &&
+      priv->complexity_level > 0)
+    priv->complexity_pending = priv->complexity_level - 1;
+
+  if (priv->complexity_pending >= 0)
+    GST_INFO_OBJECT (ce_videnc, "encoder load at %.0f%% of the frame "
+        "interval, moving to complexity level %d at the next keyframe",
+        priv->complexity_load * 100, priv->complexity_pending);
+
+out:
+  GST_OBJECT_UNLOCK (ce_videnc);
+}
+
+/*
+ * gst_ce_videnc_apply_complexity
+ *
+ * Applies a pending complexity change if the frame would be a keyframe
+ * anyway, re-creating the codec with the new static parameters.
+ */
+static gboolean
+gst_ce_videnc_apply_complexity (GstCeVidEnc * ce_videnc,
+    GstVideoCodecFrame * frame)
+{
+  GstCeVidEncClass *klass = GST_CEVIDENC_CLASS (G_OBJECT_GET_CLASS (ce_videnc));
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  guint level, previous;
+  gdouble load;
+
+  GST_OBJECT_LOCK (ce_videnc);
+  if (priv->complexity_pending < 0 ||
+      !gst_ce_videnc_predict_keyframe (ce_videnc, frame)) {
+    GST_OBJECT_UNLOCK (ce_videnc);
+    return TRUE;
+  }
+
+  level = priv->complexity_pending;
+  previous = priv->complexity_level;
+  load = priv->complexity_load;
+  priv->complexity_pending = -1;
+
+  if (!klass->set_complexity || !klass->set_complexity (ce_videnc, level)) {
+    GST_DEBUG_OBJECT (ce_videnc, "complexity level %u not supported", level);
+    priv->complexity_max = previous;
+    priv->complexity_frames = 0;
+    GST_OBJECT_UNLOCK (ce_videnc);
+    return TRUE;
+  }
+
+  priv->complexity_level = level;
+  priv->complexity_frames = 0;
+  GST_OBJECT_UNLOCK (ce_videnc);
+
+  GST_INFO_OBJECT (ce_videnc, "changing complexity level from %u to %u",
+      previous, level);
+
+  if (!gst_ce_videnc_reconfigure (ce_videnc))
+    return FALSE;
+
+  gst_element_post_message (GST_ELEMENT_CAST (ce_videnc),
+      gst_message_new_element (GST_OBJECT_CAST (ce_videnc),
+          gst_structure_new ("GstCeVidEncComplexity",
+              "level", G_TYPE_UINT, level,
+              "previous-level", G_TYPE_UINT, previous,
+              "load", G_TYPE_DOUBLE, load, NULL)));
+
+  return TRUE;
+}
+
+/*
+ * gst_ce_videnc_qos_drop
+ *
+ * Checks whether the raw frame is already too late to be displayed and
+ * can be dropped before encoding it. Frames that are likely to be
+ * encoded as keyframes are never dropped, as the following frames
+ * depend on them.
+ */
+static gboolean
+gst_ce_videnc_qos_drop (GstCeVidEnc * ce_videnc, GstVideoCodecFrame * frame)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (ce_videnc);
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstClockTime qostime, earliest_time;
+  GstClockTime stream_time;
+  gboolean keyframe;
+  GstMessage *msg;
+
+  if (!priv->qos_drop || !GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return FALSE;
+
+  qostime = gst_segment_to_running_time (&encoder->input_segment,
+      GST_FORMAT_TIME, frame->pts);
+
+  GST_OBJECT_LOCK (ce_videnc);
+  earliest_time = priv->qos_earliest_time;
+  keyframe = gst_ce_videnc_predict_keyframe (ce_videnc, frame);
+  GST_OBJECT_UNLOCK (ce_videnc);
+
+  if (!GST_CLOCK_TIME_IS_VALID (qostime) ||
+      !GST_CLOCK_TIME_IS_VALID (earliest_time) || qostime > earliest_time) {
+    priv->qos_processed++;
+    return FALSE;
+  }
+
+  if (keyframe) {
+    GST_DEBUG_OBJECT (ce_videnc, "late frame %" GST_TIME_FORMAT " would be "
+        "a keyframe, encoding it anyway", GST_TIME_ARGS (qostime));
+    priv->qos_processed++;
+    return FALSE;
+  }
+
+  priv->qos_dropped++;
+  priv->qos_skipped++;
+
+  GST_DEBUG_OBJECT (ce_videnc, "dropping late frame %" GST_TIME_FORMAT
+      ", earliest time %" GST_TIME_FORMAT " (%u consecutive)",
+      GST_TIME_ARGS (qostime), GST_TIME_ARGS (earliest_time),
+      priv->qos_skipped);
+
+  /* Too many references skipped, refresh the prediction chain */
+  if (priv->qos_max_skip && priv->qos_skipped >= priv->qos_max_skip) {
+    GST_OBJECT_LOCK (ce_videnc);
+    priv->qos_force_idr = TRUE;
+    GST_OBJECT_UNLOCK (ce_videnc);
+  }
+
+  stream_time = gst_segment_to_stream_time (&encoder->input_segment,
+      GST_FORMAT_TIME, frame->pts);
+  msg = gst_message_new_qos (GST_OBJECT_CAST (ce_videnc), FALSE, qostime,
+      stream_time, frame->pts, frame->duration);
+  gst_message_set_qos_values (msg, GST_CLOCK_DIFF (qostime, earliest_time),
+      priv->qos_proportion, 1000000);
+  gst_message_set_qos_stats (msg, GST_FORMAT_BUFFERS, priv->qos_processed,
+      priv->qos_dropped);
+  gst_element_post_message (GST_ELEMENT_CAST (ce_videnc), msg);
+
+  return TRUE;
+}
+
+/*
+ * gst_ce_videnc_decimate
+ *
+ * Drops the frames that come ahead of the maximum frame rate. Only the
+ * timestamps are looked at, so nothing else is spent on them. A frame
+ * within half an input frame of its slot takes the slot, and the slots
+ * start over on the first frame, after a gap or when time goes back.
+ */
+static gboolean
+gst_ce_videnc_decimate (GstCeVidEnc * ce_videnc, GstVideoCodecFrame * frame)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstClockTime next = priv->decimate_next;
+  GstClockTime slack = 0;
+
+  if (!GST_CLOCK_TIME_IS_VALID (priv->decimate_period) ||
+      !GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return FALSE;
+
+  if (GST_CLOCK_TIME_IS_VALID (frame->duration))
+    slack = frame->duration / 2;
+
+  if (GST_CLOCK_TIME_IS_VALID (next) && frame->pts + slack < next &&
+      frame->pts + priv->decimate_period >= next) {
+    GST_LOG_OBJECT (ce_videnc, "decimating frame %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (frame->pts));
+    return TRUE;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (next) || frame->pts + slack < next ||
+      frame->pts >= next + priv->decimate_period)
+    next = frame->pts;
+
+  priv->decimate_next = next + priv->decimate_period;
+  frame->duration = priv->decimate_period;
+
+  return FALSE;
+}
+
+/*
+ * gst_ce_videnc_static_drop
+ *
+ * Checks whether the raw frame shows the same scene as the last encoded
+ * one. The codec can't be asked for an all-skip frame, so static frames
+ * are dropped and a gap event keeps the timeline going downstream; the
+ * next encoded frame still predicts from the last one that was encoded.
+ * Requested keyframes are always encoded.
+ */
+static gboolean
+gst_ce_videnc_static_drop (GstCeVidEnc * ce_videnc, GstVideoCodecFrame * frame)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstVideoFrame vframe;
+  gboolean skip, force, is_static;
+  guint threshold, max_skip;
+
+  GST_OBJECT_LOCK (ce_videnc);
+  skip = priv->skip_static;
+  threshold = priv->static_threshold;
+  max_skip = priv->static_max_skip;
+  GST_OBJECT_UNLOCK (ce_videnc);
+
+  if (!skip) {
+    gst_ce_static_scene_reset (&priv->static_scene);
+    return FALSE;
+  }
+
+  force = GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame) ||
+      (max_skip && priv->static_skipped >= max_skip);
+
+  if (!gst_video_frame_map (&vframe, &priv->input_state->info,
+          frame->input_buffer, GST_MAP_READ))
+    return FALSE;
+
+  is_static = gst_ce_static_scene_update (&priv->static_scene, &vframe,
+      threshold, force);
+
+  gst_video_frame_unmap (&vframe);
+
+  if (!is_static) {
+    priv->static_skipped = 0;
+    return FALSE;
+  }
+
+  priv->static_skipped++;
+
+  GST_LOG_OBJECT (ce_videnc, "dropping static frame %" GST_TIME_FORMAT
+      " (%u consecutive)", GST_TIME_ARGS (frame->pts), priv->static_skipped);
+
+  return TRUE;
+}
+
+/*
+ * gst_ce_videnc_finish_static
+ *
+ * Finishes a dropped static frame and sends a gap event in its place.
+ * The gap goes after the frame is finished, which pushes any pending
+ * caps and segment events first.
+ */
+static GstFlowReturn
+gst_ce_videnc_finish_static (GstCeVidEnc * ce_videnc,
+    GstVideoCodecFrame * frame)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (ce_videnc);
+  GstClockTime pts = frame->pts;
+  GstClockTime duration = frame->duration;
+  GstFlowReturn ret;
+
+  frame->output_buffer = NULL;
+  ret = gst_video_encoder_finish_frame (encoder, frame);
+
+  if (GST_CLOCK_TIME_IS_VALID (pts))
+    gst_pad_push_event (GST_VIDEO_ENCODER_SRC_PAD (encoder),
+        gst_event_new_gap (pts, duration));
+
+  return ret;
+}
+
+/*
+ * gst_ce_videnc_update_crop
+ *
+ * Follows the region to encode of the incoming buffers. The codec only
+ * needs to be re-created when the size of the region changes.
+ */
+static gboolean
+gst_ce_videnc_update_crop (GstCeVidEnc * ce_videnc, GstBuffer * buffer)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstVideoRectangle crop;
+  gboolean resize;
+
+  GST_OBJECT_LOCK (ce_videnc);
+  gst_ce_videnc_get_crop (ce_videnc, &priv->input_state->info, buffer, &crop);
+
+  resize = crop.w != priv->crop.w || crop.h != priv->crop.h;
+  priv->crop = crop;
+  priv->inbuf_desc.frameWidth = crop.w;
+  priv->inbuf_desc.frameHeight = crop.h;
+  GST_OBJECT_UNLOCK (ce_videnc);
+
+  if (!resize)
+    return TRUE;
+
+  GST_INFO_OBJECT (ce_videnc, "encoding a %dx%d region at (%d,%d)", crop.w,
+      crop.h, crop.x, crop.y);
+
+  return gst_ce_videnc_reconfigure (ce_videnc);
+}
+
+/*
+ * gst_ce_videnc_set_planes
+ *
+ * Points the codec to the cropped region inside the mapped frame
+ */
+static void
+gst_ce_videnc_set_planes (GstCeVidEnc * ce_videnc, GstVideoFrame * vframe)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstVideoRectangle *crop = &priv->crop;
+  guint8 *data;
+  gint i, stride;
+
+  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (vframe); i++) {
+    data = GST_VIDEO_FRAME_PLANE_DATA (vframe, i);
+    stride = GST_VIDEO_FRAME_PLANE_STRIDE (vframe, i);
+
+    switch (priv->video_format) {
+      case GST_VIDEO_FORMAT_UYVY:
+        data += crop->y * stride + crop->x * 2;
+        break;
+      case GST_VIDEO_FORMAT_NV12:
+        /* The interleaved chroma plane is subsampled vertically */
+        data += (i ? crop->y / 2 : crop->y) * stride + crop->x;
+        break;
+      default:
+        break;
+    }
+
+    priv->inbuf_desc.bufDesc[i].buf = (XDAS_Int8 *) data;
+  }
+}
+
+/*
+ * gst_ce_videnc_check_layout
+ *
+ * The codec reads every plane in place through a single pitch, so the
+ * buffer must be physically contiguous and all the planes must share
+ * the same stride. Plane offsets are already honored when mapping.
+ *
+ * Returns: %NULL if the codec can read the frame, or why it can't.
+ */
+static const gchar *
+gst_ce_videnc_check_layout (GstCeVidEnc * ce_videnc, GstVideoFrame * vframe,
+    gboolean contiguous)
+{
+  gint i, stride;
+
+  if (GST_VIDEO_FRAME_FORMAT (vframe) != ce_videnc->priv->video_format)
+    return "the codec reads another format";
+
+  if (!contiguous)
+    return "the buffer is not physically contiguous";
 
-  gst_buffer_unmap (*outbuf, &info_out);
+  stride = GST_VIDEO_FRAME_PLANE_STRIDE (vframe, 0);
+  for (i = 1; i < GST_VIDEO_FRAME_N_PLANES (vframe); i++)
+    if (GST_VIDEO_FRAME_PLANE_STRIDE (vframe, i) != stride)
+      return "the planes have different strides";
 
-  gst_ce_slice_buffer_resize (GST_CE_SLICE_BUFFER_POOL_CAST (priv->outbuf_pool),
-      *outbuf, out_args->bytesGenerated);
+  return NULL;
+}
 
-  return GST_FLOW_OK;
+/*
+ * gst_ce_videnc_stage_frame
+ *
+ * Copies a frame the codec can't read in place into a contiguous buffer
+ * with the default layout, replacing the mapping of @vframe. Frames in
+ * another format are converted in the same pass.
+ */
+static gboolean
+gst_ce_videnc_stage_frame (GstCeVidEnc * ce_videnc, GstVideoFrame * vframe,
+    const gchar * reason)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstVideoFrame staging;
+  GstAllocationParams params;
 
-  /*ERRORS*/
-fail_alloc:
-  {
-    GST_INFO_OBJECT (ce_videnc, "Failed to get output buffer, frame dropped");
-    return GST_FLOW_ERROR;
+  if (reason != priv->staging_reason) {
+    if (GST_VIDEO_FRAME_FORMAT (vframe) != priv->video_format)
+      GST_INFO_OBJECT (ce_videnc, "converting the input frames to %s",
+          gst_video_format_to_string (priv->video_format));
+    else
+      GST_WARNING_OBJECT (ce_videnc, "copying the input frames, %s", reason);
+    priv->staging_reason = reason;
   }
-fail_map:
-  {
-    GST_ERROR_OBJECT (ce_videnc, "Failed to map buffer");
-    return GST_FLOW_ERROR;
+
+  if (!priv->staging_buf) {
+    gst_allocation_params_init (&params);
+    params.align = 31;
+    priv->staging_buf = gst_buffer_new_allocate (priv->allocator,
+        GST_VIDEO_INFO_SIZE (&priv->staging_info), &params);
+    if (!priv->staging_buf)
+      return FALSE;
   }
-fail_encode:
-  {
-    gst_buffer_unmap (*outbuf, &info_out);
-    GST_ERROR_OBJECT (ce_videnc,
-        "Failed encode process with extended error: 0x%x",
-        (unsigned int) out_args->extendedError);
-    return GST_FLOW_ERROR;
+
+  if (!gst_video_frame_map (&staging, &priv->staging_info, priv->staging_buf,
+          GST_MAP_WRITE))
+    return FALSE;
+
+  if (!gst_ce_convert_frame (&staging, vframe)) {
+    gst_video_frame_unmap (&staging);
+    return FALSE;
   }
+
+  gst_video_frame_unmap (vframe);
+  *vframe = staging;
+
+  return TRUE;
 }
+
 static GstFlowReturn
 gst_ce_videnc_handle_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame)
@@ -712,26 +2134,76 @@ gst_ce_videnc_handle_frame (GstVideoEncoder * encoder,
   GstBuffer *outbuf = NULL;
   GstFlowReturn ret;
   VIDENC1_OutArgs out_args;
+  GstCeStats *stats = NULL;
+  GstClockTime last = 0;
+  GstClockTime post_start, post_time = 0;
+  XDAS_Int32 frame_type = IVIDEO_NA_FRAME;
+  gboolean field_pair;
+  gsize offset = 0;
 
   gint i,j;
   gint fields;
   gint current_pitch;
+  gboolean contiguous;
+  const gchar *reason;
+  gboolean update_buffer_info = FALSE;
+  gboolean restore_force_frame = FALSE;
+  VIDENC1_DynamicParams *dyn_params = NULL;
+
+  /* Decimated frames are not counted by QoS, they were never due */
+  if (gst_ce_videnc_decimate (ce_videnc, frame)) {
+    frame->output_buffer = NULL;
+    return gst_video_encoder_finish_frame (encoder, frame);
+  }
 
-  /* $
-   * TODO
-   * Failing if input buffer is not contiguous. Should it copy the
-   * buffer instead?
-   */
-  if (!gst_ce_is_buffer_contiguous (frame->input_buffer))
-    goto fail_no_contiguous_buffer;
+  if (gst_ce_videnc_qos_drop (ce_videnc, frame)) {
+    frame->output_buffer = NULL;
+    return gst_video_encoder_finish_frame (encoder, frame);
+  }
+
+  if (gst_ce_videnc_static_drop (ce_videnc, frame))
+    return gst_ce_videnc_finish_static (ce_videnc, frame);
+
+  if (!gst_ce_videnc_apply_complexity (ce_videnc, frame))
+    goto fail_reconfigure;
+
+  if (priv->stats_enabled)
+    stats = priv->stats;
+
+  GST_CE_STATS_START (stats, last);
+
+  contiguous = gst_ce_is_buffer_contiguous (frame->input_buffer);
+
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_CONTIGUITY, last);
 
   /* Fill planes pointer */
   if (!gst_video_frame_map (&vframe, info, frame->input_buffer, GST_MAP_READ))
     goto fail_map;
 
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_MAP, last);
+
+  /* Only copy the layouts the codec can't read in place */
+  reason = gst_ce_videnc_check_layout (ce_videnc, &vframe, contiguous);
+  if (reason) {
+    if (!gst_ce_videnc_stage_frame (ce_videnc, &vframe, reason)) {
+      gst_video_frame_unmap (&vframe);
+      goto fail_copy;
+    }
+    GST_CE_STATS_LAP (stats, GST_CE_STATS_COPY, last);
+  } else if (priv->staging_reason) {
+    GST_INFO_OBJECT (ce_videnc, "input frames read in place again");
+    priv->staging_reason = NULL;
+  }
+
+  if (!gst_ce_videnc_update_crop (ce_videnc, frame->input_buffer)) {
+    gst_video_frame_unmap (&vframe);
+    goto fail_reconfigure;
+  }
+
   current_pitch = GST_VIDEO_FRAME_PLANE_STRIDE (&vframe, 0);
 
   if (priv->inbuf_desc.framePitch != current_pitch) {
+    GST_OBJECT_LOCK (ce_videnc);
     priv->inbuf_desc.framePitch = current_pitch;
     switch (priv->video_format) {
       case GST_VIDEO_FORMAT_UYVY:
@@ -750,56 +2222,145 @@ gst_ce_videnc_handle_frame (GstVideoEncoder * encoder,
       ce_videnc->codec_dyn_params->captureWidth = ce_videnc->codec_dyn_params->captureWidth << 1;
     }
 
-    if (!gst_ce_videnc_set_dynamic_params (ce_videnc))
-      goto fail_set_buffer_stride;
-
-    if (!gst_ce_videnc_get_buffer_info (ce_videnc))
-      goto fail_set_buffer_stride;
+    priv->dyn_params_pending = TRUE;
+    update_buffer_info = TRUE;
+    GST_OBJECT_UNLOCK (ce_videnc);
   }
 
-  /* Making sure the output buffer pool is configured */
-  if (priv->first_buffer && gst_pad_check_reconfigure (encoder->srcpad))
-    gst_video_encoder_negotiate (GST_VIDEO_ENCODER (encoder));
+  /* Making sure the output buffer pool is configured. Caps without the
+   * codec data are refused downstream, so they wait until the frame is
+   * finished and only the pool is configured for now */
+  if (priv->first_buffer && gst_pad_check_reconfigure (encoder->srcpad)) {
+    if (priv->codec_data_wait) {
+      GST_DEBUG_OBJECT (ce_videnc, "holding the caps until the codec data");
+      gst_allocation_params_init (&priv->alloc_params);
+      priv->alloc_params.align = 31;
+      if (!gst_ce_videnc_configure_pool (ce_videnc)) {
+        gst_video_frame_unmap (&vframe);
+        goto fail_pool;
+      }
+    } else {
+      gst_video_encoder_negotiate (GST_VIDEO_ENCODER (encoder));
+    }
+  }
 
   /* Pre-encode process */
+  GST_CE_STATS_START (stats, last);
   if (klass->pre_process
       && !klass->pre_process (ce_videnc, frame->input_buffer))
     goto fail_pre_encode;
+  GST_CE_STATS_LAP (stats, GST_CE_STATS_PRE_PROCESS, last);
 
-  /* Encode process */
-  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (&vframe); i++) {
-    priv->inbuf_desc.bufDesc[i].buf = GST_VIDEO_FRAME_PLANE_DATA (&vframe, i);
+  /* Apply all the dynamic params changed since the last frame at once */
+  GST_OBJECT_LOCK (ce_videnc);
+  if (priv->qos_force_idr || priv->cached_force_idr) {
+    if (priv->qos_force_idr)
+      GST_DEBUG_OBJECT (ce_videnc, "forcing IDR after %u dropped frames",
+          priv->qos_skipped);
+    else
+      GST_DEBUG_OBJECT (ce_videnc, "forcing IDR on the warm codec");
+    priv->qos_force_idr = FALSE;
+    priv->cached_force_idr = FALSE;
+    restore_force_frame = TRUE;
+  }
+  priv->qos_skipped = 0;
+
+  if (priv->dyn_params_pending || restore_force_frame)
+    dyn_params = gst_ce_videnc_copy_dynamic_params (ce_videnc);
+  GST_OBJECT_UNLOCK (ce_videnc);
+
+  if (dyn_params) {
+    /* Only this frame is forced, the property keeps its value */
+    if (restore_force_frame)
+      dyn_params->forceFrame = IVIDEO_IDR_FRAME;
+
+    if (!gst_ce_videnc_set_dynamic_params (ce_videnc, dyn_params)
+        && update_buffer_info)
+      goto fail_set_buffer_stride;
+
+    if (update_buffer_info
+        && !gst_ce_videnc_get_buffer_info (ce_videnc, dyn_params))
+      goto fail_set_buffer_stride;
   }
 
+  /* Encode process */
+  gst_ce_videnc_set_planes (ce_videnc, &vframe);
+
   /* Get oldest frame */
   gst_video_codec_frame_unref (frame);
   frame = gst_video_encoder_get_oldest_frame (encoder);
 
+  priv->process_time = 0;
   fields = 1 << (ce_videnc->codec_params->inputContentType);
+  field_pair = priv->field_pair_pool && fields == 2;
   for (j=1; j <= fields; j++) {
-    if (gst_ce_videnc_encode_buffer(ce_videnc, &outbuf, &out_args) != GST_FLOW_OK) {
+    GST_CE_STATS_START (stats, last);
+    if (gst_ce_videnc_encode_buffer(ce_videnc, &outbuf, &out_args,
+            field_pair && j != 1, offset, field_pair && j != fields, stats,
+            &last) != GST_FLOW_OK) {
       if (outbuf == NULL) {
 	frame->output_buffer = NULL;
 	gst_video_encoder_finish_frame (encoder, frame); 
 	goto drop_buffer;
       }
+      /* Not pushed yet, this may hold the first field of a pair too */
+      gst_buffer_unref (outbuf);
       goto fail_encode;
     }
 
+    /* A field pair is typed after its first field */
+    if (j == 1)
+      frame_type = out_args.encodedFrameType;
+
+    /* The second field is encoded right after the first one, into the
+     * same buffer even if the first one took no bytes */
+    if (field_pair && j != fields) {
+      offset = out_args.bytesGenerated;
+      for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (&vframe); i++) {
+	priv->inbuf_desc.bufDesc[i].buf += current_pitch;
+      }
+      continue;
+    }
+
     /* Post-encode process */
+    post_start = gst_util_get_timestamp ();
     if (klass->post_process && !klass->post_process (ce_videnc, outbuf))
       goto fail_post_encode;
+    post_time += gst_util_get_timestamp () - post_start;
+
+    /* Report before the last field goes downstream */
+    if (j == fields)
+      gst_ce_videnc_update_latency (ce_videnc, priv->process_time + post_time);
+
+    GST_CE_STATS_LAP (stats, GST_CE_STATS_POST_PROCESS, last);
 
     if (frame->output_buffer)
       gst_buffer_unref (frame->output_buffer);
 
     frame->output_buffer = outbuf;
 
+    if (!field_pair)
+      frame_type = out_args.encodedFrameType;
+
     /* Mark I and IDR frames */
-    if ((out_args.encodedFrameType == IVIDEO_I_FRAME) ||
-	(out_args.encodedFrameType == IVIDEO_IDR_FRAME)) {
-      GST_ERROR_OBJECT (ce_videnc, "frame type %li", out_args.encodedFrameType);
+    if ((frame_type == IVIDEO_I_FRAME) || (frame_type == IVIDEO_IDR_FRAME)) {
+      GST_LOG_OBJECT (ce_videnc, "frame type %li", frame_type);
       GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
+
+      if (!priv->first_keyframe)
+        gst_ce_videnc_report_first_keyframe (ce_videnc);
+
+      priv->frames_since_key = 0;
+    } else if (j == fields) {
+      priv->frames_since_key++;
+    }
+
+    /* The IDR was forced for this frame only */
+    if (restore_force_frame) {
+      GST_OBJECT_LOCK (ce_videnc);
+      priv->dyn_params_pending = TRUE;
+      GST_OBJECT_UNLOCK (ce_videnc);
+      restore_force_frame = FALSE;
     }
 
     if (j != fields) {
@@ -812,12 +2373,19 @@ gst_ce_videnc_handle_frame (GstVideoEncoder * encoder,
     }
 
     ret = gst_video_encoder_finish_frame (encoder, frame);
+    /* The sub-class pushed the frame in its own shape */
+    if (ret == GST_FLOW_CUSTOM_SUCCESS)
+      ret = GST_FLOW_OK;
     if (ret != GST_FLOW_OK)
       goto out;
+
+    GST_CE_STATS_LAP (stats, GST_CE_STATS_PUSH, last);
   }
 
   gst_video_frame_unmap (&vframe);
 
+  gst_ce_videnc_update_complexity (ce_videnc);
+
   GST_DEBUG_OBJECT (ce_videnc, "frame encoded succesfully");
 
 out:
@@ -838,9 +2406,21 @@ fail_set_buffer_stride:
     GST_ERROR_OBJECT (encoder, "Failed to set buffer stride");
     return GST_FLOW_ERROR;
   }
-fail_no_contiguous_buffer:
+fail_copy:
+  {
+    GST_ERROR_OBJECT (encoder, "Failed to copy the input frame");
+    return GST_FLOW_ERROR;
+  }
+fail_reconfigure:
+  {
+    GST_ELEMENT_ERROR (ce_videnc, STREAM, ENCODE, (NULL),
+        ("failed to re-create the codec"));
+    return GST_FLOW_ERROR;
+  }
+fail_pool:
   {
-    GST_ERROR_OBJECT (encoder, "Input buffer should be contiguous");
+    GST_ELEMENT_ERROR (ce_videnc, RESOURCE, NO_SPACE_LEFT, (NULL),
+        ("failed to set up the output buffers"));
     return GST_FLOW_ERROR;
   }
 fail_pre_encode:
@@ -945,13 +2525,113 @@ gst_ce_videnc_set_property (GObject * object,
           "setting min output buffer size percentage to %d",
           ce_videnc->priv->outbuf_size_percentage);
       break;
+    case PROP_CODEC_CACHE_SIZE:
+      ce_videnc->priv->codec_cache_size = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_videnc, "setting codec cache size to %u",
+          ce_videnc->priv->codec_cache_size);
+      break;
+    case PROP_CODEC_CACHE_TIMEOUT:
+      ce_videnc->priv->codec_cache_timeout = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_videnc, "setting codec cache timeout to %u ms",
+          ce_videnc->priv->codec_cache_timeout);
+      break;
+    case PROP_ENABLE_STATS:
+      ce_videnc->priv->stats_enabled = g_value_get_boolean (value);
+      if (ce_videnc->priv->stats_enabled)
+        gst_ce_stats_reset (ce_videnc->priv->stats);
+      GST_LOG_OBJECT (ce_videnc, "setting stats enabled to %d",
+          ce_videnc->priv->stats_enabled);
+      break;
+    case PROP_QOS_DROP:
+      ce_videnc->priv->qos_drop = g_value_get_boolean (value);
+      GST_LOG_OBJECT (ce_videnc, "setting qos drop to %d",
+          ce_videnc->priv->qos_drop);
+      break;
+    case PROP_QOS_MAX_SKIP:
+      ce_videnc->priv->qos_max_skip = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_videnc, "setting qos max skip to %u",
+          ce_videnc->priv->qos_max_skip);
+      break;
+    case PROP_BITRATE_ADAPTATION:
+      ce_videnc->priv->bitrate_adaptation = g_value_get_enum (value);
+      GST_LOG_OBJECT (ce_videnc, "setting bit rate adaptation to %d",
+          ce_videnc->priv->bitrate_adaptation);
+      break;
+    case PROP_MIN_BITRATE:
+      ce_videnc->priv->min_bitrate = g_value_get_int (value);
+      GST_LOG_OBJECT (ce_videnc, "setting min bitrate to %d",
+          ce_videnc->priv->min_bitrate);
+      break;
+    case PROP_BITRATE_ADAPTATION_INTERVAL:
+      ce_videnc->priv->bitrate_adaptation_interval = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_videnc, "setting bit rate adaptation interval to "
+          "%u ms", ce_videnc->priv->bitrate_adaptation_interval);
+      break;
+    case PROP_CROP:
+    {
+      const gchar *crop = g_value_get_string (value);
+      GstVideoRectangle *rect = &ce_videnc->priv->crop_prop;
+
+      if (!crop || !*crop) {
+        ce_videnc->priv->crop_set = FALSE;
+      } else if (sscanf (crop, "%d,%d,%d,%d", &rect->x, &rect->y, &rect->w,
+              &rect->h) == 4 && rect->x >= 0 && rect->y >= 0 && rect->w > 0
+          && rect->h > 0) {
+        ce_videnc->priv->crop_set = TRUE;
+      } else {
+        ce_videnc->priv->crop_set = FALSE;
+        GST_WARNING_OBJECT (ce_videnc, "invalid crop region \"%s\"", crop);
+      }
+      GST_LOG_OBJECT (ce_videnc, "setting crop region to %s",
+          ce_videnc->priv->crop_set ? crop : "the whole frame");
+      break;
+    }
+    case PROP_LOW_LATENCY:
+      ce_videnc->priv->low_latency = g_value_get_boolean (value);
+      GST_LOG_OBJECT (ce_videnc, "setting low latency to %d",
+          ce_videnc->priv->low_latency);
+      break;
+    case PROP_FIELD_PAIR:
+      ce_videnc->priv->field_pair = g_value_get_boolean (value);
+      GST_LOG_OBJECT (ce_videnc, "setting field pair to %d",
+          ce_videnc->priv->field_pair);
+      break;
+    case PROP_SKIP_STATIC:
+      ce_videnc->priv->skip_static = g_value_get_boolean (value);
+      GST_LOG_OBJECT (ce_videnc, "setting skip static to %d",
+          ce_videnc->priv->skip_static);
+      break;
+    case PROP_STATIC_THRESHOLD:
+      ce_videnc->priv->static_threshold = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_videnc, "setting static threshold to %u",
+          ce_videnc->priv->static_threshold);
+      break;
+    case PROP_STATIC_MAX_SKIP:
+      ce_videnc->priv->static_max_skip = g_value_get_uint (value);
+      GST_LOG_OBJECT (ce_videnc, "setting static max skip to %u",
+          ce_videnc->priv->static_max_skip);
+      break;
+    case PROP_MAX_FRAMERATE:
+      ce_videnc->priv->max_fps_num = gst_value_get_fraction_numerator (value);
+      ce_videnc->priv->max_fps_den =
+          gst_value_get_fraction_denominator (value);
+      GST_LOG_OBJECT (ce_videnc, "setting max framerate to %d/%d",
+          ce_videnc->priv->max_fps_num, ce_videnc->priv->max_fps_den);
+      break;
+    case PROP_ADAPTIVE_COMPLEXITY:
+      ce_videnc->priv->complexity_enabled = g_value_get_boolean (value);
+      ce_videnc->priv->complexity_frames = 0;
+      GST_LOG_OBJECT (ce_videnc, "setting adaptive complexity to %d",
+          ce_videnc->priv->complexity_enabled);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 
-  if (set_params && ce_videnc->codec_handle)
-    gst_ce_videnc_set_dynamic_params (ce_videnc);
+  /* Applied by the streaming thread before encoding the next frame */
+  if (set_params)
+    ce_videnc->priv->dyn_params_pending = TRUE;
 
   GST_OBJECT_UNLOCK (ce_videnc);
   return;
@@ -1010,6 +2690,67 @@ gst_ce_videnc_get_property (GObject * object,
     case PROP_MIN_SIZE_PERCENTAGE:
       g_value_set_int (value, ce_videnc->priv->outbuf_size_percentage);
       break;
+    case PROP_CODEC_CACHE_SIZE:
+      g_value_set_uint (value, ce_videnc->priv->codec_cache_size);
+      break;
+    case PROP_CODEC_CACHE_TIMEOUT:
+      g_value_set_uint (value, ce_videnc->priv->codec_cache_timeout);
+      break;
+    case PROP_ENABLE_STATS:
+      g_value_set_boolean (value, ce_videnc->priv->stats_enabled);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value,
+          gst_ce_stats_get_structure (ce_videnc->priv->stats));
+      break;
+    case PROP_QOS_DROP:
+      g_value_set_boolean (value, ce_videnc->priv->qos_drop);
+      break;
+    case PROP_QOS_MAX_SKIP:
+      g_value_set_uint (value, ce_videnc->priv->qos_max_skip);
+      break;
+    case PROP_BITRATE_ADAPTATION:
+      g_value_set_enum (value, ce_videnc->priv->bitrate_adaptation);
+      break;
+    case PROP_MIN_BITRATE:
+      g_value_set_int (value, ce_videnc->priv->min_bitrate);
+      break;
+    case PROP_BITRATE_ADAPTATION_INTERVAL:
+      g_value_set_uint (value, ce_videnc->priv->bitrate_adaptation_interval);
+      break;
+    case PROP_ADAPTIVE_COMPLEXITY:
+      g_value_set_boolean (value, ce_videnc->priv->complexity_enabled);
+      break;
+    case PROP_COMPLEXITY_LEVEL:
+      g_value_set_uint (value, ce_videnc->priv->complexity_level);
+      break;
+    case PROP_CROP:
+      if (ce_videnc->priv->crop_set)
+        g_value_take_string (value, g_strdup_printf ("%d,%d,%d,%d",
+                ce_videnc->priv->crop_prop.x, ce_videnc->priv->crop_prop.y,
+                ce_videnc->priv->crop_prop.w, ce_videnc->priv->crop_prop.h));
+      else
+        g_value_set_string (value, NULL);
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, ce_videnc->priv->low_latency);
+      break;
+    case PROP_FIELD_PAIR:
+      g_value_set_boolean (value, ce_videnc->priv->field_pair);
+      break;
+    case PROP_SKIP_STATIC:
+      g_value_set_boolean (value, ce_videnc->priv->skip_static);
+      break;
+    case PROP_STATIC_THRESHOLD:
+      g_value_set_uint (value, ce_videnc->priv->static_threshold);
+      break;
+    case PROP_STATIC_MAX_SKIP:
+      g_value_set_uint (value, ce_videnc->priv->static_max_skip);
+      break;
+    case PROP_MAX_FRAMERATE:
+      gst_value_set_fraction (value, ce_videnc->priv->max_fps_num,
+          ce_videnc->priv->max_fps_den);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1023,11 +2764,17 @@ gst_ce_videnc_open (GstVideoEncoder * encoder)
   GstCeVidEnc *ce_videnc = GST_CEVIDENC (encoder);
   GstCeVidEncPrivate *priv = ce_videnc->priv;
 
-  GST_DEBUG_OBJECT (ce_videnc, "opening %s Engine", CODEC_ENGINE);
-  /* reset, load, and start DSP Engine */
-  if ((priv->engine_handle =
-          Engine_open ((Char *) CODEC_ENGINE, NULL, NULL)) == NULL)
-    goto fail_engine_open;
+  /*
+   * When caching codec instances the engine is opened along with the
+   * codec, so a warm instance and its engine can be adopted instead
+   */
+  if (!priv->codec_cache_size) {
+    GST_DEBUG_OBJECT (ce_videnc, "opening %s Engine", CODEC_ENGINE);
+    /* reset, load, and start DSP Engine */
+    if ((priv->engine_handle =
+            Engine_open ((Char *) CODEC_ENGINE, NULL, NULL)) == NULL)
+      goto fail_engine_open;
+  }
 
   if (priv->allocator)
     gst_object_unref (priv->allocator);
@@ -1087,6 +2834,7 @@ gst_ce_videnc_close (GstVideoEncoder * encoder)
     gst_object_unref (priv->outbuf_pool);
     priv->outbuf_pool = NULL;
   }
+  priv->outbuf_pool_size = 0;
 
   return TRUE;
 }
@@ -1120,13 +2868,42 @@ gst_ce_videnc_reset (GstVideoEncoder * encoder)
     priv->output_state = NULL;
   }
 
-  if (ce_videnc->codec_handle) {
-    VIDENC1_delete (ce_videnc->codec_handle);
-    ce_videnc->codec_handle = NULL;
-  }
-
   GST_OBJECT_LOCK (ce_videnc);
 
+  gst_ce_videnc_release_codec (ce_videnc);
+
+  gst_ce_latency_reset (&priv->latency);
+  priv->latency_reported_low = FALSE;
+
+  priv->qos_proportion = 1.0;
+  priv->qos_earliest_time = GST_CLOCK_TIME_NONE;
+  priv->qos_skipped = 0;
+  priv->qos_force_idr = FALSE;
+  priv->cached_force_idr = FALSE;
+  priv->codec_data_wait = FALSE;
+  priv->qos_processed = 0;
+  priv->qos_dropped = 0;
+  priv->frames_since_key = 0;
+  priv->static_skipped = 0;
+  gst_ce_static_scene_reset (&priv->static_scene);
+  priv->decimate_period = GST_CLOCK_TIME_NONE;
+  priv->decimate_next = GST_CLOCK_TIME_NONE;
+  priv->bitrate_estimate = 0;
+  priv->bitrate_events = FALSE;
+  priv->bitrate_last_change = GST_CLOCK_TIME_NONE;
+  priv->complexity_level = 0;
+  priv->complexity_pending = -1;
+  priv->complexity_max = -1;
+  priv->complexity_load = 0;
+  priv->complexity_frames = 0;
+  memset (&priv->crop, 0, sizeof (priv->crop));
+  memset (&priv->crop_warned, 0, sizeof (priv->crop_warned));
+  if (priv->staging_buf) {
+    gst_buffer_unref (priv->staging_buf);
+    priv->staging_buf = NULL;
+  }
+  priv->staging_reason = NULL;
+
   priv->num_out_buffers = PROP_NUM_OUT_BUFFERS_DEFAULT;
   priv->outbuf_size_percentage = PROP_MIN_SIZE_PERCENTAGE_DEFAULT;
   /* Set default values for codec static params */
@@ -1159,24 +2936,112 @@ gst_ce_videnc_reset (GstVideoEncoder * encoder)
   return TRUE;
 }
 
-/* Set current dynamic parameters */
+static GstStateChangeReturn
+gst_ce_videnc_change_state (GstElement * element, GstStateChange transition)
+{
+  GstCeVidEnc *ce_videnc = GST_CEVIDENC (element);
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      priv->first_keyframe = FALSE;
+      priv->start_time = gst_util_get_timestamp ();
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+      /* Live sources only start pushing data once playing */
+      if (!priv->first_keyframe)
+        priv->start_time = gst_util_get_timestamp ();
+      break;
+    default:
+      break;
+  }
+
+  return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+/*
+ * gst_ce_videnc_release_codec
+ *
+ * Gives the codec instance away, either to the idle instances cache
+ * along with its engine or back to the codec engine.
+ * Call with the object lock held.
+ */
+static void
+gst_ce_videnc_release_codec (GstCeVidEnc * ce_videnc)
+{
+  GstCeVidEncClass *klass = GST_CEVIDENC_CLASS (G_OBJECT_GET_CLASS (ce_videnc));
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  GstClockTime timeout = GST_CLOCK_TIME_NONE;
+
+  if (!ce_videnc->codec_handle)
+    return;
+
+  if (priv->codec_cache_size && priv->engine_handle && priv->codec_key) {
+    if (priv->codec_cache_timeout)
+      timeout = priv->codec_cache_timeout * GST_MSECOND;
+
+    GST_DEBUG_OBJECT (ce_videnc, "keeping codec handle %p warm",
+        ce_videnc->codec_handle);
+    gst_ce_codec_cache_release (klass->codec_name, priv->codec_key,
+        priv->codec_key->size, priv->engine_handle,
+        ce_videnc->codec_handle, (GstCeCodecDeleteFunc) VIDENC1_delete,
+        priv->codec_cache_size, timeout);
+    /* The engine now belongs to the cache */
+    priv->engine_handle = NULL;
+  } else {
+    VIDENC1_delete (ce_videnc->codec_handle);
+  }
+
+  ce_videnc->codec_handle = NULL;
+}
+
+/*
+ * gst_ce_videnc_copy_dynamic_params
+ *
+ * Takes a snapshot of codec_dyn_params, with all the pending changes,
+ * for the codec calls made without the object lock. The changes are
+ * no longer pending afterwards.
+ * Call with the object lock held.
+ */
+static VIDENC1_DynamicParams *
+gst_ce_videnc_copy_dynamic_params (GstCeVidEnc * ce_videnc)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+  gsize size = ce_videnc->codec_dyn_params->size;
+
+  if (!priv->dyn_params_copy || priv->dyn_params_copy->size != size)
+    priv->dyn_params_copy = g_realloc (priv->dyn_params_copy, size);
+  memcpy (priv->dyn_params_copy, ce_videnc->codec_dyn_params, size);
+  priv->dyn_params_pending = FALSE;
+
+  return priv->dyn_params_copy;
+}
+
+/*
+ * Set the dynamic parameters taken by gst_ce_videnc_copy_dynamic_params().
+ * A change the codec rejects is dropped, it isn't tried again with every
+ * frame.
+ * Call without the object lock.
+ */
 static gboolean
-gst_ce_videnc_set_dynamic_params (GstCeVidEnc * ce_videnc)
+gst_ce_videnc_set_dynamic_params (GstCeVidEnc * ce_videnc,
+    VIDENC1_DynamicParams * dyn_params)
 {
   VIDENC1_Status enc_status;
   gint ret;
 
   g_return_val_if_fail (ce_videnc->codec_handle, FALSE);
-  g_return_val_if_fail (ce_videnc->codec_dyn_params, FALSE);
+  g_return_val_if_fail (dyn_params, FALSE);
 
   enc_status.size = sizeof (VIDENC1_Status);
   enc_status.data.buf = NULL;
 
   ret = VIDENC1_control (ce_videnc->codec_handle, XDM_SETPARAMS,
-      ce_videnc->codec_dyn_params, &enc_status);
+      dyn_params, &enc_status);
   if (ret != VIDENC1_EOK) {
     GST_WARNING_OBJECT (ce_videnc, "Failed to set dynamic parameters, "
-        "status error %x, %d", (unsigned int) enc_status.extendedError, ret);
+        "status error %x, %d, dropping the change",
+        (unsigned int) enc_status.extendedError, ret);
     return FALSE;
   }
 
@@ -1185,20 +3050,21 @@ gst_ce_videnc_set_dynamic_params (GstCeVidEnc * ce_videnc)
 
 /* Get buffer information from video codec */
 static gboolean
-gst_ce_videnc_get_buffer_info (GstCeVidEnc * ce_videnc)
+gst_ce_videnc_get_buffer_info (GstCeVidEnc * ce_videnc,
+    VIDENC1_DynamicParams * dyn_params)
 {
   GstCeVidEncPrivate *priv = ce_videnc->priv;
   VIDENC1_Status enc_status;
   gint i, ret;
 
   g_return_val_if_fail (ce_videnc->codec_handle, FALSE);
-  g_return_val_if_fail (ce_videnc->codec_dyn_params, FALSE);
+  g_return_val_if_fail (dyn_params, FALSE);
 
   enc_status.size = sizeof (VIDENC1_Status);
   enc_status.data.buf = NULL;
 
   ret = VIDENC1_control (ce_videnc->codec_handle, XDM_GETBUFINFO,
-      ce_videnc->codec_dyn_params, &enc_status);
+      dyn_params, &enc_status);
   if (ret != VIDENC1_EOK) {
     GST_ERROR_OBJECT (ce_videnc, "failed to get buffer information, "
         "status error %x, %d", (guint) enc_status.extendedError, ret);
@@ -1220,6 +3086,38 @@ gst_ce_videnc_get_buffer_info (GstCeVidEnc * ce_videnc)
   return TRUE;
 }
 
+/*
+ * gst_ce_videnc_header_key
+ *
+ * Fingerprint of the parameters a stream header depends on. The static
+ * part is the codec cache key of the running instance, so it is compared
+ * the same way: whole zeroed structs, padding included. Call with the
+ * object lock held.
+ */
+static gpointer
+gst_ce_videnc_header_key (GstCeVidEnc * ce_videnc, gsize * size)
+{
+  VIDENC1_Params *params = ce_videnc->priv->codec_key;
+  VIDENC1_DynamicParams *dyn_params;
+  guint8 *key;
+
+  g_return_val_if_fail (params, NULL);
+
+  *size = params->size + ce_videnc->codec_dyn_params->size;
+  key = g_malloc0 (*size);
+  memcpy (key, params, params->size);
+  memcpy (key + params->size, ce_videnc->codec_dyn_params,
+      ce_videnc->codec_dyn_params->size);
+
+  /* These don't make it into the header */
+  dyn_params = (VIDENC1_DynamicParams *) (key + params->size);
+  dyn_params->generateHeader = XDM_GENERATE_HEADER;
+  dyn_params->forceFrame = IVIDEO_NA_FRAME;
+  dyn_params->captureWidth = 0;
+
+  return key;
+}
+
 /**
  * gst_ce_videnc_get_header:
  * @ce_videnc: a #GstCeVidEnc
@@ -1236,11 +3134,16 @@ gboolean
 gst_ce_videnc_get_header (GstCeVidEnc * ce_videnc, GstBuffer ** buffer,
     gint * header_size)
 {
+  GstCeVidEncClass *klass = GST_CEVIDENC_CLASS (G_OBJECT_GET_CLASS (ce_videnc));
   GstCeVidEncPrivate *priv = ce_videnc->priv;
   VIDENC1_InArgs in_args;
   VIDENC1_OutArgs out_args;
-  GstBuffer *header_buf;
+  GstBuffer *header_buf = NULL;
+  GstBuffer *cached;
   GstMapInfo info;
+  VIDENC1_DynamicParams *dyn_params;
+  gpointer key;
+  gsize key_size;
   gint ret;
 
   g_return_val_if_fail (GST_IS_CEVIDENC (ce_videnc), FALSE);
@@ -1249,10 +3152,25 @@ gst_ce_videnc_get_header (GstCeVidEnc * ce_videnc, GstBuffer ** buffer,
 
   GST_OBJECT_LOCK (ce_videnc);
 
+  /* Reuse the header generated with the same parameters if any */
+  key = gst_ce_videnc_header_key (ce_videnc, &key_size);
+  cached = gst_ce_codec_cache_lookup_header (klass->codec_name, key, key_size);
+  if (cached) {
+    GST_OBJECT_UNLOCK (ce_videnc);
+    GST_DEBUG_OBJECT (ce_videnc, "using cached header");
+    g_free (key);
+    *header_size = gst_buffer_get_size (cached);
+    *buffer = cached;
+    return TRUE;
+  }
+
+  dyn_params = gst_ce_videnc_copy_dynamic_params (ce_videnc);
+  GST_OBJECT_UNLOCK (ce_videnc);
+
   GST_DEBUG_OBJECT (ce_videnc, "get H.264 header");
 
-  ce_videnc->codec_dyn_params->generateHeader = XDM_GENERATE_HEADER;
-  if (!gst_ce_videnc_set_dynamic_params (ce_videnc))
+  dyn_params->generateHeader = XDM_GENERATE_HEADER;
+  if (!gst_ce_videnc_set_dynamic_params (ce_videnc, dyn_params))
     goto fail_out;
 
   /*Allocate an output buffer for the header */
@@ -1277,36 +3195,107 @@ gst_ce_videnc_get_header (GstCeVidEnc * ce_videnc, GstBuffer ** buffer,
   if (ret != VIDENC1_EOK)
     goto fail_encode;
 
+  /* Keep a copy out of CMEM, shared with the later lookups */
+  cached = gst_buffer_new_wrapped (g_memdup (info.data,
+          out_args.bytesGenerated), out_args.bytesGenerated);
   gst_buffer_unmap (header_buf, &info);
+  gst_buffer_unref (header_buf);
 
-  ce_videnc->codec_dyn_params->generateHeader = XDM_ENCODE_AU;
-  if (!gst_ce_videnc_set_dynamic_params (ce_videnc))
-    goto fail_out;
+  gst_ce_codec_cache_store_header (klass->codec_name, key, key_size, cached);
+  g_free (key);
 
-  GST_OBJECT_UNLOCK (ce_videnc);
+  dyn_params->generateHeader = XDM_ENCODE_AU;
+  if (!gst_ce_videnc_set_dynamic_params (ce_videnc, dyn_params)) {
+    gst_buffer_unref (cached);
+    goto fail_restore;
+  }
 
   *header_size = out_args.bytesGenerated;
-  *buffer = header_buf;
+  *buffer = cached;
 
   return TRUE;
 
 fail_encode:
   {
     gst_buffer_unmap (header_buf, &info);
-    GST_OBJECT_UNLOCK (ce_videnc);
     GST_WARNING_OBJECT (ce_videnc,
         "Failed header encode process with extended error: 0x%x",
         (unsigned int) out_args.extendedError);
-    return FALSE;
+    gst_buffer_unref (header_buf);
+    g_free (key);
+    goto fail_restore;
   }
 
 fail_out:
   {
-    GST_OBJECT_UNLOCK (ce_videnc);
     if (header_buf)
       gst_buffer_unref (header_buf);
+    g_free (key);
+    goto fail_restore;
+  }
+
+fail_restore:
+  {
+    /* The codec may be left generating headers, the next frame sets
+     * the params again */
+    GST_OBJECT_LOCK (ce_videnc);
+    priv->dyn_params_pending = TRUE;
+    GST_OBJECT_UNLOCK (ce_videnc);
+    return FALSE;
+  }
+}
+
+/**
+ * gst_ce_videnc_wait_codec_data:
+ * @ce_videnc: a #GstCeVidEnc
+ *
+ * Holds the output caps back until the codec data is given with
+ * gst_ce_videnc_set_codec_data(), for subclasses that take it from the
+ * first encoded frame. Only the caps of a new format are held back, call
+ * it from the set_src_caps vfunc.
+ */
+void
+gst_ce_videnc_wait_codec_data (GstCeVidEnc * ce_videnc)
+{
+  g_return_if_fail (GST_IS_CEVIDENC (ce_videnc));
+
+  ce_videnc->priv->codec_data_wait = TRUE;
+}
+
+/**
+ * gst_ce_videnc_set_codec_data:
+ * @ce_videnc: a #GstCeVidEnc
+ * @codec_data: (transfer full): the codec data
+ *
+ * Updates the codec data of the output caps once it is known, i.e.
+ * after parsing the headers out of the first encoded keyframe. The new
+ * caps are pushed before the next output buffer, only if they changed.
+ *
+ * Returns: %TRUE if the output state could be updated
+ */
+gboolean
+gst_ce_videnc_set_codec_data (GstCeVidEnc * ce_videnc, GstBuffer * codec_data)
+{
+  GstCeVidEncPrivate *priv = ce_videnc->priv;
+
+  g_return_val_if_fail (GST_IS_CEVIDENC (ce_videnc), FALSE);
+  g_return_val_if_fail (GST_IS_BUFFER (codec_data), FALSE);
+
+  if (!priv->output_state) {
+    gst_buffer_unref (codec_data);
     return FALSE;
   }
+
+  priv->codec_data_wait = FALSE;
+
+  if (!gst_ce_videnc_codec_data_changed (ce_videnc, codec_data)) {
+    gst_buffer_unref (codec_data);
+    return TRUE;
+  }
+
+  GST_DEBUG_OBJECT (ce_videnc, "updating the codec data");
+  return gst_ce_videnc_set_output_state (ce_videnc,
+      gst_caps_copy (priv->output_state->caps), codec_data);
 }
 
 /**
@@ -1334,3 +3323,23 @@ gst_ce_videnc_set_interlace (GstCeVidEnc *ce_videnc, gboolean interlace)
   GST_DEBUG_OBJECT (ce_videnc, "set interlace %d", ce_videnc->priv->interlace);
   GST_OBJECT_UNLOCK (ce_videnc);
 }
+
+/**
+ * gst_ce_videnc_update_dynamic_params:
+ * @ce_videnc: a #GstCeVidEnc
+ *
+ * Lets #GstCeVidEnc sub-classes notify that they modified
+ * codec_dyn_params. All the changes made since the last encoded frame
+ * are given to the codec in a single call right before encoding the
+ * next frame, from the streaming thread.
+ *
+ * Call with the object lock held, the same lock must be held while
+ * modifying codec_dyn_params.
+ */
+void
+gst_ce_videnc_update_dynamic_params (GstCeVidEnc * ce_videnc)
+{
+  g_return_if_fail (GST_IS_CEVIDENC (ce_videnc));
+
+  ce_videnc->priv->dyn_params_pending = TRUE;
+}
@@ -32,6 +32,17 @@ G_BEGIN_DECLS typedef struct _GstCeVidEnc GstCeVidEnc;
 typedef struct _GstCeVidEncClass GstCeVidEncClass;
 typedef struct _GstCeVidEncPrivate GstCeVidEncPrivate;
 
+/**
+ * GST_CE_VIDENC_BANDWIDTH_ESTIMATE:
+ *
+ * Name of the custom upstream event carrying the bandwidth available
+ * downstream, in bits per second, in its "bitrate" integer field.
+ * #GstCeVidEnc adapts its target bit rate to it when the
+ * bitrate-adaptation property is enabled and a rate control is used,
+ * otherwise the event is forwarded upstream.
+ */
+#define GST_CE_VIDENC_BANDWIDTH_ESTIMATE "GstCeBandwidthEstimate"
+
 struct _GstCeVidEnc
 {
   GstVideoEncoder parent;
@@ -66,6 +77,14 @@ struct _GstCeVidEnc
  * @post_process:   Optional.
  *                  Called after the base class finished the encoding 
  *                  process. Allows output buffer transformations.
+ * @set_complexity: Optional.
+ *                  Allows subclass to trade quality for encoding speed
+ *                  when adaptive complexity is enabled. Level 0 is the
+ *                  complexity configured through the properties, each
+ *                  level above it should be cheaper to encode. Returns
+ *                  FALSE, leaving the parameters untouched, if the level
+ *                  is not supported. Called with the object lock held,
+ *                  right before the codec is re-created.
  * 
  * Subclasses can override any of the available virtual methods or not, as
  * needed. At minimum @codec_name shoud be filled.
@@ -85,9 +104,10 @@ struct _GstCeVidEncClass
     gboolean (*pre_process) (GstCeVidEnc * ce_videnc, GstBuffer * input_buffer);
     gboolean (*post_process) (GstCeVidEnc * ce_videnc,
       GstBuffer * output_buffer);
+    gboolean (*set_complexity) (GstCeVidEnc * ce_videnc, guint level);
 
   /*< private > */
-  gpointer _gst_reserved[GST_PADDING_LARGE];
+  gpointer _gst_reserved[GST_PADDING_LARGE - 1];
 };
 
 #define GST_TYPE_CEVIDENC \
@@ -109,5 +129,12 @@ gboolean gst_ce_videnc_get_header (GstCeVidEnc * ce_videnc,
 void gst_ce_videnc_set_interlace (GstCeVidEnc *ce_videnc, 
 			          gboolean interlace);
 
+void gst_ce_videnc_update_dynamic_params (GstCeVidEnc * ce_videnc);
+
+void gst_ce_videnc_wait_codec_data (GstCeVidEnc * ce_videnc);
+
+gboolean gst_ce_videnc_set_codec_data (GstCeVidEnc * ce_videnc,
+    GstBuffer * codec_data);
+
 G_END_DECLS
 #endif /* __GST_CE_VIDENC_H__ */
@@ -35,6 +35,15 @@ typedef struct _memSlice
   gint size;
 } memSlice;
 
+/* memory slice in use by a buffer */
+typedef struct _usedSlice
+{
+  GstCeSliceBufferPool *pool;
+  GstMemory *block;
+  gint start;
+  gint size;
+} usedSlice;
+
 /* bufferpool */
 struct _GstCeSliceBufferPoolPrivate
 {
@@ -69,6 +78,9 @@ static GstFlowReturn ce_slice_buffer_pool_acquire_buffer (GstBufferPool * pool,
     GstBuffer ** buffer, GstBufferPoolAcquireParams * params);
 
 GList *get_slice (GstCeSliceBufferPool * spool, gint * size);
+static void ce_slice_buffer_pool_slice_free (usedSlice * used);
+
+static GQuark used_slice_quark;
 
 #define GST_CE_SLICE_BUFFER_POOL_GET_PRIVATE(obj)  \
    (G_TYPE_INSTANCE_GET_PRIVATE ((obj), GST_TYPE_CE_SLICE_BUFFER_POOL, GstCeSliceBufferPoolPrivate))
@@ -95,6 +107,8 @@ gst_ce_slice_buffer_pool_class_init (GstCeSliceBufferPoolClass * klass)
 
   GST_DEBUG_CATEGORY_INIT (gst_ce_slice_buffer_pool_debug, "ceslicebufferpool",
       0, "CE slice buffer pool debug");
+
+  used_slice_quark = g_quark_from_static_string ("GstCeSliceBufferPoolSlice");
 }
 
 static void
@@ -253,8 +267,8 @@ ce_slice_buffer_pool_stop (GstBufferPool * pool)
   if (priv->slices
       && ((memSlice *) (priv->slices->data))->size != priv->memory_block_size) {
     GST_WARNING_OBJECT (pool,
-        "not all downstream buffers are free... "
-        "forcing release, this may cause a segfault");
+        "not all downstream buffers are free, their memory is kept "
+        "until they are");
   }
 
   if (G_LIKELY (priv->slices)) {
@@ -352,6 +366,7 @@ ce_slice_buffer_pool_buffer_alloc (GstBufferPool * pool, GstBuffer ** buffer,
   GstMemory *mem;
   GList *element;
   memSlice *slice;
+  usedSlice *used;
   gint offset;
   gint size = priv->buffer_size;
 
@@ -363,11 +378,21 @@ ce_slice_buffer_pool_buffer_alloc (GstBufferPool * pool, GstBuffer ** buffer,
   priv->last_slice = slice = (memSlice *) (element->data);
   /* The offset was already reserved, so we need to correct the start */
   offset = slice->start - size;
+
+  /* The memory keeps the block alive for as long as it is in use */
+  used = g_slice_new (usedSlice);
+  used->pool = gst_object_ref (spool);
+  used->block = gst_memory_ref (priv->memory);
+  used->start = offset;
+  used->size = size;
+
   mem =
       gst_cmem_new_wrapped (GST_MEMORY_FLAG_NO_SHARE, priv->data + offset,
-      size, 0, size, NULL, NULL);
+      size, 0, size, used, (GDestroyNotify) ce_slice_buffer_pool_slice_free);
   if (!mem)
     goto no_memory;
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (mem), used_slice_quark,
+      used, NULL);
   *buffer = gst_buffer_new ();
   gst_buffer_append_memory (*buffer, mem);
 
@@ -381,49 +406,16 @@ no_memory:
   }
 }
 
+/* Returns the memory from spos to epos to the free slices, merging it
+ * with the contiguous ones. Call with the pool lock held. */
 static void
-ce_slice_buffer_pool_release_buffer (GstBufferPool * pool, GstBuffer * buffer)
+ce_slice_buffer_pool_merge_slice (GstCeSliceBufferPool * spool, gint spos,
+    gint epos)
 {
-  GstCeSliceBufferPool *spool = GST_CE_SLICE_BUFFER_POOL_CAST (pool);
   GstCeSliceBufferPoolPrivate *priv = spool->priv;
-  GstMapInfo info;
   memSlice *slice, *nslice;
-  gint spos, epos, buffer_size;
+  gint buffer_size = epos - spos;
   GList *e;
-  guint nmem;
-
-  /* keep it around in our queue */
-  GST_DEBUG_OBJECT (spool, "released buffer %p", buffer);
-  GST_SLICE_POOL_LOCK (spool);
-
-  if (!priv->data || !priv->slices) {
-    GST_DEBUG_OBJECT (spool,
-        "releasing memory after memory structures were freed");
-    /* No need for unlock, since it wasn't taked */
-    goto out;
-  }
-
-  nmem = gst_buffer_n_memory (buffer);
-  if (nmem != 1) {
-    GST_ERROR_OBJECT (spool,
-        "buffer %p was modified, its memory can't be merged to the GstCeSliceBufferPool's memory block causing fragmentation",
-        buffer);
-    goto out;
-  }
-
-  if (!gst_buffer_map (buffer, &info, GST_MAP_READ))
-    goto fail_map;
-  spos = info.data - info.memory->offset - priv->data;
-  buffer_size = info.memory->maxsize;
-  gst_buffer_unmap (buffer, &info);
-
-  epos = spos + buffer_size;
-
-  if (!epos > priv->buffer_size) {
-    GST_DEBUG_OBJECT (spool,
-        "releasing buffer how ends outside memory boundaries");
-    return;
-  }
 
   GST_DEBUG_OBJECT (spool, "releasing memory from %d to %d", spos, epos);
   e = priv->slices;
@@ -452,7 +444,7 @@ ce_slice_buffer_pool_release_buffer (GstBufferPool * pool, GstBuffer * buffer)
           priv->slices = g_list_delete_link (priv->slices, e);
         }
       }
-      goto out;
+      return;
     }
 
     if (slice->end == spos) {
@@ -473,7 +465,7 @@ ce_slice_buffer_pool_release_buffer (GstBufferPool * pool, GstBuffer * buffer)
           priv->slices = g_list_delete_link (priv->slices, g_list_next (e));
         }
       }
-      goto out;
+      return;
     }
 
     /* Create a new free slice */
@@ -486,7 +478,7 @@ ce_slice_buffer_pool_release_buffer (GstBufferPool * pool, GstBuffer * buffer)
       nslice->size = buffer_size;
       priv->slices = g_list_insert_before (priv->slices, e, nslice);
 
-      goto out;
+      return;
     }
 
     e = g_list_next (e);
@@ -503,22 +495,40 @@ ce_slice_buffer_pool_release_buffer (GstBufferPool * pool, GstBuffer * buffer)
   nslice->end = epos;
   nslice->size = buffer_size;
   priv->slices = g_list_insert_before (priv->slices, NULL, nslice);
+}
 
-out:
-  {
-    gst_buffer_unref (buffer);
-    GST_SLICE_POOL_UNLOCK (spool);
-    return;
-  }
-/* ERRORS */
-fail_map:
-  {
-    GST_WARNING_OBJECT (pool, "invalid buffer");
-    gst_buffer_unref (buffer);
-    GST_SLICE_POOL_UNLOCK (spool);
-    return;
-  }
+/* GDestroyNotify of the slice memories. The slice goes back to the pool
+ * only when its memory is freed, which may be after the buffer was
+ * released if sub-memories of it are still in use downstream. */
+static void
+ce_slice_buffer_pool_slice_free (usedSlice * used)
+{
+  GstCeSliceBufferPool *spool = used->pool;
+  GstCeSliceBufferPoolPrivate *priv = spool->priv;
+
+  GST_SLICE_POOL_LOCK (spool);
+
+  /* The pool may have been stopped or restarted meanwhile */
+  if (used->block == priv->memory)
+    ce_slice_buffer_pool_merge_slice (spool, used->start,
+        used->start + used->size);
+  else
+    GST_DEBUG_OBJECT (spool, "slice from an old memory block freed");
+
+  GST_SLICE_POOL_UNLOCK (spool);
 
+  gst_memory_unref (used->block);
+  gst_object_unref (spool);
+  g_slice_free (usedSlice, used);
+}
+
+static void
+ce_slice_buffer_pool_release_buffer (GstBufferPool * pool, GstBuffer * buffer)
+{
+  GST_DEBUG_OBJECT (pool, "released buffer %p", buffer);
+
+  /* The slice is returned once the memory is freed */
+  gst_buffer_unref (buffer);
 }
 
 static GstFlowReturn
@@ -644,7 +654,13 @@ gst_ce_slice_buffer_resize (GstCeSliceBufferPool * spool, GstBuffer * buffer,
   }
 
   if (element) {
+    usedSlice *used;
+
     GST_DEBUG_OBJECT (spool, "resizing buffer %p", buffer);
+    used = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (info.memory),
+        used_slice_quark);
+    if (used)
+      used->size = align_size;
     info.memory->maxsize = align_size;
     gst_buffer_unmap (buffer, &info);
     gst_buffer_set_size (buffer, size);
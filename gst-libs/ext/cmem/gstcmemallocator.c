@@ -209,7 +209,7 @@ _cmem_share (GstMemoryContig * mem, gssize offset, gsize size)
     size = mem->mem.size - offset;
 
   sub = g_slice_alloc (sizeof (GstMemoryContig));
-  if (mem == NULL)
+  if (sub == NULL)
     return NULL;
 
   /* the shared memory is always readonly */
@@ -423,3 +423,25 @@ gst_cmem_new_wrapped (GstMemoryFlags flags, gpointer data,
 
   return (GstMemory *) mem;
 }
+
+/**
+ * gst_cmem_share:
+ * @mem: a CMEM #GstMemory
+ * @offset: offset to share from
+ * @size: size to share, or -1 to share to the end of @mem
+ *
+ * Creates a sub-memory of @mem like gst_memory_share() does, even if
+ * @mem is flagged with #GST_MEMORY_FLAG_NO_SHARE. This is meant for the
+ * owner of such memory only: the sub-memory inherits the flag, so it
+ * still can't be shared any further downstream.
+ *
+ * Returns: (transfer full): a new #GstMemory or %NULL
+ */
+GstMemory *
+gst_cmem_share (GstMemory * mem, gssize offset, gssize size)
+{
+  g_return_val_if_fail (mem != NULL, NULL);
+  g_return_val_if_fail (mem->allocator == _cmem_allocator, NULL);
+
+  return (GstMemory *) _cmem_share ((GstMemoryContig *) mem, offset, size);
+}
@@ -39,5 +39,7 @@ GstMemory *gst_cmem_new_wrapped (GstMemoryFlags flags, gpointer data,
     gsize maxsize, gsize offset, gsize size, gpointer user_data,
     GDestroyNotify notify);
 
+GstMemory *gst_cmem_share (GstMemory * mem, gssize offset, gssize size);
+
 G_END_DECLS
 #endif /*_GST_CMEM_ALLOCATOR_H_*/
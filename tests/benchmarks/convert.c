@@ -0,0 +1,202 @@
+/* GStreamer
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * Benchmark of the conversions the encoders do while staging the input
+ * frames against videoconvert, which is what the pipelines needed before.
+ * The plain copy of the frame is the staging cost without a conversion.
+ *
+ * Usage: convert [width] [height]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <ext/ce/gstceconvert.h>
+
+#define FRAMES 100
+
+static guint converted;
+
+static GstFlowReturn
+count_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  converted++;
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static GstBuffer *
+make_input (GstVideoInfo * info)
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+  gsize i;
+
+  buffer = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (info), NULL);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  for (i = 0; i < map.size; i++)
+    map.data[i] = g_random_int_range (0, 256);
+  gst_buffer_unmap (buffer, &map);
+
+  return buffer;
+}
+
+/* Seconds per frame videoconvert takes, output allocation included */
+static gdouble
+run_videoconvert (GstBuffer * input, GstVideoInfo * in, GstVideoInfo * out)
+{
+  GstElement *bin;
+  GstPad *srcpad, *sinkpad, *bin_sinkpad, *bin_srcpad;
+  GstSegment segment;
+  GstBuffer *buffer;
+  GstCaps *caps;
+  GError *err = NULL;
+  GTimer *timer;
+  gchar *desc;
+  gdouble elapsed;
+  guint i;
+
+  desc = g_strdup_printf ("videoconvert ! video/x-raw, format = %s",
+      gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (out)));
+  bin = gst_parse_bin_from_description (desc, TRUE, &err);
+  g_free (desc);
+  if (!bin)
+    g_error ("can't create videoconvert: %s", err->message);
+
+  srcpad = gst_pad_new ("src", GST_PAD_SRC);
+  sinkpad = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sinkpad, count_chain);
+
+  bin_sinkpad = gst_element_get_static_pad (bin, "sink");
+  bin_srcpad = gst_element_get_static_pad (bin, "src");
+  gst_pad_link (srcpad, bin_sinkpad);
+  gst_pad_link (bin_srcpad, sinkpad);
+  gst_object_unref (bin_sinkpad);
+  gst_object_unref (bin_srcpad);
+
+  gst_pad_set_active (srcpad, TRUE);
+  gst_pad_set_active (sinkpad, TRUE);
+  gst_element_set_state (bin, GST_STATE_PLAYING);
+
+  caps = gst_video_info_to_caps (in);
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (srcpad, gst_event_new_stream_start ("convert"));
+  gst_pad_push_event (srcpad, gst_event_new_caps (caps));
+  gst_pad_push_event (srcpad, gst_event_new_segment (&segment));
+  gst_caps_unref (caps);
+
+  converted = 0;
+  timer = g_timer_new ();
+  for (i = 0; i < FRAMES; i++) {
+    buffer = gst_buffer_ref (input);
+    if (gst_pad_push (srcpad, buffer) != GST_FLOW_OK)
+      g_error ("videoconvert failed to convert frame %u", i);
+  }
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  if (converted != FRAMES)
+    g_error ("%u frames converted, expected %u", converted, FRAMES);
+
+  gst_element_set_state (bin, GST_STATE_NULL);
+  gst_pad_set_active (srcpad, FALSE);
+  gst_pad_set_active (sinkpad, FALSE);
+  gst_object_unref (srcpad);
+  gst_object_unref (sinkpad);
+  gst_object_unref (bin);
+
+  return elapsed / FRAMES;
+}
+
+/* Seconds per frame to stage the frame into a reused buffer, as the
+ * encoders do */
+static gdouble
+run_staging (GstBuffer * input, GstVideoInfo * in, GstVideoInfo * out)
+{
+  GstVideoFrame src, dest;
+  GstBuffer *staging;
+  GTimer *timer;
+  gdouble elapsed;
+  guint i;
+
+  staging = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (out), NULL);
+
+  timer = g_timer_new ();
+  for (i = 0; i < FRAMES; i++) {
+    gst_video_frame_map (&src, in, input, GST_MAP_READ);
+    gst_video_frame_map (&dest, out, staging, GST_MAP_WRITE);
+    if (!gst_ce_convert_frame (&dest, &src))
+      g_error ("failed to convert frame %u", i);
+    gst_video_frame_unmap (&dest);
+    gst_video_frame_unmap (&src);
+  }
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  gst_buffer_unref (staging);
+
+  return elapsed / FRAMES;
+}
+
+static void
+run (GstVideoFormat in_format, GstVideoFormat out_format, gint width,
+    gint height)
+{
+  GstVideoInfo in, out;
+  GstBuffer *input;
+  gdouble convert, copy, staging;
+
+  gst_video_info_set_format (&in, in_format, width, height);
+  gst_video_info_set_format (&out, out_format, width, height);
+  input = make_input (&in);
+
+  convert = run_videoconvert (input, &in, &out);
+  copy = run_staging (input, &in, &in);
+  staging = run_staging (input, &in, &out);
+
+  gst_buffer_unref (input);
+
+  g_print ("%dx%d %s->%s  videoconvert %7.2f ms  copy %7.2f ms  %s %7.2f ms"
+      "  x%.1f\n", width, height, gst_video_format_to_string (in_format),
+      gst_video_format_to_string (out_format), convert * 1e3, copy * 1e3,
+      gst_ce_convert_impl (), staging * 1e3, convert / staging);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gint width = 1280, height = 720;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 2) {
+    width = atoi (argv[1]);
+    height = atoi (argv[2]);
+  }
+
+  run (GST_VIDEO_FORMAT_I420, GST_VIDEO_FORMAT_NV12, width, height);
+  run (GST_VIDEO_FORMAT_YV12, GST_VIDEO_FORMAT_NV12, width, height);
+  run (GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_UYVY, width, height);
+  run (GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_NV12, width, height);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+/* GStreamer
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * Benchmark of the parallel image encoding of ce_jpegenc, encoding the
+ * same images with one codec instance and up to max-instances of them.
+ * The throughput stops scaling once the hardware is saturated.
+ *
+ * Usage: jpegenc [max-instances] [width] [height]
+ *
+ * ce_jpegenc is looked up in the registry, so GST_PLUGIN_PATH may need to
+ * point to the build tree.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <gst/gst.h>
+#include <ext/cmem/gstcmemallocator.h>
+
+#define FRAMES 200
+#define N_INPUTS 4
+
+static guint encoded;
+
+static GstFlowReturn
+count_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  encoded++;
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+/* Gradients with some noise, so the codec has real work to do */
+static GstBuffer *
+make_input (gint width, gint height, gint seed)
+{
+  GstAllocator *alloc;
+  GstAllocationParams params;
+  GstBuffer *buffer;
+  GstMapInfo info;
+  gint x, y;
+  guint8 *chroma;
+
+  alloc = gst_allocator_find ("ContiguousMemory");
+  if (!alloc)
+    g_error ("can't find the CMEM allocator");
+
+  gst_allocation_params_init (&params);
+  buffer = gst_buffer_new_allocate (alloc, width * height * 3 / 2, &params);
+  gst_object_unref (alloc);
+
+  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      info.data[y * width + x] = ((x + y + seed * 16) & 0xff) ^
+          g_random_int_range (0, 16);
+
+  chroma = info.data + width * height;
+  for (y = 0; y < height / 2; y++)
+    for (x = 0; x < width; x++)
+      chroma[y * width + x] = (x & 1) ? (y & 0xff) : ((x / 2) & 0xff);
+  gst_buffer_unmap (buffer, &info);
+
+  return buffer;
+}
+
+static gdouble
+run (GstBuffer ** inputs, gint width, gint height, guint n_instances)
+{
+  GstElement *jpegenc;
+  GstPad *srcpad, *sinkpad, *enc_sinkpad, *enc_srcpad;
+  GstSegment segment;
+  GstBuffer *buffer;
+  GstCaps *caps;
+  GTimer *timer;
+  gdouble elapsed;
+  guint i;
+
+  jpegenc = gst_element_factory_make ("ce_jpegenc", NULL);
+  if (!jpegenc)
+    g_error ("can't create ce_jpegenc, check GST_PLUGIN_PATH");
+
+  /* Enough output buffers to keep every instance busy */
+  g_object_set (jpegenc, "n-instances", n_instances, "num-out-buffers",
+      MAX (3, 2 * n_instances + 1), NULL);
+
+  srcpad = gst_pad_new ("src", GST_PAD_SRC);
+  sinkpad = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sinkpad, count_chain);
+
+  enc_sinkpad = gst_element_get_static_pad (jpegenc, "sink");
+  enc_srcpad = gst_element_get_static_pad (jpegenc, "src");
+  gst_pad_link (srcpad, enc_sinkpad);
+  gst_pad_link (enc_srcpad, sinkpad);
+  gst_object_unref (enc_sinkpad);
+  gst_object_unref (enc_srcpad);
+
+  gst_pad_set_active (srcpad, TRUE);
+  gst_pad_set_active (sinkpad, TRUE);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "NV12",
+      "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+      "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (srcpad, gst_event_new_stream_start ("jpegenc"));
+  gst_pad_push_event (srcpad, gst_event_new_caps (caps));
+  gst_pad_push_event (srcpad, gst_event_new_segment (&segment));
+  gst_caps_unref (caps);
+
+  encoded = 0;
+  timer = g_timer_new ();
+  for (i = 0; i < FRAMES; i++) {
+    /* The copies share the contiguous memory of the inputs */
+    buffer = gst_buffer_copy (inputs[i % N_INPUTS]);
+    GST_BUFFER_PTS (buffer) = gst_util_uint64_scale_int (i, GST_SECOND, 30);
+    GST_BUFFER_DURATION (buffer) = GST_SECOND / 30;
+    if (gst_pad_push (srcpad, buffer) != GST_FLOW_OK)
+      g_error ("%u instances: failed to encode image %u", n_instances, i);
+  }
+  gst_pad_push_event (srcpad, gst_event_new_eos ());
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  if (encoded != FRAMES)
+    g_error ("%u instances: %u images encoded, expected %u", n_instances,
+        encoded, FRAMES);
+
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  gst_pad_set_active (srcpad, FALSE);
+  gst_pad_set_active (sinkpad, FALSE);
+  gst_object_unref (srcpad);
+  gst_object_unref (sinkpad);
+  gst_object_unref (jpegenc);
+
+  return FRAMES / elapsed;
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  GstBuffer *inputs[N_INPUTS];
+  guint max_instances = 4, n;
+  gint width = 1280, height = 720, i;
+  gdouble fps, serial = 0;
+
+  gst_init (&argc, &argv);
+  gst_cmem_init ();
+
+  if (argc > 1)
+    max_instances = CLAMP (atoi (argv[1]), 1, 8);
+  if (argc > 3) {
+    width = atoi (argv[2]);
+    height = atoi (argv[3]);
+  }
+
+  for (i = 0; i < N_INPUTS; i++)
+    inputs[i] = make_input (width, height, i);
+
+  for (n = 1; n <= max_instances; n++) {
+    fps = run (inputs, width, height, n);
+    if (n == 1)
+      serial = fps;
+    g_print ("%dx%d  %u instances  %7.1f fps  x%.2f\n", width, height, n,
+        fps, fps / serial);
+  }
+
+  for (i = 0; i < N_INPUTS; i++)
+    gst_buffer_unref (inputs[i]);
+
+  return EXIT_SUCCESS;
+}
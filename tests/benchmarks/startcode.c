@@ -0,0 +1,160 @@
+/* GStreamer
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * Benchmark of the byte-stream start code scanner against the byte at
+ * a time loop the encoders used to have.
+ *
+ * Usage: startcode [file.h264]
+ *
+ * Without a file it scans synthetic byte-streams of a few frame sizes,
+ * with emulation prevention applied as an encoder would.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <glib.h>
+#include <ext/ce/gstcestartcode.h>
+
+#define SLICE_SIZE 1400
+#define ROUNDS 200
+
+static gint
+find_start_code_bytewise (const guint8 * data, gint size)
+{
+  gint32 state = ~1;
+  gint i;
+
+  for (i = 0; i < size; i++) {
+    state = (state << 8) | data[i];
+    if (state == 1)
+      return i - 3;
+  }
+
+  return -1;
+}
+
+typedef gint (*FindFunc) (const guint8 * data, gint size);
+
+static gint
+count_nals (FindFunc find, const guint8 * data, gint size)
+{
+  gint pos = 0, next, count = 0;
+
+  while ((next = find (data + pos, size - pos)) >= 0) {
+    pos += next + GST_CE_START_CODE_LENGTH;
+    count++;
+  }
+
+  return count;
+}
+
+/* Random slices of SLICE_SIZE bytes with emulation prevention */
+static guint8 *
+make_stream (gint size, gint * out_size)
+{
+  guint8 *data = g_malloc (size + size / 2 + GST_CE_START_CODE_LENGTH);
+  gint i = 0, zeros = 0, slice = 0;
+  guint8 byte;
+
+  while (i < size) {
+    if (slice == 0) {
+      data[i++] = 0;
+      data[i++] = 0;
+      data[i++] = 0;
+      data[i++] = 1;
+      data[i++] = 0x41;
+      zeros = 0;
+      slice = SLICE_SIZE;
+    }
+
+    /* Skew the payload towards zeros as entropy coded data has more */
+    byte = g_random_int_range (0, 8) == 0 ? 0 : g_random_int_range (0, 256);
+    if (zeros >= 2 && byte <= 3) {
+      data[i++] = 3;
+      zeros = 0;
+    }
+    data[i++] = byte;
+    zeros = byte ? 0 : zeros + 1;
+    slice--;
+  }
+
+  *out_size = i;
+  return data;
+}
+
+static void
+run (const gchar * name, const guint8 * data, gint size)
+{
+  GTimer *timer = g_timer_new ();
+  gdouble old, new;
+  gint n_old = 0, n_new = 0, i;
+
+  g_timer_start (timer);
+  for (i = 0; i < ROUNDS; i++)
+    n_old = count_nals (find_start_code_bytewise, data, size);
+  old = g_timer_elapsed (timer, NULL) / ROUNDS;
+
+  g_timer_start (timer);
+  for (i = 0; i < ROUNDS; i++)
+    n_new = count_nals (gst_ce_find_start_code, data, size);
+  new = g_timer_elapsed (timer, NULL) / ROUNDS;
+
+  g_timer_destroy (timer);
+
+  if (n_old != n_new)
+    g_error ("%s: %d NAL units found, expected %d", name, n_new, n_old);
+
+  g_print ("%-12s %8d bytes %5d NALs  bytewise %8.1f us  %s %8.1f us  "
+      "x%.1f\n", name, size, n_new, old * 1e6, gst_ce_start_code_impl (),
+      new * 1e6, old / new);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  const gint sizes[] = { 4 * 1024, 32 * 1024, 128 * 1024, 512 * 1024 };
+  guint8 *data;
+  gsize length;
+  gint i, size;
+
+  if (argc > 1) {
+    GError *err = NULL;
+
+    if (!g_file_get_contents (argv[1], (gchar **) & data, &length, &err)) {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      return EXIT_FAILURE;
+    }
+    run (argv[1], data, length);
+    g_free (data);
+    return EXIT_SUCCESS;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+    gchar *name = g_strdup_printf ("frame-%dk", sizes[i] / 1024);
+
+    data = make_stream (sizes[i], &size);
+    run (name, data, size);
+    g_free (data);
+    g_free (name);
+  }
+
+  return EXIT_SUCCESS;
+}
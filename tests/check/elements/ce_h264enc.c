@@ -23,8 +23,11 @@
 #include <unistd.h>
 
 #include <ext/cmem/gstcmemallocator.h>
+#include <ext/ce/gstceutils.h>
 #include <gst/check/gstcheck.h>
 #include <gst/app/gstappsink.h>
+#include <gst/video/gstvideometa.h>
+#include <gst/video/gstvideoencoder.h>
 
 /* For ease of programming we use globals to keep refs for our floating
  * src and sink pads we create; otherwise we always have to do get_pad,
@@ -47,6 +50,16 @@ static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS (H264_CAPS_STRING));
 
+static GstStaticPadTemplate anysinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("video/x-h264"));
+
+static GstStaticPadTemplate rtpsinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("application/x-rtp"));
+
 static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
@@ -162,6 +175,47 @@ play_a_buffer (GstElement * h264enc, GstCaps * caps)
 
 }
 
+static GstClockTime
+push_frames (gint width, gint height, gint fps, GstClockTime timestamp,
+    gint n_frames)
+{
+  GstBuffer *inbuffer;
+  GstCaps *caps;
+  gint i;
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      width, "height", G_TYPE_INT, height, "framerate",
+      GST_TYPE_FRACTION, fps, 1, "format", G_TYPE_STRING, "NV12", NULL);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  for (i = 0; i < n_frames; i++) {
+    fail_unless ((inbuffer =
+            create_cmem_buffer (width * height * 3 / 2)) != NULL);
+    GST_BUFFER_TIMESTAMP (inbuffer) = timestamp;
+    GST_BUFFER_DURATION (inbuffer) = GST_SECOND / fps;
+    fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+    timestamp += GST_SECOND / fps;
+  }
+
+  return timestamp;
+}
+
+static GstMessage *
+pop_element_message (GstBus * bus, const gchar * name)
+{
+  GstMessage *msg;
+
+  while ((msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ELEMENT))) {
+    if (gst_structure_has_name (gst_message_get_structure (msg), name))
+      return msg;
+    gst_message_unref (msg);
+  }
+
+  fail_if (TRUE, "no %s message posted", name);
+  return NULL;
+}
+
 static void
 check_caps (GstCaps * caps, gint profile_id)
 {
@@ -257,6 +311,885 @@ GST_START_TEST (test_ce_h264enc_properties)
 
 GST_END_TEST;
 
+GST_START_TEST (test_ce_h264enc_dynamic_params)
+{
+  GstElement *h264enc;
+  GstBuffer *inbuffer;
+  GstCaps *caps;
+  gint res_bitrate, res_qpintra, res_idrinterval;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "byte-stream",
+      NULL);
+
+  play_a_buffer (h264enc, caps);
+
+  /* several changes are applied at once along with the next frame */
+  g_object_set (h264enc, "target-bitrate", 1000000, "qpintra", 30,
+      "idrinterval", 15, NULL);
+  g_object_get (h264enc, "target-bitrate", &res_bitrate, "qpintra",
+      &res_qpintra, "idrinterval", &res_idrinterval, NULL);
+
+  fail_unless (res_bitrate == 1000000);
+  fail_unless (res_qpintra == 30);
+  fail_unless (res_idrinterval == 15);
+
+  fail_unless ((inbuffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+  GST_BUFFER_TIMESTAMP (inbuffer) = GST_SECOND / 30;
+  fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+
+  /* send eos to have all flushed if needed */
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+
+  fail_unless (g_list_length (buffers) == 2);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_qos)
+{
+  GstElement *h264enc;
+  GstBuffer *inbuffer;
+  GstCaps *caps;
+  GstBus *bus;
+  GstMessage *msg;
+  GstFormat format;
+  guint64 processed, dropped;
+  gint i;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  bus = gst_bus_new ();
+  gst_element_set_bus (h264enc, bus);
+  g_object_set (h264enc, "qos-drop", TRUE, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "byte-stream",
+      NULL);
+
+  /* the first frame is a keyframe and is never dropped */
+  play_a_buffer (h264enc, caps);
+
+  /* downstream reports it is 5 seconds behind */
+  fail_unless (gst_pad_push_event (mysinkpad,
+          gst_event_new_qos (GST_QOS_TYPE_UNDERFLOW, 2.0, 5 * GST_SECOND,
+              5 * GST_SECOND)));
+
+  for (i = 1; i <= 3; i++) {
+    fail_unless ((inbuffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+    GST_BUFFER_TIMESTAMP (inbuffer) = i * GST_SECOND / 30;
+    GST_BUFFER_DURATION (inbuffer) = GST_SECOND / 30;
+    fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+  }
+
+  /* late frames are dropped before being encoded */
+  fail_unless (g_list_length (buffers) == 1);
+
+  for (i = 1; i <= 3; i++) {
+    msg = gst_bus_pop_filtered (bus, GST_MESSAGE_QOS);
+    fail_unless (msg != NULL);
+    gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+    fail_unless (format == GST_FORMAT_BUFFERS);
+    fail_unless (dropped == i);
+    gst_message_unref (msg);
+  }
+
+  gst_element_set_bus (h264enc, NULL);
+  gst_object_unref (bus);
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_qos_flush)
+{
+  GstElement *h264enc;
+  GstBuffer *inbuffer;
+  GstCaps *caps;
+  GstSegment segment;
+  gint i;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "qos-drop", TRUE, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "byte-stream",
+      NULL);
+  play_a_buffer (h264enc, caps);
+
+  /* downstream reports it is 5 seconds behind */
+  fail_unless (gst_pad_push_event (mysinkpad,
+          gst_event_new_qos (GST_QOS_TYPE_UNDERFLOW, 2.0, 5 * GST_SECOND,
+              5 * GST_SECOND)));
+
+  /* a seek flushes the stream, the old feedback doesn't apply anymore */
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_flush_start ()));
+  fail_unless (gst_pad_push_event (mysrcpad,
+          gst_event_new_flush_stop (TRUE)));
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  fail_unless (gst_pad_push_event (mysrcpad,
+          gst_event_new_segment (&segment)));
+
+  for (i = 1; i <= 3; i++) {
+    fail_unless ((inbuffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+    GST_BUFFER_TIMESTAMP (inbuffer) = i * GST_SECOND / 30;
+    GST_BUFFER_DURATION (inbuffer) = GST_SECOND / 30;
+    fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+  }
+
+  /* none of the frames after the seek is dropped */
+  fail_unless (g_list_length (buffers) == 4);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_bitrate_adaptation)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstStructure *s;
+  gint res_bitrate;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "bitrate-adaptation", 1, "min-bitrate", 200000,
+      "bitrate-adaptation-interval", 0, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "byte-stream",
+      NULL);
+  play_a_buffer (h264enc, caps);
+
+  /* the first estimate is followed right away */
+  s = gst_structure_new ("GstCeBandwidthEstimate", "bitrate", G_TYPE_INT,
+      1000000, NULL);
+  fail_unless (gst_pad_push_event (mysinkpad,
+          gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM, s)));
+  g_object_get (h264enc, "target-bitrate", &res_bitrate, NULL);
+  fail_unless (res_bitrate == 1000000);
+
+  /* later ones are smoothed */
+  s = gst_structure_new ("GstCeBandwidthEstimate", "bitrate", G_TYPE_INT,
+      2000000, NULL);
+  fail_unless (gst_pad_push_event (mysinkpad,
+          gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM, s)));
+  g_object_get (h264enc, "target-bitrate", &res_bitrate, NULL);
+  fail_unless (res_bitrate > 1000000 && res_bitrate < 2000000);
+
+  /* and bounded */
+  s = gst_structure_new ("GstCeBandwidthEstimate", "bitrate", G_TYPE_INT,
+      1000, NULL);
+  fail_unless (gst_pad_push_event (mysinkpad,
+          gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM, s)));
+  s = gst_structure_new ("GstCeBandwidthEstimate", "bitrate", G_TYPE_INT,
+      1000, NULL);
+  fail_unless (gst_pad_push_event (mysinkpad,
+          gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM, s)));
+  g_object_get (h264enc, "target-bitrate", &res_bitrate, NULL);
+  fail_unless (res_bitrate >= 200000);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_crop)
+{
+  GstElement *h264enc;
+  GstBuffer *inbuffer;
+  GstVideoCropMeta *crop;
+  GstCaps *caps;
+  GstStructure *s;
+  gint width, height;
+
+  h264enc = setup_ce_h264enc (&anysinktemplate);
+
+  /* the region gets aligned to whole macroblocks */
+  g_object_set (h264enc, "crop", "160,120,330,240", NULL);
+
+  caps = gst_caps_from_string ("video/x-h264, width = (int) 320, "
+      "height = (int) 240, framerate = (fraction) 30/1, "
+      "stream-format = (string) byte-stream");
+  play_a_buffer (h264enc, caps);
+
+  caps = gst_pad_get_current_caps (mysinkpad);
+  s = gst_caps_get_structure (caps, 0);
+  fail_unless (gst_structure_get_int (s, "width", &width));
+  fail_unless (gst_structure_get_int (s, "height", &height));
+  fail_unless_equals_int (width, 320);
+  fail_unless_equals_int (height, 240);
+  gst_caps_unref (caps);
+
+  /* the buffer crop meta overrides the property */
+  fail_unless ((inbuffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+  crop = gst_buffer_add_video_crop_meta (inbuffer);
+  crop->x = 320;
+  crop->y = 240;
+  crop->width = 320;
+  crop->height = 240;
+  GST_BUFFER_TIMESTAMP (inbuffer) = GST_SECOND / 30;
+  fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) == 2);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_copy)
+{
+  GstElement *h264enc;
+  GstBuffer *inbuffer;
+  GstCaps *caps;
+  GstStructure *stats;
+  const GstStructure *copy;
+  guint64 count;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "enable-stats", TRUE, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "byte-stream",
+      NULL);
+  play_a_buffer (h264enc, caps);
+
+  /* system memory can't be read by the codec, it is copied */
+  inbuffer = gst_buffer_new_and_alloc (640 * 480 * 3 / 2);
+  gst_buffer_memset (inbuffer, 0, 0, -1);
+  GST_BUFFER_TIMESTAMP (inbuffer) = GST_SECOND / 30;
+  fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) == 2);
+
+  g_object_get (h264enc, "stats", &stats, NULL);
+  copy = gst_value_get_structure (gst_structure_get_value (stats, "copy"));
+  fail_unless (gst_structure_get_uint64 (copy, "count", &count));
+  fail_unless (count == 1);
+  gst_structure_free (stats);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_encode_meta)
+{
+  GstElement *h264enc;
+  GstBuffer *inbuffer;
+  GstCaps *caps;
+  GstCeEncodeMeta *meta;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "target-bitrate", 2000000, "qpintra", 28,
+      "qpinter", 30, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "byte-stream",
+      NULL);
+  play_a_buffer (h264enc, caps);
+
+  fail_unless ((inbuffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+  GST_BUFFER_TIMESTAMP (inbuffer) = GST_SECOND / 30;
+  fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) == 2);
+
+  meta = GST_CE_ENCODE_META_GET (GST_BUFFER (buffers->data));
+  fail_unless (meta != NULL);
+  fail_unless (meta->frame_type == GST_CE_ENCODE_FRAME_IDR);
+  fail_unless (meta->bytes > 0);
+  fail_unless (GST_CLOCK_TIME_IS_VALID (meta->encode_duration));
+  fail_unless_equals_int (meta->bitrate, 2000000);
+  fail_unless_equals_int (meta->qp, 28);
+
+  meta = GST_CE_ENCODE_META_GET (GST_BUFFER (buffers->next->data));
+  fail_unless (meta != NULL);
+  fail_unless (meta->frame_type == GST_CE_ENCODE_FRAME_P);
+  fail_unless_equals_int (meta->qp, 30);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+/* Keeps the first caps pushed downstream */
+static GstPadProbeReturn
+first_caps_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstCaps **first_caps = user_data;
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS && !*first_caps) {
+    gst_event_parse_caps (event, &caps);
+    *first_caps = gst_caps_ref (caps);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+GST_START_TEST (test_ce_h264enc_lazy_codec_data)
+{
+  GstElement *h264enc;
+  GstCaps *caps, *outcaps, *first_caps = NULL;
+  GstBuffer *outbuffer;
+  GstMapInfo map;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "lazy-codec-data", TRUE, NULL);
+  gst_pad_add_probe (mysinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      first_caps_probe, &first_caps, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "avc", NULL);
+  play_a_buffer (h264enc, caps);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) == 1);
+
+  /* The codec data was taken from the IDR before it was pushed */
+  outcaps = gst_pad_get_current_caps (mysinkpad);
+  check_caps (outcaps, 100);
+  gst_caps_unref (outcaps);
+
+  /* And no caps went out without it before */
+  check_caps (first_caps, 100);
+  gst_caps_unref (first_caps);
+
+  /* And the SPS/PPS were still dropped from the stream */
+  outbuffer = GST_BUFFER (buffers->data);
+  gst_buffer_map (outbuffer, &map, GST_MAP_READ);
+  fail_unless (map.size > 4);
+  fail_if ((map.data[4] & 0x1f) == 7);
+  gst_buffer_unmap (outbuffer, &map);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_nal_index)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstBuffer *outbuffer;
+  GstCeNalMeta *nal_meta;
+  GstMapInfo map;
+  guint n, pos;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "nal-index", TRUE, "headers", TRUE, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "avc", NULL);
+  play_a_buffer (h264enc, caps);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) == 1);
+
+  outbuffer = GST_BUFFER (buffers->data);
+  nal_meta = GST_CE_NAL_META_GET (outbuffer);
+  fail_unless (nal_meta != NULL);
+  fail_unless (nal_meta->n_nals >= 3);
+  fail_unless_equals_int (nal_meta->nals[0].type, 7);
+  fail_unless_equals_int (nal_meta->nals[1].type, 8);
+
+  /* The index matches the length prefixes */
+  gst_buffer_map (outbuffer, &map, GST_MAP_READ);
+  for (n = 0, pos = 0; n < nal_meta->n_nals; n++) {
+    fail_unless_equals_int (nal_meta->nals[n].offset, pos + 4);
+    fail_unless_equals_int (nal_meta->nals[n].size,
+        GST_READ_UINT32_BE (map.data + pos));
+    fail_unless_equals_int (nal_meta->nals[n].type, map.data[pos + 4] & 0x1f);
+    pos += 4 + nal_meta->nals[n].size;
+  }
+  fail_unless_equals_int (pos, map.size);
+  gst_buffer_unmap (outbuffer, &map);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_rtp)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstBuffer *outbuffer;
+  GstMapInfo map;
+  GList *l;
+  guint16 seqnum = 0;
+
+  h264enc = setup_ce_h264enc (&rtpsinktemplate);
+  g_object_set (h264enc, "mtu", 200, "pt", 100, NULL);
+
+  caps = gst_caps_from_string ("application/x-rtp");
+  play_a_buffer (h264enc, caps);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) > 1);
+
+  for (l = buffers; l; l = l->next) {
+    outbuffer = GST_BUFFER (l->data);
+    gst_buffer_map (outbuffer, &map, GST_MAP_READ);
+    fail_unless (map.size > 12 && map.size <= 200);
+    fail_unless_equals_int (map.data[0], 0x80);
+    fail_unless_equals_int (map.data[1] & 0x7f, 100);
+    /* Only the last packet of the frame is marked */
+    fail_unless_equals_int (map.data[1] >> 7, l->next == NULL);
+    if (l != buffers)
+      fail_unless_equals_int (GST_READ_UINT16_BE (map.data + 2),
+          (guint16) (seqnum + 1));
+    seqnum = GST_READ_UINT16_BE (map.data + 2);
+    gst_buffer_unmap (outbuffer, &map);
+  }
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_rtp_single_nalu)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstBuffer *outbuffer;
+  GstMapInfo map;
+  GList *l;
+  gboolean sps = FALSE;
+
+  h264enc = setup_ce_h264enc (&rtpsinktemplate);
+  g_object_set (h264enc, "single-nalu", TRUE, "mtu", 200, NULL);
+
+  caps = gst_caps_from_string ("application/x-rtp");
+  play_a_buffer (h264enc, caps);
+
+  /* single-nalu doesn't apply to RTP, the frame is still packetized */
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) > 1);
+
+  for (l = buffers; l; l = l->next) {
+    outbuffer = GST_BUFFER (l->data);
+    gst_buffer_map (outbuffer, &map, GST_MAP_READ);
+    fail_unless (map.size > 12 && map.size <= 200);
+    if ((map.data[12] & 0x1f) == 7)
+      sps = TRUE;
+    gst_buffer_unmap (outbuffer, &map);
+  }
+  /* The IDR keeps its in-band headers */
+  fail_unless (sps);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_insert_config)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstBuffer *outbuffer;
+  GstMapInfo map;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  gst_util_set_object_arg (G_OBJECT (h264enc), "insert-config", "idr-count");
+  g_object_set (h264enc, "config-interval", 1, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "byte-stream",
+      NULL);
+  play_a_buffer (h264enc, caps);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) == 1);
+
+  /* The first frame is an IDR and starts with the SPS */
+  outbuffer = GST_BUFFER (buffers->data);
+  gst_buffer_map (outbuffer, &map, GST_MAP_READ);
+  fail_unless (map.size > 5);
+  fail_unless_equals_int (GST_READ_UINT32_BE (map.data), 1);
+  fail_unless_equals_int (map.data[4] & 0x1f, 7);
+  gst_buffer_unmap (outbuffer, &map);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_temporal_layers)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstBuffer *inbuffer, *outbuffer;
+  GstCeEncodeMeta *meta;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  gst_util_set_object_arg (G_OBJECT (h264enc), "ntemplayers", "two");
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  play_a_buffer (h264enc, caps);
+
+  inbuffer = create_cmem_buffer (640 * 480 * 3 / 2);
+  GST_BUFFER_TIMESTAMP (inbuffer) = GST_SECOND / 30;
+  fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) == 2);
+
+  outbuffer = GST_BUFFER (buffers->data);
+  meta = GST_CE_ENCODE_META_GET (outbuffer);
+  fail_unless (meta != NULL);
+  fail_unless_equals_int (meta->temporal_layer, 0);
+  fail_if (GST_BUFFER_FLAG_IS_SET (outbuffer, GST_BUFFER_FLAG_DROPPABLE));
+
+  outbuffer = GST_BUFFER (buffers->next->data);
+  meta = GST_CE_ENCODE_META_GET (outbuffer);
+  fail_unless (meta != NULL);
+  fail_unless_equals_int (meta->temporal_layer, 1);
+  fail_unless (GST_BUFFER_FLAG_IS_SET (outbuffer, GST_BUFFER_FLAG_DROPPABLE));
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_max_temporal_layer)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstBuffer *inbuffer;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  gst_util_set_object_arg (G_OBJECT (h264enc), "ntemplayers", "two");
+  g_object_set (h264enc, "max-temporal-layer", 0, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  play_a_buffer (h264enc, caps);
+
+  inbuffer = create_cmem_buffer (640 * 480 * 3 / 2);
+  GST_BUFFER_TIMESTAMP (inbuffer) = GST_SECOND / 30;
+  fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+
+  /* The second frame belongs to the top layer */
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless_equals_int (g_list_length (buffers), 1);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_latency)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstClockTime min, max;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "low-latency", TRUE, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  play_a_buffer (h264enc, caps);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless (g_list_length (buffers) == 1);
+
+  /* The encoding time of the frame was reported */
+  gst_video_encoder_get_latency (GST_VIDEO_ENCODER (h264enc), &min, &max);
+  fail_unless (min > 0);
+  fail_unless_equals_uint64 (max, min);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_field_pair)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstBuffer *outbuffer;
+  GstCeEncodeMeta *meta;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "interlace", TRUE, "field-pair", TRUE, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  play_a_buffer (h264enc, caps);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+
+  /* Both fields in a single buffer */
+  fail_unless_equals_int (g_list_length (buffers), 1);
+  outbuffer = GST_BUFFER (buffers->data);
+  meta = GST_CE_ENCODE_META_GET (outbuffer);
+  fail_unless (meta != NULL);
+  fail_unless_equals_int (meta->n_fields, 2);
+  fail_unless (meta->bytes >= gst_buffer_get_size (outbuffer));
+  fail_unless (GST_CLOCK_TIME_IS_VALID (meta->field_duration[0]));
+  fail_unless (GST_CLOCK_TIME_IS_VALID (meta->field_duration[1]));
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_max_framerate)
+{
+  GstElement *h264enc;
+  GstBuffer *inbuffer;
+  GstStructure *s;
+  GstCaps *caps;
+  gint i, fps_n, fps_d;
+
+  h264enc = setup_ce_h264enc (&anysinktemplate);
+  gst_util_set_object_arg (G_OBJECT (h264enc), "max-framerate", "10/1");
+  fail_unless (gst_element_set_state (h264enc,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  caps = gst_caps_from_string (VIDEO_CAPS_STRING);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  /* Only every third frame of the 30 fps input makes it */
+  for (i = 0; i < 6; i++) {
+    fail_unless ((inbuffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+    GST_BUFFER_TIMESTAMP (inbuffer) = i * GST_SECOND / 30;
+    GST_BUFFER_DURATION (inbuffer) = GST_SECOND / 30;
+    fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+  }
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless_equals_int (g_list_length (buffers), 2);
+  fail_unless_equals_uint64 (GST_BUFFER_TIMESTAMP (buffers->next->data),
+      GST_SECOND / 10);
+  fail_unless_equals_uint64 (GST_BUFFER_DURATION (buffers->data),
+      GST_SECOND / 10);
+
+  /* Downstream is told about the decimated rate */
+  caps = gst_pad_get_current_caps (mysinkpad);
+  fail_unless (caps != NULL);
+  s = gst_caps_get_structure (caps, 0);
+  fail_unless (gst_structure_get_fraction (s, "framerate", &fps_n, &fps_d));
+  fail_unless_equals_int (fps_n, 10);
+  fail_unless_equals_int (fps_d, 1);
+  gst_caps_unref (caps);
+
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_codec_cache)
+{
+  GstElement *h264enc;
+  GstBus *bus;
+  GstMessage *msg;
+  gboolean warm;
+
+  h264enc = setup_ce_h264enc (&anysinktemplate);
+  bus = gst_bus_new ();
+  gst_element_set_bus (h264enc, bus);
+  g_object_set (h264enc, "codec-cache-size", 2, NULL);
+  fail_unless (gst_element_set_state (h264enc,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* The first instance is created from scratch */
+  push_frames (640, 480, 30, 0, 1);
+  msg = pop_element_message (bus, "GstCeVidEncFirstKeyframe");
+  fail_unless (gst_structure_get_boolean (gst_message_get_structure (msg),
+          "warm-codec", &warm));
+  fail_if (warm);
+  gst_message_unref (msg);
+
+  /* Renegotiating parks the 640x480 instance in the cache */
+  push_frames (320, 240, 30, GST_SECOND / 30, 1);
+
+  gst_element_set_bus (h264enc, NULL);
+  gst_object_unref (bus);
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+
+  /* A new element with the same parameters adopts the parked instance */
+  h264enc = setup_ce_h264enc (&anysinktemplate);
+  bus = gst_bus_new ();
+  gst_element_set_bus (h264enc, bus);
+  g_object_set (h264enc, "codec-cache-size", 2, NULL);
+  fail_unless (gst_element_set_state (h264enc,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  push_frames (640, 480, 30, 0, 1);
+  msg = pop_element_message (bus, "GstCeVidEncFirstKeyframe");
+  fail_unless (gst_structure_get_boolean (gst_message_get_structure (msg),
+          "warm-codec", &warm));
+  fail_unless (warm);
+  gst_message_unref (msg);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+  fail_unless_equals_int (g_list_length (buffers), 1);
+
+  gst_element_set_bus (h264enc, NULL);
+  gst_object_unref (bus);
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_stats)
+{
+  GstElement *h264enc;
+  GstCaps *caps;
+  GstStructure *stats;
+  const GstStructure *process;
+  guint64 count, min, avg, max, p99;
+
+  h264enc = setup_ce_h264enc (&sinktemplate);
+  g_object_set (h264enc, "enable-stats", TRUE, NULL);
+
+  caps = gst_caps_from_string (H264_CAPS_STRING);
+  play_a_buffer (h264enc, caps);
+
+  g_object_get (h264enc, "stats", &stats, NULL);
+  fail_unless (stats != NULL);
+  fail_unless (gst_structure_has_name (stats, "GstCeStats"));
+
+  process = gst_value_get_structure (gst_structure_get_value (stats,
+          "process"));
+  fail_unless (process != NULL);
+  fail_unless (gst_structure_get_uint64 (process, "count", &count));
+  fail_unless (gst_structure_get_uint64 (process, "min", &min));
+  fail_unless (gst_structure_get_uint64 (process, "avg", &avg));
+  fail_unless (gst_structure_get_uint64 (process, "max", &max));
+  fail_unless (gst_structure_get_uint64 (process, "p99", &p99));
+
+  fail_unless (count == 1);
+  fail_unless (min > 0);
+  fail_unless (min <= avg && avg <= max);
+  fail_unless (p99 <= max);
+
+  /* The encoded frame was timed on its way downstream too */
+  fail_unless (gst_structure_has_field (stats, "push"));
+
+  gst_structure_free (stats);
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_h264enc_complexity)
+{
+  GstElement *h264enc;
+  GstBus *bus;
+  GstMessage *msg;
+  const GstStructure *s;
+  GstClockTime timestamp;
+  gboolean t8x8intra, t8x8inter;
+  guint level, previous;
+
+  h264enc = setup_ce_h264enc (&anysinktemplate);
+  bus = gst_bus_new ();
+  gst_element_set_bus (h264enc, bus);
+  g_object_set (h264enc, "adaptive-complexity", TRUE,
+      "intraframe-interval", 1, "t8x8intra", TRUE, "t8x8inter", TRUE, NULL);
+  fail_unless (gst_element_set_state (h264enc,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* 1080p at 60 fps is more than the encoder keeps up with, the level is
+   * raised once enough frames were measured */
+  timestamp = push_frames (1920, 1080, 60, 0, 70);
+
+  msg = pop_element_message (bus, "GstCeVidEncComplexity");
+  s = gst_message_get_structure (msg);
+  fail_unless (gst_structure_get_uint (s, "level", &level));
+  fail_unless (gst_structure_get_uint (s, "previous-level", &previous));
+  fail_unless_equals_int (level, 1);
+  fail_unless_equals_int (previous, 0);
+  gst_message_unref (msg);
+
+  g_object_get (h264enc, "complexity-level", &level, "t8x8intra",
+      &t8x8intra, "t8x8inter", &t8x8inter, NULL);
+  fail_unless_equals_int (level, 1);
+  /* The coding tools the user asked for are reported, not the applied */
+  fail_unless (t8x8intra);
+  fail_unless (t8x8inter);
+
+  /* At 1 fps there is plenty of headroom to restore the complexity */
+  push_frames (1920, 1080, 1, timestamp, 70);
+
+  msg = pop_element_message (bus, "GstCeVidEncComplexity");
+  s = gst_message_get_structure (msg);
+  fail_unless (gst_structure_get_uint (s, "level", &level));
+  fail_unless (gst_structure_get_uint (s, "previous-level", &previous));
+  fail_unless_equals_int (level, 0);
+  fail_unless_equals_int (previous, 1);
+  gst_message_unref (msg);
+
+  g_object_get (h264enc, "complexity-level", &level, "t8x8intra",
+      &t8x8intra, "t8x8inter", &t8x8inter, NULL);
+  fail_unless_equals_int (level, 0);
+  fail_unless (t8x8intra);
+  fail_unless (t8x8inter);
+
+  gst_element_set_bus (h264enc, NULL);
+  gst_object_unref (bus);
+  cleanup_ce_h264enc (h264enc);
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+}
+
+GST_END_TEST;
+
 GST_START_TEST (test_ce_h264enc_bytestream)
 {
   GstElement *h264enc;
@@ -473,6 +1406,26 @@ ce_h264enc_suite (void)
   tcase_add_test (tc_chain, test_ce_h264enc_packetized_base);
   tcase_add_test (tc_chain, test_ce_h264enc_bytestream);
   tcase_add_test (tc_chain, test_ce_h264enc_properties);
+  tcase_add_test (tc_chain, test_ce_h264enc_dynamic_params);
+  tcase_add_test (tc_chain, test_ce_h264enc_qos);
+  tcase_add_test (tc_chain, test_ce_h264enc_qos_flush);
+  tcase_add_test (tc_chain, test_ce_h264enc_bitrate_adaptation);
+  tcase_add_test (tc_chain, test_ce_h264enc_crop);
+  tcase_add_test (tc_chain, test_ce_h264enc_copy);
+  tcase_add_test (tc_chain, test_ce_h264enc_encode_meta);
+  tcase_add_test (tc_chain, test_ce_h264enc_lazy_codec_data);
+  tcase_add_test (tc_chain, test_ce_h264enc_nal_index);
+  tcase_add_test (tc_chain, test_ce_h264enc_rtp);
+  tcase_add_test (tc_chain, test_ce_h264enc_rtp_single_nalu);
+  tcase_add_test (tc_chain, test_ce_h264enc_insert_config);
+  tcase_add_test (tc_chain, test_ce_h264enc_temporal_layers);
+  tcase_add_test (tc_chain, test_ce_h264enc_max_temporal_layer);
+  tcase_add_test (tc_chain, test_ce_h264enc_latency);
+  tcase_add_test (tc_chain, test_ce_h264enc_field_pair);
+  tcase_add_test (tc_chain, test_ce_h264enc_max_framerate);
+  tcase_add_test (tc_chain, test_ce_h264enc_codec_cache);
+  tcase_add_test (tc_chain, test_ce_h264enc_stats);
+  tcase_add_test (tc_chain, test_ce_h264enc_complexity);
 
   return s;
 }
@@ -299,6 +299,390 @@ GST_START_TEST (test_ce_jpegenc_properties)
 
 GST_END_TEST;
 
+GST_START_TEST (test_ce_jpegenc_stats)
+{
+  GstElement *jpegenc;
+  GstBuffer *buffer;
+  GstCaps *caps;
+  GstStructure *stats;
+  const GstStructure *process;
+  guint64 count, min, avg, max, p99;
+
+  jpegenc = setup_ce_jpegenc (&any_sinktemplate);
+  g_object_set (jpegenc, "enable-stats", TRUE, NULL);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      640, "height", G_TYPE_INT, 480, "framerate",
+      GST_TYPE_FRACTION, 1, 1, "format", G_TYPE_STRING, "NV12", NULL);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+  fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+  fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+
+  g_object_get (jpegenc, "stats", &stats, NULL);
+  fail_unless (stats != NULL);
+  fail_unless (gst_structure_has_name (stats, "GstCeStats"));
+
+  process = gst_value_get_structure (gst_structure_get_value (stats,
+          "process"));
+  fail_unless (process != NULL);
+  fail_unless (gst_structure_get_uint64 (process, "count", &count));
+  fail_unless (gst_structure_get_uint64 (process, "min", &min));
+  fail_unless (gst_structure_get_uint64 (process, "avg", &avg));
+  fail_unless (gst_structure_get_uint64 (process, "max", &max));
+  fail_unless (gst_structure_get_uint64 (process, "p99", &p99));
+
+  fail_unless (count == 2);
+  fail_unless (min > 0);
+  fail_unless (min <= avg && avg <= max);
+  fail_unless (p99 <= max);
+
+  gst_structure_free (stats);
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  cleanup_ce_jpegenc (jpegenc);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_jpegenc_skip_static)
+{
+  GstElement *jpegenc;
+  GstBuffer *buffer;
+  GstCaps *caps;
+  gint i;
+
+  jpegenc = setup_ce_jpegenc (&any_sinktemplate);
+  g_object_set (jpegenc, "skip-static", TRUE, "static-max-skip", 0, NULL);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      640, "height", G_TYPE_INT, 480, "framerate",
+      GST_TYPE_FRACTION, 1, 1, "format", G_TYPE_STRING, "NV12", NULL);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  /* Three identical images, then a different one */
+  for (i = 0; i < 4; i++) {
+    fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+    if (i == 3)
+      gst_buffer_memset (buffer, 0, 0x80, -1);
+    GST_BUFFER_TIMESTAMP (buffer) = i * GST_SECOND;
+    GST_BUFFER_DURATION (buffer) = GST_SECOND;
+    fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  }
+
+  fail_unless (g_list_length (buffers) == 2);
+  fail_unless (GST_BUFFER_TIMESTAMP (buffers->data) == 0);
+  fail_unless (GST_BUFFER_TIMESTAMP (buffers->next->data) == 3 * GST_SECOND);
+
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  cleanup_ce_jpegenc (jpegenc);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_jpegenc_rate_control)
+{
+  GstElement *jpegenc;
+  GstBuffer *buffer;
+  GstCaps *caps;
+  gint i, quality;
+
+  jpegenc = setup_ce_jpegenc (&any_sinktemplate);
+  g_object_set (jpegenc, "frame-budget", 100, "min-quality", 30,
+      "max-quality-step", 5, NULL);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      640, "height", G_TYPE_INT, 480, "framerate",
+      GST_TYPE_FRACTION, 30, 1, "format", G_TYPE_STRING, "NV12", NULL);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  /* No image fits in the budget, the quality goes down a step at a time */
+  fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+  fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  g_object_get (jpegenc, "quality-value", &quality, NULL);
+  fail_unless_equals_int (quality, 70);
+
+  for (i = 0; i < 20; i++) {
+    fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+    fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  }
+  g_object_get (jpegenc, "quality-value", &quality, NULL);
+  fail_unless_equals_int (quality, 30);
+
+  /* The quality set by the user is restored without a budget */
+  g_object_set (jpegenc, "frame-budget", 0, NULL);
+  g_object_get (jpegenc, "quality-value", &quality, NULL);
+  fail_unless_equals_int (quality, 75);
+
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  cleanup_ce_jpegenc (jpegenc);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_jpegenc_snapshot)
+{
+  GstElement *jpegenc;
+  GstBuffer *buffer;
+  GstSample *sample = NULL;
+  GstCaps *caps;
+  GstEvent *event;
+  gint i;
+
+  jpegenc = setup_ce_jpegenc (&any_sinktemplate);
+  g_object_set (jpegenc, "snapshot", TRUE, NULL);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      640, "height", G_TYPE_INT, 480, "framerate",
+      GST_TYPE_FRACTION, 30, 1, "format", G_TYPE_STRING, "NV12", NULL);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  /* Nothing is encoded until a snapshot is taken */
+  for (i = 0; i < 3; i++) {
+    fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+    GST_BUFFER_TIMESTAMP (buffer) = i * GST_SECOND / 30;
+    fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  }
+  fail_unless (g_list_length (buffers) == 0);
+
+  /* The latest image is returned and pushed */
+  g_signal_emit_by_name (jpegenc, "snapshot", 1, &sample);
+  fail_unless (sample != NULL);
+  fail_unless (g_list_length (buffers) == 1);
+  fail_unless (gst_sample_get_buffer (sample) == buffers->data);
+  fail_unless (GST_BUFFER_TIMESTAMP (buffers->data) == 2 * GST_SECOND / 30);
+  gst_sample_unref (sample);
+
+  /* Nothing is held anymore, the burst takes the next images */
+  event = gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+      gst_structure_new ("GstCeSnapshot", "frames", G_TYPE_UINT, 2, NULL));
+  fail_unless (gst_pad_push_event (mysinkpad, event));
+  fail_unless (g_list_length (buffers) == 1);
+
+  for (i = 3; i < 6; i++) {
+    fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+    GST_BUFFER_TIMESTAMP (buffer) = i * GST_SECOND / 30;
+    fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  }
+  fail_unless (g_list_length (buffers) == 3);
+
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  cleanup_ce_jpegenc (jpegenc);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_jpegenc_tiles)
+{
+  GstElement *jpegenc;
+  GstBuffer *buffer;
+  GstMapInfo info;
+  GstCaps *caps;
+  gsize i;
+  gint height = 0, restarts = 0;
+
+  jpegenc = setup_ce_jpegenc (&any_sinktemplate);
+  /* Rounded down to 192 rows, three tiles with a shorter last one */
+  g_object_set (jpegenc, "tile-height", 200, NULL);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      640, "height", G_TYPE_INT, 480, "framerate",
+      GST_TYPE_FRACTION, 30, 1, "format", G_TYPE_STRING, "NV12", NULL);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+  fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  fail_unless (g_list_length (buffers) == 1);
+
+  /* A single image, with the whole height and a restart between tiles */
+  fail_unless (gst_buffer_map (buffers->data, &info, GST_MAP_READ));
+  fail_unless (info.data[0] == 0xFF && info.data[1] == 0xD8);
+  fail_unless (info.data[info.size - 2] == 0xFF &&
+      info.data[info.size - 1] == 0xD9);
+  for (i = 2; i < info.size - 1; i++) {
+    if (info.data[i] != 0xFF)
+      continue;
+    if (info.data[i + 1] == 0xC0 && !height)
+      height = GST_READ_UINT16_BE (info.data + i + 5);
+    else if (info.data[i + 1] >= 0xD0 && info.data[i + 1] <= 0xD7)
+      restarts++;
+    else if (info.data[i + 1] == 0xD8)
+      fail ("more than one image in the buffer");
+  }
+  gst_buffer_unmap (buffers->data, &info);
+  fail_unless_equals_int (height, 480);
+  fail_unless_equals_int (restarts, 2);
+
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  cleanup_ce_jpegenc (jpegenc);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_jpegenc_thumbnail)
+{
+  GstElement *jpegenc;
+  GstPad *thumbpad, *mythumbpad;
+  GstBuffer *buffer;
+  GstStructure *structure;
+  GstCaps *caps;
+  gint width, height, par_n, par_d;
+
+  jpegenc = setup_ce_jpegenc (&any_sinktemplate);
+  thumbpad = gst_element_get_request_pad (jpegenc, "thumbnail");
+  fail_unless (thumbpad != NULL);
+  mythumbpad = gst_pad_new_from_static_template (&any_sinktemplate, "sink");
+  gst_pad_set_chain_function (mythumbpad, gst_check_chain_func);
+  gst_pad_set_active (mythumbpad, TRUE);
+  fail_unless (gst_pad_link (thumbpad, mythumbpad) == GST_PAD_LINK_OK);
+
+  g_object_set (jpegenc, "thumbnail-factor", 4, NULL);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      640, "height", G_TYPE_INT, 480, "framerate",
+      GST_TYPE_FRACTION, 30, 1, "format", G_TYPE_STRING, "NV12", NULL);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+  GST_BUFFER_TIMESTAMP (buffer) = GST_SECOND;
+  fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+
+  /* Both images share the timestamp */
+  fail_unless (g_list_length (buffers) == 2);
+  fail_unless (GST_BUFFER_TIMESTAMP (buffers->data) == GST_SECOND);
+  fail_unless (GST_BUFFER_TIMESTAMP (buffers->next->data) == GST_SECOND);
+
+  /* A quarter of the size in both dimensions, with the same pixels */
+  caps = gst_pad_get_current_caps (mythumbpad);
+  fail_unless (caps != NULL);
+  structure = gst_caps_get_structure (caps, 0);
+  fail_unless (gst_structure_get_int (structure, "width", &width));
+  fail_unless (gst_structure_get_int (structure, "height", &height));
+  fail_unless (gst_structure_get_fraction (structure, "pixel-aspect-ratio",
+          &par_n, &par_d));
+  fail_unless_equals_int (width, 160);
+  fail_unless_equals_int (height, 120);
+  fail_unless_equals_int (par_n, 1);
+  fail_unless_equals_int (par_d, 1);
+  gst_caps_unref (caps);
+
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  gst_pad_unlink (thumbpad, mythumbpad);
+  gst_pad_set_active (mythumbpad, FALSE);
+  gst_object_unref (mythumbpad);
+  gst_element_release_request_pad (jpegenc, thumbpad);
+  gst_object_unref (thumbpad);
+  cleanup_ce_jpegenc (jpegenc);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_jpegenc_n_instances)
+{
+  GstElement *jpegenc;
+  GstBuffer *buffer;
+  GstCaps *caps;
+  GList *l;
+  gint i;
+
+  jpegenc = setup_ce_jpegenc (&any_sinktemplate);
+  g_object_set (jpegenc, "n-instances", 3, "num-out-buffers", 5, NULL);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      640, "height", G_TYPE_INT, 480, "framerate",
+      GST_TYPE_FRACTION, 30, 1, "format", G_TYPE_STRING, "NV12", NULL);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  for (i = 0; i < 10; i++) {
+    fail_unless ((buffer = create_cmem_buffer (640 * 480 * 3 / 2)) != NULL);
+    GST_BUFFER_TIMESTAMP (buffer) = i * GST_SECOND / 30;
+    fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  }
+
+  /* Every image is out after the EOS, in input order */
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()));
+  fail_unless (g_list_length (buffers) == 10);
+  for (l = buffers, i = 0; l; l = l->next, i++)
+    fail_unless (GST_BUFFER_TIMESTAMP (l->data) == i * GST_SECOND / 30);
+
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  cleanup_ce_jpegenc (jpegenc);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ce_jpegenc_convert)
+{
+  const gchar *formats[] = { "I420", "YV12", "YUY2" };
+  const gsize sizes[] = { 640 * 480 * 3 / 2, 640 * 480 * 3 / 2,
+    640 * 480 * 2
+  };
+  GstElement *jpegenc;
+  GstBuffer *buffer;
+  GstCaps *caps;
+  guint i;
+
+  jpegenc = setup_ce_jpegenc (&any_sinktemplate);
+  gst_element_set_state (jpegenc, GST_STATE_PLAYING);
+
+  /* Plain system memory, converted into the contiguous staging buffers */
+  for (i = 0; i < G_N_ELEMENTS (formats); i++) {
+    caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+        640, "height", G_TYPE_INT, 480, "framerate",
+        GST_TYPE_FRACTION, 30, 1, "format", G_TYPE_STRING, formats[i], NULL);
+    fail_unless (gst_pad_set_caps (mysrcpad, caps));
+    gst_caps_unref (caps);
+
+    buffer = gst_buffer_new_allocate (NULL, sizes[i], NULL);
+    gst_buffer_memset (buffer, 0, 0x80, sizes[i]);
+    GST_BUFFER_TIMESTAMP (buffer) = i * GST_SECOND / 30;
+    fail_unless (gst_pad_push (mysrcpad, buffer) == GST_FLOW_OK);
+  }
+
+  fail_unless (g_list_length (buffers) == G_N_ELEMENTS (formats));
+
+  g_list_free_full (buffers, (GDestroyNotify) gst_buffer_unref);
+  buffers = NULL;
+
+  gst_element_set_state (jpegenc, GST_STATE_NULL);
+  cleanup_ce_jpegenc (jpegenc);
+}
+
+GST_END_TEST;
+
 /**
  * Also review:
  * ARM consume vs quality, for a given size
@@ -316,6 +700,14 @@ ce_jpegenc_suite (void)
   tcase_add_test (tc_chain, test_ce_jpegenc_getcaps);
   tcase_add_test (tc_chain, test_ce_jpegenc_different_caps);
   tcase_add_test (tc_chain, test_ce_jpegenc_properties);
+  tcase_add_test (tc_chain, test_ce_jpegenc_stats);
+  tcase_add_test (tc_chain, test_ce_jpegenc_skip_static);
+  tcase_add_test (tc_chain, test_ce_jpegenc_rate_control);
+  tcase_add_test (tc_chain, test_ce_jpegenc_snapshot);
+  tcase_add_test (tc_chain, test_ce_jpegenc_tiles);
+  tcase_add_test (tc_chain, test_ce_jpegenc_thumbnail);
+  tcase_add_test (tc_chain, test_ce_jpegenc_n_instances);
+  tcase_add_test (tc_chain, test_ce_jpegenc_convert);
 
   return s;
 }
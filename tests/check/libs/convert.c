@@ -0,0 +1,216 @@
+/* GStreamer
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * Test the conversions to the formats the codecs read
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <ext/ce/gstceconvert.h>
+#include <gst/gst.h>
+
+/* Sizes that leave every kind of tail to the kernels */
+static const gint widths[] = { 2, 15, 16, 33, 64, 170 };
+
+static GstBuffer *
+make_frame (GstVideoInfo * info, GstVideoFrame * frame)
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+  gsize i;
+
+  buffer = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (info), NULL);
+  fail_unless (gst_buffer_map (buffer, &map, GST_MAP_WRITE));
+  for (i = 0; i < map.size; i++)
+    map.data[i] = g_random_int_range (0, 256);
+  gst_buffer_unmap (buffer, &map);
+
+  fail_unless (gst_video_frame_map (frame, info, buffer, GST_MAP_READWRITE));
+
+  return buffer;
+}
+
+/* Checks every sample of dest against the one it comes from in src */
+static void
+check_frame (GstVideoFrame * dest, GstVideoFrame * src)
+{
+  gint x, y, c, sy;
+
+  for (c = 0; c < 3; c++) {
+    for (y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT (dest, c); y++) {
+      for (x = 0; x < GST_VIDEO_FRAME_COMP_WIDTH (dest, c); x++) {
+        const guint8 *d = GST_VIDEO_FRAME_COMP_DATA (dest, c);
+        const guint8 *s = GST_VIDEO_FRAME_COMP_DATA (src, c);
+
+        /* 4:2:2 to 4:2:0 keeps the chromas of the even rows */
+        sy = y * GST_VIDEO_FRAME_COMP_HEIGHT (src, c) /
+            GST_VIDEO_FRAME_COMP_HEIGHT (dest, c);
+
+        d += y * GST_VIDEO_FRAME_COMP_STRIDE (dest, c) +
+            x * GST_VIDEO_FRAME_COMP_PSTRIDE (dest, c);
+        s += sy * GST_VIDEO_FRAME_COMP_STRIDE (src, c) +
+            x * GST_VIDEO_FRAME_COMP_PSTRIDE (src, c);
+
+        fail_unless_equals_int (*d, *s);
+      }
+    }
+  }
+}
+
+static void
+check_conversion (GstVideoFormat in, GstVideoFormat out)
+{
+  GstVideoInfo in_info, out_info;
+  GstVideoFrame src, dest;
+  GstBuffer *src_buf, *dest_buf;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (widths); i++) {
+    gst_video_info_set_format (&in_info, in, widths[i], 6);
+    gst_video_info_set_format (&out_info, out, widths[i], 6);
+
+    src_buf = make_frame (&in_info, &src);
+    dest_buf = make_frame (&out_info, &dest);
+
+    fail_unless (gst_ce_convert_frame (&dest, &src));
+    check_frame (&dest, &src);
+
+    gst_video_frame_unmap (&src);
+    gst_video_frame_unmap (&dest);
+    gst_buffer_unref (src_buf);
+    gst_buffer_unref (dest_buf);
+  }
+}
+
+/* Checks every sample of dest against the average of its box in src */
+static void
+check_downscale (GstVideoFormat format, gint factor)
+{
+  GstVideoInfo in_info, out_info;
+  GstVideoFrame src, dest;
+  GstBuffer *src_buf, *dest_buf;
+  gint x, y, c, i, j, sum;
+
+  gst_video_info_set_format (&in_info, format, 16 * factor, 8 * factor);
+  gst_video_info_set_format (&out_info, format, 16, 8);
+
+  src_buf = make_frame (&in_info, &src);
+  dest_buf = make_frame (&out_info, &dest);
+
+  fail_unless (gst_ce_convert_downscale (&dest, &src));
+
+  for (c = 0; c < 3; c++) {
+    for (y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT (&dest, c); y++) {
+      for (x = 0; x < GST_VIDEO_FRAME_COMP_WIDTH (&dest, c); x++) {
+        const guint8 *d = GST_VIDEO_FRAME_COMP_DATA (&dest, c);
+        const guint8 *s = GST_VIDEO_FRAME_COMP_DATA (&src, c);
+
+        sum = 0;
+        for (j = 0; j < factor; j++)
+          for (i = 0; i < factor; i++)
+            sum += s[(y * factor + j) * GST_VIDEO_FRAME_COMP_STRIDE (&src, c)
+                + (x * factor + i) * GST_VIDEO_FRAME_COMP_PSTRIDE (&src, c)];
+
+        d += y * GST_VIDEO_FRAME_COMP_STRIDE (&dest, c) +
+            x * GST_VIDEO_FRAME_COMP_PSTRIDE (&dest, c);
+        fail_unless_equals_int (*d, (sum + factor * factor / 2) /
+            (factor * factor));
+      }
+    }
+  }
+
+  /* Only the same format is scaled */
+  gst_video_frame_unmap (&dest);
+  gst_buffer_unref (dest_buf);
+  gst_video_info_set_format (&out_info, format == GST_VIDEO_FORMAT_NV12 ?
+      GST_VIDEO_FORMAT_UYVY : GST_VIDEO_FORMAT_NV12, 16, 8);
+  dest_buf = make_frame (&out_info, &dest);
+  fail_if (gst_ce_convert_downscale (&dest, &src));
+
+  gst_video_frame_unmap (&src);
+  gst_video_frame_unmap (&dest);
+  gst_buffer_unref (src_buf);
+  gst_buffer_unref (dest_buf);
+}
+
+GST_START_TEST (test_convert_format)
+{
+  GstCaps *caps;
+
+  caps = gst_caps_from_string ("video/x-raw, format = (string) NV12");
+  fail_unless_equals_int (gst_ce_convert_get_format (GST_VIDEO_FORMAT_I420,
+          caps), GST_VIDEO_FORMAT_NV12);
+  fail_unless_equals_int (gst_ce_convert_get_format (GST_VIDEO_FORMAT_YUY2,
+          caps), GST_VIDEO_FORMAT_NV12);
+  fail_unless_equals_int (gst_ce_convert_get_format (GST_VIDEO_FORMAT_RGB,
+          caps), GST_VIDEO_FORMAT_UNKNOWN);
+  gst_caps_unref (caps);
+
+  /* Packed input stays packed if the codec can */
+  caps = gst_caps_from_string ("video/x-raw, "
+      "format = (string) { NV12, UYVY }");
+  fail_unless_equals_int (gst_ce_convert_get_format (GST_VIDEO_FORMAT_YUY2,
+          caps), GST_VIDEO_FORMAT_UYVY);
+  fail_unless_equals_int (gst_ce_convert_get_format (GST_VIDEO_FORMAT_UYVY,
+          caps), GST_VIDEO_FORMAT_UYVY);
+  gst_caps_unref (caps);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_convert_frames)
+{
+  GST_INFO ("using the %s kernels", gst_ce_convert_impl ());
+
+  check_conversion (GST_VIDEO_FORMAT_I420, GST_VIDEO_FORMAT_NV12);
+  check_conversion (GST_VIDEO_FORMAT_YV12, GST_VIDEO_FORMAT_NV12);
+  check_conversion (GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_UYVY);
+  check_conversion (GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_NV12);
+  check_conversion (GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_convert_downscale)
+{
+  check_downscale (GST_VIDEO_FORMAT_NV12, 2);
+  check_downscale (GST_VIDEO_FORMAT_NV12, 4);
+  check_downscale (GST_VIDEO_FORMAT_UYVY, 3);
+  check_downscale (GST_VIDEO_FORMAT_UYVY, 16);
+}
+
+GST_END_TEST;
+
+static Suite *
+convert_suite (void)
+{
+  Suite *s = suite_create ("Format conversion");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_convert_format);
+  tcase_add_test (tc_chain, test_convert_frames);
+  tcase_add_test (tc_chain, test_convert_downscale);
+
+  return s;
+}
+
+GST_CHECK_MAIN (convert);
@@ -0,0 +1,119 @@
+/* GStreamer
+ * Copyright (C) 2013 RidgeRun, LLC (http://www.ridgerun.com)
+ *
+ * Test the byte-stream start code scanner
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <ext/ce/gstcestartcode.h>
+#include <gst/gst.h>
+
+/* The byte at a time scanner the encoders used to have */
+static gint
+find_start_code_bytewise (const guint8 * data, gint size)
+{
+  gint32 state = ~1;
+  gint i;
+
+  for (i = 0; i < size; i++) {
+    state = (state << 8) | data[i];
+    if (state == 1)
+      return i - 3;
+  }
+
+  return -1;
+}
+
+GST_START_TEST (test_start_code_simple)
+{
+  const guint8 nals[] = { 0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x00,
+    0x00, 0x01, 0x68, 0xce, 0x00, 0x00, 0x01, 0x65, 0x00, 0x00, 0x00, 0x01
+  };
+
+  GST_INFO ("using the %s scanner", gst_ce_start_code_impl ());
+
+  fail_unless_equals_int (gst_ce_find_start_code (nals, sizeof (nals)), 0);
+  fail_unless_equals_int (gst_ce_find_start_code (nals + 1,
+          sizeof (nals) - 1), 5);
+  /* A three byte start code is not enough */
+  fail_unless_equals_int (gst_ce_find_start_code (nals + 7,
+          sizeof (nals) - 7), 9);
+  /* The start code must fit entirely */
+  fail_unless_equals_int (gst_ce_find_start_code (nals + 7,
+          sizeof (nals) - 8), -1);
+  fail_unless_equals_int (gst_ce_find_start_code (nals, 3), -1);
+  fail_unless_equals_int (gst_ce_find_start_code (nals, 0), -1);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_start_code_random)
+{
+  guint8 *buffer;
+  gint i, n, offset, size;
+
+  buffer = g_malloc (1024 + 32);
+
+  /* Lots of zeros and ones, at every alignment and size */
+  for (n = 0; n < 20000; n++) {
+    offset = g_random_int_range (0, 32);
+    size = g_random_int_range (0, 1024);
+
+    for (i = 0; i < size; i++) {
+      switch (g_random_int_range (0, 8)) {
+        case 0:
+        case 1:
+        case 2:
+          buffer[offset + i] = 0;
+          break;
+        case 3:
+          buffer[offset + i] = 1;
+          break;
+        default:
+          buffer[offset + i] = g_random_int_range (0, 256);
+          break;
+      }
+    }
+
+    fail_unless_equals_int (gst_ce_find_start_code (buffer + offset, size),
+        find_start_code_bytewise (buffer + offset, size));
+  }
+
+  g_free (buffer);
+}
+
+GST_END_TEST;
+
+static Suite *
+startcode_suite (void)
+{
+  Suite *s = suite_create ("Start code scanner");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, test_start_code_simple);
+  tcase_add_test (tc_chain, test_start_code_random);
+
+  return s;
+}
+
+GST_CHECK_MAIN (startcode);